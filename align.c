@@ -0,0 +1,499 @@
+/*
+ * Genome Mapper
+ * (local alignment with affine gaps, striped SIMD implementation)
+ *
+ * Authors: Maarja Lepamets, Fanny-Dhelia Pajuste
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define ALIGN_X86 1
+#endif
+
+#include "utils.h"
+
+/*
+ * Striped Smith-Waterman (M. Farrar, Bioinformatics 2007)
+ *
+ * Query is split into LANES segments of segLen positions, position q is in lane q / segLen
+ * of vector q % segLen, so the vertical dependency between vectors is only lane shift.
+ * Gap of length L costs gapopen + L * gapextend.
+ * 8-bit kernels use unsigned saturated scores with bias, if the best score does not fit
+ * alignment is repeated with 16-bit kernel.
+ */
+
+/* Nucleotide codes of profile, all other symbols are 4 */
+#define PROFILE_SYMBOLS 5
+
+static const char *enginenames[] = { "scalar", "sse2", "avx2" };
+
+typedef int (*alignkernel) (const void *profile, unsigned qlen, unsigned seglen, const unsigned char *seq, unsigned slen, int gapo, int gape, int bias, void *work, int *seqend, int *queryend);
+
+static int selected = -1;
+
+static unsigned char nuclcode(char c)
+{
+	switch (c) {
+	case 'A': case 'a': return 0;
+	case 'C': case 'c': return 1;
+	case 'G': case 'g': return 2;
+	case 'T': case 't': return 3;
+	}
+	return 4;
+}
+
+static int pairscore(unsigned char a, unsigned char b, const alignscoring *sc)
+{
+	return ((a == b) && (a < 4)) ? sc->match : -sc->mismatch;
+}
+
+/* Gotoh local alignment, used where SIMD is not available and when scores do not fit 16 bits, rows has 2 * (qlen + 1) entries */
+static int scalarscore(const unsigned char *query, unsigned qlen, const unsigned char *seq, unsigned slen, const alignscoring *sc, int *rows, int *seqend, int *queryend)
+{
+	int *h = rows;
+	int *f = rows + qlen + 1;
+	int gapo = sc->gapopen + sc->gapextend, gape = sc->gapextend;
+	int best = 0;
+	unsigned i, j;
+	*seqend = *queryend = -1;
+	for (j = 0; j <= qlen; j++) h[j] = f[j] = 0;
+	for (i = 0; i < slen; i++) {
+		int diag = 0, e = 0, colmax = 0, colmaxpos = -1;
+		h[0] = 0;
+		for (j = 1; j <= qlen; j++) {
+			int v, up = h[j];
+			/* Gap in query (along sequence) */
+			f[j] = (f[j] - gape > up - gapo) ? f[j] - gape : up - gapo;
+			if (f[j] < 0) f[j] = 0;
+			v = diag + pairscore(query[j - 1], seq[i], sc);
+			if (e > v) v = e;
+			if (f[j] > v) v = f[j];
+			if (v < 0) v = 0;
+			diag = up;
+			h[j] = v;
+			if (v > colmax) {
+				colmax = v;
+				colmaxpos = j - 1;
+			}
+			/* Gap in sequence (along query) */
+			e = (e - gape > v - gapo) ? e - gape : v - gapo;
+			if (e < 0) e = 0;
+		}
+		if (colmax > best) {
+			best = colmax;
+			*seqend = i;
+			*queryend = colmaxpos;
+		}
+	}
+	return best;
+}
+
+#ifdef ALIGN_X86
+
+/*
+ * Kernel body, the same for every instruction set and lane width
+ * work holds 4 * seglen vectors (two H columns, E and the column of the best score), the latter is used to find
+ * the query position of the best score at the end
+ * Returns the best score
+ */
+#define STRIPED_KERNEL(NAME, ATTR, VEC, T, SET1, ZERO, ADDSAT, SUBSAT, MAXV, SHIFT1, ANYGT, MAXLANE) \
+ATTR static int NAME (const void *profile, unsigned qlen, unsigned seglen, const unsigned char *seq, unsigned slen, int gapo, int gape, int bias, void *work, int *seqend, int *queryend) \
+{ \
+	const VEC *prof = (const VEC *) profile; \
+	VEC *buf = (VEC *) work, *hstore, *hload, *ebuf, *hbest; \
+	VEC vgapo = SET1(gapo), vgape = SET1(gape), vbias = SET1(bias), vzero = ZERO, vbest = ZERO; \
+	int best = 0; \
+	unsigned i, j; \
+	hstore = buf; \
+	hload = buf + seglen; \
+	ebuf = buf + 2 * seglen; \
+	hbest = buf + 3 * seglen; \
+	for (j = 0; j < 4 * seglen; j++) buf[j] = vzero; \
+	*seqend = *queryend = -1; \
+	for (i = 0; i < slen; i++) { \
+		const VEC *vp = prof + seq[i] * seglen; \
+		VEC vf = vzero, vmax = vzero, vh, *t; \
+		vh = SHIFT1(hstore[seglen - 1]); \
+		t = hload; hload = hstore; hstore = t; \
+		for (j = 0; j < seglen; j++) { \
+			VEC e = ebuf[j]; \
+			vh = SUBSAT(ADDSAT(vh, vp[j]), vbias); \
+			vh = MAXV(vh, e); \
+			vh = MAXV(vh, vf); \
+			vmax = MAXV(vmax, vh); \
+			hstore[j] = vh; \
+			vh = SUBSAT(vh, vgapo); \
+			ebuf[j] = MAXV(SUBSAT(e, vgape), vh); \
+			vf = MAXV(SUBSAT(vf, vgape), vh); \
+			vh = hload[j]; \
+		} \
+		/* Lazy F loop, vertical gaps that cross segment boundaries */ \
+		vf = SHIFT1(vf); \
+		j = 0; \
+		while (ANYGT(vf, SUBSAT(hstore[j], vgapo))) { \
+			vh = MAXV(hstore[j], vf); \
+			hstore[j] = vh; \
+			vmax = MAXV(vmax, vh); \
+			vh = SUBSAT(vh, vgapo); \
+			ebuf[j] = MAXV(ebuf[j], vh); \
+			vf = SUBSAT(vf, vgape); \
+			if (++j >= seglen) { \
+				j = 0; \
+				vf = SHIFT1(vf); \
+			} \
+		} \
+		if (ANYGT(vmax, vbest)) { \
+			best = MAXLANE(vmax); \
+			vbest = SET1(best); \
+			*seqend = i; \
+			for (j = 0; j < seglen; j++) hbest[j] = hstore[j]; \
+		} \
+	} \
+	if (best > 0) { \
+		const T *h = (const T *) hbest; \
+		unsigned lanes = sizeof(VEC) / sizeof(T), q; \
+		for (q = 0; q < qlen; q++) { \
+			if (h[(q % seglen) * lanes + q / seglen] == best) break; \
+		} \
+		*queryend = q; \
+	} \
+	return best; \
+}
+
+/* SSE2, 8-bit unsigned lanes */
+static inline int anygt_sse_u8(__m128i a, __m128i b) { return _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_subs_epu8(a, b), _mm_setzero_si128())) != 0xffff; }
+static inline int maxlane_sse_u8(__m128i a)
+{
+	a = _mm_max_epu8(a, _mm_srli_si128(a, 8));
+	a = _mm_max_epu8(a, _mm_srli_si128(a, 4));
+	a = _mm_max_epu8(a, _mm_srli_si128(a, 2));
+	a = _mm_max_epu8(a, _mm_srli_si128(a, 1));
+	return _mm_cvtsi128_si32(a) & 0xff;
+}
+#define SSE_SET1_U8(x) _mm_set1_epi8((char) (x))
+#define SSE_SHIFT_U8(a) _mm_slli_si128(a, 1)
+STRIPED_KERNEL(sse2_u8, , __m128i, unsigned char, SSE_SET1_U8, _mm_setzero_si128(), _mm_adds_epu8, _mm_subs_epu8, _mm_max_epu8, SSE_SHIFT_U8, anygt_sse_u8, maxlane_sse_u8)
+
+/* SSE2, 16-bit lanes (scores are kept non-negative, bias is 0) */
+static inline int anygt_sse_i16(__m128i a, __m128i b) { return _mm_movemask_epi8(_mm_cmpgt_epi16(a, b)) != 0; }
+static inline int maxlane_sse_i16(__m128i a)
+{
+	a = _mm_max_epi16(a, _mm_srli_si128(a, 8));
+	a = _mm_max_epi16(a, _mm_srli_si128(a, 4));
+	a = _mm_max_epi16(a, _mm_srli_si128(a, 2));
+	return (short) _mm_cvtsi128_si32(a);
+}
+#define SSE_SET1_I16(x) _mm_set1_epi16((short) (x))
+#define SSE_SHIFT_I16(a) _mm_slli_si128(a, 2)
+STRIPED_KERNEL(sse2_i16, , __m128i, short, SSE_SET1_I16, _mm_setzero_si128(), _mm_adds_epi16, _mm_subs_epu16, _mm_max_epi16, SSE_SHIFT_I16, anygt_sse_i16, maxlane_sse_i16)
+
+/* AVX2, lane shift has to cross 128-bit halves */
+#define AVX2 __attribute__((target("avx2")))
+AVX2 static inline __m256i shift_avx_u8(__m256i a) { return _mm256_alignr_epi8(a, _mm256_permute2x128_si256(a, a, 0x08), 15); }
+AVX2 static inline __m256i shift_avx_i16(__m256i a) { return _mm256_alignr_epi8(a, _mm256_permute2x128_si256(a, a, 0x08), 14); }
+AVX2 static inline int anygt_avx_u8(__m256i a, __m256i b) { return (unsigned) _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_subs_epu8(a, b), _mm256_setzero_si256())) != 0xffffffff; }
+AVX2 static inline int anygt_avx_i16(__m256i a, __m256i b) { return _mm256_movemask_epi8(_mm256_cmpgt_epi16(a, b)) != 0; }
+AVX2 static inline int maxlane_avx_u8(__m256i a) { return maxlane_sse_u8(_mm_max_epu8(_mm256_castsi256_si128(a), _mm256_extracti128_si256(a, 1))); }
+AVX2 static inline int maxlane_avx_i16(__m256i a) { return maxlane_sse_i16(_mm_max_epi16(_mm256_castsi256_si128(a), _mm256_extracti128_si256(a, 1))); }
+#define AVX_SET1_U8(x) _mm256_set1_epi8((char) (x))
+#define AVX_SET1_I16(x) _mm256_set1_epi16((short) (x))
+STRIPED_KERNEL(avx2_u8, AVX2, __m256i, unsigned char, AVX_SET1_U8, _mm256_setzero_si256(), _mm256_adds_epu8, _mm256_subs_epu8, _mm256_max_epu8, shift_avx_u8, anygt_avx_u8, maxlane_avx_u8)
+STRIPED_KERNEL(avx2_i16, AVX2, __m256i, short, AVX_SET1_I16, _mm256_setzero_si256(), _mm256_adds_epi16, _mm256_subs_epu16, _mm256_max_epi16, shift_avx_i16, anygt_avx_i16, maxlane_avx_i16)
+
+static const alignkernel kernels8[] = { NULL, sse2_u8, avx2_u8 };
+static const alignkernel kernels16[] = { NULL, sse2_i16, avx2_i16 };
+/* Vector size in bytes */
+static const unsigned vectorbytes[] = { 0, 16, 32 };
+
+#endif
+
+/* Pick the best engine supported by CPU */
+static int detectengine(void)
+{
+#ifdef ALIGN_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) return ALIGN_AVX2;
+	if (__builtin_cpu_supports("sse2")) return ALIGN_SSE2;
+#endif
+	return ALIGN_SCALAR;
+}
+
+/*
+ * Select alignment engine (ALIGN_AUTO picks the best one CPU supports)
+ *
+ * returns    - selected engine, engine that is not supported falls back to the best supported one
+ */
+int setalignengine(int engine)
+{
+	int best = detectengine();
+	selected = ((engine == ALIGN_AUTO) || (engine > best)) ? best : engine;
+	return selected;
+}
+
+const char *alignenginename(int engine)
+{
+	return enginenames[engine];
+}
+
+/* Build query profile into profile: for every symbol and vector the scores of query positions (+ bias), returns the number of vectors */
+static unsigned buildprofile(void *profile, const unsigned char *query, unsigned qlen, const alignscoring *sc, unsigned lanes, unsigned lanebytes, int bias)
+{
+	unsigned n = (qlen + lanes - 1) / lanes, a, j, k;
+	for (a = 0; a < PROFILE_SYMBOLS; a++) {
+		for (j = 0; j < n; j++) {
+			for (k = 0; k < lanes; k++) {
+				unsigned q = k * n + j;
+				int v = (q < qlen) ? pairscore(query[q], a, sc) + bias : bias;
+				if (lanebytes == 1) {
+					((unsigned char *) profile)[(a * n + j) * lanes + k] = v;
+				} else {
+					((short *) profile)[(a * n + j) * lanes + k] = v;
+				}
+			}
+		}
+	}
+	return n;
+}
+
+/*
+ * Best local score and its end in sequence using selected engine
+ * Profiles of query are built into prof8 and prof16 on first use (built8 and built16 are set), they can be the same buffer
+ * if the query is aligned only once
+ */
+static int bestscore(alignquery *a, const unsigned char *query, unsigned qlen, const unsigned char *seq, unsigned slen, void *prof8, int *built8, void *prof16, int *built16, int *seqend, int *queryend)
+{
+	const alignscoring *sc = &a->scoring;
+#ifdef ALIGN_X86
+	int gapo = sc->gapopen + sc->gapextend, gape = sc->gapextend;
+	if (selected != ALIGN_SCALAR) {
+		unsigned seglen;
+		int bias = sc->mismatch, score;
+		/* 8-bit lanes first */
+		if ((sc->match + sc->mismatch < 255) && (gapo < 255)) {
+			seglen = (qlen + vectorbytes[selected] - 1) / vectorbytes[selected];
+			if (!*built8) {
+				buildprofile(prof8, query, qlen, sc, vectorbytes[selected], 1, bias);
+				*built8 = 1;
+			}
+			score = kernels8[selected](prof8, qlen, seglen, seq, slen, gapo, gape, bias, a->work, seqend, queryend);
+			if (score + bias < 255) return score;
+		}
+		if ((qlen * sc->match < 32767) && (sc->mismatch < 32767) && (gapo < 32767)) {
+			seglen = (qlen + vectorbytes[selected] / 2 - 1) / (vectorbytes[selected] / 2);
+			if (!*built16) {
+				buildprofile(prof16, query, qlen, sc, vectorbytes[selected] / 2, 2, 0);
+				*built16 = 1;
+			}
+			return kernels16[selected](prof16, qlen, seglen, seq, slen, gapo, gape, 0, a->work, seqend, queryend);
+		}
+	}
+#endif
+	return scalarscore(query, qlen, seq, slen, sc, a->rows, seqend, queryend);
+}
+
+/*
+ * Set query (one strand) of local alignment with affine gap scoring
+ * Buffers are allocated on first use and reused for all queries, profiles of query are built on first alignment
+ *
+ * a          - alignment state of mapping thread (zeroed before first use)
+ * query      - query sequence
+ * sc         - match and mismatch scores, gap open and extension penalties
+ */
+void setalignquery(alignquery *a, const char *query, unsigned qlen, const alignscoring *sc)
+{
+	unsigned i;
+	if (selected < 0) setalignengine(ALIGN_AUTO);
+	if (a->rows == NULL) {
+		/* Profile has at most MAX_READ_LENGTH + 31 lanes of at most 2 bytes for every symbol, kernels keep 4 columns */
+		size_t profilesize = PROFILE_SYMBOLS * (MAX_READ_LENGTH + 32) * 2, worksize = 4 * (MAX_READ_LENGTH + 32) * 2;
+		if (posix_memalign(&a->profile8, 32, profilesize) || posix_memalign(&a->profile16, 32, profilesize) ||
+				posix_memalign(&a->revprofile, 32, profilesize) || posix_memalign(&a->work, 32, worksize)) {
+			fprintf(stderr, "Cannot allocate alignment buffers.\n");
+			exit(1);
+		}
+		a->rows = (int *) malloc (2 * (MAX_READ_LENGTH + 1) * sizeof(int));
+	}
+	if (qlen >= MAX_READ_LENGTH) qlen = MAX_READ_LENGTH - 1;
+	for (i = 0; i < qlen; i++) a->query[i] = nuclcode(query[i]);
+	a->qlen = qlen;
+	a->scoring = *sc;
+	a->built8 = a->built16 = 0;
+}
+
+void freealignquery(alignquery *a)
+{
+	free(a->profile8);
+	free(a->profile16);
+	free(a->revprofile);
+	free(a->work);
+	free(a->rows);
+	free(a->seq);
+}
+
+/*
+ * Local alignment of query (see setalignquery) and sequence
+ *
+ * a          - alignment state with query
+ * seq        - sequence (candidate window of genome)
+ * seqstart   - first position of best alignment in sequence (-1 if score is 0)
+ * querystart - first position of best alignment in query (-1 if score is 0)
+ *
+ * returns    - the best alignment score
+ */
+int alignscore(alignquery *a, const char *seq, unsigned slen, int *seqstart, int *querystart)
+{
+	unsigned char *s;
+	int score, end, qend, rend, rqend;
+	unsigned i;
+
+	if (a->nseq_slots < slen + 1) {
+		a->nseq_slots = slen + 1;
+		a->seq = (unsigned char *) realloc (a->seq, a->nseq_slots);
+	}
+	s = a->seq;
+	for (i = 0; i < slen; i++) s[i] = nuclcode(seq[i]);
+	score = bestscore(a, a->query, a->qlen, s, slen, a->profile8, &a->built8, a->profile16, &a->built16, &end, &qend);
+	*seqstart = *querystart = -1;
+	if (score > 0) {
+		/* Alignment of reversed query and sequence ending at the best end gives the start */
+		unsigned char q[MAX_READ_LENGTH], t;
+		int built8 = 0, built16 = 0;
+		for (i = 0; i <= (unsigned) qend; i++) q[i] = a->query[qend - i];
+		for (i = 0; i < (unsigned) (end + 1) / 2; i++) {
+			t = s[i]; s[i] = s[end - i]; s[end - i] = t;
+		}
+		bestscore(a, q, qend + 1, s, end + 1, a->revprofile, &built8, a->revprofile, &built16, &rend, &rqend);
+		*seqstart = end - rend;
+		*querystart = qend - rqend;
+	}
+	return score;
+}
+
+/*
+ * Pack sequence to 2 bits per nucleotide (32 per word, the first in the lowest bits)
+ * Other symbols are marked by the low bit of their position in nmask
+ * Both arrays have nwords (at least (len + 31) / 32 + 1) words, positions after len are marked as unknown
+ */
+void packsequence(const char *seq, unsigned len, unsigned nwords, unsigned long long *packed, unsigned long long *nmask)
+{
+	unsigned i;
+	memset(packed, 0, nwords * sizeof(unsigned long long));
+	memset(nmask, 0, nwords * sizeof(unsigned long long));
+	for (i = 0; i < len; i++) {
+		unsigned char c = nuclcode(seq[i]);
+		if (c < 4) {
+			packed[i / 32] |= (unsigned long long) c << (2 * (i % 32));
+		} else {
+			nmask[i / 32] |= 1ULL << (2 * (i % 32));
+		}
+	}
+	for (i = len; i < nwords * 32; i++) nmask[i / 32] |= 1ULL << (2 * (i % 32));
+}
+
+/* 32 nucleotides of packed sequence starting from any position */
+static inline unsigned long long packedword(const unsigned long long *p, unsigned pos)
+{
+	unsigned k = pos / 32, sh = 2 * (pos % 32);
+	return (sh) ? (p[k] >> sh) | (p[k + 1] << (64 - sh)) : p[k];
+}
+
+/*
+ * Number of mismatches between packed query and packed sequence starting from pos
+ * Unknown nucleotides (in either) are mismatches
+ * Counting stops as soon as it exceeds maxmm
+ *
+ * returns    - number of mismatches (or maxmm + 1 if there are more)
+ */
+__attribute__((target_clones("avx2", "popcnt", "default")))
+unsigned hammingdistance(const unsigned long long *query, const unsigned long long *qmask, unsigned qlen, const unsigned long long *seq, const unsigned long long *smask, unsigned pos, unsigned maxmm)
+{
+	const unsigned long long low = 0x5555555555555555ULL;
+	unsigned k, nmm = 0;
+	for (k = 0; k * 32 < qlen; k++) {
+		unsigned long long x = query[k] ^ packedword(seq, pos + k * 32);
+		unsigned long long d = ((x | (x >> 1)) | qmask[k] | packedword(smask, pos + k * 32)) & low;
+		if (qlen - k * 32 < 32) d &= (1ULL << (2 * (qlen - k * 32))) - 1;
+		nmm += __builtin_popcountll(d);
+		if (nmm > maxmm) return maxmm + 1;
+	}
+	return nmm;
+}
+
+/* Only uppercase nucleotides are the same for edit distance, everything else is 4 */
+static inline unsigned qgramcode(char c)
+{
+	switch (c) {
+	case 'A': return 0;
+	case 'C': return 1;
+	case 'G': return 2;
+	case 'T': return 3;
+	}
+	return 4;
+}
+
+/*
+ * Count q-grams (q <= QGRAM_MAX) of sequence into counts (4^q entries)
+ * Q-grams containing other symbols than A, C, G, T are skipped
+ *
+ * returns    - number of counted q-grams
+ */
+unsigned qgramprofile(const char *seq, unsigned len, unsigned q, unsigned short *counts)
+{
+	unsigned mask = (1U << (2 * q)) - 1, code = 0, valid = 0, n = 0, i;
+	memset(counts, 0, (mask + 1) * sizeof(unsigned short));
+	for (i = 0; i < len; i++) {
+		unsigned c = qgramcode(seq[i]);
+		if (c < 4) {
+			code = ((code << 2) | c) & mask;
+			valid += 1;
+		} else {
+			valid = 0;
+		}
+		if (valid >= q) {
+			counts[code] += 1;
+			n += 1;
+		}
+	}
+	return n;
+}
+
+/*
+ * Number of q-grams of sequence that are also in profile (every profile q-gram is matched once)
+ * Counting stops as soon as need q-grams are found, used (4^q entries) has to be zero and is left zero
+ *
+ * returns    - number of shared q-grams (at most need)
+ */
+unsigned qgramcommon(const unsigned short *counts, unsigned short *used, unsigned q, const char *seq, unsigned len, unsigned need)
+{
+	unsigned mask = (1U << (2 * q)) - 1, code = 0, valid = 0, common = 0, end, i;
+	for (end = 0; (end < len) && (common < need); end++) {
+		unsigned c = qgramcode(seq[end]);
+		if (c < 4) {
+			code = ((code << 2) | c) & mask;
+			valid += 1;
+		} else {
+			valid = 0;
+		}
+		if ((valid >= q) && (used[code] < counts[code])) {
+			used[code] += 1;
+			common += 1;
+		}
+	}
+	/* Clear only what was touched */
+	code = valid = 0;
+	for (i = 0; i < end; i++) {
+		unsigned c = qgramcode(seq[i]);
+		if (c < 4) {
+			code = ((code << 2) | c) & mask;
+			valid += 1;
+		} else {
+			valid = 0;
+		}
+		if (valid >= q) used[code] = 0;
+	}
+	return common;
+}
@@ -0,0 +1,563 @@
+/*
+ * Genome Mapper
+ * (FM index backend: suffix array construction, index file, bidirectional search and SMEM seeds)
+ *
+ * Text of the index is the genome followed by its reverse complement, so every string and its reverse
+ * complement occur equally often. The interval of a string is kept together with the interval of its
+ * reverse complement and can be extended to both sides (FMD index, Li 2012). Unknown nucleotides and
+ * the gaps between sequences are filled with pseudo-random nucleotides, positions are the same as in
+ * names file.
+ *
+ * Authors: Maarja Lepamets, Fanny-Dhelia Pajuste
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "utils.h"
+
+/* SMEMs at least FM_RESEED_LENGTH times minimum seed length with at most FM_RESEED_WIDTH occurrences are searched again from their middle */
+#define FM_RESEED_LENGTH 1.5
+#define FM_RESEED_WIDTH 10
+
+/* Seeds of current query and the interval lists of SMEM search */
+static __thread fminterval *fmseedbuf = NULL;
+static __thread unsigned nfmseed_slots = 0;
+static __thread fminterval *fmlist[2] = { NULL, NULL };
+static __thread unsigned nfmlist_slots[2] = { 0, 0 };
+static __thread unsigned char *fmquery = NULL;
+static __thread unsigned nfmquery_slots = 0;
+
+/*
+ * Suffix array construction by induced sorting (SA-IS, Nong, Zhang & Chan 2009)
+ * s is unsigned char (cs == 1) or int (cs == sizeof(int)) array of n characters in 0...K,
+ * the last character has to be 0 and occur only once
+ */
+
+#define SAIS_CHR(i) ((cs == sizeof(int)) ? ((const int *) s)[i] : ((const unsigned char *) s)[i])
+#define SAIS_TGET(i) ((t[(i) >> 3] >> ((i) & 7)) & 1)
+#define SAIS_TSET(i, b) t[(i) >> 3] = (b) ? (t[(i) >> 3] | (1 << ((i) & 7))) : (t[(i) >> 3] & ~(1 << ((i) & 7)))
+#define SAIS_ISLMS(i) (((i) > 0) && SAIS_TGET(i) && !SAIS_TGET((i) - 1))
+
+/* Start (or end if end is set) of the bucket of every character */
+static void saisbuckets(const void *s, int *bkt, int n, int K, int cs, int end)
+{
+	int i, sum = 0;
+	for (i = 0; i <= K; i++) bkt[i] = 0;
+	for (i = 0; i < n; i++) bkt[SAIS_CHR(i)] += 1;
+	for (i = 0; i <= K; i++) {
+		sum += bkt[i];
+		bkt[i] = (end) ? sum : sum - bkt[i];
+	}
+}
+
+/* Induce the order of L-type suffixes from the sorted LMS suffixes, then that of S-type suffixes */
+static void saisinduce(const unsigned char *t, int *SA, const void *s, int *bkt, int n, int K, int cs)
+{
+	int i, j;
+	saisbuckets(s, bkt, n, K, cs, 0);
+	for (i = 0; i < n; i++) {
+		j = SA[i] - 1;
+		if ((j >= 0) && !SAIS_TGET(j)) SA[bkt[SAIS_CHR(j)]++] = j;
+	}
+	saisbuckets(s, bkt, n, K, cs, 1);
+	for (i = n - 1; i >= 0; i--) {
+		j = SA[i] - 1;
+		if ((j >= 0) && SAIS_TGET(j)) SA[--bkt[SAIS_CHR(j)]] = j;
+	}
+}
+
+static void sais(const void *s, int *SA, int n, int K, int cs)
+{
+	unsigned char *t;
+	int *bkt, *SA1, *s1;
+	int i, j, n1, name, prev;
+
+	/* Types of suffixes (1 - S-type, 0 - L-type) */
+	t = (unsigned char *) calloc (n / 8 + 1, 1);
+	bkt = (int *) malloc ((K + 1) * sizeof(int));
+	if (!t || !bkt) {
+		fprintf(stderr, "Not enough memory for suffix array!\n");
+		exit(1);
+	}
+	SAIS_TSET(n - 2, 0);
+	SAIS_TSET(n - 1, 1);
+	for (i = n - 3; i >= 0; i--) {
+		SAIS_TSET(i, (SAIS_CHR(i) < SAIS_CHR(i + 1)) || ((SAIS_CHR(i) == SAIS_CHR(i + 1)) && SAIS_TGET(i + 1)));
+	}
+
+	/* Sort LMS substrings */
+	saisbuckets(s, bkt, n, K, cs, 1);
+	for (i = 0; i < n; i++) SA[i] = -1;
+	for (i = 1; i < n; i++) {
+		if (SAIS_ISLMS(i)) SA[--bkt[SAIS_CHR(i)]] = i;
+	}
+	saisinduce(t, SA, s, bkt, n, K, cs);
+
+	/* Name LMS substrings by their order, equal substrings get the same name */
+	n1 = 0;
+	for (i = 0; i < n; i++) {
+		if (SAIS_ISLMS(SA[i])) SA[n1++] = SA[i];
+	}
+	for (i = n1; i < n; i++) SA[i] = -1;
+	name = 0;
+	prev = -1;
+	for (i = 0; i < n1; i++) {
+		int pos = SA[i], diff = 0, d;
+		for (d = 0; d < n; d++) {
+			if ((prev == -1) || (SAIS_CHR(pos + d) != SAIS_CHR(prev + d)) || (SAIS_TGET(pos + d) != SAIS_TGET(prev + d))) {
+				diff = 1;
+				break;
+			} else if ((d > 0) && (SAIS_ISLMS(pos + d) || SAIS_ISLMS(prev + d))) {
+				break;
+			}
+		}
+		if (diff) {
+			name += 1;
+			prev = pos;
+		}
+		SA[n1 + pos / 2] = name - 1;
+	}
+	for (i = n - 1, j = n - 1; i >= n1; i--) {
+		if (SA[i] >= 0) SA[j--] = SA[i];
+	}
+
+	/* Sort reduced string, recursively if names are not unique */
+	SA1 = SA;
+	s1 = SA + n - n1;
+	if (name < n1) {
+		sais(s1, SA1, n1, name - 1, sizeof(int));
+	} else {
+		for (i = 0; i < n1; i++) SA1[s1[i]] = i;
+	}
+
+	/* Induce suffix array from the sorted LMS suffixes */
+	saisbuckets(s, bkt, n, K, cs, 1);
+	for (i = 1, j = 0; i < n; i++) {
+		if (SAIS_ISLMS(i)) s1[j++] = i;
+	}
+	for (i = 0; i < n1; i++) SA1[i] = s1[SA1[i]];
+	for (i = n1; i < n; i++) SA[i] = -1;
+	for (i = n1 - 1; i >= 0; i--) {
+		j = SA[i];
+		SA[i] = -1;
+		SA[--bkt[SAIS_CHR(j)]] = j;
+	}
+	saisinduce(t, SA, s, bkt, n, K, cs);
+	free(bkt);
+	free(t);
+}
+
+static void fmtoolong(void)
+{
+	fprintf(stderr, "Genome is too long for FM index (at most %u positions)!\n", FM_MAX_LENGTH - 1);
+	exit(1);
+}
+
+/*
+ * Append sequence of FastA file to text (nucleotides as 1...4) from location loc, text has room for limit nucleotides
+ * Unknown nucleotides get pseudo-random values, name is set to the sequence name (up to the first space)
+ *
+ * returns    - the location after the sequence
+ */
+static unsigned filltext(const char *filename, unsigned char *text, unsigned loc, unsigned limit, unsigned *random, char **name)
+{
+	struct stat st;
+	const char *data = filemmap(filename, &st);
+	off_t i, namestart = 0;
+	int isheader = 0;
+
+	if (data == NULL) {
+		fprintf(stderr, "Cannot open file %s!\n", filename);
+		exit(1);
+	}
+	*name = NULL;
+	for (i = 0; i < st.st_size; ++i) {
+		if (data[i] == '>') {
+			if (i != 0) {
+				fprintf(stderr, "Only one FastA sequence per file is allowed!\n");
+				exit(1);
+			}
+			isheader = 1;
+			namestart = i + 1;
+		}
+		if (isheader) {
+			if (data[i] == '\n') {
+				off_t e = namestart;
+				while ((e < i) && (data[e] > ' ')) e += 1;
+				*name = (char *) malloc (e - namestart + 1);
+				memcpy(*name, data + namestart, e - namestart);
+				(*name)[e - namestart] = 0;
+				isheader = 0;
+			}
+		} else if (data[i] >= 'A') {
+			if (loc >= limit) fmtoolong();
+			if (strchr(alphabet, data[i]) != NULL) {
+				text[loc] = 1 + getnuclvalue(data[i]);
+			} else {
+				*random = *random * 1103515245 + 12345;
+				text[loc] = 1 + ((*random >> 16) & 3);
+			}
+			loc += 1;
+		}
+	}
+	munmap((void *) data, st.st_size);
+	if (*name == NULL) *name = strdup(filename);
+	return loc;
+}
+
+/*
+ * Build FM index <outputname>.fm and names file <outputname>.names from FastA files
+ * Sequences get the same locations as in k-mer index
+ */
+void buildfmindex(const char *files[], int nfiles, const char *outputname)
+{
+	unsigned long long bound = 0;
+	unsigned char *text;
+	unsigned length = 0, nrows, nblocks, nsamples, occ[4] = { 0, 0, 0, 0 }, random = 1, r;
+	int *SA, i;
+	fmheader h;
+	fmblock *blocks;
+	unsigned *samples;
+	char fname[256];
+	FILE *f;
+
+	for (i = 0; i < nfiles; ++i) {
+		struct stat st;
+		if (stat(files[i], &st) < 0) {
+			fprintf (stderr, "Cannot get the statistics of file %s!\n", files[i]);
+			exit (1);
+		}
+		bound += st.st_size + 10000;
+	}
+	if (bound > FM_MAX_LENGTH - 1) bound = FM_MAX_LENGTH - 1;
+	text = (unsigned char *) malloc (2 * bound + 1);
+	if (text == NULL) {
+		fprintf(stderr, "Not enough memory for FM index text!\n");
+		exit(1);
+	}
+
+	sprintf(fname, "%s.names", outputname);
+	f = fopen(fname, "w");
+	if (f == NULL) {
+		fprintf(stderr, "Cannot open file %s!\n", fname);
+		exit(1);
+	}
+	for (i = 0; i < nfiles; ++i) {
+		unsigned start, end;
+		char *name;
+		if (debug > 0) fprintf (stderr, "Reading: %s...\n", files[i]);
+		if (i > 0) {
+			/* Gap between sequences, the same as in k-mer index */
+			if (length + 10000 >= bound) fmtoolong();
+			for (end = length + 10000; length < end; length++) {
+				random = random * 1103515245 + 12345;
+				text[length] = 1 + ((random >> 16) & 3);
+			}
+		}
+		start = length;
+		length = filltext(files[i], text, length, bound, &random, &name);
+		if (length > start) fprintf (f, "%s %s %u\n", name, files[i], start);
+		free(name);
+	}
+	fclose(f);
+	if (length == 0) {
+		fprintf(stderr, "No sequence in FastA files!\n");
+		exit(1);
+	}
+
+	/* Reverse complement follows genome, 0 is the end of text */
+	for (r = 0; r < length; r++) text[length + r] = 5 - text[length - 1 - r];
+	text[2 * length] = 0;
+	nrows = 2 * length + 1;
+	SA = (int *) malloc ((unsigned long long) nrows * sizeof(int));
+	if (SA == NULL) {
+		fprintf(stderr, "Not enough memory for suffix array!\n");
+		exit(1);
+	}
+	if (debug > 0) fprintf (stderr, "Suffix array of %u positions\n", nrows);
+	sais(text, SA, nrows, 4, 1);
+
+	memset(&h, 0, sizeof(fmheader));
+	h.magic = FM_MAGIC;
+	h.length = length;
+	h.nrows = nrows;
+	h.sarate = FM_SA_RATE;
+	nblocks = (nrows >> 6) + 1;
+	nsamples = (nrows - 1) / FM_SA_RATE + 1;
+	h.nblocks = nblocks;
+	h.nsamples = nsamples;
+	blocks = (fmblock *) calloc (nblocks, sizeof(fmblock));
+	samples = (unsigned *) malloc (nsamples * sizeof(unsigned));
+	if (!blocks || !samples) {
+		fprintf(stderr, "Not enough memory for FM index!\n");
+		exit(1);
+	}
+	/* BWT character of the row of whole text is the end of text, it is stored as A */
+	for (r = 0; r < nrows; r++) {
+		unsigned c = (SA[r] == 0) ? 0 : text[SA[r] - 1] - 1;
+		if (SA[r] == 0) h.primary = r;
+		if ((r & 63) == 0) memcpy(blocks[r >> 6].occ, occ, sizeof(occ));
+		blocks[r >> 6].bwt[(r >> 5) & 1] |= (unsigned long long) c << (2 * (r & 31));
+		occ[c] += 1;
+		if (r % FM_SA_RATE == 0) samples[r / FM_SA_RATE] = SA[r];
+	}
+	if ((nrows & 63) == 0) memcpy(blocks[nrows >> 6].occ, occ, sizeof(occ));
+	occ[0] -= 1;
+	h.count[0] = 1;
+	for (i = 0; i < 4; i++) h.count[i + 1] = h.count[i] + occ[i];
+	free(SA);
+	free(text);
+
+	sprintf(fname, "%s.fm", outputname);
+	f = fopen(fname, "wb");
+	if (f == NULL) {
+		fprintf(stderr, "Cannot open file %s!\n", fname);
+		exit(1);
+	}
+	if ((fwrite(&h, sizeof(fmheader), 1, f) != 1) || (fwrite(blocks, sizeof(fmblock), nblocks, f) != nblocks) ||
+			(fwrite(samples, sizeof(unsigned), nsamples, f) != nsamples)) {
+		fprintf(stderr, "Cannot write file %s!\n", fname);
+		exit(1);
+	}
+	fclose(f);
+	free(blocks);
+	free(samples);
+}
+
+/*
+ * Set up FM index from index data (as loaded by loadindex)
+ *
+ * returns    - 1 if data is FM index, 0 if not (k-mer index)
+ */
+int openfmindex(fmindex *fm, const char *data)
+{
+	const fmheader *h = (const fmheader *) data;
+	if (h->magic != FM_MAGIC) return 0;
+	fm->h = h;
+	fm->blocks = (const fmblock *) (data + sizeof(fmheader));
+	fm->samples = (const unsigned *) (data + sizeof(fmheader) + (unsigned long long) h->nblocks * sizeof(fmblock));
+	return 1;
+}
+
+/* Number of nucleotides with 2-bit code pattern (repeated) among the first n (0...32) characters of x */
+static inline unsigned countcode(unsigned long long x, unsigned long long pattern, unsigned n)
+{
+	unsigned long long z = x ^ pattern;
+	z = ~(z | (z >> 1)) & 0x5555555555555555ULL;
+	if (n < 32) z &= (1ULL << (2 * n)) - 1;
+	return __builtin_popcountll(z);
+}
+
+/* Occurrences of nucleotide a in BWT rows before row i */
+static inline unsigned fmocc(const fmindex *fm, unsigned a, unsigned i)
+{
+	const fmblock *b = fm->blocks + (i >> 6);
+	unsigned long long pattern = 0x5555555555555555ULL * a;
+	unsigned r = i & 63, occ = b->occ[a];
+	if (r > 32) {
+		occ += countcode(b->bwt[0], pattern, 32) + countcode(b->bwt[1], pattern, r - 32);
+	} else {
+		occ += countcode(b->bwt[0], pattern, r);
+	}
+	/* End of text is stored as A */
+	if ((a == 0) && (fm->h->primary < i)) occ -= 1;
+	return occ;
+}
+
+/* Occurrences of every nucleotide before row i, C, G and T are counted from the high and low bits of codes, A is the rest */
+static inline void fmocc4(const fmindex *fm, unsigned i, unsigned occ[4])
+{
+	const fmblock *b = fm->blocks + (i >> 6);
+	unsigned r = i & 63, w, n[4] = { 0, 0, 0, 0 };
+	for (w = 0; (w < 2) && (w * 32 < r); w++) {
+		unsigned m = (r - w * 32 < 32) ? r - w * 32 : 32;
+		unsigned long long mask = (m < 32) ? 0x5555555555555555ULL & ((1ULL << (2 * m)) - 1) : 0x5555555555555555ULL;
+		unsigned long long lo = b->bwt[w] & mask, hi = (b->bwt[w] >> 1) & mask;
+		n[1] += __builtin_popcountll(lo & ~hi);
+		n[2] += __builtin_popcountll(hi & ~lo);
+		n[3] += __builtin_popcountll(hi & lo);
+	}
+	occ[1] = b->occ[1] + n[1];
+	occ[2] = b->occ[2] + n[2];
+	occ[3] = b->occ[3] + n[3];
+	occ[0] = b->occ[0] + r - n[1] - n[2] - n[3];
+	/* End of text is stored as A */
+	if (fm->h->primary < i) occ[0] -= 1;
+}
+
+/*
+ * Extend interval by nucleotide a on the left (backward) or on the right
+ * Left extension gives the rows of aP from the rows of P, the rows of the reverse complement
+ * rc(P)comp(a) are the part of rc(P) rows followed by comp(a) (ordered by the next nucleotide: end of text, A, C, G, T)
+ * Right extension is left extension of the reverse complement
+ */
+static void fmextend(const fmindex *fm, const fminterval *ik, unsigned a, int backward, fminterval *ok)
+{
+	unsigned tk[4], tl[4], s[4], k, l, b;
+	k = (backward) ? ik->k : ik->l;
+	l = (backward) ? ik->l : ik->k;
+	if (!backward) a = 3 - a;
+	fmocc4(fm, k, tk);
+	fmocc4(fm, k + ik->s, tl);
+	for (b = 0; b < 4; b++) s[b] = tl[b] - tk[b];
+	/* Rows of rc(P) followed by end of text, then by comp(b) for b = T, G, C, A */
+	l += ((fm->h->primary >= k) && (fm->h->primary < k + ik->s));
+	for (b = 3; b > a; b--) l += s[b];
+	ok->s = s[a];
+	if (backward) {
+		ok->k = fm->h->count[a] + tk[a];
+		ok->l = l;
+	} else {
+		ok->k = l;
+		ok->l = fm->h->count[a] + tk[a];
+	}
+}
+
+/* Append interval to growable list */
+static inline void pushinterval(fminterval **list, unsigned *n, unsigned *nslots, const fminterval *iv)
+{
+	if (*n >= *nslots) {
+		*nslots = (*nslots) ? 2 * *nslots : 64;
+		*list = (fminterval *) realloc (*list, *nslots * sizeof(fminterval));
+	}
+	(*list)[(*n)++] = *iv;
+}
+
+/*
+ * Find the SMEMs (exact matches that are not contained in longer matches) of query that contain
+ * position x and occur at least minocc times, append them to seed buffer in the order of start
+ * First the match is extended to the right and every interval where the number of occurrences drops
+ * is kept, then all kept intervals are extended to the left together (Li 2012, algorithm 5)
+ *
+ * returns    - the end of the longest match starting at x
+ */
+static unsigned smem1(const fmindex *fm, const unsigned char *q, unsigned qlen, unsigned x, unsigned minocc, unsigned *nseeds)
+{
+	fminterval ik, ok;
+	unsigned nprev, ncurr = 0, first = *nseeds, i, j, end;
+	fminterval *prev, *curr;
+	int p, cur = 0;
+
+	if (q[x] > 3) return x + 1;
+	ik.k = fm->h->count[q[x]];
+	ik.l = fm->h->count[3 - q[x]];
+	ik.s = fm->h->count[q[x] + 1] - fm->h->count[q[x]];
+	ik.qstart = x;
+	ik.qend = x + 1;
+	for (i = x + 1; i < qlen; i++) {
+		if (q[i] > 3) {
+			pushinterval(&fmlist[cur], &ncurr, &nfmlist_slots[cur], &ik);
+			break;
+		}
+		fmextend(fm, &ik, q[i], 0, &ok);
+		if (ok.s != ik.s) {
+			pushinterval(&fmlist[cur], &ncurr, &nfmlist_slots[cur], &ik);
+			if (ok.s < minocc) break;
+		}
+		ik.k = ok.k;
+		ik.l = ok.l;
+		ik.s = ok.s;
+		ik.qend = i + 1;
+	}
+	if (i == qlen) pushinterval(&fmlist[cur], &ncurr, &nfmlist_slots[cur], &ik);
+	/* Longest match first */
+	curr = fmlist[cur];
+	for (j = 0; j < ncurr / 2; j++) {
+		fminterval t = curr[j];
+		curr[j] = curr[ncurr - 1 - j];
+		curr[ncurr - 1 - j] = t;
+	}
+	end = curr[0].qend;
+	nprev = ncurr;
+	cur = 1 - cur;
+
+	for (p = (int) x - 1; p >= -1; p--) {
+		int c = ((p < 0) || (q[p] > 3)) ? -1 : q[p];
+		prev = fmlist[1 - cur];
+		ncurr = 0;
+		for (j = 0; j < nprev; j++) {
+			if (c >= 0) fmextend(fm, &prev[j], c, 1, &ok);
+			if ((c < 0) || (ok.s < minocc)) {
+				/* Match cannot be extended, it is SMEM unless a longer match continues */
+				if ((ncurr == 0) && ((*nseeds == first) || ((unsigned) (p + 1) < fmseedbuf[*nseeds - 1].qstart))) {
+					ik = prev[j];
+					ik.qstart = p + 1;
+					pushinterval(&fmseedbuf, nseeds, &nfmseed_slots, &ik);
+				}
+			} else if ((ncurr == 0) || (ok.s != fmlist[cur][ncurr - 1].s)) {
+				ok.qstart = p;
+				ok.qend = prev[j].qend;
+				pushinterval(&fmlist[cur], &ncurr, &nfmlist_slots[cur], &ok);
+			}
+		}
+		if (ncurr == 0) break;
+		nprev = ncurr;
+		cur = 1 - cur;
+	}
+	for (i = first, j = *nseeds - 1; i < j; i++, j--) {
+		fminterval t = fmseedbuf[i];
+		fmseedbuf[i] = fmseedbuf[j];
+		fmseedbuf[j] = t;
+	}
+	return end;
+}
+
+/*
+ * Find the seeds of query: SMEMs of at least minlen nucleotides, and for long SMEMs with few
+ * occurrences the more frequent matches that contain their middle (so that repeats of query
+ * region are not hidden by a single longer match)
+ *
+ * returns    - the number of seeds, seeds points to thread local buffer
+ */
+unsigned fmseeds(const fmindex *fm, const char *query, unsigned qlen, unsigned minlen, fminterval **seeds)
+{
+	unsigned x, i, n = 0, nsmems;
+
+	if (nfmquery_slots < qlen) {
+		nfmquery_slots = qlen;
+		fmquery = (unsigned char *) realloc (fmquery, nfmquery_slots);
+	}
+	for (i = 0; i < qlen; i++) {
+		fmquery[i] = (strchr(alphabet, query[i]) != NULL) ? getnuclvalue(query[i]) : 4;
+	}
+	x = 0;
+	while (x < qlen) x = smem1(fm, fmquery, qlen, x, 1, &n);
+	nsmems = n;
+	for (i = 0; i < nsmems; i++) {
+		unsigned len = fmseedbuf[i].qend - fmseedbuf[i].qstart, s = fmseedbuf[i].s, first = n, j;
+		if ((len < FM_RESEED_LENGTH * minlen) || (s > FM_RESEED_WIDTH)) continue;
+		smem1(fm, fmquery, qlen, (fmseedbuf[i].qstart + fmseedbuf[i].qend) / 2, s + 1, &n);
+		/* Only long enough matches are kept */
+		for (j = first; j < n; j++) {
+			if (fmseedbuf[j].qend - fmseedbuf[j].qstart >= minlen) fmseedbuf[first++] = fmseedbuf[j];
+		}
+		n = first;
+	}
+	/* Short SMEMs are dropped after reseeding */
+	for (i = 0, x = 0; i < n; i++) {
+		if ((i >= nsmems) || (fmseedbuf[i].qend - fmseedbuf[i].qstart >= minlen)) fmseedbuf[x++] = fmseedbuf[i];
+	}
+	*seeds = fmseedbuf;
+	return x;
+}
+
+/*
+ * Text position of BWT row, rows are followed by LF mapping until sampled row
+ */
+unsigned fmlocate(const fmindex *fm, unsigned row)
+{
+	unsigned steps = 0;
+	while (row % fm->h->sarate) {
+		unsigned c;
+		if (row == fm->h->primary) return steps;
+		c = (fm->blocks[row >> 6].bwt[(row >> 5) & 1] >> (2 * (row & 31))) & 3;
+		row = fm->h->count[c] + fmocc(fm, c, row);
+		steps += 1;
+	}
+	return fm->samples[row / fm->h->sarate] + steps;
+}
@@ -0,0 +1,163 @@
+/*
+ * Genome Mapper
+ * (libgmapper - index handles and mapping calls of the library, see gmapper.h)
+ *
+ * Authors: Maarja Lepamets, Fanny-Dhelia Pajuste
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "utils.h"
+#include "gmapper.h"
+
+struct _gmapper_index {
+	loadedindex li;
+	mapcontext ctx;
+	Chromosome *chr;
+	unsigned nchr;
+	readcache *cache;
+	/* Every thread maps with its own worker, workers are kept until the index is closed */
+	pthread_key_t key;
+	pthread_mutex_t lock;
+	mapworker **workers;
+	unsigned nworkers;
+};
+
+void gmapper_default_options(gmapper_options *opt)
+{
+	mapoptions mo;
+	defaultmapoptions(&mo);
+	memset(opt, 0, sizeof(gmapper_options));
+	opt->step = 5;
+	opt->maxcandidates = mo.maxcandidates;
+	opt->maxerror = mo.maxerror;
+}
+
+gmapper_index *gmapper_open(const char *indexfile, const char *namesfile, const gmapper_options *opt)
+{
+	gmapper_options defaults;
+	gmapper_index *idx;
+	mapoptions mo;
+
+	if (!opt) {
+		gmapper_default_options(&defaults);
+		opt = &defaults;
+	}
+	if ((opt->mismatches < 0) || (opt->mismatches > 10) || (opt->step < 1) || (opt->step > 10) || (opt->maxerror > 100)) return NULL;
+	if (!indexfile || !namesfile || access(indexfile, R_OK) || access(namesfile, R_OK)) return NULL;
+
+	idx = (gmapper_index *) malloc (sizeof(gmapper_index));
+	memset(idx, 0, sizeof(gmapper_index));
+	defaultmapoptions(&mo);
+	mo.maxcandidates = opt->maxcandidates;
+	mo.skipoverflow = opt->skipoverflow;
+	mo.diagonal = opt->diagonal;
+	mo.noindels = opt->noindels;
+	mo.prefilter = opt->prefilter;
+	mo.longreads = opt->longreads;
+	mo.maxerror = opt->maxerror;
+	if (opt->cachesize > 0) idx->cache = newreadcache((unsigned long long) opt->cachesize << 20);
+	idx->chr = (Chromosome *) malloc (MAX_CHROMOSOMES * sizeof(Chromosome));
+	idx->nchr = readchromosomes(namesfile, idx->chr, MAX_CHROMOSOMES);
+	loadindex(indexfile, LOAD_LAZY, &idx->li, 0);
+	initmapcontext(&idx->ctx, idx->li.data, opt->mismatches, opt->step, &mo, idx->chr, idx->nchr, idx->cache);
+	pthread_key_create(&idx->key, NULL);
+	pthread_mutex_init(&idx->lock, NULL);
+	/* Chaining of long queries needs k-mer index */
+	if (idx->ctx.fm.h && opt->longreads) {
+		gmapper_close(idx);
+		return NULL;
+	}
+	return idx;
+}
+
+void gmapper_close(gmapper_index *idx)
+{
+	unsigned i;
+	if (!idx) return;
+	for (i = 0; i < idx->nworkers; i++) {
+		freemapworker(idx->workers[i]);
+		free(idx->workers[i]);
+	}
+	free(idx->workers);
+	pthread_key_delete(idx->key);
+	pthread_mutex_destroy(&idx->lock);
+	for (i = 0; i < idx->nchr; i++) {
+		free(idx->chr[i].name);
+		free(idx->chr[i].filename);
+		free(idx->chr[i].sequence);
+		free(idx->chr[i].packed);
+		free(idx->chr[i].nmask);
+	}
+	free(idx->chr);
+	freemapcontext(&idx->ctx);
+	if (idx->cache) freereadcache(idx->cache);
+	unloadindex(&idx->li);
+	free(idx);
+}
+
+/* Worker of calling thread, made on the first call of thread */
+static mapworker *threadworker(gmapper_index *idx)
+{
+	mapworker *w = (mapworker *) pthread_getspecific(idx->key);
+	if (w) return w;
+	w = (mapworker *) malloc (sizeof(mapworker));
+	initmapworker(w, &idx->ctx);
+	pthread_mutex_lock(&idx->lock);
+	idx->workers = (mapworker **) realloc (idx->workers, (idx->nworkers + 1) * sizeof(mapworker *));
+	idx->workers[idx->nworkers] = w;
+	idx->nworkers += 1;
+	pthread_mutex_unlock(&idx->lock);
+	pthread_setspecific(idx->key, w);
+	return w;
+}
+
+/* Copy hits of the last query of worker, returns the number of hits */
+static unsigned copyhits(gmapper_index *idx, mapworker *w, unsigned query, gmapper_hit *hits, unsigned maxhits)
+{
+	unsigned i;
+	for (i = 0; (i < w->nhits) && (i < maxhits); i++) {
+		hits[i].query = query;
+		hits[i].chromosome = idx->chr[w->hits[i].chr].name;
+		hits[i].chrom = w->hits[i].chr;
+		hits[i].pos = idx->chr[w->hits[i].chr].offset + w->hits[i].pos;
+		hits[i].dist = w->hits[i].dist;
+		hits[i].reverse = w->hits[i].strand;
+	}
+	return w->nhits;
+}
+
+unsigned gmapper_map_read(gmapper_index *idx, const char *query, gmapper_hit *hits, unsigned maxhits)
+{
+	mapworker *w = threadworker(idx);
+	mapquery(w, 0, query);
+	return copyhits(idx, w, 0, hits, maxhits);
+}
+
+unsigned gmapper_map_batch(gmapper_index *idx, const char *queries[], unsigned n, gmapper_hit *hits, unsigned maxhits)
+{
+	mapworker *w = threadworker(idx);
+	unsigned i, nhits = 0;
+	for (i = 0; i < n; i++) {
+		mapquery(w, i, queries[i]);
+		if (nhits < maxhits) {
+			nhits += copyhits(idx, w, i, hits + nhits, maxhits - nhits);
+		} else {
+			nhits += w->nhits;
+		}
+	}
+	return nhits;
+}
+
+int gmapper_build_index(const char *files[], int nfiles, int wordlength, int canonical, const char *outputname)
+{
+	if ((nfiles < 1) || (wordlength < 1) || (wordlength > 16) || !outputname) return -1;
+	/* Standard output belongs to the program */
+	quiet = 1;
+	buildindex(files, nfiles, wordlength, (canonical) ? INDEX_CANONICAL : 0, BUILD_AUTO, 1, outputname);
+	return 0;
+}
@@ -0,0 +1,98 @@
+/*
+ * Genome Mapper
+ * (libgmapper - mapping library for embedding the mapper into other programs)
+ *
+ * Index is opened once and the handle is used for any number of mapping calls,
+ * handle can be used by several threads at the same time
+ * Fatal errors (unreadable index or sequence files, out of memory) end the program
+ * the same way as in the command line tools
+ *
+ * Authors: Maarja Lepamets, Fanny-Dhelia Pajuste
+ */
+
+#ifndef GMAPPER_H_
+#define GMAPPER_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct _gmapper_index gmapper_index;
+
+typedef struct _gmapper_options {
+	/* Number of mismatches allowed (0 - 10) */
+	int mismatches;
+	/* Step of seeds taken from query (1 - 10) */
+	int step;
+	/* Maximum number of candidates per query and strand (0 - no limit) */
+	unsigned maxcandidates;
+	/* Query strands with more candidates are left unverified instead of verifying the first maxcandidates */
+	int skipoverflow;
+	/* Find candidates by diagonal binning of seed hits instead of merging location lists */
+	int diagonal;
+	/* Only substitutions are allowed (no insertions or deletions) */
+	int noindels;
+	/* Reject candidates by q-gram count before alignment */
+	int prefilter;
+	/* Map long queries by chaining seed anchors, hits can have up to maxerror percent of errors */
+	int longreads;
+	unsigned maxerror;
+	/* Memory in megabytes for the cache of repeated queries (0 - no cache) */
+	unsigned cachesize;
+} gmapper_options;
+
+/* Hit of query, positions are 0-based positions in chromosome */
+typedef struct _gmapper_hit {
+	/* Index of query in batch (always 0 for single query) */
+	unsigned query;
+	/* Chromosome name (owned by index handle) and its number in names file */
+	const char *chromosome;
+	unsigned chrom;
+	unsigned pos;
+	unsigned dist;
+	/* Whether query maps to reverse strand */
+	int reverse;
+} gmapper_hit;
+
+/* Fill options with the defaults of mapper */
+void gmapper_default_options(gmapper_options *opt);
+
+/*
+ * Open index made by indexer (<name>_<wordlength>.index or <name>.fm and <name>.names)
+ * opt can be NULL for default options
+ *
+ * returns    - index handle or NULL if files cannot be read or options are invalid
+ *              (long queries cannot be mapped with FM index)
+ */
+gmapper_index *gmapper_open(const char *indexfile, const char *namesfile, const gmapper_options *opt);
+
+/* Close index, it must not be in use by any thread */
+void gmapper_close(gmapper_index *idx);
+
+/*
+ * Map single query, at most maxhits hits are stored to hits
+ *
+ * returns    - the number of hits found (can be more than maxhits)
+ */
+unsigned gmapper_map_read(gmapper_index *idx, const char *query, gmapper_hit *hits, unsigned maxhits);
+
+/*
+ * Map n queries, hits are stored in the order of queries, at most maxhits in total
+ *
+ * returns    - the number of hits found (can be more than maxhits)
+ */
+unsigned gmapper_map_batch(gmapper_index *idx, const char *queries[], unsigned n, gmapper_hit *hits, unsigned maxhits);
+
+/*
+ * Build index <outputname>_<wordlength>.index and names file <outputname>.names
+ * from FastA files, canonical index stores every word in one orientation only
+ *
+ * returns    - 0 if index was built, -1 if arguments are invalid
+ */
+int gmapper_build_index(const char *files[], int nfiles, int wordlength, int canonical, const char *outputname);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* GMAPPER_H_ */
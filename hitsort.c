@@ -0,0 +1,402 @@
+/*
+ * Genome Mapper
+ * (coordinate-sorted output)
+ *
+ * Result lines written to the input of sorter are parsed by sorter thread while mapping goes on.
+ * Hits are collected into runs of limited size, full run is sorted by (chromosome, position) and
+ * written to temporary file by spill thread while the next run is filled. At the end the runs are
+ * merged and written out. Hits of the same position keep the order in which they were written.
+ *
+ * Authors: Maarja Lepamets, Fanny-Dhelia Pajuste
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "utils.h"
+
+/* Key of hit is chromosome (8 bits), position (32 bits) and number of hit in run (24 bits) */
+#define SORT_RUN_BITS 24
+#define SORT_MAX_RUN (1U << SORT_RUN_BITS)
+/* Memory of one hit in run: hit, its key and radix sort buffer */
+#define SORT_HIT_MEMORY (sizeof(sortedhit) + 2 * sizeof(unsigned long long))
+#define SORT_FILE_BUFFER (1 << 18)
+#define SORT_READ_BUFFER (1 << 20)
+
+typedef struct _sortedhit {
+	unsigned query;
+	unsigned pos;
+	int dist;
+	unsigned short chr;
+	unsigned short strand;
+} sortedhit;
+
+/* Hits being collected or spilled */
+typedef struct _sortrun {
+	sortedhit *hits;
+	unsigned long long *keys;
+	unsigned long long *buffer;
+	unsigned n;
+	/* Temporary file the run is spilled to */
+	FILE *f;
+} sortrun;
+
+struct _hitsorter {
+	/* Read end of the pipe (not stdio stream, fflush(NULL) before fork would wait for its lock), mapper writes to the other end */
+	int in;
+	FILE *out;
+	const Chromosome *chr;
+	unsigned nchr;
+	/* Distinct chromosome names (regions of region index share name) as the numbers of their first chromosome */
+	unsigned *distinct;
+	unsigned ndistinct;
+	/* Numbers of distinct names by the hash of name */
+	int *names;
+	unsigned namemask;
+	/* Two runs: one is filled by sorter thread while the other is spilled */
+	sortrun runs[2];
+	unsigned runsize;
+	unsigned current;
+	pthread_t sorter;
+	pthread_t spiller;
+	int spilling;
+	/* Spilled runs in the order of input */
+	FILE **files;
+	unsigned nfiles;
+	/* Statistics */
+	unsigned long long nhits;
+};
+
+static unsigned namehash(const char *name, unsigned len)
+{
+	unsigned h = 2166136261U, i;
+	for (i = 0; i < len; i++) h = (h ^ (unsigned char) name[i]) * 16777619U;
+	return h;
+}
+
+/* Number of distinct chromosome name, ~0U if the name is unknown */
+static unsigned findchromosome(const hitsorter *s, const char *name, unsigned len)
+{
+	unsigned i = namehash(name, len) & s->namemask;
+	while (s->names[i] >= 0) {
+		const char *c = s->chr[s->distinct[s->names[i]]].name;
+		if (!strncmp(c, name, len) && !c[len]) return s->names[i];
+		i = (i + 1) & s->namemask;
+	}
+	return ~0U;
+}
+
+/* Parse result line (query, chromosome, position, distance, strand), returns 0 if line is empty */
+static int parsehit(const hitsorter *s, char *line, sortedhit *h)
+{
+	char *p = line, *name;
+	unsigned c;
+	h->query = strtoul(p, &p, 10);
+	if (*p != '\t') return 0;
+	name = ++p;
+	while (*p && (*p != '\t')) p++;
+	if (!*p) return 0;
+	c = findchromosome(s, name, p - name);
+	if (c == ~0U) {
+		fprintf(stderr, "sort: Unknown chromosome %.*s in results.\n", (int) (p - name), name);
+		exit (1);
+	}
+	h->chr = c;
+	h->pos = strtoul(p + 1, &p, 10);
+	h->dist = strtol(p + 1, &p, 10);
+	h->strand = (p[1] == 'R');
+	return 1;
+}
+
+static FILE *newrunfile(void)
+{
+	char name[1024];
+	int fd;
+	FILE *f;
+	snprintf(name, sizeof(name), "%s/gmapper-sort.XXXXXX", (getenv("TMPDIR")) ? getenv("TMPDIR") : "/tmp");
+	fd = mkstemp(name);
+	if (fd < 0) {
+		fprintf(stderr, "sort: Cannot create temporary file %s.\n", name);
+		exit (1);
+	}
+	/* File is removed when it is closed */
+	unlink(name);
+	f = fdopen(fd, "w+");
+	setvbuf(f, NULL, _IOFBF, SORT_FILE_BUFFER);
+	return f;
+}
+
+/* Sort hits of run by key, returns the sorted keys (low bits are the numbers of hits) */
+static unsigned long long *sortrunkeys(sortrun *r)
+{
+	unsigned i;
+	if (r->n == 0) return r->keys;
+	for (i = 0; i < r->n; i++) {
+		r->keys[i] = ((((unsigned long long) r->hits[i].chr << 32) | r->hits[i].pos) << SORT_RUN_BITS) | i;
+	}
+	return radixsortpacked(r->keys, r->buffer, r->n, 64);
+}
+
+static void *spillthread(void *arg)
+{
+	sortrun *r = (sortrun *) arg;
+	unsigned long long *keys = sortrunkeys(r);
+	unsigned i;
+	for (i = 0; i < r->n; i++) {
+		if (fwrite(&r->hits[keys[i] & (SORT_MAX_RUN - 1)], sizeof(sortedhit), 1, r->f) != 1) {
+			fprintf(stderr, "sort: Cannot write temporary file.\n");
+			exit (1);
+		}
+	}
+	fflush(r->f);
+	rewind(r->f);
+	r->n = 0;
+	return NULL;
+}
+
+/* Spill full current run in background and continue with the other one */
+static void spillrun(hitsorter *s)
+{
+	sortrun *r = &s->runs[s->current];
+	if (s->spilling) pthread_join(s->spiller, NULL);
+	r->f = newrunfile();
+	s->files = (FILE **) realloc (s->files, (s->nfiles + 1) * sizeof(FILE *));
+	s->files[s->nfiles++] = r->f;
+	if (pthread_create(&s->spiller, NULL, spillthread, r)) {
+		fprintf (stderr, "Cannot create thread!\n");
+		exit (1);
+	}
+	s->spilling = 1;
+	s->current ^= 1;
+	if (!s->runs[s->current].hits) {
+		sortrun *o = &s->runs[s->current];
+		o->hits = (sortedhit *) malloc (s->runsize * sizeof(sortedhit));
+		o->keys = (unsigned long long *) malloc (s->runsize * sizeof(unsigned long long));
+		o->buffer = (unsigned long long *) malloc (s->runsize * sizeof(unsigned long long));
+		if (!o->hits || !o->keys || !o->buffer) {
+			fprintf(stderr, "sort: Not enough memory for sorting!\n");
+			exit (1);
+		}
+	}
+}
+
+static void writehit(hitsorter *s, const sortedhit *h)
+{
+	fprintf (s->out, "%u\t%s\t%u\t%d\t%s\n", h->query, s->chr[s->distinct[h->chr]].name, h->pos, h->dist, (h->strand) ? "R" : "F");
+}
+
+static int readhit(FILE *f, sortedhit *h)
+{
+	return fread(h, sizeof(sortedhit), 1, f) == 1;
+}
+
+/* Whether hit of source a goes before hit of source b, sources are in the order of input */
+static int hitbefore(const sortedhit *heads, unsigned a, unsigned b)
+{
+	if (heads[a].chr != heads[b].chr) return heads[a].chr < heads[b].chr;
+	if (heads[a].pos != heads[b].pos) return heads[a].pos < heads[b].pos;
+	return a < b;
+}
+
+/* Merge spilled runs and the last run (sorted keys in memory) with binary heap of sources */
+static void mergeruns(hitsorter *s, sortrun *last, unsigned long long *keys)
+{
+	unsigned nsources = s->nfiles + 1, nheap = 0, i, k, lastpos = 0;
+	sortedhit *heads = (sortedhit *) malloc (nsources * sizeof(sortedhit));
+	unsigned *heap = (unsigned *) malloc (nsources * sizeof(unsigned));
+
+	for (k = 0; k < nsources; k++) {
+		int has;
+		if (k < s->nfiles) {
+			has = readhit(s->files[k], &heads[k]);
+		} else {
+			has = (lastpos < last->n);
+			if (has) heads[k] = last->hits[keys[lastpos++] & (SORT_MAX_RUN - 1)];
+		}
+		if (!has) continue;
+		/* Sift up */
+		i = nheap++;
+		while ((i > 0) && hitbefore(heads, k, heap[(i - 1) / 2])) {
+			heap[i] = heap[(i - 1) / 2];
+			i = (i - 1) / 2;
+		}
+		heap[i] = k;
+	}
+	while (nheap > 0) {
+		unsigned child;
+		int has;
+		k = heap[0];
+		writehit(s, &heads[k]);
+		if (k < s->nfiles) {
+			has = readhit(s->files[k], &heads[k]);
+		} else {
+			has = (lastpos < last->n);
+			if (has) heads[k] = last->hits[keys[lastpos++] & (SORT_MAX_RUN - 1)];
+		}
+		if (!has) k = heap[--nheap];
+		/* Sift down */
+		i = 0;
+		while ((child = 2 * i + 1) < nheap) {
+			if ((child + 1 < nheap) && hitbefore(heads, heap[child + 1], heap[child])) child += 1;
+			if (!hitbefore(heads, heap[child], k)) break;
+			heap[i] = heap[child];
+			i = child;
+		}
+		if (nheap > 0) heap[i] = k;
+	}
+	free(heads);
+	free(heap);
+}
+
+/* Collect hits until the end of input, then write them sorted */
+static void *sorterthread(void *arg)
+{
+	hitsorter *s = (hitsorter *) arg;
+	char *data = (char *) malloc (SORT_READ_BUFFER + 1);
+	unsigned long long *keys;
+	sortrun *r;
+	size_t len = 0;
+	ssize_t n;
+	unsigned k;
+
+	while ((n = read(s->in, data + len, SORT_READ_BUFFER - len)) > 0) {
+		char *line = data, *end;
+		len += n;
+		/* Parse complete lines, keep the rest for the next read */
+		while ((end = (char *) memchr(line, '\n', data + len - line)) != NULL) {
+			*end = 0;
+			r = &s->runs[s->current];
+			if (parsehit(s, line, &r->hits[r->n])) {
+				r->n += 1;
+				s->nhits += 1;
+				if (r->n == s->runsize) spillrun(s);
+			}
+			line = end + 1;
+		}
+		len = data + len - line;
+		if (len == SORT_READ_BUFFER) {
+			fprintf(stderr, "sort: Too long result line.\n");
+			exit (1);
+		}
+		memmove(data, line, len);
+	}
+	free(data);
+	if (s->spilling) pthread_join(s->spiller, NULL);
+	s->spilling = 0;
+
+	r = &s->runs[s->current];
+	keys = sortrunkeys(r);
+	if (s->nfiles == 0) {
+		for (k = 0; k < r->n; k++) writehit(s, &r->hits[keys[k] & (SORT_MAX_RUN - 1)]);
+	} else {
+		/* Memory of the other run is not needed for merging */
+		sortrun *o = &s->runs[s->current ^ 1];
+		free(o->hits);
+		free(o->keys);
+		free(o->buffer);
+		o->hits = NULL;
+		o->keys = o->buffer = NULL;
+		mergeruns(s, r, keys);
+	}
+	fflush(s->out);
+	return NULL;
+}
+
+/*
+ * Start sorter thread that writes hits to out sorted by chromosome (in the order of the first appearance in chr) and position
+ * Memory (in bytes) limits the size of runs kept in memory, larger outputs are spilled to temporary files
+ * in TMPDIR (default /tmp)
+ *
+ * input      - the stream results have to be written to (in the format of mapper output)
+ * returns    - sorter that has to be finished with finishhitsorter
+ */
+hitsorter *newhitsorter(FILE *out, const Chromosome *chr, unsigned nchr, unsigned long long memory, FILE **input)
+{
+	hitsorter *s;
+	unsigned i;
+	int fd[2];
+
+	s = (hitsorter *) malloc (sizeof(hitsorter));
+	memset(s, 0, sizeof(hitsorter));
+	s->out = out;
+	s->chr = chr;
+	s->nchr = nchr;
+	s->namemask = 1;
+	while (s->namemask < 2 * nchr) s->namemask *= 2;
+	s->names = (int *) malloc (s->namemask * sizeof(int));
+	for (i = 0; i < s->namemask; i++) s->names[i] = -1;
+	s->namemask -= 1;
+	s->distinct = (unsigned *) malloc (nchr * sizeof(unsigned));
+	for (i = 0; i < nchr; i++) {
+		unsigned len = strlen(chr[i].name), h;
+		if (findchromosome(s, chr[i].name, len) != ~0U) continue;
+		if (s->ndistinct >= 256) {
+			fprintf(stderr, "sort: Too many chromosomes for sorting (at most 256).\n");
+			exit (1);
+		}
+		h = namehash(chr[i].name, len) & s->namemask;
+		while (s->names[h] >= 0) h = (h + 1) & s->namemask;
+		s->names[h] = s->ndistinct;
+		s->distinct[s->ndistinct++] = i;
+	}
+
+	/* Memory is shared by the run being filled and the run being spilled */
+	memory /= 2 * SORT_HIT_MEMORY;
+	s->runsize = (memory < 1024) ? 1024 : (memory > SORT_MAX_RUN) ? SORT_MAX_RUN : (unsigned) memory;
+	s->runs[0].hits = (sortedhit *) malloc (s->runsize * sizeof(sortedhit));
+	s->runs[0].keys = (unsigned long long *) malloc (s->runsize * sizeof(unsigned long long));
+	s->runs[0].buffer = (unsigned long long *) malloc (s->runsize * sizeof(unsigned long long));
+	if (!s->runs[0].hits || !s->runs[0].keys || !s->runs[0].buffer) {
+		fprintf(stderr, "sort: Not enough memory for sorting!\n");
+		exit (1);
+	}
+
+	if (pipe(fd)) {
+		fprintf(stderr, "sort: Cannot create pipe.\n");
+		exit (1);
+	}
+	/* Larger pipe lets mapping run ahead while sorter thread is busy (may fail, then default is used) */
+	fcntl(fd[1], F_SETPIPE_SZ, 1 << 20);
+	s->in = fd[0];
+	*input = fdopen(fd[1], "w");
+	if (!*input) {
+		fprintf(stderr, "sort: Cannot open pipe.\n");
+		exit (1);
+	}
+	if (pthread_create(&s->sorter, NULL, sorterthread, s)) {
+		fprintf (stderr, "Cannot create thread!\n");
+		exit (1);
+	}
+	return s;
+}
+
+/*
+ * Close input of sorter, wait until all hits are written to output and free sorter
+ * Processes forked after newhitsorter must have exited before (they hold the pipe open)
+ */
+void finishhitsorter(hitsorter *s, FILE *input)
+{
+	unsigned k;
+	fclose(input);
+	pthread_join(s->sorter, NULL);
+	if (debug > 0) fprintf(stderr, "Sorted %llu hits in %u spilled runs\n", s->nhits, s->nfiles);
+	close(s->in);
+	for (k = 0; k < s->nfiles; k++) fclose(s->files[k]);
+	for (k = 0; k < 2; k++) {
+		free(s->runs[k].hits);
+		free(s->runs[k].keys);
+		free(s->runs[k].buffer);
+	}
+	free(s->files);
+	free(s->names);
+	free(s->distinct);
+	free(s);
+}
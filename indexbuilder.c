@@ -0,0 +1,1188 @@
+/*
+ * Genome Indexer
+ * (building and updating of index files, used by the indexer and libgmapper)
+ *
+ * Authors: Maarja Lepamets, Fanny-Dhelia Pajuste
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "utils.h"
+
+/* Region of BED file (0-based, end not included) */
+typedef struct _bedregion {
+	char *chrom;
+	unsigned start;
+	unsigned end;
+	int used;
+} bedregion;
+
+/*
+ * reading in the genome in FastA format
+ * if name is not NULL it will be assigned a copy of sequence name
+ */
+unsigned readfastafile(const char *filename, wordtable *table, unsigned loc, char **name);
+
+/*
+ * fills the table with words and their locations
+ * if name is not NULL it will be assigned a copy of sequence name
+ */
+unsigned fillwordtable(const char *data, wordtable *table, struct stat st, unsigned loc, char **name);
+
+/*
+ * mask has as many 1's as the wordlength is
+ */
+unsigned createmask(int wordlength);
+
+/* wrapper for in-place radix sort */
+void sortwords(wordtable *table);
+
+/*
+ * find the number of unique words
+ */
+unsigned countunique(wordtable *table);
+
+/*
+ * find the starting position for the locations of all the words
+ * from the array of all locations
+ */
+void findstartpositions(wordtable *table);
+
+void sortlocations(wordtable *table);
+
+/*
+ * out-of-place radix sort of packed (word, location) records: words and the locations
+ * of every word are sorted at once, replaces sortwords and sortlocations
+ * (takes twice the memory of in-place sort)
+ */
+void packedsortwords(wordtable *table);
+
+/*
+ * counting sort build: histogram of all words, prefix sums give starts and
+ * locations are scattered into place (already sorted because they are read in order)
+ * replaces sortwords, findstartpositions and sortlocations
+ */
+void countingsortwords(wordtable *table);
+
+/*
+ * whether counting sort is used for the table
+ * (4^wordlength counters must not take more memory than the words themselves)
+ */
+int usecountingsort(wordtable *table, int engine);
+
+/*
+ * for combining two sorted lists of words (with locations)
+ */
+void combineindices(wordtable *table, wordtable *other);
+
+/*
+ * sorts the words of temptable (with the given engine) and merges them into table
+ * temptable is left empty
+ */
+void addtotable(wordtable *table, wordtable *temptable, int engine);
+/*
+ * builds the table of words from the given FastA files, the first sequence starts from location
+ * sequence names are written to ofs (if not NULL)
+ * returns the location after the last sequence
+ */
+unsigned buildtable(wordtable *table, const char *files[], int nfiles, int wordlen, unsigned flags, int engine, unsigned location, FILE *ofs, sequences *seqinfo);
+
+/*
+ * builds nshards indices over consecutive groups of FastA files (genome ranges of similar size)
+ * locations are the same as in single index, so all shards share one names file
+ * shard set file <outputname>_<n>.shards lists the shard indices <outputname>.<k>_<n>.index
+ */
+void buildshards(const char *files[], int nfiles, int nshards, int wordlen, unsigned flags, int engine, const char *outputname, FILE *ofs);
+
+/*
+ * reads regions (chromosome, 0-based start, end) of BED file, returns the number of regions
+ */
+unsigned readregions(const char *bedfile, bedregion **regions);
+/*
+ * writing binary .index file
+ */
+void writetoindex(wordtable *table, const char *outputname, sequences seqinfo);
+
+/*
+ * writes header, words, starts and locations of table to f
+ * more is INDEX_MORE_TABLES if another table is written after it
+ */
+void writetable(FILE *f, wordtable *table, sequences seqinfo, unsigned more);
+
+/*
+ * streaming merge of existing index data and the table of new words into file fname
+ * locations within [rmstart[k], rmend[k]) are left out
+ */
+void appendindex(const char *data, wordtable *table, const char *fname, unsigned *rmstart, unsigned *rmend, int nremoved);
+
+/*
+ * Build index <outputname>_<wordlen>.index (or nshards shards of it) and names file <outputname>.names
+ * from the given FastA files
+ */
+void buildindex(const char *files[], int nfiles, int wordlen, unsigned flags, int engine, int nshards, const char *outputname)
+{
+	sequences seqinfo;
+	wordtable tables[1];
+	wordtable *table = &tables[0];
+	char ofsname[256];
+	FILE *ofs;
+
+	memset(table, 0, sizeof(wordtable));
+	seqinfo.seq_name = (char **) malloc(nfiles * sizeof(const char *));
+	seqinfo.start_pos = (unsigned *) malloc(nfiles * sizeof(unsigned));
+	seqinfo.n = nfiles;
+
+	/* work-flow */
+	sprintf(ofsname, "%s.names", outputname);
+	ofs = fopen (ofsname, "w");
+	if (nshards > 1) {
+		buildshards(files, nfiles, nshards, wordlen, flags, engine, outputname, ofs);
+		fclose (ofs);
+		return;
+	}
+	buildtable(table, files, nfiles, wordlen, flags, engine, 0, ofs, &seqinfo);
+	fclose (ofs);
+
+	if (debug > 1) {
+		unsigned int i, j;
+		for (i = 0; i < table->nwords - 1; ++i) {
+			printf("järjestus %s, start %u\n", word2string(table->words[i], table->wordlength), table->starts[i]);
+			for (j = table->starts[i]; j < table->starts[i + 1]; ++j) {
+				printf("asukohad: %u ", table->locations[j]);
+			}
+			printf("\n");
+		}
+		printf("järjestus %s, start %u\n", word2string(table->words[i], table->wordlength), table->starts[i]);
+		for (j = table->starts[i]; j < table->nloc; ++j) {
+			printf("asukohad: %u ", table->locations[j]);
+		}
+		printf("\n");
+	}
+
+	writetoindex(table, outputname, seqinfo);
+}
+
+/*
+ * Build multi-k index <outputname>_<k1>-<k2>...index and names file <outputname>.names from the given FastA files
+ * Word lengths are in decreasing order, tables are written one after another in the same order
+ */
+void buildmultiindex(const char *files[], int nfiles, const int *wordlens, int nwordlens, unsigned flags, int engine, const char *outputname)
+{
+	sequences seqinfo;
+	char ofsname[256], fname[256];
+	FILE *ofs, *f;
+	int i, len;
+
+	seqinfo.seq_name = (char **) malloc(nfiles * sizeof(const char *));
+	seqinfo.start_pos = (unsigned *) malloc(nfiles * sizeof(unsigned));
+	seqinfo.n = nfiles;
+
+	sprintf(ofsname, "%s.names", outputname);
+	ofs = fopen (ofsname, "w");
+	len = sprintf(fname, "%s", outputname);
+	for (i = 0; i < nwordlens; ++i) {
+		len += sprintf(fname + len, "%c%d", (i > 0) ? '-' : '_', wordlens[i]);
+	}
+	sprintf(fname + len, ".index");
+	f = fopen(fname, "w");
+	if ((ofs == NULL) || (f == NULL)) {
+		fprintf(stderr, "Cannot open file %s!\n", (ofs == NULL) ? ofsname : fname);
+		exit(1);
+	}
+	/*
+	 * only one table is in memory at a time, all tables have the same locations so names are written once
+	 * by the shortest words (the last table): files too short for longer words still have words there
+	 */
+	for (i = 0; i < nwordlens; ++i) {
+		wordtable table;
+		memset(&table, 0, sizeof(wordtable));
+		if (debug > 0) fprintf (stderr, "Building table of word length %d\n", wordlens[i]);
+		buildtable(&table, files, nfiles, wordlens[i], flags, engine, 0, (i == nwordlens - 1) ? ofs : NULL, &seqinfo);
+		table.wordlength = wordlens[i];
+		table.flags = flags;
+		writetable(f, &table, seqinfo, (i < nwordlens - 1) ? INDEX_MORE_TABLES : 0);
+		free(table.words);
+		free(table.starts);
+		free(table.locations);
+	}
+	fclose(f);
+	fclose(ofs);
+	free(seqinfo.seq_name);
+	free(seqinfo.start_pos);
+}
+
+unsigned buildtable(wordtable *table, const char *files[], int nfiles, int wordlen, unsigned flags, int engine, unsigned location, FILE *ofs, sequences *seqinfo)
+{
+	wordtable temp;
+	wordtable *temptable = &temp;
+	int i;
+
+	memset(temptable, 0, sizeof(wordtable));
+	for (i = 0; i < nfiles; ++i) { /* iteration over the input files */
+		char *seqname;
+		unsigned currentloc;
+		char *p;
+
+		if (debug > 0) fprintf (stderr, "Reading: %s...\n", files[i]);
+
+		temptable->wordlength = wordlen;
+		temptable->flags = flags;
+		if (i > 0) {
+			location += 10000;
+		}
+		currentloc = location;
+		if (seqinfo) {
+			seqinfo->seq_name[i] = (char *) files[i];
+			seqinfo->start_pos[i] = location;
+		}
+		location = readfastafile(files[i], temptable, location, &seqname);
+		if (temptable->nwords == 0) continue;
+		addtotable(table, temptable, engine);
+		for (p = seqname; *p; ++p) {
+			if (*p <= ' ') {
+				*p = 0;
+				break;
+			}
+		}
+		if (ofs) fprintf (ofs, "%s %s %u\n", seqname, files[i], currentloc);
+	}
+	return location;
+}
+
+void addtotable(wordtable *table, wordtable *temptable, int engine)
+{
+	if (usecountingsort(temptable, engine)) {
+		if (debug > 0) fprintf (stderr, "Counting sort of %u words\n", temptable->nwords);
+		countingsortwords(temptable);
+	} else if (engine == BUILD_RADIX) {
+		sortwords(temptable);
+		findstartpositions(temptable);
+		sortlocations(temptable);
+	} else {
+		if (debug > 0) fprintf (stderr, "Packed radix sort of %u words\n", temptable->nwords);
+		packedsortwords(temptable);
+		findstartpositions(temptable);
+	}
+	if (table->nwords > 0) {
+		combineindices(table, temptable);
+		free(temptable->words);
+		free(temptable->starts);
+		free(temptable->locations);
+	} else {
+		*table = *temptable;
+	}
+	memset(temptable, 0, sizeof(wordtable));
+}
+
+void buildshards(const char *files[], int nfiles, int nshards, int wordlen, unsigned flags, int engine, const char *outputname, FILE *ofs)
+{
+	unsigned long long total, sum, *sizes;
+	unsigned location;
+	int i, k, first;
+	char fname[256], shardname[256];
+	const char *base;
+	FILE *f;
+
+	if (nshards > nfiles) {
+		fprintf(stderr, "Warning: Only %d FastA files given, using %d shards!\n", nfiles, nfiles);
+		nshards = nfiles;
+	}
+	sizes = (unsigned long long *) malloc(nfiles * sizeof(unsigned long long));
+	total = 0;
+	for (i = 0; i < nfiles; ++i) {
+		struct stat st;
+		if (stat(files[i], &st) < 0) {
+			fprintf (stderr, "Cannot get the statistics of file %s!\n", files[i]);
+			exit (1);
+		}
+		sizes[i] = st.st_size;
+		total += st.st_size;
+	}
+
+	sprintf(fname, "%s_%d.shards", outputname, wordlen);
+	f = fopen(fname, "w");
+	if (f == NULL) {
+		fprintf(stderr, "Cannot open file %s!\n", fname);
+		exit(1);
+	}
+	/* shard files are listed relative to the shard set file */
+	base = strrchr(outputname, '/');
+	base = (base) ? base + 1 : outputname;
+
+	location = 0;
+	sum = 0;
+	first = 0;
+	for (k = 0; k < nshards; ++k) {
+		wordtable table;
+		sequences seqinfo;
+		int last = first;
+		/* take files until the shard has its share of genome, leaving at least one file for every remaining shard */
+		while (last < nfiles - (nshards - k - 1)) {
+			if ((last > first) && (sum + sizes[last]) * nshards > total * (k + 1)) break;
+			sum += sizes[last];
+			++last;
+		}
+
+		memset(&table, 0, sizeof(wordtable));
+		seqinfo.n = last - first;
+		seqinfo.seq_name = (char **) malloc(seqinfo.n * sizeof(char *));
+		seqinfo.start_pos = (unsigned *) malloc(seqinfo.n * sizeof(unsigned));
+		if (debug > 0) fprintf(stderr, "Shard %d: files %d - %d from location %u\n", k, first, last - 1, location);
+		location = buildtable(&table, files + first, last - first, wordlen, flags, engine, location, ofs, &seqinfo);
+		location += 10000;
+
+		sprintf(shardname, "%s.%d", outputname, k);
+		writetoindex(&table, shardname, seqinfo);
+		fprintf(f, "%s.%d_%d.index\n", base, k, wordlen);
+
+		free(table.words);
+		free(table.starts);
+		free(table.locations);
+		free(seqinfo.seq_name);
+		free(seqinfo.start_pos);
+		first = last;
+	}
+	fclose(f);
+	free(sizes);
+}
+
+static int compareregions(const void *a, const void *b)
+{
+	const bedregion *x = (const bedregion *) a, *y = (const bedregion *) b;
+	return (x->start > y->start) - (x->start < y->start);
+}
+
+unsigned readregions(const char *bedfile, bedregion **regions)
+{
+	char line[1024], chrom[256];
+	unsigned n = 0, nslots = 0, start, end;
+	FILE *f = fopen(bedfile, "r");
+	if (f == NULL) {
+		fprintf(stderr, "Cannot open file %s!\n", bedfile);
+		exit(1);
+	}
+	*regions = NULL;
+	while (fgets(line, sizeof(line), f)) {
+		if ((line[0] == '#') || !strncmp(line, "track", 5) || !strncmp(line, "browser", 7)) continue;
+		if (sscanf(line, "%255s %u %u", chrom, &start, &end) != 3) continue;
+		if (end <= start) {
+			fprintf(stderr, "Warning: Empty region %s %u %u is ignored!\n", chrom, start, end);
+			continue;
+		}
+		if (n >= nslots) {
+			nslots = (nslots) ? 2 * nslots : 1024;
+			*regions = (bedregion *) realloc(*regions, nslots * sizeof(bedregion));
+		}
+		(*regions)[n].chrom = strdup(chrom);
+		(*regions)[n].start = start;
+		(*regions)[n].end = end;
+		(*regions)[n].used = 0;
+		n += 1;
+	}
+	fclose(f);
+	return n;
+}
+
+/*
+ * Build index <outputname>_<wordlen>.index of the regions of bedfile only (panel of targets)
+ * Regions are extended by padding on both sides and overlapping ones are merged. Their sequences
+ * are written one after another to <outputname>.regions, every region is a sequence of names file
+ * with the name of its chromosome, its position in chromosome, length and offset in .regions file
+ */
+void buildregionindex(const char *files[], int nfiles, const char *bedfile, unsigned padding, int wordlen, unsigned flags, int engine, const char *outputname)
+{
+	wordtable table, temptable;
+	sequences seqinfo;
+	bedregion *regions, *chosen;
+	char ofsname[256], regionsname[256];
+	unsigned nregions, nchosen, location = 0, k, j, total = 0;
+	unsigned long long fileoffset = 0;
+	int i;
+	FILE *ofs, *rfs;
+
+	nregions = readregions(bedfile, &regions);
+	if (nregions == 0) {
+		fprintf(stderr, "No regions in %s!\n", bedfile);
+		exit(1);
+	}
+	chosen = (bedregion *) malloc(nregions * sizeof(bedregion));
+	memset(&table, 0, sizeof(wordtable));
+	memset(&temptable, 0, sizeof(wordtable));
+	seqinfo.seq_name = (char **) malloc(nregions * sizeof(char *));
+	seqinfo.start_pos = (unsigned *) malloc(nregions * sizeof(unsigned));
+	seqinfo.n = 0;
+
+	sprintf(ofsname, "%s.names", outputname);
+	sprintf(regionsname, "%s.regions", outputname);
+	ofs = fopen(ofsname, "w");
+	rfs = fopen(regionsname, "w");
+	if (!ofs || !rfs) {
+		fprintf(stderr, "Cannot open file %s or %s!\n", ofsname, regionsname);
+		exit(1);
+	}
+	for (i = 0; i < nfiles; ++i) {
+		struct stat st;
+		const char *data;
+		char *seq, *name = NULL;
+		unsigned len = 0, header = 0;
+		off_t s, namestart = 0;
+
+		if (debug > 0) fprintf (stderr, "Reading: %s...\n", files[i]);
+		data = filemmap(files[i], &st);
+		/* nucleotides are counted as in fillwordtable */
+		seq = (char *) malloc(st.st_size + 1);
+		for (s = 0; s < st.st_size; s++) {
+			if (data[s] == '>') {
+				header = 1;
+				namestart = s + 1;
+				if (s != 0) {
+					fprintf(stderr, "Only one FastA sequence per file is allowed!\n");
+					exit(1);
+				}
+			}
+			if (header) {
+				if ((data[s] <= ' ') && !name) name = strndup(data + namestart, s - namestart);
+				if (data[s] == '\n') header = 0;
+			} else if (data[s] >= 'A') {
+				seq[len++] = data[s];
+			}
+		}
+		munmap((void *) data, st.st_size);
+		if (!name) name = strdup(files[i]);
+
+		/* padded regions of this chromosome, merged where they overlap */
+		nchosen = 0;
+		for (k = 0; k < nregions; k++) {
+			if (strcmp(regions[k].chrom, name)) continue;
+			regions[k].used = 1;
+			chosen[nchosen] = regions[k];
+			chosen[nchosen].start = (regions[k].start > padding) ? regions[k].start - padding : 0;
+			chosen[nchosen].end = ((unsigned long long) regions[k].end + padding < len) ? regions[k].end + padding : len;
+			if (chosen[nchosen].start < chosen[nchosen].end) nchosen += 1;
+		}
+		qsort(chosen, nchosen, sizeof(bedregion), compareregions);
+		for (k = 0, j = 0; k < nchosen; k++) {
+			if ((j > 0) && (chosen[k].start <= chosen[j - 1].end)) {
+				if (chosen[k].end > chosen[j - 1].end) chosen[j - 1].end = chosen[k].end;
+			} else {
+				chosen[j++] = chosen[k];
+			}
+		}
+		nchosen = j;
+
+		for (k = 0; k < nchosen; k++) {
+			struct stat rst;
+			unsigned rlen = chosen[k].end - chosen[k].start;
+			if (seqinfo.n > 0) location += 10000;
+			if (fwrite(seq + chosen[k].start, 1, rlen, rfs) != rlen) {
+				fprintf(stderr, "Cannot write file %s!\n", regionsname);
+				exit(1);
+			}
+			fprintf(ofs, "%s %s %u %u %u %llu\n", name, regionsname, location, chosen[k].start, rlen, fileoffset);
+			if (debug > 0) fprintf(stderr, "Region %s:%u-%u at location %u\n", name, chosen[k].start, chosen[k].end, location);
+			seqinfo.seq_name[seqinfo.n] = (char *) files[i];
+			seqinfo.start_pos[seqinfo.n] = location;
+			seqinfo.n += 1;
+
+			temptable.wordlength = wordlen;
+			temptable.flags = flags;
+			temptable.nword_slots = temptable.nloc_slots = rlen;
+			temptable.words = (unsigned *) malloc(rlen * sizeof(unsigned));
+			temptable.locations = (unsigned *) malloc(rlen * sizeof(unsigned));
+			memset(&rst, 0, sizeof(rst));
+			rst.st_size = rlen;
+			location = fillwordtable(seq + chosen[k].start, &temptable, rst, location, NULL);
+			if (temptable.nwords > 0) {
+				addtotable(&table, &temptable, engine);
+			} else {
+				free(temptable.words);
+				free(temptable.locations);
+				memset(&temptable, 0, sizeof(wordtable));
+			}
+			fileoffset += rlen;
+			total += rlen;
+		}
+		free(seq);
+		free(name);
+	}
+	fclose(ofs);
+	fclose(rfs);
+
+	for (k = 0; k < nregions; k++) {
+		if (regions[k].used) continue;
+		/* one warning per chromosome */
+		for (j = 0; (j < k) && (regions[j].used || strcmp(regions[j].chrom, regions[k].chrom)); j++) {}
+		if (j < k) continue;
+		fprintf(stderr, "Warning: Chromosome %s of region %u - %u is not in the input files!\n", regions[k].chrom, regions[k].start, regions[k].end);
+	}
+	if (seqinfo.n == 0) {
+		fprintf(stderr, "None of the regions is in the input files!\n");
+		exit(1);
+	}
+	fprintf(stderr, "Indexed %u regions, %u nucleotides\n", seqinfo.n, total);
+	writetoindex(&table, outputname, seqinfo);
+
+	for (k = 0; k < nregions; k++) free(regions[k].chrom);
+	free(regions);
+	free(chosen);
+	free(seqinfo.seq_name);
+	free(seqinfo.start_pos);
+	free(table.words);
+	free(table.starts);
+	free(table.locations);
+}
+
+unsigned readfastafile(const char *filename, wordtable *table, unsigned locprev, char **name)
+{
+	struct stat st;				/* file statistics */
+	int status, handle;
+	const char *data;
+	unsigned loc;
+
+	/* memory-mapping a file */
+	status = stat(filename, &st);
+	if (status < 0) {
+		fprintf (stderr, "Cannot get the statistics of file %s!\n", filename);
+		exit (1);
+	}
+	handle = open(filename, O_RDONLY);
+	if (handle < 0) {
+		fprintf (stderr, "Cannot open file %s!\n", filename);
+		exit (1);
+	}
+	data = (const char *) mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, handle, 0);
+	if (data == (const char *) -1) {
+		fprintf (stderr, "Cannot memory-map file %s!\n", filename);
+		exit (1);
+	}
+	close(handle);
+
+	if (st.st_size > table->nword_slots) {
+		table->nword_slots = st.st_size;
+		table->nloc_slots = st.st_size;
+		table->words = (unsigned *) realloc(table->words, table->nword_slots * sizeof(unsigned));
+		table->locations = (unsigned *) realloc(table->locations, table->nloc_slots * sizeof(unsigned));
+	}
+	loc = fillwordtable(data, table, st, locprev, name);
+
+	munmap((void *) data, st.st_size);
+	return loc;
+}
+
+unsigned fillwordtable(const char *data, wordtable *table, struct stat st, unsigned locprev, char **name)
+{
+	unsigned word, rcword, location;
+	unsigned mask, rcshift;
+	int m, wordlength;
+	int isheader = 0;
+	off_t i;
+	/* Initiqalized to suppress warning */
+	off_t namestart = 0;
+
+	wordlength = table->wordlength;
+	mask = createmask(wordlength);
+	rcshift = 2 * (wordlength - 1);
+	word = 0;
+	rcword = 0;
+	location = locprev;
+	m = 0;
+
+	/* find the unsigned integer corresponding to a word with a given length */
+	for (i = 0; i < st.st_size; ++i) {
+		if (data[i] == '>') {
+			isheader = 1;
+			namestart = i + 1;
+			if (i != 0) {
+				fprintf(stderr, "Only one FastA sequence per file is allowed!\n");
+				exit(1);
+			}
+		}
+		if (isheader) {
+			if (data[i] == '\n') {
+				isheader = 0;
+				if (name) {
+					*name = (char *) malloc (i - namestart);
+					memcpy (*name, data + namestart, i - namestart);
+					(*name)[i - namestart] = 0;
+				}
+			}
+		} else {
+			if (data[i] < 'A') {
+				continue;
+			} else if (strchr(alphabet, data[i]) == NULL) {
+				word = 0;
+				m = 0;
+				location += 1;
+				continue;
+			}
+			word <<= 2;
+			word |= getnuclvalue(data[i]);
+			/* reverse complement is built from the other end */
+			rcword >>= 2;
+			rcword |= (unsigned) (3 - getnuclvalue(data[i])) << rcshift;
+			m += 1;
+			if (m > wordlength) {
+				word &= mask;
+				m = wordlength;
+			}
+			if (m == wordlength) {
+				if (table->flags & INDEX_CANONICAL) {
+					/* strand bit is 1 if the word in genome is the reverse complement of the canonical one */
+					if (location + 1 - table->wordlength >= (1U << 31)) {
+						fprintf(stderr, "Genome is too long for canonical index!\n");
+						exit(1);
+					}
+					if (rcword < word) {
+						table->words[table->nwords] = rcword;
+						table->locations[table->nloc] = ((location + 1 - table->wordlength) << 1) | 1;
+					} else {
+						table->words[table->nwords] = word;
+						table->locations[table->nloc] = (location + 1 - table->wordlength) << 1;
+					}
+				} else {
+					table->words[table->nwords] = word;
+					table->locations[table->nloc] = location + 1 - table->wordlength;
+				}
+				table->nwords += 1;
+				table->nloc += 1;
+				/* location += 1; */
+			}
+			location += 1;
+		}
+
+	}
+	/*printf("alguses nloc %u\n", table->nloc);*/
+	return location;
+}
+
+unsigned createmask(int wordlength)
+{
+	int i;
+	unsigned mask = 0;
+
+	for (i = 0; i < 2 * wordlength; ++i) {
+		mask = (mask << 1) | 1;
+	}
+	return mask;
+}
+
+void sortwords(wordtable *table)
+{
+	int firstshift = 0, i;
+	if (table->nwords == 0) return;
+
+	/* calculate the number of shifted positions for making radix sort faster (no need to sort digits that are all zeros)*/
+	for (i = 8; i < table->wordlength * 2; i += 8) firstshift += 8;
+
+	hybridInPlaceRadixSort256(table->words, table->words + table->nwords, table->locations, firstshift);
+
+	return;
+}
+
+unsigned countunique(wordtable *table)
+{
+	unsigned i, count;
+	count = 0;
+	for (i = 0; i < table->nwords; ++i) {
+		if (i == 0 || table->words[i] != table->words[i - 1])
+			++count;
+	}
+	return count;
+}
+
+void findstartpositions(wordtable *table)
+{
+	unsigned ri, wi, count, nunique;
+
+	if (table->nwords == 0) return;
+	nunique = countunique(table);
+
+	if (nunique > table->nstart_slots) {
+		table->nstart_slots = nunique;
+		table->starts = (unsigned *) realloc(table->starts, table->nstart_slots * sizeof(unsigned));
+	}
+
+	wi = 1;
+	count = 1;
+	table->starts[0] = 0;
+	for (ri = 1; ri < table->nwords; ++ri) {
+		if (table->words[ri] == table->words[ri - 1]) {
+			count += 1;
+		} else {
+			table->words[wi - 1] = table->words[ri - 1];
+			table->starts[wi] = count;
+			count += 1;
+			++wi;
+		}
+	}
+	table->words[wi - 1] = table->words[ri - 1];
+	table->nwords = nunique;
+	table->nstarts = nunique;
+	return;
+}
+
+void sortlocations(wordtable *table)
+{
+	unsigned i;
+	for (i = 0; i < table->nwords - 1; ++i) {
+		hybridInPlaceRadixSort256(table->locations + table->starts[i], table->locations + table->starts[i + 1], NULL, 24);
+	}
+	hybridInPlaceRadixSort256(table->locations + table->starts[i], table->locations + table->nloc, NULL, 24);
+}
+
+void packedsortwords(wordtable *table)
+{
+	unsigned long long *records, *buffer, *sorted, i, n = table->nwords;
+	unsigned maxloc = 0, locbits = 0;
+
+	if (n == 0) return;
+	for (i = 0; i < n; ++i) {
+		if (table->locations[i] > maxloc) maxloc = table->locations[i];
+	}
+	while ((locbits < 32) && (maxloc >> locbits)) locbits += 1;
+
+	records = (unsigned long long *) malloc (n * sizeof(unsigned long long));
+	if (records == NULL) {
+		fprintf(stderr, "Not enough memory for sorting %llu words (try -b radix)!\n", n);
+		exit(1);
+	}
+	for (i = 0; i < n; ++i) {
+		records[i] = ((unsigned long long) table->words[i] << locbits) | table->locations[i];
+	}
+	/* Unpacked arrays are made again after sorting, so that they never exist together with both record arrays */
+	free(table->words);
+	free(table->locations);
+	buffer = (unsigned long long *) malloc (n * sizeof(unsigned long long));
+	if (buffer == NULL) {
+		fprintf(stderr, "Not enough memory for sorting %llu words (try -b radix)!\n", n);
+		exit(1);
+	}
+	sorted = radixsortpacked(records, buffer, n, 2 * table->wordlength + locbits);
+	free((sorted == records) ? buffer : records);
+
+	table->nword_slots = table->nloc_slots = n;
+	table->words = (unsigned *) malloc (n * sizeof(unsigned));
+	table->locations = (unsigned *) malloc (n * sizeof(unsigned));
+	for (i = 0; i < n; ++i) {
+		table->words[i] = sorted[i] >> locbits;
+		table->locations[i] = sorted[i] & ((1ULL << locbits) - 1);
+	}
+	free(sorted);
+}
+
+int usecountingsort(wordtable *table, int engine)
+{
+	unsigned long long ncounters = 1ULL << (2 * table->wordlength);
+	if ((engine == BUILD_RADIX) || (engine == BUILD_PACKED)) return 0;
+	if (table->wordlength > MAX_COUNTING_WORDLENGTH) return 0;
+	if (engine == BUILD_COUNTING) return 1;
+	return (table->wordlength <= MIN_COUNTING_WORDLENGTH) || (ncounters <= table->nwords);
+}
+
+void countingsortwords(wordtable *table)
+{
+	unsigned long long ncounters, w;
+	unsigned *counts, *locations;
+	unsigned i, wi, sum, start;
+
+	if (table->nwords == 0) return;
+	ncounters = 1ULL << (2 * table->wordlength);
+	counts = (unsigned *) calloc(ncounters, sizeof(unsigned));
+	locations = (unsigned *) malloc(table->nloc * sizeof(unsigned));
+	if (!counts || !locations) {
+		fprintf(stderr, "Cannot allocate memory for counting sort!\n");
+		exit(1);
+	}
+
+	/* histogram */
+	for (i = 0; i < table->nwords; ++i) {
+		counts[table->words[i]] += 1;
+	}
+	/* prefix sums, counts[w] becomes the starting position of word w */
+	sum = 0;
+	for (w = 0; w < ncounters; ++w) {
+		unsigned c = counts[w];
+		counts[w] = sum;
+		sum += c;
+	}
+	/* scatter, locations are in increasing order so every bucket stays sorted */
+	for (i = 0; i < table->nwords; ++i) {
+		locations[counts[table->words[i]]++] = table->locations[i];
+	}
+	/* now counts[w] is the end position of word w (and the start of w + 1) */
+	if (table->nwords > table->nstart_slots) {
+		table->nstart_slots = table->nwords;
+		table->starts = (unsigned *) realloc(table->starts, table->nstart_slots * sizeof(unsigned));
+	}
+	wi = 0;
+	start = 0;
+	for (w = 0; w < ncounters; ++w) {
+		if (counts[w] > start) {
+			table->words[wi] = (unsigned) w;
+			table->starts[wi] = start;
+			++wi;
+		}
+		start = counts[w];
+	}
+
+	free(counts);
+	free(table->locations);
+	table->locations = locations;
+	table->nloc_slots = table->nloc;
+	table->nwords = wi;
+	table->nstarts = wi;
+}
+
+void combineindices(wordtable *table, wordtable *other)
+{
+	long long i, j, k, l;
+	int n1, n2;
+	unsigned count, location_pos, count1 = 0, count2 = 0;
+
+	if (table->nloc + other->nloc > table->nloc_slots) {
+		table->nloc_slots = table->nloc + other->nloc;
+		table->locations = (unsigned *) realloc(table->locations, table->nloc_slots * sizeof(unsigned));
+	}
+	location_pos = table->nloc + other->nloc - 1;
+
+	j = 0;
+	count = 0;
+	for (i = 0; i < other->nwords; ) {
+		if (j < table->nwords && table->words[j] == other->words[i]) {
+			++i;
+			++j;
+		} else if (j < table->nwords && table->words[j] < other->words[i]) {
+			++j;
+		} else {
+			++i;
+			++count;
+		}
+	}
+
+	if (table->nwords + count > table->nword_slots) {
+		table->nword_slots = table->nwords + count;
+		table->words = (unsigned *) realloc(table->words, table->nword_slots * sizeof(unsigned));
+	}
+	if (table->nstarts + count > table->nstart_slots) {
+		table->nstart_slots = table->nwords + count;
+		table->starts = (unsigned *) realloc(table->starts, table->nstart_slots * sizeof(unsigned));
+	}
+
+	i = other->nwords - 1;
+	j = table->nwords - 1;
+	n1 = table->nloc - table->starts[j];
+	n2 = other->nloc - other->starts[i];
+	for (k = table->nwords + count - 1; k >= 0; --k) {
+		if (i >= 0 && j >= 0 && table->words[j] == other->words[i]) {
+			for (l = n2 - 1; l >= 0; --l) {
+				table->locations[location_pos] = other->locations[other->starts[i] + l];
+				location_pos--;
+				count1++;
+			}
+			for (l = n1 - 1; l >= 0; --l) {
+				table->locations[location_pos] = table->locations[table->starts[j] + l];
+				location_pos--;
+				count1++;
+			}
+			n1 = (j > 0) ? table->starts[j] - table->starts[j - 1] : 0;
+			n2 = (i > 0) ? other->starts[i] - other->starts[i - 1] : 0;
+			table->words[k] = table->words[j];
+			table->starts[k] = location_pos + 1;
+			--j; --i;
+		} else if ((i < 0) || (j >= 0 && table->words[j] > other->words[i])) {
+			for (l = n1 - 1; l >= 0; --l) {
+				table->locations[location_pos] = table->locations[table->starts[j] + l];
+				location_pos--;
+				count1++;
+			}
+			n1 = (j > 0) ? table->starts[j] - table->starts[j - 1] : 0;
+			table->words[k] = table->words[j];
+			table->starts[k] = location_pos + 1;
+			--j;
+
+		} else {
+			for (l = n2 - 1; l >= 0; --l) {
+				table->locations[location_pos] = other->locations[other->starts[i] + l];
+				location_pos--;
+				count2++;
+			}
+			n2 = (i > 0) ? other->starts[i] - other->starts[i - 1] : 0;
+			table->words[k] = other->words[i];
+			table->starts[k] = location_pos + 1;
+			--i;
+		}
+	}
+	table->nwords += count;
+	table->nstarts += count;
+	table->nloc += other->nloc;
+}
+
+void writetoindex(wordtable *table, const char *outputname, sequences seqinfo)
+{
+	char fname[256];
+	FILE *f;
+	if (table->nwords == 0) return;
+
+	if (debug) {
+		long long i;
+		for (i = 0; i < seqinfo.n; ++i) {
+			printf("%s %u\n", seqinfo.seq_name[i], seqinfo.start_pos[i]);
+		}
+	}
+
+	if (!quiet) printf("%s %u\n", seqinfo.seq_name[0], seqinfo.start_pos[0]);
+
+	sprintf(fname, "%s_%d.index", outputname, table->wordlength);
+	f = fopen(fname, "w");
+	writetable(f, table, seqinfo, 0);
+	fclose(f);
+	return;
+}
+
+void writetable(FILE *f, wordtable *table, sequences seqinfo, unsigned more)
+{
+	unsigned long long i;
+	info h;
+
+	h.wordsize = table->wordlength | table->flags | more;
+	h.nwords = table->nwords;
+	h.nlocations = table->nloc;
+	h.seqs = seqinfo;
+	fwrite(&h, sizeof(info), 1, f);
+
+	for (i = 0; i < table->nwords; ++i) {
+		fwrite(&table->words[i], sizeof(table->words[i]), 1, f);
+	}
+	for (i = 0; i < table->nstarts; ++i) {
+		fwrite(&table->starts[i], sizeof(table->starts[i]), 1, f);
+	}
+	for (i = 0; i < table->nloc; ++i) {
+		fwrite(&table->locations[i], sizeof(table->locations[i]), 1, f);
+	}
+}
+
+/*
+ * Update existing index: locations in the ranges of removed sequences are dropped
+ * and new sequences are placed after the last existing one
+ */
+void updateindex(const char *indexname, const char *namesname, const char *outputname, const char *files[], int nfiles,
+		const char *removed[], int nremoved, int engine)
+{
+	struct stat st;
+	const char *data;
+	info *h;
+	wordtable table;
+	char fname[256], names[256], tmpname[512], namestmp[512], line[1024];
+	char **lname, **lfile;
+	unsigned *lstart, *rmstart, *rmend;
+	unsigned *words, *starts, *locations;
+	unsigned i, nlines, maxloc, location, shift;
+	int wordlen, k;
+	FILE *f, *ofs;
+
+	data = filemmap(indexname, &st);
+	h = (info *) data;
+	if (h->wordsize & INDEX_MORE_TABLES) {
+		fprintf(stderr, "Cannot update multi-k index %s, build it again!\n", indexname);
+		exit(1);
+	}
+	wordlen = h->wordsize & INDEX_WORDSIZE_MASK;
+	shift = (h->wordsize & INDEX_CANONICAL) ? 1 : 0;
+	words = (unsigned *)(data + sizeof(info));
+	starts = words + h->nwords;
+	locations = starts + h->nwords;
+
+	/* names file of existing index is <outputname>.names for <outputname>_<n>.index */
+	if (!namesname) {
+		const char *p = strrchr(indexname, '_');
+		if (!p || (p - indexname) > 200) {
+			fprintf(stderr, "Cannot find the names file of %s, use -g!\n", indexname);
+			exit(1);
+		}
+		sprintf(names, "%.*s.names", (int) (p - indexname), indexname);
+		namesname = names;
+	}
+	if (outputname) {
+		sprintf(fname, "%s_%d.index", outputname, wordlen);
+	} else {
+		sprintf(fname, "%s", indexname);
+	}
+
+	/* read existing sequence table */
+	f = fopen(namesname, "r");
+	if (f == NULL) {
+		fprintf(stderr, "Cannot open file %s!\n", namesname);
+		exit(1);
+	}
+	nlines = 0;
+	lname = lfile = NULL;
+	lstart = NULL;
+	while (fgets(line, sizeof(line), f)) {
+		char n[1024], fn[1024];
+		unsigned start, offset;
+		if (sscanf(line, "%1023s %1023s %u %u", n, fn, &start, &offset) == 4) {
+			fprintf(stderr, "Cannot update region index %s, build it again with --regions!\n", indexname);
+			exit(1);
+		}
+		if (sscanf(line, "%1023s %1023s %u", n, fn, &start) != 3) continue;
+		lname = (char **) realloc(lname, (nlines + 1) * sizeof(char *));
+		lfile = (char **) realloc(lfile, (nlines + 1) * sizeof(char *));
+		lstart = (unsigned *) realloc(lstart, (nlines + 1) * sizeof(unsigned));
+		lname[nlines] = strdup(n);
+		lfile[nlines] = strdup(fn);
+		lstart[nlines] = start;
+		nlines += 1;
+	}
+	fclose(f);
+
+	/* the end of existing genome is after the largest location */
+	maxloc = 0;
+	for (i = 0; i < h->nwords; ++i) {
+		unsigned end = (i < h->nwords - 1) ? starts[i + 1] : h->nlocations;
+		if (end > starts[i] && (locations[end - 1] >> shift) > maxloc) maxloc = locations[end - 1] >> shift;
+	}
+	location = (h->nwords > 0) ? maxloc + wordlen + 10000 : 0;
+
+	/* ranges of removed sequences */
+	rmstart = (unsigned *) malloc((nremoved + 1) * sizeof(unsigned));
+	rmend = (unsigned *) malloc((nremoved + 1) * sizeof(unsigned));
+	for (k = 0; k < nremoved; ++k) {
+		for (i = 0; i < nlines; ++i) {
+			if (lname[i] && !strcmp(lname[i], removed[k])) break;
+		}
+		if (i == nlines) {
+			fprintf(stderr, "Sequence %s is not in %s!\n", removed[k], namesname);
+			exit(1);
+		}
+		rmstart[k] = lstart[i];
+		rmend[k] = (i < nlines - 1) ? lstart[i + 1] : location;
+		if (debug > 0) fprintf(stderr, "Removing %s: %u - %u\n", lname[i], rmstart[k], rmend[k]);
+		free(lname[i]);
+		lname[i] = NULL;
+	}
+
+	/* new sequence table: kept lines followed by the new sequences */
+	sprintf(namestmp, "%s.tmp", namesname);
+	ofs = fopen(namestmp, "w");
+	if (ofs == NULL) {
+		fprintf(stderr, "Cannot open file %s!\n", namestmp);
+		exit(1);
+	}
+	for (i = 0; i < nlines; ++i) {
+		if (lname[i]) fprintf(ofs, "%s %s %u\n", lname[i], lfile[i], lstart[i]);
+	}
+
+	/* words of new sequences only */
+	memset(&table, 0, sizeof(wordtable));
+	table.wordlength = wordlen;
+	table.flags = h->wordsize & ~INDEX_WORDSIZE_MASK;
+	buildtable(&table, files, nfiles, wordlen, table.flags, engine, location, ofs, NULL);
+	fclose(ofs);
+
+	sprintf(tmpname, "%s.tmp", fname);
+	appendindex(data, &table, tmpname, rmstart, rmend, nremoved);
+	munmap((void *) data, st.st_size);
+	if (rename(tmpname, fname)) {
+		fprintf(stderr, "Cannot rename %s to %s!\n", tmpname, fname);
+		exit(1);
+	}
+	if (outputname) {
+		sprintf(names, "%s.names", outputname);
+	} else if (namesname != names) {
+		strcpy(names, namesname);
+	}
+	if (rename(namestmp, names)) {
+		fprintf(stderr, "Cannot rename %s to %s!\n", namestmp, names);
+		exit(1);
+	}
+}
+
+void appendindex(const char *data, wordtable *table, const char *fname, unsigned *rmstart, unsigned *rmend, int nremoved)
+{
+	info *h = (info *) data;
+	info nh;
+	unsigned *words, *starts, *locations;
+	unsigned nwords, nloc, shift;
+	int pass;
+	FILE *f;
+
+	nwords = h->nwords;
+	nloc = h->nlocations;
+	shift = (h->wordsize & INDEX_CANONICAL) ? 1 : 0;
+	words = (unsigned *)(data + sizeof(info));
+	starts = words + nwords;
+	locations = starts + nwords;
+
+	f = fopen(fname, "w");
+	if (f == NULL) {
+		fprintf(stderr, "Cannot open file %s!\n", fname);
+		exit(1);
+	}
+	memset(&nh, 0, sizeof(info));
+	nh.wordsize = h->wordsize;
+	fwrite(&nh, sizeof(info), 1, f);
+
+	/* every pass merges the word lists again: 0 - words, 1 - starts, 2 - locations */
+	for (pass = 0; pass < 3; ++pass) {
+		unsigned i = 0, j = 0, outwords = 0, outloc = 0;
+		while ((i < nwords) || (j < table->nwords)) {
+			unsigned w, n, l;
+			/* [ob, oe) are the old and [nb, ne) the new locations of word */
+			unsigned ob = 0, oe = 0, nb = 0, ne = 0;
+			if ((j >= table->nwords) || ((i < nwords) && (words[i] <= table->words[j]))) {
+				w = words[i];
+				ob = starts[i];
+				oe = (i < nwords - 1) ? starts[i + 1] : nloc;
+				++i;
+			} else {
+				w = table->words[j];
+			}
+			if ((j < table->nwords) && (table->words[j] == w)) {
+				nb = table->starts[j];
+				ne = (j < table->nwords - 1) ? table->starts[j + 1] : table->nloc;
+				++j;
+			}
+			n = ne - nb;
+			if (nremoved == 0) {
+				n += oe - ob;
+			} else {
+				for (l = ob; l < oe; ++l) {
+					unsigned loc = locations[l] >> shift;
+					int k;
+					for (k = 0; k < nremoved; ++k) {
+						if ((loc >= rmstart[k]) && (loc < rmend[k])) break;
+					}
+					if (k < nremoved) continue;
+					n += 1;
+					if (pass == 2) fwrite(&locations[l], sizeof(unsigned), 1, f);
+				}
+			}
+			if (n == 0) continue;
+			if (pass == 0) {
+				fwrite(&w, sizeof(unsigned), 1, f);
+			} else if (pass == 1) {
+				fwrite(&outloc, sizeof(unsigned), 1, f);
+			} else {
+				/* old locations come first, new sequences are placed after them */
+				if (nremoved == 0) fwrite(locations + ob, sizeof(unsigned), oe - ob, f);
+				fwrite(table->locations + nb, sizeof(unsigned), ne - nb, f);
+			}
+			outwords += 1;
+			outloc += n;
+		}
+		nh.nwords = outwords;
+		nh.nlocations = outloc;
+	}
+
+	fseek(f, 0, SEEK_SET);
+	fwrite(&nh, sizeof(info), 1, f);
+	fclose(f);
+}
@@ -1,6 +1,6 @@
 /*
  * Genome Indexer
- * (using radix sort)
+ * (command line tool, index building is in indexbuilder.c)
  *
  * Authors: Maarja Lepamets, Fanny-Dhelia Pajuste
  */
@@ -8,76 +8,27 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <stdint.h>
-
-#include <sys/stat.h>
-#include <sys/mman.h>
-#include <fcntl.h>
-#include <unistd.h>
 
 #include "utils.h"
 
-int debug = 0;
-
-/*
- * reading in the genome in FastA format
- * if name is not NULL it will be assigned a copy of sequence name
- */
-unsigned readfastafile(const char *filename, wordtable *table, unsigned loc, char **name);
-
-/*
- * fills the table with words and their locations
- * if name is not NULL it will be assigned a copy of sequence name
- */
-unsigned fillwordtable(const char *data, wordtable *table, struct stat st, unsigned loc, char **name);
-
-/*
- * mask has as many 1's as the wordlength is
- */
-unsigned createmask(int wordlength);
-
-/* wrapper for in-place radix sort */
-void sortwords(wordtable *table);
-
-/*
- * find the number of unique words
- */
-unsigned countunique(wordtable *table);
-
-/*
- * find the starting position for the locations of all the words
- * from the array of all locations
- */
-void findstartpositions(wordtable *table);
-
-void sortlocations(wordtable *table);
-
-/*
- * for combining two sorted lists of words (with locations)
- */
-void combineindices(wordtable *table, wordtable *other);
-
-/*
- * writing binary .index file
- */
-void writetoindex(wordtable *table, const char *outputname, sequences seqinfo);
 void printhelp();
 
 int main (int argc, const char *argv[])
 {
 	int wordlen = 10;
+	int wordlens[MAX_INDEX_TABLES], nwordlens = 1;
+	int engine = BUILD_AUTO;
+	unsigned flags = 0;
 	int i, inputbeg = -1, inputend = -1;
-	unsigned location;
 	const char *outputname = "output";
-	sequences seqinfo;
-	wordtable tables[2];
-	wordtable *table = &tables[0];
-	wordtable *temptable = &tables[1];
-	char ofsname[256];
-	FILE *ofs;
+	const char *appendname = NULL, *namesname = NULL;
+	const char **newfiles, **removed;
+	int nnewfiles = 0, nremoved = 0, outputgiven = 0, nshards = 1, fm = 0;
+	const char *bedfile = NULL;
+	unsigned padding = 100;
 
-	memset(table, 0, sizeof(wordtable));
-	memset(temptable, 0, sizeof(wordtable));
+	newfiles = (const char **) malloc(argc * sizeof(const char *));
+	removed = (const char **) malloc(argc * sizeof(const char *));
 
 	/* default value */
 	wordlen = 16;
@@ -106,405 +57,193 @@ int main (int argc, const char *argv[])
 				continue;
 			}
 			outputname = argv[i + 1];
+			outputgiven = 1;
 			++i;
+		} else if (!strcmp(argv[i], "-a") || !strcmp(argv[i], "--append")) {
+			if (!argv[i + 1] || argv[i + 1][0] == '-') {
+				fprintf(stderr, "Error: No index file specified!\n");
+				printhelp();
+				exit(1);
+			}
+			appendname = argv[++i];
+			/* the following arguments are new FastA files */
+			while (i < argc - 1 && argv[i + 1][0] != '-') {
+				newfiles[nnewfiles++] = argv[++i];
+			}
+		} else if (!strcmp(argv[i], "-g") || !strcmp(argv[i], "--genome")) {
+			if (!argv[i + 1] || argv[i + 1][0] == '-') {
+				fprintf(stderr, "Error: No genome (.names file) specified!\n");
+				printhelp();
+				exit(1);
+			}
+			namesname = argv[++i];
+		} else if (!strcmp(argv[i], "--remove")) {
+			if (!argv[i + 1] || argv[i + 1][0] == '-') {
+				fprintf(stderr, "Error: No sequence name specified!\n");
+				printhelp();
+				exit(1);
+			}
+			removed[nremoved++] = argv[++i];
+		} else if (!strcmp(argv[i], "--replace")) {
+			if (!argv[i + 1] || !argv[i + 2] || argv[i + 1][0] == '-' || argv[i + 2][0] == '-') {
+				fprintf(stderr, "Error: --replace needs sequence name and FastA file!\n");
+				printhelp();
+				exit(1);
+			}
+			removed[nremoved++] = argv[++i];
+			newfiles[nnewfiles++] = argv[++i];
 		} else if (!strcmp(argv[i], "-n") || !strcmp(argv[i], "--wordlength")) {
 			if (!argv[i + 1]) {
 				fprintf(stderr, "Warning: No word-length specified! Using the default value: %d.\n", wordlen);
 				break;
 			}
-			char *e;
-			wordlen = strtol (argv[i + 1], &e, 10);
+			/* several word lengths (12,16) make multi-k index */
+			char *e = (char *) argv[i + 1];
+			nwordlens = 0;
+			do {
+				if (nwordlens == MAX_INDEX_TABLES) break;
+				wordlens[nwordlens++] = strtol ((*e == ',') ? e + 1 : e, &e, 10);
+			} while (*e == ',');
 			if (*e != 0) {
-				fprintf(stderr, "Invalid input: %s! Must be an integer.\n", argv[i + 1]);
+				fprintf(stderr, "Invalid input: %s! Must be an integer or up to %d comma-separated integers.\n", argv[i + 1], MAX_INDEX_TABLES);
 				printhelp();
 				exit(1);
 			}
+			wordlen = wordlens[0];
 			++i;
-		} else if (!strcmp(argv[i], "-h") || !strcmp(argv[i], "--help")) {
-			printhelp();
-			exit(1);
-		} else {
-			fprintf(stderr, "Unknown argument: %s\n", argv[i]);
-			exit(1);
-		}
-	}
-
-	/* checking the parameter */
-	if (wordlen > 16) {
-		fprintf(stderr, "Seed size too large!\n");
-		exit(1);
-	} else if (wordlen < 1) {
-		fprintf(stderr, "Error: Invalid word-length: %d! Must be between 1 and 16.\n", wordlen);
-		exit(1);
-	}
-	if (inputbeg == -1) {
-		fprintf(stderr, "No input FastA files given!\n");
-		printhelp();
-		exit(1);
-	}
-
-	seqinfo.seq_name = (char **) malloc((inputend - inputbeg + 1) * sizeof(const char *));
-	seqinfo.start_pos = (unsigned *) malloc((inputend - inputbeg + 1) * sizeof(unsigned));
-	seqinfo.n = inputend - inputbeg + 1;
-
-	/* work-flow */
-	location = 0;
-	sprintf(ofsname, "%s.names", outputname);
-	ofs = fopen (ofsname, "w");
-	for (i = inputbeg; i <= inputend; ++i) { /* iteration over the input file parameters */
-		char *seqname;
-		unsigned currentloc;
-		char *p;
-
-		if (debug > 0) fprintf (stderr, "Reading: %s...\n", argv[i]);
-
-		temptable->wordlength = wordlen;
-		if (i > inputbeg) {
-			location += 10000;
-		}
-		currentloc = location;
-		seqinfo.seq_name[i - inputbeg] = (char *) argv[i];
-		seqinfo.start_pos[i - inputbeg] = location;
-		location = readfastafile(argv[i], temptable, location, &seqname);
-		if (temptable->nwords == 0) continue;
-		sortwords(temptable);
-		findstartpositions(temptable);
-		sortlocations(temptable);
-		if (i > inputbeg) {
-			combineindices(table, temptable);
-		} else {
-			*table = *temptable;
-		}
-		memset(temptable, 0, sizeof(wordtable));
-		for (p = seqname; *p; ++p) {
-			if (*p <= ' ') {
-				*p = 0;
+		} else if (!strcmp(argv[i], "-s") || !strcmp(argv[i], "--shards")) {
+			if (!argv[i + 1]) {
+				fprintf(stderr, "Warning: No number of shards specified! Using the default value: %d.\n", nshards);
 				break;
 			}
-		}
-		fprintf (ofs, "%s %s %u\n", seqname, argv[i], currentloc);
-	}
-	fclose (ofs);
-
-	if (debug > 1) {
-		unsigned int i, j;
-		for (i = 0; i < table->nwords - 1; ++i) {
-			printf("järjestus %s, start %u\n", word2string(table->words[i], table->wordlength), table->starts[i]);
-			for (j = table->starts[i]; j < table->starts[i + 1]; ++j) {
-				printf("asukohad: %u ", table->locations[j]);
+			char *e;
+			nshards = strtol (argv[i + 1], &e, 10);
+			if ((*e != 0) || (nshards < 1)) {
+				fprintf(stderr, "Invalid input: %s! Must be a positive integer.\n", argv[i + 1]);
+				printhelp();
+				exit(1);
 			}
-			printf("\n");
-		}
-		printf("järjestus %s, start %u\n", word2string(table->words[i], table->wordlength), table->starts[i]);
-		for (j = table->starts[i]; j < table->nloc; ++j) {
-			printf("asukohad: %u ", table->locations[j]);
-		}
-		printf("\n");
-	}
-
-	writetoindex(table, outputname, seqinfo);
-	fprintf(stdout, "Done!\n");
-	return 0;
-}
-
-unsigned readfastafile(const char *filename, wordtable *table, unsigned locprev, char **name)
-{
-	struct stat st;				/* file statistics */
-	int status, handle;
-	const char *data;
-	unsigned loc;
-
-	/* memory-mapping a file */
-	status = stat(filename, &st);
-	if (status < 0) {
-		fprintf (stderr, "Cannot get the statistics of file %s!\n", filename);
-		exit (1);
-	}
-	handle = open(filename, O_RDONLY);
-	if (handle < 0) {
-		fprintf (stderr, "Cannot open file %s!\n", filename);
-		exit (1);
-	}
-	data = (const char *) mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, handle, 0);
-	if (data == (const char *) -1) {
-		fprintf (stderr, "Cannot memory-map file %s!\n", filename);
-		exit (1);
-	}
-	close(handle);
-
-	if (st.st_size > table->nword_slots) {
-		table->nword_slots = st.st_size;
-		table->nloc_slots = st.st_size;
-		table->words = (unsigned *) realloc(table->words, table->nword_slots * sizeof(unsigned));
-		table->locations = (unsigned *) realloc(table->locations, table->nloc_slots * sizeof(unsigned));
-	}
-	loc = fillwordtable(data, table, st, locprev, name);
-
-	munmap((void *) data, st.st_size);
-	return loc;
-}
-
-unsigned fillwordtable(const char *data, wordtable *table, struct stat st, unsigned locprev, char **name)
-{
-	unsigned word, location;
-	unsigned mask;
-	int m, wordlength;
-	int isheader = 0;
-	off_t i;
-	/* Initiqalized to suppress warning */
-	off_t namestart = 0;
-
-	wordlength = table->wordlength;
-	mask = createmask(wordlength);
-	word = 0;
-	location = locprev;
-	m = 0;
-
-	/* find the unsigned integer corresponding to a word with a given length */
-	for (i = 0; i < st.st_size; ++i) {
-		if (data[i] == '>') {
-			isheader = 1;
-			namestart = i + 1;
-			if (i != 0) {
-				fprintf(stderr, "Only one FastA sequence per file is allowed!\n");
+			++i;
+		} else if (!strcmp(argv[i], "--regions")) {
+			if (!argv[i + 1] || argv[i + 1][0] == '-') {
+				fprintf(stderr, "Error: No BED file specified!\n");
+				printhelp();
 				exit(1);
 			}
-		}
-		if (isheader) {
-			if (data[i] == '\n') {
-				isheader = 0;
-				if (name) {
-					*name = (char *) malloc (i - namestart);
-					memcpy (*name, data + namestart, i - namestart);
-					(*name)[i - namestart] = 0;
-				}
+			bedfile = argv[++i];
+		} else if (!strcmp(argv[i], "--padding")) {
+			if (!argv[i + 1]) {
+				fprintf(stderr, "Warning: No padding specified! Using the default value: %u.\n", padding);
+				break;
 			}
-		} else {
-			if (data[i] < 'A') {
-				continue;
-			} else if (strchr(alphabet, data[i]) == NULL) {
-				word = 0;
-				m = 0;
-				location += 1;
-				continue;
+			char *e;
+			long v = strtol (argv[i + 1], &e, 10);
+			if ((*e != 0) || (v < 0) || (v > 1000000)) {
+				fprintf(stderr, "Invalid input: %s! Must be an integer between 0 and 1000000.\n", argv[i + 1]);
+				printhelp();
+				exit(1);
 			}
-			word <<= 2;
-			word |= getnuclvalue(data[i]);
-			m += 1;
-			if (m > wordlength) {
-				word &= mask;
-				m = wordlength;
+			padding = v;
+			++i;
+		} else if (!strcmp(argv[i], "--fm")) {
+			fm = 1;
+		} else if (!strcmp(argv[i], "-c") || !strcmp(argv[i], "--canonical")) {
+			flags |= INDEX_CANONICAL;
+		} else if (!strcmp(argv[i], "-b") || !strcmp(argv[i], "--build")) {
+			if (!argv[i + 1]) {
+				fprintf(stderr, "Warning: No build engine specified! Using the default value: auto.\n");
+				break;
 			}
-			if (m == wordlength) {
-				table->words[table->nwords] = word;
-				table->locations[table->nloc] = location + 1 - table->wordlength;
-				table->nwords += 1;
-				table->nloc += 1;
-				/* location += 1; */
+			if (!strcmp(argv[i + 1], "auto")) {
+				engine = BUILD_AUTO;
+			} else if (!strcmp(argv[i + 1], "radix")) {
+				engine = BUILD_RADIX;
+			} else if (!strcmp(argv[i + 1], "counting")) {
+				engine = BUILD_COUNTING;
+			} else if (!strcmp(argv[i + 1], "packed")) {
+				engine = BUILD_PACKED;
+			} else {
+				fprintf(stderr, "Invalid input: %s! Must be auto, packed, radix or counting.\n", argv[i + 1]);
+				printhelp();
+				exit(1);
 			}
-			location += 1;
-		}
-
-	}
-	/*printf("alguses nloc %u\n", table->nloc);*/
-	return location;
-}
-
-unsigned createmask(int wordlength)
-{
-	int i;
-	unsigned mask = 0;
-
-	for (i = 0; i < 2 * wordlength; ++i) {
-		mask = (mask << 1) | 1;
-	}
-	return mask;
-}
-
-void sortwords(wordtable *table)
-{
-	int firstshift = 0, i;
-	if (table->nwords == 0) return;
-
-	/* calculate the number of shifted positions for making radix sort faster (no need to sort digits that are all zeros)*/
-	for (i = 8; i < table->wordlength * 2; i += 8) firstshift += 8;
-
-	hybridInPlaceRadixSort256(table->words, table->words + table->nwords, table->locations, firstshift);
-
-	return;
-}
-
-unsigned countunique(wordtable *table)
-{
-	unsigned i, count;
-	count = 0;
-	for (i = 0; i < table->nwords; ++i) {
-		if (i == 0 || table->words[i] != table->words[i - 1])
-			++count;
-	}
-	return count;
-}
-
-void findstartpositions(wordtable *table)
-{
-	unsigned ri, wi, count, nunique;
-
-	if (table->nwords == 0) return;
-	nunique = countunique(table);
-
-	if (nunique > table->nstart_slots) {
-		table->nstart_slots = nunique;
-		table->starts = (unsigned *) realloc(table->starts, table->nstart_slots * sizeof(unsigned));
-	}
-
-	wi = 1;
-	count = 1;
-	table->starts[0] = 0;
-	for (ri = 1; ri < table->nwords; ++ri) {
-		if (table->words[ri] == table->words[ri - 1]) {
-			count += 1;
+			++i;
+		} else if (!strcmp(argv[i], "-h") || !strcmp(argv[i], "--help")) {
+			printhelp();
+			exit(1);
 		} else {
-			table->words[wi - 1] = table->words[ri - 1];
-			table->starts[wi] = count;
-			count += 1;
-			++wi;
+			fprintf(stderr, "Unknown argument: %s\n", argv[i]);
+			exit(1);
 		}
 	}
-	table->words[wi - 1] = table->words[ri - 1];
-	table->nwords = nunique;
-	table->nstarts = nunique;
-	return;
-}
-
-void sortlocations(wordtable *table)
-{
-	unsigned i;
-	for (i = 0; i < table->nwords - 1; ++i) {
-		hybridInPlaceRadixSort256(table->locations + table->starts[i], table->locations + table->starts[i + 1], NULL, 24);
-	}
-	hybridInPlaceRadixSort256(table->locations + table->starts[i], table->locations + table->nloc, NULL, 24);
-}
-
-void combineindices(wordtable *table, wordtable *other)
-{
-	long long i, j, k, l;
-	int n1, n2;
-	unsigned count, location_pos, count1 = 0, count2 = 0;
 
-	if (table->nloc + other->nloc > table->nloc_slots) {
-		table->nloc_slots = table->nloc + other->nloc;
-		table->locations = (unsigned *) realloc(table->locations, table->nloc_slots * sizeof(unsigned));
+	/* checking the parameter */
+	if (nwordlens == 1) wordlens[0] = wordlen;
+	/* multi-k index has the longest words first, they are used first by mapper */
+	for (i = 1; i < nwordlens; ++i) {
+		int j, k = wordlens[i];
+		for (j = i; (j > 0) && (wordlens[j - 1] < k); --j) wordlens[j] = wordlens[j - 1];
+		wordlens[j] = k;
 	}
-	location_pos = table->nloc + other->nloc - 1;
-
-	j = 0;
-	count = 0;
-	for (i = 0; i < other->nwords; ) {
-		if (j < table->nwords && table->words[j] == other->words[i]) {
-			++i;
-			++j;
-		} else if (j < table->nwords && table->words[j] < other->words[i]) {
-			++j;
-		} else {
-			++i;
-			++count;
+	for (i = 0; i < nwordlens; ++i) {
+		if (wordlens[i] > 16) {
+			fprintf(stderr, "Seed size too large!\n");
+			exit(1);
+		} else if (wordlens[i] < 1) {
+			fprintf(stderr, "Error: Invalid word-length: %d! Must be between 1 and 16.\n", wordlens[i]);
+			exit(1);
+		} else if ((i > 0) && (wordlens[i] == wordlens[i - 1])) {
+			fprintf(stderr, "Error: Word-length %d is given twice!\n", wordlens[i]);
+			exit(1);
+		}
+		if ((engine == BUILD_COUNTING) && (wordlens[i] > MAX_COUNTING_WORDLENGTH)) {
+			fprintf(stderr, "Error: Counting sort build supports word-lengths up to %d!\n", MAX_COUNTING_WORDLENGTH);
+			exit(1);
 		}
 	}
-
-	if (table->nwords + count > table->nword_slots) {
-		table->nword_slots = table->nwords + count;
-		table->words = (unsigned *) realloc(table->words, table->nword_slots * sizeof(unsigned));
+	wordlen = wordlens[0];
+	if (fm && (appendname || (nshards > 1) || (flags & INDEX_CANONICAL))) {
+		fprintf(stderr, "Error: FM index cannot be appended to, sharded or canonical!\n");
+		exit(1);
 	}
-	if (table->nstarts + count > table->nstart_slots) {
-		table->nstart_slots = table->nwords + count;
-		table->starts = (unsigned *) realloc(table->starts, table->nstart_slots * sizeof(unsigned));
+	if (bedfile && (fm || appendname || (nshards > 1))) {
+		fprintf(stderr, "Error: Region index cannot be FM index, appended to or sharded!\n");
+		exit(1);
 	}
-
-	i = other->nwords - 1;
-	j = table->nwords - 1;
-	n1 = table->nloc - table->starts[j];
-	n2 = other->nloc - other->starts[i];
-	for (k = table->nwords + count - 1; k >= 0; --k) {
-		if (i >= 0 && j >= 0 && table->words[j] == other->words[i]) {
-			for (l = n2 - 1; l >= 0; --l) {
-				table->locations[location_pos] = other->locations[other->starts[i] + l];
-				location_pos--;
-				count1++;
-			}
-			for (l = n1 - 1; l >= 0; --l) {
-				table->locations[location_pos] = table->locations[table->starts[j] + l];
-				location_pos--;
-				count1++;
-			}
-			n1 = (j > 0) ? table->starts[j] - table->starts[j - 1] : 0;
-			n2 = (i > 0) ? other->starts[i] - other->starts[i - 1] : 0;
-			table->words[k] = table->words[j];
-			table->starts[k] = location_pos + 1;
-			--j; --i;
-		} else if ((i < 0) || (j >= 0 && table->words[j] > other->words[i])) {
-			for (l = n1 - 1; l >= 0; --l) {
-				table->locations[location_pos] = table->locations[table->starts[j] + l];
-				location_pos--;
-				count1++;
-			}
-			n1 = (j > 0) ? table->starts[j] - table->starts[j - 1] : 0;
-			table->words[k] = table->words[j];
-			table->starts[k] = location_pos + 1;
-			--j;
-
-		} else {
-			for (l = n2 - 1; l >= 0; --l) {
-				table->locations[location_pos] = other->locations[other->starts[i] + l];
-				location_pos--;
-				count2++;
-			}
-			n2 = (i > 0) ? other->starts[i] - other->starts[i - 1] : 0;
-			table->words[k] = other->words[i];
-			table->starts[k] = location_pos + 1;
-			--i;
-		}
+	if ((nwordlens > 1) && (fm || bedfile || appendname || (nshards > 1))) {
+		fprintf(stderr, "Error: Multi-k index cannot be FM index, region index, appended to or sharded!\n");
+		exit(1);
 	}
-	table->nwords += count;
-	table->nstarts += count;
-	table->nloc += other->nloc;
-}
-
-void writetoindex(wordtable *table, const char *outputname, sequences seqinfo)
-{
-	unsigned long long i;
-	char fname[256];
-	FILE *f;
-	info h;
-	if (table->nwords == 0) return;
-
-	h.wordsize = table->wordlength;
-	h.nwords = table->nwords;
-	h.nlocations = table->nloc;
-	h.seqs = seqinfo;
-
-	if (debug) {
-		long long i;
-		for (i = 0; i < seqinfo.n; ++i) {
-			printf("%s %u\n", seqinfo.seq_name[i], seqinfo.start_pos[i]);
+	if (appendname) {
+		/* input files given with -i are appended too */
+		for (i = inputbeg; (inputbeg != -1) && (i <= inputend); ++i) {
+			newfiles[nnewfiles++] = argv[i];
 		}
+		updateindex(appendname, namesname, (outputgiven) ? outputname : NULL, newfiles, nnewfiles, removed, nremoved, engine);
+		fprintf(stdout, "Done!\n");
+		return 0;
 	}
-
-	printf("%s %u\n", h.seqs.seq_name[0], h.seqs.start_pos[0]);
-
-	sprintf(fname, "%s_%d.index", outputname, table->wordlength);
-	f = fopen(fname, "w");
-	fwrite(&h, sizeof(info), 1, f);
-
-	for (i = 0; i < table->nwords; ++i) {
-		fwrite(&table->words[i], sizeof(table->words[i]), 1, f);
+	if (nremoved > 0) {
+		fprintf(stderr, "Error: --remove and --replace can only be used with --append!\n");
+		exit(1);
 	}
-	for (i = 0; i < table->nstarts; ++i) {
-		fwrite(&table->starts[i], sizeof(table->starts[i]), 1, f);
+	if (inputbeg == -1) {
+		fprintf(stderr, "No input FastA files given!\n");
+		printhelp();
+		exit(1);
 	}
-	for (i = 0; i < table->nloc; ++i) {
-		fwrite(&table->locations[i], sizeof(table->locations[i]), 1, f);
+
+	if (fm) {
+		buildfmindex(argv + inputbeg, inputend - inputbeg + 1, outputname);
+	} else if (nwordlens > 1) {
+		buildmultiindex(argv + inputbeg, inputend - inputbeg + 1, wordlens, nwordlens, flags, engine, outputname);
+	} else if (bedfile) {
+		buildregionindex(argv + inputbeg, inputend - inputbeg + 1, bedfile, padding, wordlen, flags, engine, outputname);
+	} else {
+		buildindex(argv + inputbeg, inputend - inputbeg + 1, wordlen, flags, engine, nshards, outputname);
 	}
-	return;
+	fprintf(stdout, "Done!\n");
+	return 0;
 }
 
 void printhelp()
@@ -512,6 +251,16 @@ void printhelp()
 	fprintf(stdout, "\n");
 	fprintf(stdout, "%s, %s\t%s\n", "-i", "--input", "FastA files");
 	fprintf(stdout, "%s, %s\t%s\n", "-o", "--outputname", "Name used in output files");
-	fprintf(stdout, "%s, %s\t%s\n", "-n", "--wordlength", "Length of the words in the index file");
+	fprintf(stdout, "%s, %s\t%s\n", "-n", "--wordlength", "Length of the words in the index file, several comma-separated lengths (16,12) build multi-k index");
+	fprintf(stdout, "%s, %s\t%s\n", "-c", "--canonical", "Index canonical words (both strands from one entry)");
+	fprintf(stdout, "%s, %s\t%s\n", "-b", "--build", "Index build engine: auto, packed, radix or counting, default: auto");
+	fprintf(stdout, "%s\t\t%s\n", "--fm", "Build FM index <outputname>.fm (suffix array, SMEM seeds of any length) instead of word index");
+	fprintf(stdout, "%s\t%s\n", "--regions", "BED file of target regions, only they are indexed (sequences are written to <outputname>.regions)");
+	fprintf(stdout, "%s\t%s\n", "--padding", "Nucleotides added to both sides of every region, default: 100");
+	fprintf(stdout, "%s, %s\t%s\n", "-s", "--shards", "Number of index shards (split by genome range), default: 1");
+	fprintf(stdout, "%s, %s\t%s\n", "-a", "--append", "Existing index file followed by FastA files to add to it");
+	fprintf(stdout, "%s, %s\t%s\n", "-g", "--genome", "Names file of existing index, default: derived from index name");
+	fprintf(stdout, "%s\t\t%s\n", "--remove", "Name of sequence to remove from existing index");
+	fprintf(stdout, "%s\t%s\n", "--replace", "Name of sequence and FastA file to replace it with");
 	fprintf(stdout, "\n");
 }
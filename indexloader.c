@@ -0,0 +1,262 @@
+/*
+ * Genome Mapper
+ * (index loading policies)
+ *
+ * Authors: Maarja Lepamets, Fanny-Dhelia Pajuste
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sched.h>
+
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "utils.h"
+
+#define HUGEPAGE_SIZE (2 * 1024 * 1024)
+
+/* The same as in numaif.h, we do not want to depend on libnuma */
+#define NUMA_MPOL_BIND 2
+#define MAX_NUMA_NODES 64
+
+static const char *policynames[] = { "lazy", "populate", "mlock", "hugepages", "hugetlb", "numa" };
+
+/* Parse list of integers like "0-3,8,10-11" into array, returns the number of values */
+static int parselist(const char *s, int *values, int maxvalues)
+{
+	int n = 0;
+	while (*s && (*s != '\n')) {
+		char *e;
+		int a, b, i;
+		a = strtol(s, &e, 10);
+		if (e == s) break;
+		b = a;
+		s = e;
+		if (*s == '-') {
+			b = strtol(s + 1, &e, 10);
+			s = e;
+		}
+		for (i = a; (i <= b) && (n < maxvalues); i++) values[n++] = i;
+		if (*s == ',') s++;
+	}
+	return n;
+}
+
+static int readlist(const char *filename, int *values, int maxvalues)
+{
+	char buf[4096];
+	FILE *f = fopen(filename, "r");
+	if (f == NULL) return 0;
+	if (!fgets(buf, sizeof(buf), f)) buf[0] = 0;
+	fclose(f);
+	return parselist(buf, values, maxvalues);
+}
+
+/* Get the list of online NUMA nodes, returns the number of nodes */
+int numanodes(int *nodes)
+{
+	int n = readlist("/sys/devices/system/node/online", nodes, MAX_NUMA_NODES);
+	if (n < 1) {
+		nodes[0] = 0;
+		n = 1;
+	}
+	return n;
+}
+
+/* Restrict calling thread to the CPUs of given NUMA node */
+int pintonode(int node)
+{
+	char fname[256];
+	int cpus[1024], ncpus, i;
+	cpu_set_t set;
+
+	sprintf(fname, "/sys/devices/system/node/node%d/cpulist", node);
+	ncpus = readlist(fname, cpus, 1024);
+	if (ncpus < 1) return -1;
+	CPU_ZERO(&set);
+	for (i = 0; i < ncpus; i++) CPU_SET(cpus[i], &set);
+	return sched_setaffinity(0, sizeof(set), &set);
+}
+
+/* Read whole file into (already allocated) memory */
+static void readfile(const char *filename, char *data, size_t size)
+{
+	size_t done = 0;
+	int handle = open(filename, O_RDONLY);
+	if (handle < 0) {
+		fprintf (stderr, "Cannot open file %s!\n", filename);
+		exit (1);
+	}
+	while (done < size) {
+		ssize_t r = read(handle, data + done, size - done);
+		if (r <= 0) {
+			fprintf (stderr, "Cannot read file %s!\n", filename);
+			exit (1);
+		}
+		done += r;
+	}
+	close(handle);
+}
+
+/* Anonymous memory for the copy of index, hugetlb pages are used if requested and available */
+static char *allocindex(size_t size, int hugetlb, unsigned long long *mapsize)
+{
+	char *data = (char *) MAP_FAILED;
+	*mapsize = (size + HUGEPAGE_SIZE - 1) / HUGEPAGE_SIZE * HUGEPAGE_SIZE;
+	if (hugetlb) {
+		data = (char *) mmap(NULL, *mapsize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if (data == (char *) MAP_FAILED) {
+			fprintf (stderr, "Warning: Cannot allocate explicit hugepages, using transparent hugepages!\n");
+		}
+	}
+	if (data == (char *) MAP_FAILED) {
+		data = (char *) mmap(NULL, *mapsize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (data == (char *) MAP_FAILED) {
+			fprintf (stderr, "Cannot allocate memory for index!\n");
+			exit (1);
+		}
+		madvise(data, *mapsize, MADV_HUGEPAGE);
+	}
+	return data;
+}
+
+/*
+ * Load index file using given policy
+ *
+ * lazy       - plain mmap, pages are faulted in on first access
+ * populate   - mmap with all pages prefaulted
+ * mlock      - prefaulted and locked in memory
+ * hugepages  - copy in anonymous memory backed by transparent hugepages
+ * hugetlb    - copy in explicit hugepages (falls back to transparent hugepages)
+ * numa       - copy bound to the memory of every NUMA node
+ *
+ * returns    - pointer to the index data (the first replica)
+ */
+const char *loadindex(const char *filename, int policy, loadedindex *li, int report)
+{
+	struct stat st;
+	struct timespec t0, t1;
+	int i;
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	memset(li, 0, sizeof(loadedindex));
+	li->policy = policy;
+
+	if ((policy == LOAD_LAZY) || (policy == LOAD_POPULATE) || (policy == LOAD_MLOCK)) {
+		if (policy == LOAD_LAZY) {
+			li->data = filemmap(filename, &st);
+		} else {
+			int handle;
+			if (stat(filename, &st) < 0) {
+				fprintf (stderr, "Cannot get the statistics of file %s!\n", filename);
+				exit (1);
+			}
+			handle = open(filename, O_RDONLY);
+			if (handle < 0) {
+				fprintf (stderr, "Cannot open file %s!\n", filename);
+				exit (1);
+			}
+			/* Prefault all pages at once instead of random faults while mapping */
+			li->data = (const char *) mmap(NULL, st.st_size, PROT_READ, MAP_SHARED | MAP_POPULATE, handle, 0);
+			if (li->data == (const char *) MAP_FAILED) {
+				fprintf (stderr, "Cannot memory-map file %s!\n", filename);
+				exit (1);
+			}
+			close(handle);
+			madvise((void *) li->data, st.st_size, MADV_WILLNEED);
+			if ((policy == LOAD_MLOCK) && mlock(li->data, st.st_size)) {
+				fprintf (stderr, "Warning: Cannot lock index in memory (check ulimit -l)!\n");
+			}
+		}
+		li->size = st.st_size;
+		li->mapsize = st.st_size;
+		li->filemapped = 1;
+		li->nreplicas = 1;
+		li->replicas[0] = li->data;
+	} else {
+		if (stat(filename, &st) < 0) {
+			fprintf (stderr, "Cannot get the statistics of file %s!\n", filename);
+			exit (1);
+		}
+		li->size = st.st_size;
+		if (policy == LOAD_NUMA) {
+			int nodes[MAX_NUMA_NODES];
+			int n = numanodes(nodes);
+			if (n > MAX_INDEX_REPLICAS) n = MAX_INDEX_REPLICAS;
+			/* One copy bound to the memory of every node */
+			for (i = 0; i < n; i++) {
+				unsigned long mask[MAX_NUMA_NODES / (8 * sizeof(unsigned long)) + 1];
+				char *data = allocindex(st.st_size, 0, &li->mapsize);
+				memset(mask, 0, sizeof(mask));
+				mask[nodes[i] / (8 * sizeof(unsigned long))] |= 1UL << (nodes[i] % (8 * sizeof(unsigned long)));
+				if (syscall(SYS_mbind, data, li->mapsize, NUMA_MPOL_BIND, mask, MAX_NUMA_NODES + 1, 0)) {
+					fprintf (stderr, "Warning: Cannot bind index replica to NUMA node %d!\n", nodes[i]);
+				}
+				readfile(filename, data, st.st_size);
+				li->replicas[i] = data;
+				li->nodes[i] = nodes[i];
+			}
+			li->nreplicas = n;
+		} else {
+			char *data = allocindex(st.st_size, policy == LOAD_HUGETLB, &li->mapsize);
+			readfile(filename, data, st.st_size);
+			li->replicas[0] = data;
+			li->nreplicas = 1;
+		}
+		li->data = li->replicas[0];
+		li->filemapped = 0;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	if (report) {
+		fprintf (stderr, "Loaded index %s (%s, %.1f MB, %d replica%s) in %.3f s\n", filename, policynames[policy],
+				li->size / 1048576.0, li->nreplicas, (li->nreplicas > 1) ? "s" : "",
+				(t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9);
+	}
+	return li->data;
+}
+
+/* Get the replica of index for given NUMA node (or the only copy) */
+const char *indexreplica(loadedindex *li, int node)
+{
+	int i;
+	for (i = 0; i < li->nreplicas; i++) {
+		if (li->nodes[i] == node) return li->replicas[i];
+	}
+	return li->data;
+}
+
+/* Release the memory of loaded index */
+void unloadindex(loadedindex *li)
+{
+	int i;
+	if (li->filemapped) {
+		if (li->policy == LOAD_MLOCK) munlock(li->data, li->size);
+		munmap((void *) li->data, li->size);
+	} else {
+		for (i = 0; i < li->nreplicas; i++) {
+			munmap((void *) li->replicas[i], li->mapsize);
+		}
+	}
+	memset(li, 0, sizeof(loadedindex));
+}
+
+/* Get policy by name, returns -1 for unknown names */
+int parseloadpolicy(const char *name)
+{
+	unsigned i;
+	for (i = 0; i < sizeof(policynames) / sizeof(policynames[0]); i++) {
+		if (!strcmp(name, policynames[i])) return i;
+	}
+	return -1;
+}
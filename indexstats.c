@@ -0,0 +1,442 @@
+/*
+ * Genome Index Statistics
+ * (shape, size and validity of index files made by the Indexer)
+ *
+ * Authors: Maarja Lepamets, Fanny-Dhelia Pajuste
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "utils.h"
+
+/* Location counts below this are kept in histogram, larger ones in a list */
+#define HISTOGRAM_SIZE 65536
+/* Cache line size used for footprint estimate */
+#define CACHE_LINE 64
+
+typedef struct _heavyword {
+	unsigned word;
+	unsigned count;
+} heavyword;
+
+/* Counts of locations per word */
+typedef struct _countstats {
+	unsigned long long *histogram;
+	unsigned *large;
+	unsigned nlarge;
+	unsigned nlarge_slots;
+} countstats;
+
+void printhelp();
+/* Print statistics of index file, returns the number of errors found */
+static unsigned indexstats(const char *filename, unsigned ntop, int validate);
+/* Print statistics of one word table (of size bytes left in file), its size is stored in tablesize */
+static unsigned tablestats(const char *data, unsigned long long size, unsigned ntop, int validate, unsigned long long *tablesize);
+/* Print all words and their locations as text */
+static void dumpindex(const char *filename);
+
+int main (int argc, const char *argv[])
+{
+	int i, inputbeg = -1, inputend = -1, validate = 1, dump = 0;
+	unsigned ntop = 10, nerrors = 0;
+
+	for (i = 1; i < argc; ++i) {
+		if (!strcmp(argv[i], "-i") || !strcmp(argv[i], "--input")) {
+			if (!argv[i + 1] || argv[i + 1][0] == '-') {
+				fprintf(stderr, "Error: No index file specified!\n");
+				printhelp();
+				exit(1);
+			}
+			inputbeg = ++i;
+			while (i < argc - 1 && argv[i + 1][0] != '-') {
+				++i;
+			}
+			inputend = i;
+		} else if (!strcmp(argv[i], "--top")) {
+			if (!argv[i + 1]) {
+				fprintf(stderr, "Warning: No number of words specified! Using the default value: %u.\n", ntop);
+				break;
+			}
+			char *e;
+			ntop = strtol (argv[i + 1], &e, 10);
+			if ((*e != 0) || (ntop > 1000000)) {
+				fprintf(stderr, "Invalid input: %s! Must be an integer between 0 and 1000000.\n", argv[i + 1]);
+				printhelp();
+				exit(1);
+			}
+			++i;
+		} else if (!strcmp(argv[i], "--no-validate")) {
+			validate = 0;
+		} else if (!strcmp(argv[i], "--dump")) {
+			dump = 1;
+		} else if (!strcmp(argv[i], "-h") || !strcmp(argv[i], "--help")) {
+			printhelp();
+			exit(1);
+		} else {
+			fprintf(stderr, "Unknown argument: %s\n", argv[i]);
+			printhelp();
+			exit(1);
+		}
+	}
+	if (inputbeg < 0) {
+		fprintf(stderr, "Error: No index file specified!\n");
+		printhelp();
+		exit(1);
+	}
+
+	for (i = inputbeg; i <= inputend; i++) {
+		if (dump) {
+			dumpindex(argv[i]);
+		} else {
+			if (i > inputbeg) fprintf(stdout, "\n");
+			nerrors += indexstats(argv[i], ntop, validate);
+		}
+	}
+	return (nerrors) ? 1 : 0;
+}
+
+static void addcount(countstats *cs, unsigned count)
+{
+	if (count < HISTOGRAM_SIZE) {
+		cs->histogram[count] += 1;
+		return;
+	}
+	if (cs->nlarge >= cs->nlarge_slots) {
+		cs->nlarge_slots = (cs->nlarge_slots) ? 2 * cs->nlarge_slots : 1024;
+		cs->large = (unsigned *) realloc (cs->large, cs->nlarge_slots * sizeof(unsigned));
+	}
+	cs->large[cs->nlarge++] = count;
+}
+
+static int compareunsigned(const void *a, const void *b)
+{
+	unsigned x = *(const unsigned *) a, y = *(const unsigned *) b;
+	return (x > y) - (x < y);
+}
+
+/* Count of word at given rank (0 - smallest) */
+static unsigned countatrank(const countstats *cs, unsigned long long rank)
+{
+	unsigned long long seen = 0;
+	unsigned c;
+	for (c = 0; c < HISTOGRAM_SIZE; c++) {
+		seen += cs->histogram[c];
+		if (rank < seen) return c;
+	}
+	return cs->large[rank - seen];
+}
+
+/* Keep ntop words with the most locations in min-heap (smallest count at top) */
+static void pushheavy(heavyword *heap, unsigned *nheap, unsigned ntop, unsigned word, unsigned count)
+{
+	unsigned i, child;
+	if (*nheap < ntop) {
+		i = (*nheap)++;
+		while ((i > 0) && (heap[(i - 1) / 2].count > count)) {
+			heap[i] = heap[(i - 1) / 2];
+			i = (i - 1) / 2;
+		}
+		heap[i].word = word;
+		heap[i].count = count;
+		return;
+	}
+	if ((ntop == 0) || (count <= heap[0].count)) return;
+	i = 0;
+	while ((child = 2 * i + 1) < *nheap) {
+		if ((child + 1 < *nheap) && (heap[child + 1].count < heap[child].count)) child += 1;
+		if (heap[child].count >= count) break;
+		heap[i] = heap[child];
+		i = child;
+	}
+	heap[i].word = word;
+	heap[i].count = count;
+}
+
+static int compareheavy(const void *a, const void *b)
+{
+	const heavyword *x = (const heavyword *) a, *y = (const heavyword *) b;
+	if (x->count != y->count) return (x->count < y->count) ? 1 : -1;
+	return (x->word > y->word) - (x->word < y->word);
+}
+
+static double megabytes(unsigned long long bytes)
+{
+	return bytes / 1048576.0;
+}
+
+/* Summary and consistency check of FM index (made by indexer --fm) */
+static unsigned fmstats(const char *filename, const char *data, unsigned long long size, int validate)
+{
+	const fmheader *h = (const fmheader *) data;
+	const fmblock *blocks;
+	const unsigned *samples;
+	unsigned long long expected;
+	unsigned occ[4] = { 0, 0, 0, 0 }, r, i, nerrors = 0;
+	char firsterror[256];
+
+	if (size < sizeof(fmheader)) {
+		fprintf(stdout, "Index: %s\nError: File is shorter than FM index header (%llu bytes)\n", filename, size);
+		return 1;
+	}
+	expected = sizeof(fmheader) + (unsigned long long) h->nblocks * sizeof(fmblock) + (unsigned long long) h->nsamples * sizeof(unsigned);
+	fprintf(stdout, "Index: %s\n", filename);
+	fprintf(stdout, "FM index: genome length %u, %u rows (both strands), suffix array sampled every %u rows\n", h->length, h->nrows, h->sarate);
+	fprintf(stdout, "Sections: header %u B, BWT %.1f MB, samples %.1f MB, total %.1f MB\n",
+			(unsigned) sizeof(fmheader), megabytes((unsigned long long) h->nblocks * sizeof(fmblock)), megabytes(4ULL * h->nsamples), megabytes(expected));
+	if ((size != expected) || (h->nrows != 2 * h->length + 1) || (h->nblocks != (h->nrows >> 6) + 1) || (h->sarate == 0)) {
+		fprintf(stdout, "Error: File size %llu does not match header (expected %llu bytes)\n", size, expected);
+		return 1;
+	}
+	if (!validate) return 0;
+
+	blocks = (const fmblock *) (data + sizeof(fmheader));
+	samples = (const unsigned *) (data + sizeof(fmheader) + (unsigned long long) h->nblocks * sizeof(fmblock));
+	firsterror[0] = 0;
+	for (r = 0; r < h->nrows; r++) {
+		if (((r & 63) == 0) && memcmp(blocks[r >> 6].occ, occ, sizeof(occ))) {
+			if (!nerrors++) snprintf(firsterror, sizeof(firsterror), "occurrence counts of block %u do not match BWT", r >> 6);
+		}
+		occ[(blocks[r >> 6].bwt[(r >> 5) & 1] >> (2 * (r & 31))) & 3] += 1;
+	}
+	/* End of text is stored as A */
+	occ[0] -= 1;
+	for (i = 0; i < 4; i++) {
+		if (h->count[i + 1] - h->count[i] != occ[i]) {
+			if (!nerrors++) snprintf(firsterror, sizeof(firsterror), "count of nucleotide %c does not match BWT", "ACGT"[i]);
+		}
+	}
+	if ((h->primary >= h->nrows) || ((h->primary % h->sarate == 0) && (samples[h->primary / h->sarate] != 0))) {
+		if (!nerrors++) snprintf(firsterror, sizeof(firsterror), "invalid row %u of the whole text", h->primary);
+	}
+	for (i = 0; i < h->nsamples; i++) {
+		if (samples[i] >= h->nrows) {
+			if (!nerrors++) snprintf(firsterror, sizeof(firsterror), "sample %u is outside of text", i);
+		}
+	}
+	if (nerrors) {
+		fprintf(stdout, "Validation: %u errors (first: %s)\n", nerrors, firsterror);
+	} else {
+		fprintf(stdout, "Validation: OK\n");
+	}
+	return nerrors;
+}
+
+static unsigned indexstats(const char *filename, unsigned ntop, int validate)
+{
+	struct stat st;
+	const char *data;
+	unsigned long long offset = 0, tablesize;
+	unsigned nerrors = 0;
+
+	data = filemmap(filename, &st);
+	if ((unsigned long long) st.st_size < sizeof(info)) {
+		fprintf(stdout, "Index: %s\nError: File is shorter than index header (%llu bytes)\n", filename, (unsigned long long) st.st_size);
+		munmap((void *) data, st.st_size);
+		return 1;
+	}
+	if (*((const unsigned *) data) == FM_MAGIC) {
+		nerrors = fmstats(filename, data, st.st_size, validate);
+		munmap((void *) data, st.st_size);
+		return nerrors;
+	}
+	fprintf(stdout, "Index: %s\n", filename);
+	madvise((void *) data, st.st_size, MADV_SEQUENTIAL);
+	/* Tables of multi-k index follow each other, every one but the last has INDEX_MORE_TABLES flag */
+	while (1) {
+		unsigned more = ((const info *) (data + offset))->wordsize & INDEX_MORE_TABLES;
+		nerrors += tablestats(data + offset, st.st_size - offset, ntop, validate, &tablesize);
+		offset += tablesize;
+		if (!more || !tablesize) break;
+		fprintf(stdout, "\n");
+		if (offset + sizeof(info) > (unsigned long long) st.st_size) {
+			fprintf(stdout, "Error: Next table of multi-k index is beyond the end of file\n");
+			nerrors += 1;
+			break;
+		}
+	}
+	munmap((void *) data, st.st_size);
+	return nerrors;
+}
+
+static unsigned tablestats(const char *data, unsigned long long size, unsigned ntop, int validate, unsigned long long *tablesize)
+{
+	const info *h;
+	unsigned *words, *starts, *locations;
+	unsigned wordlength, nwords, nloc, canonical, i, j, nheap = 0, nerrors = 0;
+	unsigned long long expected, possible, maxword, nover[3] = { 0, 0, 0 }, nreverse = 0, maxloc = 0;
+	const unsigned limits[3] = { 100, 1000, 10000 };
+	double sumsquares = 0;
+	char firsterror[256];
+	countstats cs;
+	heavyword *heap;
+
+	*tablesize = 0;
+	h = (const info *) data;
+	wordlength = h->wordsize & INDEX_WORDSIZE_MASK;
+	canonical = (h->wordsize & INDEX_CANONICAL) != 0;
+	nwords = h->nwords;
+	nloc = h->nlocations;
+	possible = (wordlength <= 16) ? 1ULL << (2 * wordlength) : 0;
+	maxword = possible - 1;
+	expected = sizeof(info) + (2ULL * nwords + nloc) * sizeof(unsigned);
+
+	fprintf(stdout, "Word length: %u%s%s\n", wordlength, (canonical) ? " (canonical words, locations with strand)" : "",
+			(h->wordsize & INDEX_MORE_TABLES) ? " (multi-k index, more tables follow)" : "");
+	fprintf(stdout, "Words: %u of %llu possible (%.2f%% occupied)\n", nwords, possible, (possible) ? 100.0 * nwords / possible : 0.0);
+	fprintf(stdout, "Locations: %u (%.2f per word)\n", nloc, (nwords) ? (double) nloc / nwords : 0.0);
+	fprintf(stdout, "Sections: header %u B, words %.1f MB, starts %.1f MB, locations %.1f MB, total %.1f MB\n",
+			(unsigned) sizeof(info), megabytes(4ULL * nwords), megabytes(4ULL * nwords), megabytes(4ULL * nloc), megabytes(expected));
+	/* Table that is followed by another one only has to fit into the file */
+	if ((wordlength < 1) || (wordlength > 16) || (size < expected) || (!(h->wordsize & INDEX_MORE_TABLES) && (size != expected))) {
+		fprintf(stdout, "Error: File size %llu does not match header (expected %llu bytes)\n", size, expected);
+		return 1;
+	}
+	*tablesize = expected;
+	words = (unsigned *)(data + sizeof(info));
+	starts = (unsigned *)(data + sizeof(info) + nwords * sizeof(unsigned));
+	locations = (unsigned *)(data + sizeof(info) + nwords * sizeof(unsigned) + nwords * sizeof(unsigned));
+
+	memset(&cs, 0, sizeof(countstats));
+	cs.histogram = (unsigned long long *) malloc (HISTOGRAM_SIZE * sizeof(unsigned long long));
+	memset(cs.histogram, 0, HISTOGRAM_SIZE * sizeof(unsigned long long));
+	heap = (heavyword *) malloc ((ntop + 1) * sizeof(heavyword));
+	firsterror[0] = 0;
+
+	for (i = 0; i < nwords; i++) {
+		unsigned start = starts[i], end = (i + 1 < nwords) ? starts[i + 1] : nloc, count;
+		if (validate) {
+			if ((i > 0) && (words[i] <= words[i - 1])) {
+				if (!nerrors++) snprintf(firsterror, sizeof(firsterror), "words not sorted at word %u", i);
+			}
+			if (words[i] > maxword) {
+				if (!nerrors++) snprintf(firsterror, sizeof(firsterror), "word %u is longer than word length", i);
+			}
+			if ((i == 0) && (start != 0)) {
+				if (!nerrors++) snprintf(firsterror, sizeof(firsterror), "first word starts at %u", start);
+			}
+		}
+		if ((end < start) || (end > nloc)) {
+			/* Locations of broken word are not looked at */
+			if (!nerrors++) snprintf(firsterror, sizeof(firsterror), "starts not sorted at word %u", i);
+			continue;
+		}
+		count = end - start;
+		addcount(&cs, count);
+		sumsquares += (double) count * count;
+		for (j = 0; j < 3; j++) {
+			if (count > limits[j]) nover[j] += count;
+		}
+		pushheavy(heap, &nheap, ntop, words[i], count);
+		if (validate || canonical) {
+			for (j = start; j < end; j++) {
+				unsigned long long loc = (canonical) ? locations[j] >> 1 : locations[j];
+				if (validate && (j > start) && (locations[j] <= locations[j - 1])) {
+					if (!nerrors++) snprintf(firsterror, sizeof(firsterror), "locations of word %u not sorted at %u", i, j);
+				}
+				if (canonical) nreverse += locations[j] & 1;
+				if (loc > maxloc) maxloc = loc;
+			}
+		}
+	}
+
+	if (nwords > 0) {
+		if (cs.nlarge) qsort(cs.large, cs.nlarge, sizeof(unsigned), compareunsigned);
+		fprintf(stdout, "Locations per word: min %u, median %u, 90%% %u, 99%% %u, 99.9%% %u, max %u\n",
+				countatrank(&cs, 0), countatrank(&cs, (nwords - 1) / 2), countatrank(&cs, (unsigned long long) (nwords - 1) * 90 / 100),
+				countatrank(&cs, (unsigned long long) (nwords - 1) * 99 / 100), countatrank(&cs, (unsigned long long) (nwords - 1) * 999 / 1000),
+				countatrank(&cs, nwords - 1));
+		fprintf(stdout, "Locations in words with more than %u / %u / %u locations: %.2f%% / %.2f%% / %.2f%%\n", limits[0], limits[1], limits[2],
+				(nloc) ? 100.0 * nover[0] / nloc : 0.0, (nloc) ? 100.0 * nover[1] / nloc : 0.0, (nloc) ? 100.0 * nover[2] / nloc : 0.0);
+		if (canonical) fprintf(stdout, "Strands: %llu forward, %llu reverse\n", (unsigned long long) nloc - nreverse, nreverse);
+		if (validate || canonical) fprintf(stdout, "Largest location: %llu\n", maxloc);
+	}
+	if (nheap > 0) {
+		qsort(heap, nheap, sizeof(heavyword), compareheavy);
+		fprintf(stdout, "Heaviest words:\n");
+		for (i = 0; i < nheap; i++) {
+			char *w = word2string(heap[i].word, wordlength);
+			fprintf(stdout, "\t%s\t%u\n", w, heap[i].count);
+			free(w);
+		}
+	}
+	/*
+	 * Every seed is looked up by binary search in words and then its locations are read,
+	 * seeds taken from the genome hit words in proportion to their location counts
+	 */
+	if (nloc > 0) {
+		double perseed = sumsquares / nloc;
+		fprintf(stdout, "Lookup: %u binary search steps in %.1f MB of words and starts, %.1f locations (%.0f cache lines) per seed from genome\n",
+				(nwords > 1) ? (unsigned) ceil(log2((double) nwords)) : 1, megabytes(8ULL * nwords), perseed,
+				ceil(perseed * sizeof(unsigned) / CACHE_LINE) + 1);
+	}
+	if (validate) {
+		if (nerrors) {
+			fprintf(stdout, "Validation: %u errors (first: %s)\n", nerrors, firsterror);
+		} else {
+			fprintf(stdout, "Validation: OK\n");
+		}
+	}
+
+	free(cs.histogram);
+	free(cs.large);
+	free(heap);
+	return nerrors;
+}
+
+static void dumpindex(const char *filename)
+{
+	struct stat st;
+	const char *data;
+	unsigned *words, *starts, *locations;
+	unsigned wordlength, nwords, nlocations;
+	unsigned long long offset = 0;
+	info *h;
+	unsigned i, j;
+
+	data = filemmap(filename, &st);
+	if (*((const unsigned *) data) == FM_MAGIC) {
+		fprintf(stderr, "Index %s is FM index, only k-mer index can be dumped.\n", filename);
+		munmap((void *) data, st.st_size);
+		return;
+	}
+	/* Tables of multi-k index are dumped one after another (longest words first) */
+	do {
+		h = (info *)(data + offset);
+		wordlength = h->wordsize & INDEX_WORDSIZE_MASK;
+		nwords = h->nwords;
+		nlocations = h->nlocations;
+
+		words = (unsigned *)(data + offset + sizeof(info));
+		starts = (unsigned *)(data + offset + sizeof(info) + nwords * sizeof(unsigned));
+		locations = (unsigned *)(data + offset + sizeof(info) + nwords * sizeof(unsigned) + nwords * sizeof(unsigned));
+
+		for (i = 0; i < nwords; ++i) {
+			char *w = word2string(words[i], wordlength);
+			unsigned end = (i + 1 < nwords) ? starts[i + 1] : nlocations;
+			fprintf(stdout, "%s\t%u\n", w, starts[i]);
+			for (j = starts[i]; j < end; ++j) {
+				fprintf(stdout, "%u ", locations[j]);
+			}
+			fprintf(stdout, "\n");
+			free(w);
+		}
+		offset += sizeof(info) + (2ULL * nwords + nlocations) * sizeof(unsigned);
+	} while ((h->wordsize & INDEX_MORE_TABLES) && (offset + sizeof(info) <= (unsigned long long) st.st_size));
+	munmap((void *) data, st.st_size);
+}
+
+void printhelp()
+{
+	fprintf(stdout, "\n");
+	fprintf(stdout, "%s, %s\t%s\n", "-i", "--input", "Index files (output of the Indexer)");
+	fprintf(stdout, "%s\t\t%s\n", "--top", "Number of words with the most locations listed, default: 10");
+	fprintf(stdout, "%s\t%s\n", "--no-validate", "Do not check that words and locations of every word are sorted");
+	fprintf(stdout, "%s\t\t%s\n", "--dump", "Print all words with their locations as text instead of statistics");
+	fprintf(stdout, "\n");
+}
@@ -7,25 +7,118 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include <limits.h>
 
 #include <sys/stat.h>
 #include <sys/mman.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <sys/wait.h>
+#include <pthread.h>
 
 #include "utils.h"
 
-#define MAX_READ_LENGTH 1000
-#define MAX_CANDIDATES 10000
+/* Where mapping results, unmapped queries and summary messages are written */
+FILE *output = NULL;
+FILE *erroutput = NULL;
+/* Index of the first query of input (not 0 if input is a chunk of query file) */
+unsigned queryoffset = 0;
+/* Whether unmapped queries are reported (not done per shard, only after merging) */
+int reportunmapped = 1;
+/* How index is loaded into memory and whether load time is reported */
+int loadpolicy = LOAD_LAZY;
+int loadreport = 0;
+/* Number of mapping threads and queries per batch passed between threads */
+unsigned nthreads = 1;
+unsigned batchsize = 1024;
+/* Memory for the cache of repeated queries (0 - no cache) */
+unsigned long long cachebudget = 0;
+/* Options of mapping engine (mapping.c) */
+mapoptions options;
+/* Settings are chosen by mapping a sample of queries, written to autotunefile instead of mapping if given */
+int autotune = 0;
+unsigned autotunetarget = 99;
+const char *autotunefile = NULL;
+/* Set while autotuner maps the sample, summary messages are not printed */
+int tuning = 0;
 
-int debug = 0;
+/* Query file is split into chunks mapped by nprocesses processes, through spooldir if given */
+unsigned nprocesses = 1;
+unsigned nchunks = 0;
+const char *spooldir = NULL;
+/* Chunk whose worker has not touched its owner file for spoollease seconds is mapped again (0 - never) */
+unsigned spoollease = 60;
 
-static int editDistance(const char *query, const char *sequence, unsigned *qstart, char *s, char *q);
-void printindex(const char *data);
-const char* filemmap(const char *filename, struct stat *st);
-static void mapperwrapper(const char *queryfile, const char *index, info *h, int mmis, int d, Chromosome *chr, unsigned nchr);
-/* Return edit distance */
-static unsigned adjustmapping (unsigned queryidx, candidate *cand, const char *query, unsigned qlen, Chromosome *chr, unsigned int nchr, unsigned int nmm, unsigned *loc, char *s, char *q, unsigned reverse);
+/* Hits are written sorted by chromosome and position, runs larger than sortmemory are spilled to disk */
+int sortoutput = 0;
+unsigned long long sortmemory = 1024ULL * 1024 * 1024;
+
+/* Results are written to outputfile (default stdout), progress is saved to <outputfile>.checkpoint every checkpointinterval seconds */
+const char *outputfile = NULL;
+unsigned checkpointinterval = 0;
+int resume = 0;
+
+/* Number of queries mapped by autotuner for every setting */
+#define AUTOTUNE_SAMPLE 2000
+/* Every setting is timed this many times and the fastest run is used */
+#define AUTOTUNE_REPEATS 3
+
+/* Totals of one mapping run */
+typedef struct _runstats {
+	unsigned nqueries;
+	unsigned nmapped;
+	unsigned long long ncandidates;
+} runstats;
+
+/* Hits of one autotune run sorted by query, chromosome (hash of name), strand, distance and position */
+typedef struct _samplehit {
+	unsigned query;
+	unsigned chrom;
+	unsigned strand;
+	int dist;
+	unsigned pos;
+} samplehit;
+
+typedef struct _samplehits {
+	samplehit *hits;
+	unsigned nhits;
+} samplehits;
+
+/* Progress of run: the next query and its offset in query file and output (see --checkpoint) */
+typedef struct _checkpoint {
+	char file[PATH_MAX + 32];
+	char queryfile[PATH_MAX];
+	unsigned nextquery;
+	unsigned long long inputoffset;
+	unsigned long long outputoffset;
+	struct timespec saved;
+} checkpoint;
+
+/* Index and parameters that every chunk of query file is mapped with */
+typedef struct _chunkargs {
+	loadedindex *li;
+	int mmis;
+	int step;
+	Chromosome *chr;
+	unsigned nchr;
+} chunkargs;
+
+/* Return the number of queries */
+static unsigned mapperwrapper(FILE *q, loadedindex *li, int mmis, int d, Chromosome *chr, unsigned nchr, runstats *stats, checkpoint *cp);
+/* Choose step, candidate search and cutoff shift by mapping the beginning of query file */
+static void autotunesettings(const char *queryfile, loadedindex *li, int mmis, int *step, Chromosome *chr, unsigned nchr);
+static void mapbatch(readbatch *b, void *worker);
+static void mapchunk(FILE *queries, unsigned first, FILE *out, FILE *err, void *arg);
+/* Split query file into chunks, map them by worker processes and merge the results */
+static void coordinate(const char *queryfile, loadedindex *li, int mmis, int step, Chromosome *chr, unsigned nchr);
+/* Map against every shard of shard set and merge the results */
+static void mapshards(const char *shardfile, int parallel, const char *queryfile, int mmis, int d, Chromosome *chr, unsigned nchr);
+static void mergeshardoutputs(FILE **files, unsigned nfiles, unsigned nqueries);
+static void openoutput(const char *queryfile, checkpoint *cp);
+static void savecheckpoint(checkpoint *cp);
+static void checkpointbatch(unsigned nqueries, unsigned long long inputoffset, void *arg);
 void printhelp();
 
 
@@ -34,14 +127,17 @@ int main (int argc, const char *argv[])
 	int i;
 	int mmis = 0;
 	int step = 5;
-	const char *indexfile = NULL, *queryfile = NULL, *namefile = NULL;
-	struct stat stindex;
-	const char *ind;
-	info *h;
-	Chromosome chr[256];
+	const char *indexfile = NULL, *queryfile = NULL, *namefile = NULL, *shardfile = NULL, *workerdir = NULL;
+	int parallel = 0;
+	loadedindex li;
+	fmindex fm;
+	Chromosome *chr;
 	int nchr = 0;
-	const char *chrmap;
+	FILE *q;
+	hitsorter *sorter = NULL;
+	checkpoint cp;
 
+	defaultmapoptions(&options);
 	for (i = 1; i < argc; ++i) {
 		if (!strcmp(argv[i], "-d") || !strcmp(argv[i], "--debug")) {
 			debug += 1;
@@ -61,6 +157,30 @@ int main (int argc, const char *argv[])
 			}
 			queryfile = argv[i + 1];
 			++i;
+		} else if (!strcmp(argv[i], "-o") || !strcmp(argv[i], "--output")) {
+			if (!argv[i + 1] || argv[i + 1][0] == '-') {
+				fprintf(stderr, "Error: No output file specified!\n");
+				printhelp();
+				exit(1);
+			}
+			outputfile = argv[i + 1];
+			++i;
+		} else if (!strcmp(argv[i], "--checkpoint")) {
+			if (!argv[i + 1]) {
+				fprintf(stderr, "Warning: No checkpoint interval specified! Using the default value: 60.\n");
+				checkpointinterval = 60;
+				break;
+			}
+			char *e;
+			checkpointinterval = strtol (argv[i + 1], &e, 10);
+			if ((*e != 0) || (checkpointinterval < 1) || (checkpointinterval > 86400)) {
+				fprintf(stderr, "Invalid input: %s! Must be an integer between 1 and 86400 (seconds).\n", argv[i + 1]);
+				printhelp();
+				exit(1);
+			}
+			++i;
+		} else if (!strcmp(argv[i], "--resume")) {
+			resume = 1;
 		} else if (!strcmp(argv[i], "-g") || !strcmp(argv[i], "--genome")) {
 			if (!argv[i + 1] || argv[i + 1][0] == '-') {
 				fprintf(stderr, "Error: No genome (.names file) specified!\n");
@@ -95,6 +215,310 @@ int main (int argc, const char *argv[])
 				exit(1);
 			}
 			++i;
+		} else if (!strcmp(argv[i], "-t") || !strcmp(argv[i], "--threads")) {
+			if (!argv[i + 1]) {
+				fprintf(stderr, "Warning: No number of threads specified! Using the default value: %u.\n", nthreads);
+				break;
+			}
+			char *e;
+			nthreads = strtol (argv[i + 1], &e, 10);
+			if ((*e != 0) || (nthreads < 1) || (nthreads > 256)) {
+				fprintf(stderr, "Invalid input: %s! Must be an integer between 1 and 256.\n", argv[i + 1]);
+				printhelp();
+				exit(1);
+			}
+			++i;
+		} else if (!strcmp(argv[i], "--batch")) {
+			if (!argv[i + 1]) {
+				fprintf(stderr, "Warning: No batch size specified! Using the default value: %u.\n", batchsize);
+				break;
+			}
+			char *e;
+			batchsize = strtol (argv[i + 1], &e, 10);
+			if ((*e != 0) || (batchsize < 1)) {
+				fprintf(stderr, "Invalid input: %s! Must be a positive integer.\n", argv[i + 1]);
+				printhelp();
+				exit(1);
+			}
+			++i;
+		} else if (!strcmp(argv[i], "--overflow")) {
+			if (!argv[i + 1]) {
+				fprintf(stderr, "Warning: No overflow handling specified! Using the default value: truncate.\n");
+				break;
+			}
+			if (!strcmp(argv[i + 1], "truncate")) {
+				options.skipoverflow = 0;
+			} else if (!strcmp(argv[i + 1], "skip")) {
+				options.skipoverflow = 1;
+			} else {
+				fprintf(stderr, "Invalid input: %s! Must be truncate or skip.\n", argv[i + 1]);
+				printhelp();
+				exit(1);
+			}
+			++i;
+		} else if (!strcmp(argv[i], "--max-candidates")) {
+			if (!argv[i + 1]) {
+				fprintf(stderr, "Warning: No number of candidates specified! Using the default value: %u.\n", options.maxcandidates);
+				break;
+			}
+			char *e;
+			options.maxcandidates = strtol (argv[i + 1], &e, 10);
+			if (*e != 0) {
+				fprintf(stderr, "Invalid input: %s! Must be an integer.\n", argv[i + 1]);
+				printhelp();
+				exit(1);
+			}
+			++i;
+		} else if (!strcmp(argv[i], "--min-seed")) {
+			if (!argv[i + 1]) {
+				fprintf(stderr, "Warning: No seed length specified! Using the default value: %u.\n", options.minseed);
+				break;
+			}
+			char *e;
+			options.minseed = strtol (argv[i + 1], &e, 10);
+			if ((*e != 0) || (options.minseed < 1)) {
+				fprintf(stderr, "Invalid input: %s! Must be a positive integer.\n", argv[i + 1]);
+				printhelp();
+				exit(1);
+			}
+			++i;
+		} else if (!strcmp(argv[i], "--candidates")) {
+			if (!argv[i + 1]) {
+				fprintf(stderr, "Warning: No candidate engine specified! Using the default value: merge.\n");
+				break;
+			}
+			if (!strcmp(argv[i + 1], "merge")) {
+				options.diagonal = 0;
+			} else if (!strcmp(argv[i + 1], "diagonal")) {
+				options.diagonal = 1;
+			} else {
+				fprintf(stderr, "Invalid input: %s! Must be merge or diagonal.\n", argv[i + 1]);
+				printhelp();
+				exit(1);
+			}
+			++i;
+		} else if (!strcmp(argv[i], "--no-indels")) {
+			options.noindels = 1;
+		} else if (!strcmp(argv[i], "--cutoff-shift")) {
+			if (!argv[i + 1]) {
+				fprintf(stderr, "Warning: No cutoff shift specified! Using the default value: %d.\n", options.cutoffshift);
+				break;
+			}
+			char *e;
+			options.cutoffshift = strtol (argv[i + 1], &e, 10);
+			if ((*e != 0) || (options.cutoffshift < -10) || (options.cutoffshift > 10)) {
+				fprintf(stderr, "Invalid input: %s! Must be an integer between -10 and 10.\n", argv[i + 1]);
+				printhelp();
+				exit(1);
+			}
+			++i;
+		} else if (!strcmp(argv[i], "--autotune")) {
+			autotune = 1;
+		} else if (!strcmp(argv[i], "--autotune-target")) {
+			if (!argv[i + 1]) {
+				fprintf(stderr, "Warning: No target sensitivity specified! Using the default value: %u.\n", autotunetarget);
+				break;
+			}
+			char *e;
+			autotunetarget = strtol (argv[i + 1], &e, 10);
+			if ((*e != 0) || (autotunetarget < 1) || (autotunetarget > 100)) {
+				fprintf(stderr, "Invalid input: %s! Must be an integer between 1 and 100 (percent).\n", argv[i + 1]);
+				printhelp();
+				exit(1);
+			}
+			++i;
+		} else if (!strcmp(argv[i], "--autotune-save")) {
+			if (!argv[i + 1] || argv[i + 1][0] == '-') {
+				fprintf(stderr, "Error: No profile file specified!\n");
+				printhelp();
+				exit(1);
+			}
+			autotunefile = argv[i + 1];
+			autotune = 1;
+			++i;
+		} else if (!strcmp(argv[i], "--prefilter")) {
+			options.prefilter = 1;
+		} else if (!strcmp(argv[i], "--long")) {
+			options.longreads = 1;
+		} else if (!strcmp(argv[i], "--max-error")) {
+			if (!argv[i + 1]) {
+				fprintf(stderr, "Warning: No error rate specified! Using the default value: %u.\n", options.maxerror);
+				break;
+			}
+			char *e;
+			options.maxerror = strtol (argv[i + 1], &e, 10);
+			if ((*e != 0) || (options.maxerror > 100)) {
+				fprintf(stderr, "Invalid input: %s! Must be an integer between 0 and 100 (percent).\n", argv[i + 1]);
+				printhelp();
+				exit(1);
+			}
+			++i;
+		} else if (!strcmp(argv[i], "--score")) {
+			if (!argv[i + 1] || (sscanf(argv[i + 1], "%d,%d,%d,%d", &options.scoring.match, &options.scoring.mismatch, &options.scoring.gapopen, &options.scoring.gapextend) != 4) ||
+					(options.scoring.match < 1) || (options.scoring.mismatch < 0) || (options.scoring.gapopen < 0) || (options.scoring.gapextend < 1)) {
+				fprintf(stderr, "Invalid input: %s! Must be match,mismatch,gapopen,gapextend (e.g. 1,4,6,1).\n", (argv[i + 1]) ? argv[i + 1] : "");
+				printhelp();
+				exit(1);
+			}
+			options.scoremode = 1;
+			++i;
+		} else if (!strcmp(argv[i], "--min-score")) {
+			if (!argv[i + 1]) {
+				fprintf(stderr, "Warning: No minimum score specified! Using the default value.\n");
+				break;
+			}
+			char *e;
+			options.minscore = strtol (argv[i + 1], &e, 10);
+			if ((*e != 0) || (options.minscore < 0)) {
+				fprintf(stderr, "Invalid input: %s! Must be a non-negative integer.\n", argv[i + 1]);
+				printhelp();
+				exit(1);
+			}
+			++i;
+		} else if (!strcmp(argv[i], "--simd")) {
+			int engine;
+			if (!argv[i + 1]) {
+				fprintf(stderr, "Warning: No instruction set specified! Using the default value: auto.\n");
+				break;
+			}
+			if (!strcmp(argv[i + 1], "auto")) {
+				engine = ALIGN_AUTO;
+			} else if (!strcmp(argv[i + 1], "avx2")) {
+				engine = ALIGN_AVX2;
+			} else if (!strcmp(argv[i + 1], "sse2")) {
+				engine = ALIGN_SSE2;
+			} else if (!strcmp(argv[i + 1], "scalar")) {
+				engine = ALIGN_SCALAR;
+			} else {
+				fprintf(stderr, "Invalid input: %s! Must be auto, avx2, sse2 or scalar.\n", argv[i + 1]);
+				printhelp();
+				exit(1);
+			}
+			if (setalignengine(engine) != engine && engine != ALIGN_AUTO) {
+				fprintf(stderr, "Warning: %s is not supported by this CPU, using %s.\n", argv[i + 1], alignenginename(setalignengine(engine)));
+			}
+			++i;
+		} else if (!strcmp(argv[i], "--cache")) {
+			if (!argv[i + 1]) {
+				fprintf(stderr, "Warning: No cache size specified! Not using read cache.\n");
+				break;
+			}
+			char *e;
+			cachebudget = strtoull (argv[i + 1], &e, 10) * 1024 * 1024;
+			if (*e != 0) {
+				fprintf(stderr, "Invalid input: %s! Must be an integer (megabytes).\n", argv[i + 1]);
+				printhelp();
+				exit(1);
+			}
+			++i;
+		} else if (!strcmp(argv[i], "--sort")) {
+			sortoutput = 1;
+		} else if (!strcmp(argv[i], "--sort-memory")) {
+			if (!argv[i + 1]) {
+				fprintf(stderr, "Warning: No sort memory specified! Using the default value: %llu.\n", sortmemory >> 20);
+				break;
+			}
+			char *e;
+			sortmemory = strtoull (argv[i + 1], &e, 10) * 1024 * 1024;
+			if ((*e != 0) || (sortmemory == 0)) {
+				fprintf(stderr, "Invalid input: %s! Must be a positive integer (megabytes).\n", argv[i + 1]);
+				printhelp();
+				exit(1);
+			}
+			++i;
+		} else if (!strcmp(argv[i], "-rv") || !strcmp(argv[i], "--region-verify")) {
+			options.regionverify = 1;
+		} else if (!strcmp(argv[i], "-s") || !strcmp(argv[i], "--shards")) {
+			if (!argv[i + 1] || argv[i + 1][0] == '-') {
+				fprintf(stderr, "Error: No shard set file specified!\n");
+				printhelp();
+				exit(1);
+			}
+			shardfile = argv[i + 1];
+			++i;
+		} else if (!strcmp(argv[i], "--load")) {
+			if (!argv[i + 1]) {
+				fprintf(stderr, "Warning: No load policy specified! Using the default value: lazy.\n");
+				break;
+			}
+			loadpolicy = parseloadpolicy(argv[i + 1]);
+			if (loadpolicy < 0) {
+				fprintf(stderr, "Invalid input: %s! Must be lazy, populate, mlock, hugepages, hugetlb or numa.\n", argv[i + 1]);
+				printhelp();
+				exit(1);
+			}
+			loadreport = 1;
+			++i;
+		} else if (!strcmp(argv[i], "--shard-mode")) {
+			if (!argv[i + 1]) {
+				fprintf(stderr, "Warning: No shard mode specified! Using the default value: serial.\n");
+				break;
+			}
+			if (!strcmp(argv[i + 1], "serial")) {
+				parallel = 0;
+			} else if (!strcmp(argv[i + 1], "parallel")) {
+				parallel = 1;
+			} else {
+				fprintf(stderr, "Invalid input: %s! Must be serial or parallel.\n", argv[i + 1]);
+				printhelp();
+				exit(1);
+			}
+			++i;
+		} else if (!strcmp(argv[i], "--processes")) {
+			if (!argv[i + 1]) {
+				fprintf(stderr, "Warning: No number of processes specified! Using the default value: %u.\n", nprocesses);
+				break;
+			}
+			char *e;
+			nprocesses = strtol (argv[i + 1], &e, 10);
+			if ((*e != 0) || (nprocesses < 1) || (nprocesses > 256)) {
+				fprintf(stderr, "Invalid input: %s! Must be an integer between 1 and 256.\n", argv[i + 1]);
+				printhelp();
+				exit(1);
+			}
+			++i;
+		} else if (!strcmp(argv[i], "--chunks")) {
+			if (!argv[i + 1]) {
+				fprintf(stderr, "Warning: No number of chunks specified! Using the default value: 4 per process.\n");
+				break;
+			}
+			char *e;
+			nchunks = strtol (argv[i + 1], &e, 10);
+			if ((*e != 0) || (nchunks < 1) || (nchunks > 100000)) {
+				fprintf(stderr, "Invalid input: %s! Must be an integer between 1 and 100000.\n", argv[i + 1]);
+				printhelp();
+				exit(1);
+			}
+			++i;
+		} else if (!strcmp(argv[i], "--spool")) {
+			if (!argv[i + 1] || argv[i + 1][0] == '-') {
+				fprintf(stderr, "Error: No spool directory specified!\n");
+				printhelp();
+				exit(1);
+			}
+			spooldir = argv[i + 1];
+			++i;
+		} else if (!strcmp(argv[i], "--spool-lease")) {
+			if (!argv[i + 1]) {
+				fprintf(stderr, "Warning: No lease specified! Using the default value: %u.\n", spoollease);
+				break;
+			}
+			char *e;
+			spoollease = strtol (argv[i + 1], &e, 10);
+			if ((*e != 0) || ((spoollease != 0) && (spoollease < 15)) || (spoollease > 86400)) {
+				fprintf(stderr, "Invalid input: %s! Must be 0 or an integer between 15 and 86400 (seconds).\n", argv[i + 1]);
+				printhelp();
+				exit(1);
+			}
+			++i;
+		} else if (!strcmp(argv[i], "--spool-worker")) {
+			if (!argv[i + 1] || argv[i + 1][0] == '-') {
+				fprintf(stderr, "Error: No spool directory specified!\n");
+				printhelp();
+				exit(1);
+			}
+			workerdir = argv[i + 1];
+			++i;
 		} else if (!strcmp(argv[i], "-h") || !strcmp(argv[i], "--help")) {
 			printhelp();
 			exit(1);
@@ -106,7 +530,7 @@ int main (int argc, const char *argv[])
 	}
 
 	/* checking parameters */
-	if (!indexfile || !queryfile || !namefile) {
+	if ((!indexfile && !shardfile) || (!queryfile && !workerdir) || !namefile) {
 		fprintf(stderr, "Error: Some of the input files are missing!\n");
 		printhelp();
 		exit(1);
@@ -119,376 +543,768 @@ int main (int argc, const char *argv[])
 		fprintf(stderr, "Error: Step length must be between 1 and 10!\n");
 		exit(1);
 	}
+	if (autotune && (shardfile || options.longreads)) {
+		fprintf(stderr, "Error: Autotune cannot be used with shard sets or long reads!\n");
+		exit(1);
+	}
+	if (((nprocesses > 1) || spooldir || workerdir) && shardfile) {
+		fprintf(stderr, "Error: Worker processes cannot be used with shard sets!\n");
+		exit(1);
+	}
+	if (workerdir && (autotune || spooldir)) {
+		fprintf(stderr, "Error: Spool worker takes its settings from the command line, not from --autotune or --spool!\n");
+		exit(1);
+	}
+	if (resume && !checkpointinterval) checkpointinterval = 60;
+	if (checkpointinterval && !outputfile) {
+		fprintf(stderr, "Error: Checkpoints need output file (-o)!\n");
+		exit(1);
+	}
+	if (checkpointinterval && (shardfile || (nprocesses > 1) || spooldir || workerdir || sortoutput)) {
+		fprintf(stderr, "Error: Checkpoints cannot be used with shard sets, worker processes or sorted output!\n");
+		exit(1);
+	}
 
 	/* Parse chromosome description file */
-	chrmap = filemmap (namefile, &stindex);
-	if (chrmap) {
-		unsigned s = 0;
-		if (debug > 0) fprintf (stderr, "Chromosome locations:\n");
-		while (s < stindex.st_size) {
-			unsigned ns, ne, fs, fe, ps, pe;
-			ns = ne = s;
-			while (chrmap[ne] > ' ') ne += 1;
-			fs = ne;
-			while ((fs < stindex.st_size) && (chrmap[fs] <= ' ')) fs += 1;
-			fe = fs;
-			while (chrmap[fe] > ' ') fe += 1;
-			ps = fe;
-			while ((ps < stindex.st_size) && (chrmap[ps] <= ' ')) ps += 1;
-			pe = ps;
-			while (chrmap[pe] > ' ') pe += 1;
-			if ((ne > ns) && (fe > fs) && (pe > ps)) {
-				chr[nchr].name = (char *) malloc (ne - ns + 1);
-				memcpy (chr[nchr].name, chrmap + ns, ne - ns + 1);
-				chr[nchr].name[ne - ns] = 0;
-				chr[nchr].filename = (char *) malloc (fe - fs + 1);
-				memcpy (chr[nchr].filename, chrmap + fs, fe - fs + 1);
-				chr[nchr].filename[fe - fs] = 0;
-				chr[nchr].start = strtol(chrmap + ps, NULL, 10);
-				chr[nchr].length = 0;
-				chr[nchr].sequence = NULL;
-				if (debug > 0) fprintf (stderr, "Chromosome %s at %s position %u\n", chr[nchr].name, chr[nchr].filename, chr[nchr].start);
-				nchr += 1;
-			}
-			s = pe;
-			while ((s < stindex.st_size) && (chrmap[s] <= ' ')) s += 1;
+	chr = (Chromosome *) malloc (MAX_CHROMOSOMES * sizeof(Chromosome));
+	nchr = readchromosomes (namefile, chr, MAX_CHROMOSOMES);
+
+	output = stdout;
+	erroutput = stderr;
+	memset(&cp, 0, sizeof(checkpoint));
+	if (outputfile && !workerdir) openoutput(queryfile, &cp);
+	/* Spool workers write chunks, the coordinator sorts */
+	if (sortoutput && !workerdir) sorter = newhitsorter(output, chr, nchr, sortmemory, &output);
+	if (shardfile) {
+		mapshards(shardfile, parallel, queryfile, mmis, step, chr, nchr);
+		if (sorter) finishhitsorter(sorter, output);
+		return 0;
+	}
+
+	loadindex(indexfile, loadpolicy, &li, loadreport);
+	if (openfmindex(&fm, li.data) && (options.longreads || autotune)) {
+		fprintf(stderr, "Error: Long reads and autotune need k-mer index, not FM index!\n");
+		exit(1);
+	}
+	if (workerdir) {
+		chunkargs args = { &li, mmis, step, chr, (unsigned) nchr };
+		spoolwork(workerdir, mapchunk, &args);
+		return 0;
+	}
+	if (autotune) autotunesettings(queryfile, &li, mmis, &step, chr, nchr);
+	if ((nprocesses > 1) || spooldir) {
+		coordinate(queryfile, &li, mmis, step, chr, nchr);
+		if (sorter) finishhitsorter(sorter, output);
+		return 0;
+	}
+	q = fopen(queryfile, "r");
+	if (q == NULL) {
+		fprintf(stderr, "Cannot open file %s.\n", queryfile);
+		exit (1);
+	}
+	if (checkpointinterval) {
+		/* Continue after the last query of checkpoint (from the beginning if there is none) */
+		if (fseeko(q, cp.inputoffset, SEEK_SET)) {
+			fprintf(stderr, "Cannot seek to %llu in file %s.\n", cp.inputoffset, queryfile);
+			exit (1);
 		}
+		queryoffset = cp.nextquery;
+		clock_gettime(CLOCK_MONOTONIC, &cp.saved);
+		mapperwrapper(q, &li, mmis, step, chr, nchr, NULL, &cp);
+		/* Run that is resumed after finishing has nothing left to map */
+		savecheckpoint(&cp);
+	} else {
+		mapperwrapper(q, &li, mmis, step, chr, nchr, NULL, NULL);
 	}
+	fclose(q);
+	if (sorter) finishhitsorter(sorter, output);
 
-	ind = filemmap(indexfile, &stindex);
-	h = (info *) ind;
+	return 0;
+}
 
-	mapperwrapper(queryfile, ind, h, mmis, step, chr, nchr);
+static unsigned mapperwrapper(FILE *q, loadedindex *li, int mmis, int d, Chromosome *chr, unsigned nchr, runstats *stats, checkpoint *cp)
+{
+	mapcontext *ctx;
+	mapworker *workers;
+	void **wp;
+	unsigned i, nqueries, noverflows, ntoolong, nmapped, nfallbacks;
+	unsigned long long nprefiltered, nrejected, ncandidates;
+	readcache *cache = NULL;
 
-	return 0;
+	if (cachebudget > 0) cache = newreadcache(cachebudget);
+	/* Every worker has its own context as NUMA workers use the replica of their node */
+	ctx = (mapcontext *) malloc (nthreads * sizeof(mapcontext));
+	workers = (mapworker *) malloc (nthreads * sizeof(mapworker));
+	wp = (void **) malloc (nthreads * sizeof(void *));
+	for (i = 0; i < nthreads; i++) {
+		const char *index = li->data;
+		int pin = -1;
+		if (li->policy == LOAD_NUMA) {
+			pin = li->nodes[i % li->nreplicas];
+			index = indexreplica(li, pin);
+		}
+		initmapcontext(&ctx[i], index, mmis, d, &options, chr, nchr, cache);
+		initmapworker(&workers[i], &ctx[i]);
+		workers[i].pin = pin;
+		wp[i] = &workers[i];
+	}
+
+	nqueries = runpipeline(q, output, erroutput, batchsize, nthreads, wp, mapbatch, (cp) ? checkpointbatch : NULL, cp);
+
+	noverflows = 0;
+	ntoolong = 0;
+	nprefiltered = nrejected = 0;
+	nmapped = 0;
+	nfallbacks = 0;
+	ncandidates = 0;
+	for (i = 0; i < nthreads; i++) {
+		noverflows += workers[i].noverflows;
+		nfallbacks += workers[i].nfallbacks;
+		ntoolong += workers[i].ntoolong;
+		nmapped += workers[i].nmapped;
+		ncandidates += workers[i].ncandidates;
+		nprefiltered += workers[i].nprefiltered;
+		nrejected += workers[i].nrejected;
+		freemapworker(&workers[i]);
+	}
+	if (ctx[0].fallback && !tuning) {
+		fprintf(erroutput, "Multi-k index: %u queries (%.2f%%) without hits were searched again with shorter words.\n", nfallbacks,
+				(nqueries) ? 100.0 * nfallbacks / nqueries : 0.0);
+	}
+	for (i = 0; i < nthreads; i++) freemapcontext(&ctx[i]);
+	if (stats) {
+		stats->nqueries = nqueries;
+		stats->nmapped = nmapped;
+		stats->ncandidates = ncandidates;
+	}
+	if (noverflows && !tuning) {
+		if (options.skipoverflow) {
+			fprintf(erroutput, "Warning: %u query strands had more than %u candidates and were not verified (see --max-candidates and --overflow).\n", noverflows, options.maxcandidates);
+		} else {
+			fprintf(erroutput, "Warning: %u query strands had more than %u candidates, only the first %u were verified (see --max-candidates and --overflow).\n", noverflows, options.maxcandidates, options.maxcandidates);
+		}
+	}
+	if (ntoolong && !tuning) {
+		fprintf(erroutput, "Warning: %u queries were longer than %u and were not mapped (see --long).\n", ntoolong, MAX_READ_LENGTH - 1);
+	}
+	if (options.prefilter && !tuning) {
+		fprintf(erroutput, "Pre-filter: %llu candidates, %llu rejected (%.1f%%)\n", nprefiltered, nrejected,
+				(nprefiltered) ? 100.0 * nrejected / nprefiltered : 0.0);
+	}
+	if (cache) {
+		if (!tuning) readcachestats(cache, erroutput);
+		freereadcache(cache);
+	}
+	free(wp);
+	free(workers);
+	free(ctx);
+	return nqueries;
 }
 
-static void mapperwrapper(const char *queryfile, const char *index, info *h, int mmis, int d, Chromosome *chr, unsigned nchr)
+static int comparesamplehits(const void *a, const void *b)
 {
-	unsigned int j;
-	unsigned *words, *starts, *locations;
-	unsigned nwords, nloc;
-	unsigned ncandidates;
-	int wordlength;
-	unsigned queryidx;
-
-	char readfw[MAX_READ_LENGTH];
-	FILE *q;
+	const samplehit *x = (const samplehit *) a, *y = (const samplehit *) b;
+	if (x->query != y->query) return (x->query < y->query) ? -1 : 1;
+	if (x->chrom != y->chrom) return (x->chrom < y->chrom) ? -1 : 1;
+	if (x->strand != y->strand) return (x->strand < y->strand) ? -1 : 1;
+	if (x->dist != y->dist) return (x->dist < y->dist) ? -1 : 1;
+	if (x->pos != y->pos) return (x->pos < y->pos) ? -1 : 1;
+	return 0;
+}
 
-	unsigned *seeds = NULL;
-	unsigned nseed_slots = 0;
-	queryblock qb;
-	qb.candidates = (candidate *) malloc (MAX_CANDIDATES * sizeof(candidate));
+/* Parse result lines (query, chromosome, position, distance, strand) of sample run into sorted hits */
+static void parsesamplehits(const char *buf, size_t len, samplehits *h)
+{
+	const char *p = buf, *end = buf + len;
+	unsigned size = 0;
+	h->hits = NULL;
+	h->nhits = 0;
+	while (p < end) {
+		const char *eol = (const char *) memchr(p, '\n', end - p);
+		const char *q = p;
+		samplehit hit;
+		char strand;
+		if (eol == NULL) eol = end;
+		hit.query = strtoul(q, (char **) &q, 10);
+		q += 1;
+		/* FNV-1a hash of chromosome name */
+		hit.chrom = 2166136261u;
+		while ((q < eol) && (*q != '\t')) hit.chrom = (hit.chrom ^ (unsigned char) *q++) * 16777619u;
+		hit.pos = strtoul(q + 1, (char **) &q, 10);
+		hit.dist = strtol(q + 1, (char **) &q, 10);
+		strand = (q + 1 < eol) ? q[1] : 'F';
+		hit.strand = (strand == 'R');
+		if (h->nhits == size) {
+			size = (size) ? 2 * size : 4096;
+			h->hits = (samplehit *) realloc (h->hits, size * sizeof (samplehit));
+		}
+		h->hits[h->nhits++] = hit;
+		p = eol + 1;
+	}
+	qsort (h->hits, h->nhits, sizeof (samplehit), comparesamplehits);
+}
 
-	q = fopen(queryfile, "r");
-	if (q == NULL) {
-		fprintf(stderr, "mapperwrapper: Cannot open file %s.\n", queryfile);
-		exit (1);
+/*
+ * Return the number of hits of ref that are also in h
+ * Positions can differ by maxshift where the start of alignment is ambiguous
+ */
+static unsigned commonsamplehits(const samplehits *ref, const samplehits *h, unsigned maxshift)
+{
+	unsigned i, j = 0, n = 0;
+	for (i = 0; i < ref->nhits; i++) {
+		samplehit lo = ref->hits[i];
+		lo.pos = (lo.pos > maxshift) ? lo.pos - maxshift : 0;
+		while ((j < h->nhits) && (comparesamplehits(&h->hits[j], &lo) < 0)) j += 1;
+		if ((j < h->nhits) && (h->hits[j].query == lo.query) && (h->hits[j].chrom == lo.chrom) && (h->hits[j].strand == lo.strand) &&
+				(h->hits[j].dist == lo.dist) && (h->hits[j].pos <= ref->hits[i].pos + maxshift)) {
+			n += 1;
+		}
 	}
+	return n;
+}
 
-	wordlength = h->wordsize;
-	nwords = h->nwords;
-	nloc = h->nlocations;
+/*
+ * Map queries in memory (one per line) AUTOTUNE_REPEATS times, returns the time of the fastest run in seconds
+ * The hits of the first run are stored in hits
+ */
+static double mapsample(char *data, size_t datalen, loadedindex *li, int mmis, int step, Chromosome *chr, unsigned nchr, runstats *stats, samplehits *hits)
+{
+	double best = 0;
+	FILE *savedoutput = output;
+	int r;
+	for (r = 0; r < AUTOTUNE_REPEATS; r++) {
+		struct timespec t0, t1;
+		char *buf = NULL;
+		size_t buflen = 0;
+		double elapsed;
+		FILE *q = fmemopen(data, datalen, "r");
+		output = open_memstream(&buf, &buflen);
+		if ((q == NULL) || (output == NULL)) {
+			fprintf(stderr, "autotune: Cannot create sample stream.\n");
+			exit (1);
+		}
+		clock_gettime(CLOCK_MONOTONIC, &t0);
+		mapperwrapper(q, li, mmis, step, chr, nchr, stats, NULL);
+		fflush(output);
+		clock_gettime(CLOCK_MONOTONIC, &t1);
+		fclose(q);
+		fclose(output);
+		elapsed = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+		if ((r == 0) || (elapsed < best)) best = elapsed;
+		if ((r == 0) && hits) parsesamplehits(buf, buflen, hits);
+		free(buf);
+	}
+	output = savedoutput;
+	return best;
+}
 
-	words = (unsigned *)(index + sizeof(info));
-	starts = (unsigned *)(index + sizeof(info) + nwords * sizeof(unsigned));
-	locations = (unsigned *)(index + sizeof(info) + nwords * sizeof(unsigned) + nwords * sizeof(unsigned));
+/*
+ * Map the first AUTOTUNE_SAMPLE queries with every step, candidate search and cutoff shift
+ * Sensitivity of setting is the number of hits of the setting with most hits that it also finds,
+ * the fastest setting that reaches autotunetarget percent is applied or written to autotunefile
+ */
+static void autotunesettings(const char *queryfile, loadedindex *li, int mmis, int *step, Chromosome *chr, unsigned nchr)
+{
+	static const char *enginenames[] = { "merge", "diagonal" };
+	double rate[2][10][4], best = 0;
+	unsigned mapped[2][10][4], found[2][10][4];
+	unsigned long long candidates[2][10][4];
+	samplehits hits[2][10][4];
+	int engine, s, shift, bestengine = 0, beststep = *step, bestshift = options.cutoffshift;
+	int refengine = 0, refstep = 1, refshift = -1;
+	int savedunmapped = reportunmapped;
+	FILE *f;
+	char *data = NULL;
+	size_t datasize = 0, datalen = 0;
+	unsigned nsample = 0, nref;
+	runstats st;
+	int c;
 
-	queryidx = 0;
-	while (fscanf(q, "%s\n", readfw) != EOF) {
-		unsigned int len = (unsigned int)strlen(readfw);
-		if (nseed_slots < len) {
-			nseed_slots = len;
-			seeds = (unsigned *) realloc (seeds, nseed_slots * sizeof(unsigned));
+	f = fopen(queryfile, "r");
+	if (f == NULL) {
+		fprintf(stderr, "autotune: Cannot open file %s.\n", queryfile);
+		exit (1);
+	}
+	/* Sample is kept in memory as one query per line */
+	c = getc(f);
+	while ((c != EOF) && (nsample < AUTOTUNE_SAMPLE)) {
+		while ((c != EOF) && isspace(c)) c = getc(f);
+		if (c == EOF) break;
+		while ((c != EOF) && !isspace(c)) {
+			if (datalen + 2 > datasize) {
+				datasize = (datasize) ? 2 * datasize : 65536;
+				data = (char *) realloc (data, datasize);
+			}
+			data[datalen++] = c;
+			c = getc(f);
 		}
-		if (len > 0) {
-			char r[256];
-			unsigned nmatched;
-			if (debug > 1) fprintf (stderr, "Query: %s\n", readfw);
-
-			qb.query = readfw;
-			ncandidates = find_candidates (&qb, words, nwords, starts, locations, nloc, wordlength, d, seeds, MAX_CANDIDATES, mmis);
-			if (debug > 0) {
-				fprintf (stderr, "Found %u candidates:\n", ncandidates);
-				if (debug > 1) {
-					for (j = 0; j < ncandidates; j++) {
-						unsigned k;
-						fprintf (stderr, "Candidate %u location %u length %u nregions %u\n", j, qb.candidates[j].loc, qb.candidates[j].length, qb.candidates[j].nregions);
-						if (debug > 2) {
-							for (k = 0; k < qb.candidates[j].nregions; ++k) {
-								fprintf (stderr, "    Region %u qstart %u qend %u loc %u\n", k, qb.candidates[j].reg[k].qstart, qb.candidates[j].reg[k].qend, qb.candidates[j].reg[k].loc);
-							}
-						}
-					}
+		data[datalen++] = '\n';
+		nsample += 1;
+	}
+	fclose(f);
+	if (nsample == 0) {
+		fprintf(stderr, "Warning: No queries to autotune! Using the given settings.\n");
+		return;
+	}
+
+	reportunmapped = 0;
+	tuning = 1;
+	/* The first run (not counted) loads chromosomes and index pages */
+	mapsample(data, datalen, li, mmis, *step, chr, nchr, &st, NULL);
+	for (engine = 0; engine < 2; engine++) {
+		for (s = 1; s <= 10; s++) {
+			for (shift = -1; shift <= 2; shift++) {
+				double elapsed;
+				options.diagonal = engine;
+				options.cutoffshift = shift;
+				elapsed = mapsample(data, datalen, li, mmis, s, chr, nchr, &st, &hits[engine][s - 1][shift + 1]);
+				mapped[engine][s - 1][shift + 1] = st.nmapped;
+				candidates[engine][s - 1][shift + 1] = st.ncandidates;
+				rate[engine][s - 1][shift + 1] = nsample / ((elapsed > 0) ? elapsed : 1e-9);
+				if (hits[engine][s - 1][shift + 1].nhits > hits[refengine][refstep - 1][refshift + 1].nhits) {
+					refengine = engine;
+					refstep = s;
+					refshift = shift;
 				}
 			}
-			nmatched = 0;
-			for (j = 0; j < ncandidates; j++) {
-				char s[256], q[256];
-				unsigned qstart = 0, editdist;
-				editdist = adjustmapping (queryidx, &qb.candidates[j], qb.query, len, chr, nchr, mmis, &qstart, s, q, 0);
-				if (editdist <= mmis) nmatched += 1;
-			}
-			/* Reverse complement */
-			getreversecomplementstr (r, readfw, len);
-			r[len] = 0;
-			memset(readfw, 0, sizeof(readfw));
-			memset(qb.candidates, 0, MAX_CANDIDATES * sizeof(candidate));
-			qb.query = r;
-			if (debug > 1) fprintf (stderr, "Reverse Query: %s\n", qb.query);
-			ncandidates = find_candidates (&qb, words, nwords, starts, locations, nloc, wordlength, d, seeds, MAX_CANDIDATES, mmis);
-			if (debug > 2) fprintf(stderr, "kandidaatide arv: %u, neist esimene: %d, mismatche %d\n", ncandidates, qb.candidates[0].loc, qb.candidates[0].mmis);
-			if (debug > 1) {
-				fprintf (stderr, "Candidates:\n");
-				for (j = 0; j < ncandidates; j++) {
-					unsigned k;
-					fprintf (stderr, "Loc %u len %u nregions %u\n", qb.candidates[j].loc, qb.candidates[j].length, qb.candidates[j].nregions);
-					for (k = 0; k < qb.candidates[j].nregions; ++k) {
-						fprintf (stderr, "  Region %u qstart %u qend %u loc %u\n", k, qb.candidates[j].reg[k].qstart, qb.candidates[j].reg[k].qend, qb.candidates[j].reg[k].loc);
-					}
+		}
+	}
+	tuning = 0;
+	reportunmapped = savedunmapped;
+	free(data);
+
+	/* Hits of the reference setting that every setting finds */
+	nref = hits[refengine][refstep - 1][refshift + 1].nhits;
+	for (engine = 0; engine < 2; engine++) {
+		for (s = 1; s <= 10; s++) {
+			for (shift = -1; shift <= 2; shift++) {
+				found[engine][s - 1][shift + 1] = commonsamplehits(&hits[refengine][refstep - 1][refshift + 1], &hits[engine][s - 1][shift + 1], mmis);
+				if (debug > 0) {
+					fprintf(stderr, "Autotune: -step %d --candidates %s --cutoff-shift %d: %.0f queries/s, %.1f candidates/query, %.2f%% mapped, %u of %u hits\n",
+							s, enginenames[engine], shift, rate[engine][s - 1][shift + 1],
+							(double) candidates[engine][s - 1][shift + 1] / nsample, 100.0 * mapped[engine][s - 1][shift + 1] / nsample,
+							found[engine][s - 1][shift + 1], nref);
 				}
 			}
-			for (j = 0; j < ncandidates; j++) {
-				char s[256], q[256];
-				unsigned qstart = 0, editdist;
-				editdist = adjustmapping (queryidx, &qb.candidates[j], qb.query, len, chr, nchr, mmis, &qstart, s, q, 1);
-				if (editdist <= mmis) nmatched += 1;
+		}
+	}
+	for (engine = 0; engine < 2; engine++) {
+		for (s = 1; s <= 10; s++) {
+			for (shift = -1; shift <= 2; shift++) {
+				free(hits[engine][s - 1][shift + 1].hits);
+				if ((unsigned long long) found[engine][s - 1][shift + 1] * 100 < (unsigned long long) nref * autotunetarget) continue;
+				if (rate[engine][s - 1][shift + 1] > best) {
+					best = rate[engine][s - 1][shift + 1];
+					bestengine = engine;
+					beststep = s;
+					bestshift = shift;
+				}
 			}
-			if (!nmatched) fprintf (stderr, "%d\t-\n", queryidx);
-			memset(readfw, 0, sizeof(readfw));
-			memset(qb.candidates, 0, MAX_CANDIDATES * sizeof(candidate));
 		}
-		queryidx += 1;
 	}
+	options.diagonal = bestengine;
+	options.cutoffshift = bestshift;
+	*step = beststep;
+	fprintf(stderr, "Autotune: -step %d --candidates %s --cutoff-shift %d (%.0f queries/s, %.1f candidates/query, %.2f%% of %u sample queries mapped, %u of %u hits)\n",
+			beststep, enginenames[bestengine], bestshift, best, (double) candidates[bestengine][beststep - 1][bestshift + 1] / nsample,
+			100.0 * mapped[bestengine][beststep - 1][bestshift + 1] / nsample, nsample, found[bestengine][beststep - 1][bestshift + 1], nref);
+	if (autotunefile) {
+		f = fopen(autotunefile, "w");
+		if (f == NULL) {
+			fprintf(stderr, "autotune: Cannot open file %s.\n", autotunefile);
+			exit (1);
+		}
+		fprintf(f, "-step %d --candidates %s --cutoff-shift %d\n", beststep, enginenames[bestengine], bestshift);
+		fclose(f);
+		exit (0);
+	}
+}
 
+/* Map all queries of batch, called from mapping threads */
+static void mapbatch(readbatch *b, void *worker)
+{
+	mapworker *w = (mapworker *) worker;
+	unsigned i;
+	if (w->pin >= 0) {
+		/* Run on the node that holds our replica of index */
+		pintonode(w->pin);
+		w->pin = -1;
+	}
+	w->out = b->outf;
+	w->err = (reportunmapped) ? b->errf : NULL;
+	for (i = 0; i < b->n; i++) {
+		mapquery(w, queryoffset + b->first + i, b->data + b->offsets[i]);
+	}
 }
 
-static unsigned adjustmapping (unsigned queryidx, candidate *cand, const char *query, unsigned qlen, Chromosome *chr, unsigned int nchr, unsigned int nmm, unsigned *qstart, char *s, char *q, unsigned reverse)
+/* Map one chunk of query file, called from worker processes */
+static void mapchunk(FILE *queries, unsigned first, FILE *out, FILE *err, void *arg)
 {
-	unsigned i, editdist;
-	unsigned sloc, slen;
-	char seq[256];
-	for (i = 1; i < nchr; i++) {
-		if (cand->loc < chr[i].start) break;
-	}
-	i -= 1;
-	/* Load chromosome if not already loaded */
-	if (chr[i].sequence == NULL) {
-		struct stat st;
-		unsigned d, s, header;
-		const char *seq = filemmap (chr[i].filename, &st);
-		if (seq == NULL) {
-			fprintf (stderr, "Cannot mmap %s\n", chr[i].filename);
+	chunkargs *a = (chunkargs *) arg;
+	FILE *savedoutput = output, *savederr = erroutput;
+	output = out;
+	erroutput = err;
+	queryoffset = first;
+	mapperwrapper(queries, a->li, a->mmis, a->step, a->chr, a->nchr, NULL, NULL);
+	output = savedoutput;
+	erroutput = savederr;
+	queryoffset = 0;
+}
+
+/* Private spool directory of coordinator, removed if the run ends with an error */
+static char coordinatordir[1024];
+static pid_t coordinatorpid;
+
+static void removecoordinatordir(void)
+{
+	/* Forked workers that exit with an error must not remove it */
+	if (coordinatordir[0] && (getpid() == coordinatorpid)) spoolremove(coordinatordir);
+}
+
+static void coordinate(const char *queryfile, loadedindex *li, int mmis, int step, Chromosome *chr, unsigned nchr)
+{
+	char tmpdir[1024];
+	const char *dir = spooldir;
+	chunkargs args;
+	pid_t *pids;
+	unsigned ntasks, k, i;
+
+	/* Without shared spool directory chunks are passed through private temporary one */
+	if (!dir) {
+		snprintf(tmpdir, sizeof(tmpdir), "%s/gmapper.XXXXXX", (getenv("TMPDIR")) ? getenv("TMPDIR") : "/tmp");
+		dir = mkdtemp(tmpdir);
+		if (dir == NULL) {
+			fprintf(stderr, "coordinate: Cannot create temporary directory.\n");
 			exit (1);
 		}
-		chr[i].sequence = (char *) malloc (st.st_size);
-		d = 0;
-		header = 0;
-		for (s = 0; s < st.st_size; s++) {
-			if (seq[s] == '>') header = 1;
-			if (header) {
-				if (seq[s] == '\n') header = 0;
-			} else {
-				if (seq[s] >= 'A') chr[i].sequence[d++] = seq[s];
-			}
+		strcpy(coordinatordir, dir);
+		coordinatorpid = getpid();
+		atexit(removecoordinatordir);
+	}
+	ntasks = spoolsplit(queryfile, (nchunks > 0) ? nchunks : 4 * nprocesses, dir);
+	/* Chromosomes are loaded before forking so that all workers share them (as they share index) */
+	for (i = 0; i < nchr; i++) getchromosome(&chr[i], options.noindels);
+
+	args.li = li;
+	args.mmis = mmis;
+	args.step = step;
+	args.chr = chr;
+	args.nchr = nchr;
+	pids = (pid_t *) malloc(nprocesses * sizeof(pid_t));
+	for (k = 0; k < nprocesses; k++) {
+		fflush(NULL);
+		pids[k] = fork();
+		if (pids[k] < 0) {
+			fprintf(stderr, "coordinate: Cannot fork.\n");
+			exit (1);
+		}
+		if (pids[k] == 0) {
+			spoolwork(dir, mapchunk, &args);
+			_exit(0);
 		}
-		chr[i].length = d;
-		munmap ((void *) seq, st.st_size);
-	}
-
-	sloc = cand->loc - nmm;
-	slen = qlen + 2 * nmm;
-	memcpy (seq, chr[i].sequence + sloc - chr[i].start, slen);
-	seq[slen] = 0;
-	/* editdist = editDistanceMiddle (q, s); */
-	*qstart = nmm;
-	editdist = editDistance (query, seq, qstart, s, q);
-	if (debug > 0) {
-		fprintf (stderr, "Location %u Distance %u Query start %u\n", cand->loc, editdist, *qstart);
-		fprintf (stderr, "Query: %s\n", q);
-		fprintf (stderr, "Seq:   %s\n", s);
-	}
-	if (editdist <= nmm) {
-		fprintf (stdout, "%u\t%s\t%u\t%d\t%s\n", queryidx, chr[i].name, cand->loc -nmm + *qstart - chr[i].start, editdist, (reverse) ? "R" : "F");
-	}
-	return editdist;
+	}
+	for (k = 0; k < nprocesses; k++) {
+		int status;
+		waitpid(pids[k], &status, 0);
+		if (!WIFEXITED(status) || WEXITSTATUS(status)) {
+			/* Worker that exits gives its chunk back itself, the chunk of killed worker is given back here */
+			spoolrelease(dir, pids[k]);
+			fprintf(stderr, "Warning: Worker process %d failed, its unfinished chunk is mapped again.\n", (int) pids[k]);
+		}
+	}
+	/* Workers on other hosts may still be mapping their chunks, chunks given back are mapped here */
+	spoolwait(dir, ntasks, spoollease, mapchunk, &args);
+	spoolmerge(dir, ntasks, output, erroutput);
+	if (!spooldir) {
+		rmdir(dir);
+		coordinatordir[0] = 0;
+	}
+	free(pids);
 }
 
-/* fixme: Update qstart */
-
-static int editDistance (const char *query, const char *seq, unsigned *qstart, char *s, char *q)
+static void mapshards(const char *shardfile, int parallel, const char *queryfile, int mmis, int d, Chromosome *chr, unsigned nchr)
 {
-	static int *d = NULL;
-	static int dsize = 0;
-	int qlen, slen, qi, si, dist, lasts;
-	qlen = strlen (query);
-	slen = strlen (seq);
-	if (debug > 2) fprintf (stderr, "editDistance: Query %s (len = %d), sequence %s (len = %d)\n", query, qlen, seq, slen);
-	if ((qlen + 1) * (slen + 1) > dsize) {
-		dsize = (qlen + 1) * (slen + 1);
-		d = (int *) realloc (d, dsize * sizeof (int));
-	}
-	/* Fill first column */
-	for (si = 0; si <= slen; si++) {
-		/*d[si * (qlen + 1) + 0] = (si < (int) *qstart) ? *qstart - si : si - *qstart;*/
-		d[si * (qlen + 1) + 0] = (si < (int) 2 * *qstart) ? 0 : si - 2 * *qstart;
-	}
-	/* Fill first row */
-	for (qi = 1; qi <= qlen; qi++) {
-		d[qi] = 99;
-	}
-	for (qi = 1; qi <= qlen; qi++) {
-		for (si = 1; si <= slen; si++) {
-			unsigned dl, dtl, dt;
-			dl = d[si * (qlen + 1) + qi - 1] + 1;
-			dtl = d[(si - 1) * (qlen + 1) + qi - 1];
-			if ((qi < qlen) && (si < slen) && (query[qi] != seq[si])) dtl += 1;
-			dt = d[(si - 1) * (qlen + 1) + qi] + 1;
-			d[si * (qlen + 1) + qi] = ((dl < dtl) && (dl < dt)) ? dl : ((dt < dl) && (dt < dtl)) ? dt : dtl;
+	char line[1024], dir[1024], **shards = NULL;
+	const char *p;
+	FILE *f, **outputs, *savedoutput = output;
+	pid_t *pids;
+	unsigned nshards = 0, nqueries = 0, k, i;
+
+	/* shard file names are relative to the directory of shard set file */
+	p = strrchr(shardfile, '/');
+	if (p) {
+		sprintf(dir, "%.*s/", (int) (p - shardfile), shardfile);
+	} else {
+		dir[0] = 0;
+	}
+	f = fopen(shardfile, "r");
+	if (f == NULL) {
+		fprintf(stderr, "mapshards: Cannot open file %s.\n", shardfile);
+		exit (1);
+	}
+	while (fgets(line, sizeof(line), f)) {
+		char name[1024];
+		if ((line[0] == '#') || (sscanf(line, "%1023s", name) != 1)) continue;
+		shards = (char **) realloc(shards, (nshards + 1) * sizeof(char *));
+		shards[nshards] = (char *) malloc(strlen(dir) + strlen(name) + 1);
+		sprintf(shards[nshards], "%s%s", (name[0] == '/') ? "" : dir, name);
+		nshards += 1;
+	}
+	fclose(f);
+	if (nshards == 0) {
+		fprintf(stderr, "mapshards: No shards in %s.\n", shardfile);
+		exit (1);
+	}
+
+	/* every shard writes its results to temporary file, unmapped queries are found while merging */
+	outputs = (FILE **) malloc(nshards * sizeof(FILE *));
+	pids = (pid_t *) malloc(nshards * sizeof(pid_t));
+	for (k = 0; k < nshards; k++) {
+		outputs[k] = tmpfile();
+		if (outputs[k] == NULL) {
+			fprintf(stderr, "mapshards: Cannot create temporary file.\n");
+			exit (1);
 		}
 	}
-	if (debug > 3) {
-		/* Print table */
-		for (si = 0; si <= slen; si++) {
-			for (qi = 0; qi <= qlen; qi++) {
-				fprintf (stderr, "%2u ", d[si * (qlen + 1) + qi]);
+	reportunmapped = 0;
+	for (k = 0; k < nshards; k++) {
+		loadedindex li;
+		if (parallel) {
+			fflush(NULL);
+			pids[k] = fork();
+			if (pids[k] < 0) {
+				fprintf(stderr, "mapshards: Cannot fork.\n");
+				exit (1);
 			}
-			fprintf (stderr, "\n");
+			if (pids[k] > 0) continue;
 		}
-	}
-	dist = 99;
-	lasts = 0;
-	for (si = 0; si <= slen; si++) {
-		if (d[si * (qlen + 1) + qlen] < dist) {
-			dist = d[si * (qlen + 1) + qlen];
-			lasts = si;
+		if (debug > 0) fprintf(stderr, "Mapping against shard %s\n", shards[k]);
+		loadindex(shards[k], loadpolicy, &li, loadreport);
+		output = outputs[k];
+		f = fopen(queryfile, "r");
+		if (f == NULL) {
+			fprintf(stderr, "mapshards: Cannot open file %s.\n", queryfile);
+			exit (1);
 		}
-	}
-	if (s && q) {
-		unsigned sp, qp, i;
-		/* Print alignment */
-		sp = 0;
-		qp = 0;
-		qi = qlen - 1;
-		si = slen - 1;
-		while (si >= lasts) {
-			s[sp++] = seq[si--];
-			q[qp++] = '-';
+		nqueries = mapperwrapper(f, &li, mmis, d, chr, nchr, NULL, NULL);
+		fclose(f);
+		fflush(output);
+		unloadindex(&li);
+		if (parallel) _exit(0);
+		/* Only one shard (with its chromosomes) is kept in memory at a time */
+		for (i = 0; i < nchr; i++) {
+			free(chr[i].sequence);
+			free(chr[i].packed);
+			free(chr[i].nmask);
+			chr[i].sequence = NULL;
+			chr[i].packed = chr[i].nmask = NULL;
 		}
-		while ((qi >= 0) || (si >= 0)) {
-			unsigned dl, dtl, dt;
-			dl = (qi > 0) ? d[si * (qlen + 1) + qi - 1] : 99;
-			dtl = ((qi > 0) && (si > 0)) ? d[(si - 1) * (qlen + 1) + qi - 1] : 99;
-			dt = (si > 0) ? d[(si - 1) * (qlen + 1) + qi] : 99;
-			if (qi < 0) {
-				/* End of query */
-				s[sp++] = seq[si--];
-				q[qp++] = '-';
-			} else if (si < 0) {
-				/* End of sequence */
-				s[sp++] = '-';
-				q[qp++] = query[qi--];
-			} else if (qi == 0) {
-				s[sp++] = seq[si--];
-				q[qp++] = query[qi--];
-			} else if ((dtl <= dl) && (dtl <= dt)) {
-				/* Match or ungapped mismatch */
-				s[sp++] = seq[si--];
-				q[qp++] = query[qi--];
-			} else if (si == 0) {
-				s[sp++] = seq[si--];
-				q[qp++] = '-';
-			} else if ((dl <= dtl) && (dl <= dt)) {
-				/* Gap in sequence */
-				s[sp++] = '-';
-				q[qp++] = query[qi--];
-			} else {
-				/* Gap in query */
-				s[sp++] = seq[si--];
-				q[qp++] = '-';
+	}
+	if (parallel) {
+		for (k = 0; k < nshards; k++) {
+			int status;
+			waitpid(pids[k], &status, 0);
+			if (!WIFEXITED(status) || WEXITSTATUS(status)) {
+				fprintf(stderr, "mapshards: Mapping against shard %s failed.\n", shards[k]);
+				exit (1);
 			}
 		}
-		for (i = 0; i < qp / 2; i++) {
-			char t = q[i];
-			q[i] = q[qp - 1 - i];
-			q[qp - 1 - i] = t;
+		/* Count queries the same way mapperwrapper does */
+		f = fopen(queryfile, "r");
+		if (f == NULL) {
+			fprintf(stderr, "mapshards: Cannot open file %s.\n", queryfile);
+			exit (1);
 		}
-		for (i = 0; i < sp / 2; i++) {
-			char t = s[i];
-			s[i] = s[sp - 1 - i];
-			s[sp - 1 - i] = t;
+		while (fscanf(f, "%*s") != EOF) nqueries += 1;
+		fclose(f);
+	}
+
+	output = savedoutput;
+	reportunmapped = 1;
+	for (k = 0; k < nshards; k++) rewind(outputs[k]);
+	mergeshardoutputs(outputs, nshards, nqueries);
+	for (k = 0; k < nshards; k++) {
+		fclose(outputs[k]);
+		free(shards[k]);
+	}
+	free(shards);
+	free(outputs);
+	free(pids);
+}
+
+/* Read next result line of shard, returns 0 at the end of file */
+static unsigned nextshardline(FILE *f, char *line, unsigned *qidx, unsigned *strand)
+{
+	while (fgets(line, 1024, f)) {
+		unsigned len = strlen(line);
+		if (len < 2) continue;
+		*qidx = strtol(line, NULL, 10);
+		*strand = (line[len - 2] == 'R');
+		return 1;
+	}
+	return 0;
+}
+
+/*
+ * Shards are in the order of genome and every shard gives forward hits before reverse hits of query,
+ * so the order of single index is restored by taking forward hits of all shards and then reverse hits
+ */
+static void mergeshardoutputs(FILE **files, unsigned nfiles, unsigned nqueries)
+{
+	char (*lines)[1024];
+	unsigned *qidx, *strand, *has;
+	unsigned k, query, s;
+
+	lines = (char (*)[1024]) malloc(nfiles * sizeof(*lines));
+	qidx = (unsigned *) malloc(nfiles * sizeof(unsigned));
+	strand = (unsigned *) malloc(nfiles * sizeof(unsigned));
+	has = (unsigned *) malloc(nfiles * sizeof(unsigned));
+
+	for (k = 0; k < nfiles; k++) {
+		has[k] = nextshardline(files[k], lines[k], &qidx[k], &strand[k]);
+	}
+	for (query = 0; query < nqueries; query++) {
+		unsigned nmatched = 0;
+		for (s = 0; s < 2; s++) {
+			for (k = 0; k < nfiles; k++) {
+				while (has[k] && (qidx[k] == query) && (strand[k] == s)) {
+					fputs(lines[k], output);
+					nmatched += 1;
+					has[k] = nextshardline(files[k], lines[k], &qidx[k], &strand[k]);
+				}
+			}
 		}
-		s[sp] = 0;
-		q[qp] = 0;
+		if (!nmatched && reportunmapped) fprintf (stderr, "%d\t-\n", query);
 	}
-	return dist;
+
+	free(lines);
+	free(qidx);
+	free(strand);
+	free(has);
 }
 
-void printindex(const char *data)
+/*
+ * Open output file, with --resume and existing checkpoint the output is cut back to the checkpoint
+ * (results written after it are mapped again) and cp tells where to continue
+ */
+static void openoutput(const char *queryfile, checkpoint *cp)
 {
-	unsigned *words, *starts, *locations;
-	unsigned wordlength, nwords, nlocations;
-	info *h;
-	unsigned i, j;
-
-	h = (info *)data;
-	wordlength = h->wordsize;
-	nwords = h->nwords;
-	nlocations = h->nlocations;
-
-	words = (unsigned *)(data + sizeof(info));
-	starts = (unsigned *)(data + sizeof(info) + nwords * sizeof(unsigned));
-	locations = (unsigned *)(data + sizeof(info) + nwords * sizeof(unsigned) + nwords * sizeof(unsigned));
-
-	for (i = 0; i < nwords - 1; ++i) {
-		fprintf(stdout, "%s\t%u\n", word2string(words[i], wordlength), starts[i]);
-		for (j = starts[i]; j < starts[i + 1]; ++j) {
-			fprintf(stdout, "%u ", locations[j]);
+	struct stat st;
+	FILE *f;
+
+	snprintf(cp->file, sizeof(cp->file), "%s.checkpoint", outputfile);
+	if (checkpointinterval && !realpath(queryfile, cp->queryfile)) {
+		fprintf(stderr, "Cannot open file %s.\n", queryfile);
+		exit (1);
+	}
+	if (resume && ((f = fopen(cp->file, "r")) != NULL)) {
+		char name[PATH_MAX];
+		if (fscanf(f, "%u %llu %llu %4095[^\n]", &cp->nextquery, &cp->inputoffset, &cp->outputoffset, name) != 4) {
+			fprintf(stderr, "Error: Invalid checkpoint file %s!\n", cp->file);
+			exit (1);
 		}
-		fprintf(stdout, "\n");
+		fclose(f);
+		if (strcmp(name, cp->queryfile)) {
+			fprintf(stderr, "Error: Checkpoint %s is of another query file (%s)!\n", cp->file, name);
+			exit (1);
+		}
+		output = fopen(outputfile, "r+");
+		if ((output == NULL) || fstat(fileno(output), &st) || ((unsigned long long) st.st_size < cp->outputoffset)) {
+			fprintf(stderr, "Error: Output file %s is shorter than its checkpoint!\n", outputfile);
+			exit (1);
+		}
+		if (ftruncate(fileno(output), cp->outputoffset) || fseeko(output, 0, SEEK_END)) {
+			fprintf(stderr, "Cannot truncate file %s.\n", outputfile);
+			exit (1);
+		}
+		fprintf(stderr, "Resuming from query %u\n", cp->nextquery);
+		return;
 	}
-	fprintf(stdout, "%s\t%u\n", word2string(words[i], wordlength), starts[i]);
-	for (j = starts[i]; j < nlocations; ++j) {
-		fprintf(stdout, "%u ", locations[j]);
+	output = fopen(outputfile, "w");
+	if (output == NULL) {
+		fprintf(stderr, "Cannot open file %s.\n", outputfile);
+		exit (1);
 	}
-	fprintf(stdout, "\n");
-
 }
 
-const char* filemmap(const char *filename, struct stat *st)
+/* Write results to disk, then checkpoint through temporary file so that it always describes complete output */
+static void savecheckpoint(checkpoint *cp)
 {
-	int status, handle;
-	const char *data;
+	char part[PATH_MAX + 40];
+	FILE *f;
 
-	/* memory-mapping a file */
-	status = stat(filename, st);
-	if (status < 0) {
-		fprintf (stderr, "Cannot get the statistics of file %s!\n", filename);
+	fflush(erroutput);
+	if (fflush(output) || fdatasync(fileno(output))) {
+		fprintf(stderr, "Cannot write file %s.\n", outputfile);
 		exit (1);
 	}
-	handle = open(filename, O_RDONLY);
-	if (handle < 0) {
-		fprintf (stderr, "Cannot open file %s!\n", filename);
+	cp->outputoffset = ftello(output);
+	snprintf(part, sizeof(part), "%s.part", cp->file);
+	f = fopen(part, "w");
+	if (f == NULL) {
+		fprintf(stderr, "Cannot create file %s.\n", part);
 		exit (1);
 	}
-	data = (const char *) mmap(NULL, st->st_size, PROT_READ, MAP_SHARED, handle, 0);
-	if (data == (const char *) -1) {
-		fprintf (stderr, "Cannot memory-map file %s!\n", filename);
+	fprintf(f, "%u %llu %llu %s\n", cp->nextquery, cp->inputoffset, cp->outputoffset, cp->queryfile);
+	if (fflush(f) || fsync(fileno(f)) || fclose(f) || rename(part, cp->file)) {
+		fprintf(stderr, "Cannot write file %s.\n", cp->file);
 		exit (1);
 	}
-	close(handle);
+	clock_gettime(CLOCK_MONOTONIC, &cp->saved);
+	if (debug > 0) fprintf(stderr, "Checkpoint: query %u, input %llu, output %llu\n", cp->nextquery, cp->inputoffset, cp->outputoffset);
+}
 
-	return data;
+/* Called by pipeline writer after every batch, saves checkpoint once per interval */
+static void checkpointbatch(unsigned nqueries, unsigned long long inputoffset, void *arg)
+{
+	checkpoint *cp = (checkpoint *) arg;
+	struct timespec now;
+	cp->nextquery = queryoffset + nqueries;
+	cp->inputoffset = inputoffset;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if (now.tv_sec - cp->saved.tv_sec >= (time_t) checkpointinterval) savecheckpoint(cp);
 }
 
 void printhelp()
 {
 	fprintf(stdout, "\n");
-	fprintf(stdout, "%s, %s\t%s\n", "-i", "--input", "Index file (output of the Indexer)");
+	fprintf(stdout, "%s, %s\t%s\n", "-i", "--input", "Index file (output of the Indexer, k-mer or FM index)");
 	fprintf(stdout, "%s, %s\t%s\n", "-g", "--genome", "Chromosome names file (output of the Indexer)");
 	fprintf(stdout, "%s, %s\t%s\n", "-q", "--query", "File containing the list of queries (newline delimited)");
+	fprintf(stdout, "%s, %s\t%s\n", "-o", "--output", "Output file, default: standard output");
 	fprintf(stdout, "%s, %s\t%s\n", "-mm", "--mismatches", "Number of allowed mismatches, default: 0");
 	fprintf(stdout, "%s, %s\t%s\n", "-step", " ", "Used for cutting queries into seeds, default: 5");
+	fprintf(stdout, "%s, %s\t%s\n", "-t", "--threads", "Number of mapping threads, default: 1");
+	fprintf(stdout, "%s\t\t%s\n", "--batch", "Number of queries passed between reader, mapping and writer threads at once, default: 1024");
+	fprintf(stdout, "%s\t%s\n", "--max-candidates", "Maximum number of candidates verified per query strand, 0 - no limit, default: 10000");
+	fprintf(stdout, "%s\t%s\n", "--overflow", "Query strands with more candidates: truncate (verify the first ones) or skip (verify none), default: truncate");
+	fprintf(stdout, "%s\t%s\n", "--min-seed", "Shortest SMEM seed used with FM index (indexer --fm), shorter for queries that need it, default: 19");
+	fprintf(stdout, "%s\t%s\n", "--candidates", "Candidate search: merge (of sorted seed locations) or diagonal (binning of seed hits), default: merge");
+	fprintf(stdout, "%s\t%s\n", "--cutoff-shift", "Added to the number of seeds confirming candidate, negative - more candidates, default: 0");
+	fprintf(stdout, "%s\t%s\n", "--autotune", "Choose -step, --candidates and --cutoff-shift by mapping the first 2000 queries");
+	fprintf(stdout, "%s\t%s\n", "--autotune-target", "Percent of the hits of the setting with most hits that chosen setting has to find, default: 99");
+	fprintf(stdout, "%s\t%s\n", "--autotune-save", "Write the chosen settings to file instead of mapping");
+	fprintf(stdout, "%s\t%s\n", "--no-indels", "Allow only mismatches (-mm is the number of substitutions)");
+	fprintf(stdout, "%s\t\t%s\n", "--long", "Long read mode: chain seed anchors and align only the gaps between them (no query length limit)");
+	fprintf(stdout, "%s\t%s\n", "--max-error", "Maximum percent of errors of long read hit, default: 15");
+	fprintf(stdout, "%s\t\t%s\n", "--score", "Use local alignment with affine gaps: match,mismatch,gapopen,gapextend (e.g. 1,4,6,1)");
+	fprintf(stdout, "%s\t%s\n", "--min-score", "Minimum alignment score of hit, default: query length * match - mm * (match + mismatch)");
+	fprintf(stdout, "%s\t\t%s\n", "--simd", "Instruction set of alignment: auto, avx2, sse2 or scalar, default: auto");
+	fprintf(stdout, "%s\t%s\n", "--prefilter", "Reject candidates by q-gram count before alignment (edit distance only)");
+	fprintf(stdout, "%s\t\t%s\n", "--cache", "Memory (MB) for caching the results of repeated queries, default: 0 (no cache)");
+	fprintf(stdout, "%s\t%s\n", "--checkpoint", "Seconds between checkpoints of progress (written to <output>.checkpoint, needs -o)");
+	fprintf(stdout, "%s\t%s\n", "--resume", "Continue from the checkpoint of output file (from the beginning if there is none), checkpoints every 60 s by default");
+	fprintf(stdout, "%s\t\t%s\n", "--sort", "Write hits sorted by chromosome (in the order of names file) and position");
+	fprintf(stdout, "%s\t%s\n", "--sort-memory", "Memory (MB) for sorting, larger outputs are merged from temporary files in TMPDIR, default: 1024");
+	fprintf(stdout, "%s, %s\t%s\n", "-rv", "--region-verify", "Reject candidates by aligning only the query regions not confirmed by seeds (hits are aligned fully)");
+	fprintf(stdout, "%s, %s\t%s\n", "-s", "--shards", "Shard set file (output of the Indexer with --shards), used instead of -i");
+	fprintf(stdout, "%s\t\t%s\n", "--load", "Index loading: lazy, populate, mlock, hugepages, hugetlb or numa, default: lazy");
+	fprintf(stdout, "%s\t%s\n", "--shard-mode", "serial (one shard in memory at a time) or parallel (process per shard), default: serial");
+	fprintf(stdout, "%s\t%s\n", "--processes", "Number of mapping processes, query file is split into chunks between them, default: 1");
+	fprintf(stdout, "%s\t%s\n", "--chunks", "Number of chunks query file is split into, default: 4 per process");
+	fprintf(stdout, "%s\t\t%s\n", "--spool", "Directory (empty, on shared filesystem) through which chunks are passed to workers on other hosts");
+	fprintf(stdout, "%s\t%s\n", "--spool-lease", "Seconds after which the chunk of silent worker (on other host) is mapped again, 0 - never, default: 60");
+	fprintf(stdout, "%s\t%s\n", "--spool-worker", "Map chunks of given spool directory until none is left (with the same options as the coordinator)");
 	fprintf(stdout, "\n");
 }
 
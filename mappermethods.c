@@ -5,6 +5,7 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <malloc.h>
 
@@ -15,18 +16,94 @@
 typedef unsigned u32;
 
 /*
- * Per seed location function
+ * Seeding and merge functions are written as bodies that are always inlined, so that the kernels
+ * instantiated for common word lengths and steps (see select_find_candidates) get them as constants
+ */
+#define KERNEL __attribute__((always_inline))
+
+static inline KERNEL u32 get_seeds_body (const char *query, u32 qlen, u32 *words, u32 nwords, const u32 wordlen, const u32 m, u32 *seeds);
+static inline KERNEL u32 get_canonical_seeds_body (const char *query, u32 qlen, u32 *words, u32 nwords, const u32 wordlen, const u32 m, u32 *seeds, u32 *flags);
+
+/*
+ * Remove the part of query covered by confirming seed from the mismatched regions of candidate
+ * Seeds have to be processed in the order of increasing query offset
  *
- * n          - index of current seed
- * locations  - list of all locations in genome
- * pos        - per seed array of indices into locations
- * m          - step between seeds
+ * cand       - current candidate
+ * sloc       - offset of seed in query
+ * wordlen    - word length
+ * minloc     - the match location of candidate
+ */
+
+static void update_regions (candidate *cand, int sloc, u32 wordlen, u32 minloc) {
+	if ((sloc > (int) cand->reg[cand->nregions - 1].qstart) && ((sloc + wordlen) < cand->reg[cand->nregions - 1].qend)) {
+		/* Split region, if there is no room for new region the seed is ignored so that regions still cover all unconfirmed positions */
+		if (cand->nregions < MAX_REGIONS) {
+			cand->reg[cand->nregions - 1].qend = sloc;
+			cand->nregions += 1;
+			cand->reg[cand->nregions - 1].loc = minloc + sloc + wordlen;
+			cand->reg[cand->nregions - 1].qstart = sloc + wordlen;
+			cand->reg[cand->nregions - 1].qend = cand->length;
+		}
+	} else if (sloc > (int) cand->reg[cand->nregions - 1].qstart) {
+		/* Clip region end */
+		cand->reg[cand->nregions - 1].qend = sloc;
+	} else if ((sloc + wordlen) < cand->reg[cand->nregions - 1].qend) {
+		/* Clip region start */
+		cand->reg[cand->nregions - 1].qstart = sloc + wordlen;
+		cand->reg[cand->nregions - 1].loc = minloc + sloc + wordlen;
+	}
+}
+
+/* Diagonal of seed hit at loc, query offset qoff; hits of queries that would start before the genome go to diagonal 0 */
+static inline u32 hit_diagonal (u32 loc, u32 qoff) {
+	return (loc >= qoff) ? loc - qoff : 0;
+}
+
+/*
+ * Minimum number of seeds confirming candidate, every mismatch can destroy ceil(wordlen / m) seeds
+ * shift is added to the lossless value (more candidates if negative, fewer if positive)
+ */
+
+static inline int seed_cutoff (u32 nseeds, u32 wordlen, u32 m, u32 mmis, int shift) {
+	int cutoff = (wordlen % m == 0) ? (int) (nseeds - (wordlen / m) * mmis) : (int) (nseeds - (wordlen / m + 1) * mmis);
+	cutoff += shift;
+	return (cutoff <= 0) ? 1 : cutoff;
+}
+
+/* Empty the candidate array of query block before new search */
+
+static inline void clear_candidates (queryblock *qb) {
+	qb->ncandidates = 0;
+	qb->nstrand[0] = qb->nstrand[1] = 0;
+	qb->overflow = 0;
+}
+
+/*
+ * Append candidate to the (growable) candidate array of query block
+ * max_candidates is the limit per strand, 0 means no limit
  *
- * returns    - the match location of given seed (from locations array)
+ * returns    - 0 if there was no room for the strand of candidate (its bit is set in qb->overflow), 1 otherwise
  */
 
-u32 loc (u32 n, u32 *locations, u32 *pos, u32 m) {
-	return locations[pos[n]] - n * m;
+static int add_candidate (queryblock *qb, const candidate *cand, u32 max_candidates) {
+	if (max_candidates && (qb->nstrand[cand->strand] >= max_candidates)) {
+		qb->overflow |= 1 << cand->strand;
+		return 0;
+	}
+	if (qb->ncandidates >= qb->ncandidate_slots) {
+		qb->ncandidate_slots = (qb->ncandidate_slots) ? 2 * qb->ncandidate_slots : 64;
+		if (max_candidates && (qb->ncandidate_slots > 2 * max_candidates)) qb->ncandidate_slots = 2 * max_candidates;
+		qb->candidates = (candidate *) realloc (qb->candidates, qb->ncandidate_slots * sizeof (candidate));
+	}
+	qb->candidates[qb->ncandidates++] = *cand;
+	qb->nstrand[cand->strand] += 1;
+	return 1;
+}
+
+/* Whether the search of both strands (nstrands 2) or of one strand (nstrands 1) cannot add more candidates */
+
+static inline int candidates_full (const queryblock *qb, u32 nstrands) {
+	return (nstrands == 1) ? (qb->overflow != 0) : (qb->overflow == 3);
 }
 
 /* Find all candidate locations of given query
@@ -40,27 +117,30 @@ u32 loc (u32 n, u32 *locations, u32 *pos, u32 m) {
  * wordlen    - word length
  * m          - step between seeds
  * seeds      - array where seeds will be written (has to be big enough to fit all)
- * candidates - array where candidate locations will be written
- * max_candidates - the size of candidate array
- * cutoff     - minimum ratio of confirming seeds to consider given position as candidate
+ * qb         - query and the growable array where candidates are written
+ * max_candidates - maximum number of candidates per strand (0 - no limit), qb->overflow is set if there are more
+ * mmis       - maximum number of mismatches (gives the minimum number of confirming seeds)
+ * maxshift   - maximum distance of confirming seed diagonal from candidate (mmis, 0 without indels)
  *
  * returns    - number of candidate locations
  */
 
-u32 find_candidates (queryblock *qb, u32 *words, u32 nwords, u32 *starts, u32 *locations, u32 nlocations, u32 wordlen, u32 m, u32 *seeds, u32 max_candidates, u32 mmis) {
+static inline KERNEL u32 find_candidates_body (queryblock *qb, u32 *words, u32 nwords, u32 *starts, u32 *locations, u32 nlocations, const u32 wordlen, const u32 m, u32 *seeds, u32 max_candidates, u32 mmis, u32 maxshift) {
 	/* Per seed arrays */
 	/* pos is index into locations array we are currently processing */
-	static u32 *pos = NULL;
+	static __thread u32 *pos = NULL;
 	/* end is the end index (one past last) of givevn seed locations */
-	static u32 *end = NULL;
-	static u32 possize = 0;
-	u32 nseeds, i, minloc, ncandidates;
+	static __thread u32 *end = NULL;
+	static __thread u32 possize = 0;
+	u32 qlen, nseeds, i, minloc;
 	int minn;
 	int cutoff;
 
-	nseeds = get_seeds (qb->query, words, nwords, wordlen, m, seeds);
-	cutoff = (wordlen % m == 0) ? nseeds - (wordlen / m) * mmis : nseeds - (wordlen / m + 1) * mmis;
-	if (cutoff <= 0) cutoff = 1;
+	clear_candidates (qb);
+	qlen = (u32) strlen (qb->query);
+	if (qlen <= wordlen) return 0;
+	nseeds = get_seeds_body (qb->query, qlen, words, nwords, wordlen, m, seeds);
+	cutoff = seed_cutoff (nseeds, wordlen, m, mmis, qb->cutoffshift);
 	if (debug) fprintf(stderr, "Siide: %u, cutoff: %d\n", nseeds, cutoff);
 
 	if (nseeds == 0) {
@@ -103,8 +183,7 @@ u32 find_candidates (queryblock *qb, u32 *words, u32 nwords, u32 *starts, u32 *l
 	}
 
 	/* Main iteration */
-	ncandidates = 0;
-	while (ncandidates < max_candidates) {
+	for (;;) {
 		int nfound;
 		/* Find minimum n */
 		minn = -1;
@@ -112,7 +191,7 @@ u32 find_candidates (queryblock *qb, u32 *words, u32 nwords, u32 *starts, u32 *l
 		for (i = 0; i < nseeds; i++) {
 			if (seeds[i] == nwords) continue;
 			if (pos[i] < end[i]) {
-				u32 l = loc (i, locations, pos, m);
+				u32 l = hit_diagonal (locations[pos[i]], i * m);
 				if ((minloc == 0xffffffff) || (l < minloc)) {
 					minn = i;
 					minloc = l;
@@ -129,7 +208,9 @@ u32 find_candidates (queryblock *qb, u32 *words, u32 nwords, u32 *starts, u32 *l
 		candidate cand;
 		cand.loc = minloc;
 		cand.mmis = 0;
-		cand.length = (unsigned) strlen(qb->query);
+		cand.length = qlen;
+		cand.strand = 0;
+		cand.shift = 0;
 		cand.nregions = 1;
 		cand.reg[0].loc = minloc;
 		cand.reg[0].qstart = 0;
@@ -139,31 +220,14 @@ u32 find_candidates (queryblock *qb, u32 *words, u32 nwords, u32 *starts, u32 *l
 		for (i = 0; i < nseeds; i++) {
 			if (seeds[i] == nwords) continue;
 			if (pos[i] < end[i]) {
-				u32 l = loc (i, locations, pos, m);
+				u32 l = hit_diagonal (locations[pos[i]], i * m);
 				int delta = (long long) l - (long long) minloc;
-				if ((delta >= -(int) mmis) && (delta <= (int) mmis)) {
-					int sloc;
+				if ((delta >= -(int) maxshift) && (delta <= (int) maxshift)) {
 					/* This seed confirms given location */
 					nfound += 1;
+					if ((unsigned) abs (delta) > cand.shift) cand.shift = abs (delta);
 					/* Update query region list */
-					sloc = m * i;
-					if ((sloc > cand.reg[cand.nregions - 1].qstart) && ((sloc + wordlen) < cand.reg[cand.nregions - 1].qend)) {
-						/* Split region */
-						cand.reg[cand.nregions - 1].qend = sloc;
-						if (cand.nregions < MAX_REGIONS) {
-							cand.nregions += 1;
-							cand.reg[cand.nregions - 1].loc = minloc + sloc + wordlen;
-							cand.reg[cand.nregions - 1].qstart = sloc + wordlen;
-							cand.reg[cand.nregions - 1].qend = cand.length;
-						}
-					} else if (sloc > cand.reg[cand.nregions - 1].qstart) {
-						/* Clip region end */
-						cand.reg[cand.nregions - 1].qend = sloc;
-					} else if ((sloc + wordlen) < cand.reg[cand.nregions - 1].qend) {
-						/* Clip region start */
-						cand.reg[cand.nregions - 1].qstart = sloc + wordlen;
-						cand.reg[cand.nregions - 1].loc = minloc + sloc + wordlen;
-					}
+					update_regions (&cand, m * i, wordlen, minloc);
 					/* Advance pos value */
 					pos[i] += 1;
 					if (debug > 1) fprintf (stderr, "%u ", i);
@@ -176,14 +240,761 @@ u32 find_candidates (queryblock *qb, u32 *words, u32 nwords, u32 *starts, u32 *l
 			cand.nregions -= 1;
 		}
 		if (nfound >= cutoff) {
-			qb->candidates[ncandidates++] = cand;
+			if (!add_candidate (qb, &cand, max_candidates)) break;
 			if (debug > 1) {
 				fprintf (stderr, "Found candidate location %u\n", minloc);
 			}
 		}
 	}
 
-	return ncandidates;
+	return qb->ncandidates;
+}
+
+/* Seed flags of canonical index */
+#define SEED_REVERSE 1
+#define SEED_PALINDROME 2
+
+/* Number of previous anchors tried as the predecessor of anchor in chaining */
+#define CHAIN_MAX_PREDECESSORS 50
+
+/* SMEM seeds of FM index with more occurrences are skipped */
+#define FM_MAX_OCCURRENCES 500
+
+/* Find all candidate locations of given query in canonical index
+ *
+ * Single seed lookup and single merge pass give candidates for both strands. Every seed has two
+ * streams of locations - one for forward and one for reverse complement query. The strand of
+ * a location is the strand bit of location XOR the strand of query word.
+ * Candidates of reverse complement query have strand 1.
+ *
+ * Arguments are the same as for find_candidates
+ *
+ * returns    - number of candidate locations
+ */
+
+static inline KERNEL u32 find_candidates_canonical_body (queryblock *qb, u32 *words, u32 nwords, u32 *starts, u32 *locations, u32 nlocations, const u32 wordlen, const u32 m, u32 *seeds, u32 max_candidates, u32 mmis, u32 maxshift) {
+	/* Per stream arrays */
+	static __thread u32 *pos = NULL;
+	static __thread u32 *end = NULL;
+	/* offset of seed in forward or reverse complement query */
+	static __thread u32 *qoff = NULL;
+	static __thread u32 *flags = NULL;
+	static __thread u32 possize = 0;
+	u32 qlen, nseeds, nstreams, i, minloc;
+	int minn;
+	int cutoff;
+
+	clear_candidates (qb);
+	qlen = (u32) strlen (qb->query);
+	if (qlen <= wordlen) return 0;
+	/* The same number of seeds get_seeds would give */
+	nseeds = (qlen - wordlen + m - 1) / m;
+	nstreams = 2 * nseeds;
+	if (nstreams > possize) {
+		possize = nstreams;
+		pos = (u32 *) realloc (pos, possize * sizeof (u32));
+		end = (u32 *) realloc (end, possize * sizeof (u32));
+		qoff = (u32 *) realloc (qoff, possize * sizeof (u32));
+		flags = (u32 *) realloc (flags, possize * sizeof (u32));
+	}
+
+	nseeds = get_canonical_seeds_body (qb->query, qlen, words, nwords, wordlen, m, seeds, flags);
+	cutoff = seed_cutoff (nseeds, wordlen, m, mmis, qb->cutoffshift);
+	if (debug) fprintf(stderr, "Seeds: %u, cutoff: %d\n", nseeds, cutoff);
+
+	if (nseeds == 0) {
+		if (debug) fprintf (stderr, "Query %s gave 0 seeds\n", qb->query);
+		return 0;
+	}
+
+	/*
+	 * Streams 0..nseeds-1 are forward seeds in query order,
+	 * streams nseeds..2*nseeds-1 are reverse complement seeds in the order of reverse complement query
+	 */
+	for (i = 0; i < nstreams; i++) {
+		u32 s = (i < nseeds) ? i : nstreams - 1 - i;
+		u32 strand = (i < nseeds) ? 0 : 1;
+		qoff[i] = (strand) ? qlen - s * m - wordlen : s * m;
+		if (seeds[s] == nwords) {
+			pos[i] = end[i] = 0;
+			continue;
+		}
+		pos[i] = starts[seeds[s]];
+		end[i] = (seeds[s] < (nwords - 1)) ? starts[seeds[s] + 1] : nlocations;
+		/* Skip the locations of other strand */
+		if (!(flags[s] & SEED_PALINDROME)) {
+			while ((pos[i] < end[i]) && (((locations[pos[i]] ^ flags[s]) & 1) != strand)) pos[i] += 1;
+		}
+	}
+
+	/* Main iteration */
+	for (;;) {
+		int nfound;
+		u32 strand;
+		minn = -1;
+		minloc = 0xffffffff;
+		for (i = 0; i < nstreams; i++) {
+			if (pos[i] < end[i]) {
+				u32 l = hit_diagonal (locations[pos[i]] >> 1, qoff[i]);
+				if ((minloc == 0xffffffff) || (l < minloc)) {
+					minn = i;
+					minloc = l;
+				}
+			}
+		}
+		if (minn < 0) {
+			/* No more locations for any seed */
+			break;
+		}
+		strand = ((u32) minn < nseeds) ? 0 : 1;
+		candidate cand;
+		cand.loc = minloc;
+		cand.mmis = 0;
+		cand.length = qlen;
+		cand.strand = strand;
+		cand.shift = 0;
+		cand.nregions = 1;
+		cand.reg[0].loc = minloc;
+		cand.reg[0].qstart = 0;
+		cand.reg[0].qend = cand.length;
+		nfound = 0;
+		/* Only the streams of the same strand can confirm candidate */
+		for (i = strand * nseeds; i < (strand + 1) * nseeds; i++) {
+			if (pos[i] < end[i]) {
+				u32 l = hit_diagonal (locations[pos[i]] >> 1, qoff[i]);
+				int delta = (long long) l - (long long) minloc;
+				if ((delta >= -(int) maxshift) && (delta <= (int) maxshift)) {
+					u32 s = (strand) ? nstreams - 1 - i : i;
+					nfound += 1;
+					if ((unsigned) abs (delta) > cand.shift) cand.shift = abs (delta);
+					update_regions (&cand, qoff[i], wordlen, minloc);
+					/* Advance to the next location of the same strand */
+					pos[i] += 1;
+					if (!(flags[s] & SEED_PALINDROME)) {
+						while ((pos[i] < end[i]) && (((locations[pos[i]] ^ flags[s]) & 1) != strand)) pos[i] += 1;
+					}
+				}
+			}
+		}
+		if ((cand.reg[cand.nregions - 1].qstart >= cand.length) || (cand.reg[cand.nregions - 1].qend <= 0)) {
+			/* Region became empty */
+			cand.nregions -= 1;
+		}
+		if (nfound >= cutoff) {
+			/* The other strand may still have room */
+			if (!add_candidate (qb, &cand, max_candidates) && candidates_full (qb, 2)) break;
+			if (debug > 1) {
+				fprintf (stderr, "Found candidate location %u strand %u\n", minloc, strand);
+			}
+		}
+	}
+
+	return qb->ncandidates;
+}
+
+/* Generic versions (any word length and step) */
+
+u32 find_candidates (queryblock *qb, u32 *words, u32 nwords, u32 *starts, u32 *locations, u32 nlocations, u32 wordlen, u32 m, u32 *seeds, u32 max_candidates, u32 mmis, u32 maxshift) {
+	return find_candidates_body (qb, words, nwords, starts, locations, nlocations, wordlen, m, seeds, max_candidates, mmis, maxshift);
+}
+
+u32 find_candidates_canonical (queryblock *qb, u32 *words, u32 nwords, u32 *starts, u32 *locations, u32 nlocations, u32 wordlen, u32 m, u32 *seeds, u32 max_candidates, u32 mmis, u32 maxshift) {
+	return find_candidates_canonical_body (qb, words, nwords, starts, locations, nlocations, wordlen, m, seeds, max_candidates, mmis, maxshift);
+}
+
+/* Kernels with constant word length K and step M, wordlen and m arguments are ignored */
+#define SEEDING_KERNEL(K, M) \
+static u32 find_candidates_##K##_##M (queryblock *qb, u32 *words, u32 nwords, u32 *starts, u32 *locations, u32 nlocations, u32 wordlen, u32 m, u32 *seeds, u32 max_candidates, u32 mmis, u32 maxshift) { \
+	return find_candidates_body (qb, words, nwords, starts, locations, nlocations, K, M, seeds, max_candidates, mmis, maxshift); \
+} \
+static u32 find_candidates_canonical_##K##_##M (queryblock *qb, u32 *words, u32 nwords, u32 *starts, u32 *locations, u32 nlocations, u32 wordlen, u32 m, u32 *seeds, u32 max_candidates, u32 mmis, u32 maxshift) { \
+	return find_candidates_canonical_body (qb, words, nwords, starts, locations, nlocations, K, M, seeds, max_candidates, mmis, maxshift); \
+}
+
+#define SEEDING_KERNELS(K) \
+	SEEDING_KERNEL(K, 1) SEEDING_KERNEL(K, 2) SEEDING_KERNEL(K, 3) SEEDING_KERNEL(K, 4) SEEDING_KERNEL(K, 5) \
+	SEEDING_KERNEL(K, 6) SEEDING_KERNEL(K, 7) SEEDING_KERNEL(K, 8) SEEDING_KERNEL(K, 9) SEEDING_KERNEL(K, 10)
+
+SEEDING_KERNELS(10)
+SEEDING_KERNELS(12)
+SEEDING_KERNELS(14)
+SEEDING_KERNELS(16)
+
+#define SEEDING_STEPS 10
+
+typedef struct _seedingkernels {
+	u32 wordlen;
+	findcandidatesfunc forward[SEEDING_STEPS];
+	findcandidatesfunc canonical[SEEDING_STEPS];
+} seedingkernels;
+
+#define SEEDING_ROW(NAME, K) \
+	{ NAME##_##K##_1, NAME##_##K##_2, NAME##_##K##_3, NAME##_##K##_4, NAME##_##K##_5, \
+	  NAME##_##K##_6, NAME##_##K##_7, NAME##_##K##_8, NAME##_##K##_9, NAME##_##K##_10 }
+#define SEEDING_ENTRY(K) { K, SEEDING_ROW(find_candidates, K), SEEDING_ROW(find_candidates_canonical, K) }
+
+static const seedingkernels seedingtable[] = {
+	SEEDING_ENTRY(10),
+	SEEDING_ENTRY(12),
+	SEEDING_ENTRY(14),
+	SEEDING_ENTRY(16)
+};
+
+/*
+ * Choose candidate search function for index and step (done once before mapping)
+ *
+ * wordlen    - word length of index
+ * m          - step between seeds
+ * canonical  - index has canonical words
+ *
+ * returns    - specialized kernel if there is one for given word length and step, generic function otherwise
+ */
+
+findcandidatesfunc select_find_candidates (u32 wordlen, u32 m, u32 canonical) {
+	u32 i;
+	for (i = 0; i < sizeof (seedingtable) / sizeof (seedingtable[0]); i++) {
+		if ((seedingtable[i].wordlen == wordlen) && (m >= 1) && (m <= SEEDING_STEPS)) {
+			return (canonical) ? seedingtable[i].canonical[m - 1] : seedingtable[i].forward[m - 1];
+		}
+	}
+	return (canonical) ? find_candidates_canonical : find_candidates;
+}
+
+/*
+ * Diagonal binning engine
+ *
+ * Every seed hit is stored as key (diagonal << 32) | (strand << 31) | query offset, diagonal is the
+ * location of query start. Hits are counted per band of 2^DIAGONAL_BAND_BITS diagonals in a hash table and
+ * only the hits of bands that (with their neighbours) have at least cutoff hits are kept and sorted. Candidates are
+ * then formed the same way as in merge: the smallest remaining diagonal together with at most one hit per
+ * seed within maxshift from it.
+ */
+
+#define DIAGONAL_BAND_BITS 5
+#define DIAGONAL_EMPTY 0xffffffff
+
+static __thread unsigned long long *dhits = NULL;
+static __thread unsigned long long *dsorted = NULL;
+static __thread u32 ndhits = 0;
+static __thread u32 ndhit_slots = 0;
+/* Vote table (at least twice the number of hits), bandpos is the position of band bucket in dsorted (DIAGONAL_EMPTY if band is dropped) */
+static __thread u32 *bandkeys = NULL;
+static __thread u32 *bandvotes = NULL;
+static __thread u32 *bandpos = NULL;
+static __thread unsigned long long *dbands = NULL;
+static __thread u32 nband_slots = 0;
+static __thread unsigned char *dused = NULL;
+static __thread u32 *dstamp = NULL;
+static __thread u32 nstamp_slots = 0;
+
+static inline void add_hit (u32 diag, u32 strand, u32 qoff) {
+	if (ndhits >= ndhit_slots) {
+		ndhit_slots = (ndhit_slots) ? 2 * ndhit_slots : 1024;
+		dhits = (unsigned long long *) realloc (dhits, ndhit_slots * sizeof (unsigned long long));
+		dsorted = (unsigned long long *) realloc (dsorted, ndhit_slots * sizeof (unsigned long long));
+		dused = (unsigned char *) realloc (dused, ndhit_slots);
+	}
+	dhits[ndhits++] = ((unsigned long long) diag << 32) | (strand << 31) | qoff;
+}
+
+static int compare_keys (const void *a, const void *b) {
+	unsigned long long x = *((const unsigned long long *) a), y = *((const unsigned long long *) b);
+	return (x < y) ? -1 : (x > y);
+}
+
+/* Slot of band in vote table (mask + 1 slots) */
+static inline u32 band_slot (u32 band, u32 mask) {
+	u32 h = (band * 2654435761U) & mask;
+	while ((bandkeys[h] != DIAGONAL_EMPTY) && (bandkeys[h] != band)) h = (h + 1) & mask;
+	return h;
+}
+
+static u32 band_votes (u32 band, u32 mask) {
+	u32 h = band_slot (band, mask);
+	return (bandkeys[h] == band) ? bandvotes[h] : 0;
+}
+
+/*
+ * Sort the hits of bands that may hold candidate into dsorted
+ * Hits are counted per band, then the hits of kept bands are scattered into per band buckets
+ * (in the order of bands) and every bucket is sorted separately
+ *
+ * returns    - number of kept hits
+ */
+
+static u32 bin_hits (int cutoff) {
+	u32 size = 64, mask, nbands, i, k, pos;
+
+	while (size < 2 * ndhits) size *= 2;
+	if (size > nband_slots) {
+		nband_slots = size;
+		bandkeys = (u32 *) realloc (bandkeys, nband_slots * sizeof (u32));
+		bandvotes = (u32 *) realloc (bandvotes, nband_slots * sizeof (u32));
+		bandpos = (u32 *) realloc (bandpos, nband_slots * sizeof (u32));
+		dbands = (unsigned long long *) realloc (dbands, nband_slots * sizeof (unsigned long long));
+	}
+	mask = size - 1;
+	memset (bandkeys, 0xff, size * sizeof (u32));
+	for (i = 0; i < ndhits; i++) {
+		u32 band = (u32) (dhits[i] >> (32 + DIAGONAL_BAND_BITS)), h = band_slot (band, mask);
+		if (bandkeys[h] == DIAGONAL_EMPTY) {
+			bandkeys[h] = band;
+			bandvotes[h] = 0;
+		}
+		bandvotes[h] += 1;
+	}
+	/* Candidate window (maxshift < band width) can reach only the neighbouring bands */
+	nbands = 0;
+	for (i = 0; i < size; i++) {
+		u32 band = bandkeys[i], votes;
+		if (band == DIAGONAL_EMPTY) continue;
+		bandpos[i] = DIAGONAL_EMPTY;
+		votes = bandvotes[i] + band_votes (band + 1, mask) + ((band > 0) ? band_votes (band - 1, mask) : 0);
+		if (votes >= (u32) cutoff) dbands[nbands++] = ((unsigned long long) band << 32) | i;
+	}
+	if (nbands == 0) return 0;
+	qsort (dbands, nbands, sizeof (unsigned long long), compare_keys);
+	pos = 0;
+	for (k = 0; k < nbands; k++) {
+		u32 h = (u32) dbands[k];
+		bandpos[h] = pos;
+		pos += bandvotes[h];
+	}
+	for (i = 0; i < ndhits; i++) {
+		u32 h = band_slot ((u32) (dhits[i] >> (32 + DIAGONAL_BAND_BITS)), mask);
+		if (bandpos[h] != DIAGONAL_EMPTY) dsorted[bandpos[h]++] = dhits[i];
+	}
+	/* bandpos of kept band is now the end of its bucket */
+	pos = 0;
+	for (k = 0; k < nbands; k++) {
+		u32 end = bandpos[(u32) dbands[k]];
+		if (end - pos > 16) {
+			qsort (dsorted + pos, end - pos, sizeof (unsigned long long), compare_keys);
+		} else {
+			for (i = pos + 1; i < end; i++) {
+				unsigned long long key = dsorted[i];
+				u32 j = i;
+				while ((j > pos) && (dsorted[j - 1] > key)) {
+					dsorted[j] = dsorted[j - 1];
+					j -= 1;
+				}
+				dsorted[j] = key;
+			}
+		}
+		pos = end;
+	}
+	return pos;
+}
+
+/*
+ * Make candidates of collected hits
+ *
+ * qb         - query block, candidates are written to its growable array
+ * qlen       - query length
+ * wordlen    - word length
+ * m          - step between seeds
+ * nseeds     - number of seeds (per strand)
+ * cutoff     - minimum number of confirming seeds
+ * max_candidates - maximum number of candidates per strand (0 - no limit), qb->overflow is set if there are more
+ * maxshift   - maximum distance of confirming seed diagonal from candidate
+ * nstrands   - number of strands among the hits (2 for canonical index)
+ *
+ * returns    - number of candidate locations
+ */
+
+static u32 diagonal_candidates (queryblock *qb, u32 qlen, u32 wordlen, u32 m, u32 nseeds, int cutoff, u32 max_candidates, u32 maxshift, u32 nstrands) {
+	unsigned long long *h = dsorted;
+	u32 nkept, p, c;
+
+	if (ndhits == 0) return 0;
+	nkept = bin_hits (cutoff);
+	if (nkept == 0) return 0;
+	memset (dused, 0, nkept);
+	if (2 * nseeds > nstamp_slots) {
+		nstamp_slots = 2 * nseeds;
+		dstamp = (u32 *) realloc (dstamp, nstamp_slots * sizeof (u32));
+	}
+	memset (dstamp, 0, 2 * nseeds * sizeof (u32));
+
+	p = 0;
+	c = 0;
+	while (p < nkept) {
+		static __thread u32 *group = NULL;
+		static __thread u32 ngroup_slots = 0;
+		u32 d0, strand, ngroup, j;
+		candidate cand;
+		if (dused[p]) {
+			p += 1;
+			continue;
+		}
+		d0 = (u32) (h[p] >> 32);
+		strand = (u32) (h[p] >> 31) & 1;
+		c += 1;
+		if (ngroup_slots < nseeds) {
+			ngroup_slots = nseeds;
+			group = (u32 *) realloc (group, ngroup_slots * sizeof (u32));
+		}
+		ngroup = 0;
+		for (j = p; (j < nkept) && ((h[j] >> 32) <= (unsigned long long) d0 + maxshift); j++) {
+			u32 qoff, stream;
+			if (dused[j] || ((((u32) (h[j] >> 31)) & 1) != strand)) continue;
+			qoff = (u32) h[j] & 0x7fffffff;
+			stream = strand * nseeds + ((strand) ? (qlen - wordlen - qoff) / m : qoff / m);
+			if (dstamp[stream] == c) continue;
+			dstamp[stream] = c;
+			dused[j] = 1;
+			group[ngroup++] = j;
+		}
+		if ((int) ngroup < cutoff) continue;
+		/* Regions are updated in the order of query offset */
+		for (j = 1; j < ngroup; j++) {
+			u32 g = group[j], k = j;
+			while ((k > 0) && ((h[group[k - 1]] & 0x7fffffff) > (h[g] & 0x7fffffff))) {
+				group[k] = group[k - 1];
+				k -= 1;
+			}
+			group[k] = g;
+		}
+		cand.loc = d0;
+		cand.mmis = 0;
+		cand.length = qlen;
+		cand.strand = strand;
+		cand.shift = 0;
+		cand.nregions = 1;
+		cand.reg[0].loc = d0;
+		cand.reg[0].qstart = 0;
+		cand.reg[0].qend = cand.length;
+		for (j = 0; j < ngroup; j++) {
+			u32 delta = (u32) (h[group[j]] >> 32) - d0;
+			if (delta > cand.shift) cand.shift = delta;
+			update_regions (&cand, (u32) h[group[j]] & 0x7fffffff, wordlen, d0);
+		}
+		if ((cand.reg[cand.nregions - 1].qstart >= cand.length) || (cand.reg[cand.nregions - 1].qend <= 0)) {
+			/* Region became empty */
+			cand.nregions -= 1;
+		}
+		if (!add_candidate (qb, &cand, max_candidates) && candidates_full (qb, nstrands)) break;
+	}
+	return qb->ncandidates;
+}
+
+/*
+ * Find all candidate locations of given query by diagonal binning
+ * Arguments and results are the same as of find_candidates
+ */
+
+u32 find_candidates_diagonal (queryblock *qb, u32 *words, u32 nwords, u32 *starts, u32 *locations, u32 nlocations, u32 wordlen, u32 m, u32 *seeds, u32 max_candidates, u32 mmis, u32 maxshift) {
+	u32 qlen, nseeds, i;
+	int cutoff;
+
+	clear_candidates (qb);
+	qlen = (u32) strlen (qb->query);
+	nseeds = get_seeds (qb->query, words, nwords, wordlen, m, seeds);
+	if (nseeds == 0) return 0;
+	cutoff = seed_cutoff (nseeds, wordlen, m, mmis, qb->cutoffshift);
+
+	ndhits = 0;
+	for (i = 0; i < nseeds; i++) {
+		u32 j, last;
+		if (seeds[i] == nwords) continue;
+		last = (seeds[i] < (nwords - 1)) ? starts[seeds[i] + 1] : nlocations;
+		for (j = starts[seeds[i]]; j < last; j++) add_hit (hit_diagonal (locations[j], i * m), 0, i * m);
+	}
+	return diagonal_candidates (qb, qlen, wordlen, m, nseeds, cutoff, max_candidates, maxshift, 1);
+}
+
+/*
+ * Find all candidate locations of given query in canonical index by diagonal binning
+ * Arguments and results are the same as of find_candidates_canonical
+ */
+
+u32 find_candidates_canonical_diagonal (queryblock *qb, u32 *words, u32 nwords, u32 *starts, u32 *locations, u32 nlocations, u32 wordlen, u32 m, u32 *seeds, u32 max_candidates, u32 mmis, u32 maxshift) {
+	static __thread u32 *flags = NULL;
+	static __thread u32 flagsize = 0;
+	u32 qlen, nseeds, s;
+	int cutoff;
+
+	clear_candidates (qb);
+	qlen = (u32) strlen (qb->query);
+	if (qlen <= wordlen) return 0;
+	if (qlen > flagsize) {
+		flagsize = qlen;
+		flags = (u32 *) realloc (flags, flagsize * sizeof (u32));
+	}
+	nseeds = get_canonical_seeds (qb->query, words, nwords, wordlen, m, seeds, flags);
+	if (nseeds == 0) return 0;
+	cutoff = seed_cutoff (nseeds, wordlen, m, mmis, qb->cutoffshift);
+
+	ndhits = 0;
+	for (s = 0; s < nseeds; s++) {
+		u32 j, last;
+		if (seeds[s] == nwords) continue;
+		last = (seeds[s] < (nwords - 1)) ? starts[seeds[s] + 1] : nlocations;
+		for (j = starts[seeds[s]]; j < last; j++) {
+			/* The strand of location relative to query, palindromes match both strands */
+			u32 strand = (locations[j] ^ flags[s]) & 1, fwd = s * m, rev = qlen - s * m - wordlen;
+			if (flags[s] & SEED_PALINDROME) {
+				add_hit (hit_diagonal (locations[j] >> 1, fwd), 0, fwd);
+				add_hit (hit_diagonal (locations[j] >> 1, rev), 1, rev);
+			} else {
+				add_hit (hit_diagonal (locations[j] >> 1, (strand) ? rev : fwd), strand, (strand) ? rev : fwd);
+			}
+		}
+	}
+	return diagonal_candidates (qb, qlen, wordlen, m, nseeds, cutoff, max_candidates, maxshift, 2);
+}
+
+/*
+ * Find candidate locations of both query strands from the SMEM seeds of FM index
+ *
+ * Every occurrence of seed gives the diagonal (location of query start) on the strand where it was found,
+ * occurrences in the reverse complement half of the text belong to the reverse complement of query.
+ * Hits are stored and sorted as in diagonal binning (with seed length in place of query offset), diagonals
+ * within maxshift from the first diagonal of group give one candidate if the group has a seed of at
+ * least minexact nucleotides. Seeds with more than FM_MAX_OCCURRENCES occurrences are skipped as repeats.
+ *
+ * qb         - query and the growable array where candidates are written
+ * fm         - FM index
+ * minlen     - minimum seed length
+ * max_candidates - maximum number of candidates per strand (0 - no limit), qb->overflow is set if there are more
+ * minexact   - minimum length of the longest seed of candidate
+ * maxshift   - maximum distance of seed diagonal from candidate (mmis, 0 without indels)
+ *
+ * returns    - number of candidate locations
+ */
+
+u32 find_candidates_fm (queryblock *qb, const fmindex *fm, u32 minlen, u32 max_candidates, u32 minexact, u32 maxshift) {
+	fminterval *seeds;
+	u32 qlen, nseeds, s, i, genome = fm->h->length;
+	/* Current group of both strands: first diagonal and the longest seed (0 - no group) */
+	u32 first[2] = { 0, 0 }, longest[2] = { 0, 0 };
+
+	clear_candidates (qb);
+	qlen = (u32) strlen (qb->query);
+	nseeds = fmseeds (fm, qb->query, qlen, minlen, &seeds);
+	if (debug > 1) fprintf (stderr, "Query %s gave %u SMEM seeds\n", qb->query, nseeds);
+
+	ndhits = 0;
+	for (s = 0; s < nseeds; s++) {
+		u32 len = seeds[s].qend - seeds[s].qstart, r;
+		if (seeds[s].s > FM_MAX_OCCURRENCES) continue;
+		for (r = seeds[s].k; r < seeds[s].k + seeds[s].s; r++) {
+			u32 pos = fmlocate (fm, r);
+			if (pos + len <= genome) {
+				add_hit (hit_diagonal (pos, seeds[s].qstart), 0, len);
+			} else if (pos >= genome) {
+				/* Reverse complement of seed is at 2 * genome - pos - len, in reverse complement of query at qlen - qend */
+				u32 rpos = 2 * genome - pos - len, qoff = qlen - seeds[s].qend;
+				add_hit (hit_diagonal (rpos, qoff), 1, len);
+			}
+		}
+	}
+	qsort (dhits, ndhits, sizeof (unsigned long long), compare_keys);
+
+	/* One more round after the last hit closes the groups of both strands */
+	for (i = 0; i <= ndhits; i++) {
+		u32 diag = 0, len = 0, strand;
+		if (i < ndhits) {
+			diag = (u32) (dhits[i] >> 32);
+			len = (u32) dhits[i] & 0x7fffffff;
+		}
+		for (strand = 0; strand < 2; strand++) {
+			candidate cand;
+			if ((i < ndhits) && (strand != ((dhits[i] >> 31) & 1))) continue;
+			if ((i < ndhits) && longest[strand] && (diag <= first[strand] + maxshift)) {
+				if (len > longest[strand]) longest[strand] = len;
+				continue;
+			}
+			/* Hit starts new group, the previous one gives candidate if its longest seed is long enough */
+			if (longest[strand] && (longest[strand] >= minexact)) {
+				cand.loc = first[strand];
+				cand.mmis = 0;
+				cand.length = qlen;
+				cand.strand = strand;
+				cand.shift = 0;
+				cand.nregions = 0;
+				if (!add_candidate (qb, &cand, max_candidates) && candidates_full (qb, 2)) return qb->ncandidates;
+			}
+			first[strand] = diag;
+			longest[strand] = len;
+		}
+	}
+	return qb->ncandidates;
+}
+
+/*
+ * Append anchor to the (growable) anchor arrays of chain block
+ */
+
+static void add_anchor (chainblock *cb, u32 rpos, u32 qpos) {
+	if (cb->nanchors >= cb->nanchor_slots) {
+		cb->nanchor_slots = (cb->nanchor_slots) ? 2 * cb->nanchor_slots : 256;
+		cb->anchors = (anchor *) realloc (cb->anchors, cb->nanchor_slots * sizeof (anchor));
+		cb->score = (int *) realloc (cb->score, cb->nanchor_slots * sizeof (int));
+		cb->prev = (int *) realloc (cb->prev, cb->nanchor_slots * sizeof (int));
+		cb->order = (unsigned long long *) realloc (cb->order, cb->nanchor_slots * sizeof (unsigned long long));
+		cb->used = (unsigned char *) realloc (cb->used, cb->nanchor_slots);
+		cb->members = (u32 *) realloc (cb->members, cb->nanchor_slots * sizeof (u32));
+	}
+	cb->anchors[cb->nanchors].rpos = rpos;
+	cb->anchors[cb->nanchors].qpos = qpos;
+	cb->nanchors += 1;
+}
+
+/*
+ * Collect seed anchors (exact word matches) of long query for chaining
+ *
+ * cb         - chain block, anchors are written to its growable arrays
+ * query      - query sequence (one strand)
+ * words      - pointer to sorted array of all words in genome
+ * nwords     - number of words (and starts)
+ * starts     - starting indices of given word
+ * locations  - list of all locations in genome
+ * nlocations - number of distinct locations
+ * wordlen    - word length
+ * m          - step between seeds
+ * seeds      - array where seeds will be written (has to be big enough to fit all)
+ * canonical  - index has canonical words, only the locations on the strand of query are used
+ * maxocc     - seeds with more locations are skipped as repeats
+ *
+ * returns    - number of anchors
+ */
+
+u32 collect_anchors (chainblock *cb, const char *query, u32 *words, u32 nwords, u32 *starts, u32 *locations, u32 nlocations, u32 wordlen, u32 m, u32 *seeds, u32 canonical, u32 maxocc) {
+	static __thread u32 *flags = NULL;
+	static __thread u32 flagsize = 0;
+	u32 qlen, nseeds, s;
+
+	cb->nanchors = 0;
+	qlen = (u32) strlen (query);
+	if (qlen <= wordlen) return 0;
+	if (canonical) {
+		if (qlen > flagsize) {
+			flagsize = qlen;
+			flags = (u32 *) realloc (flags, flagsize * sizeof (u32));
+		}
+		nseeds = get_canonical_seeds (query, words, nwords, wordlen, m, seeds, flags);
+	} else {
+		nseeds = get_seeds (query, words, nwords, wordlen, m, seeds);
+	}
+	for (s = 0; s < nseeds; s++) {
+		u32 first, last, j;
+		if (seeds[s] >= nwords) continue;
+		first = starts[seeds[s]];
+		last = (seeds[s] < (nwords - 1)) ? starts[seeds[s] + 1] : nlocations;
+		if (last - first > maxocc) continue;
+		for (j = first; j < last; j++) {
+			if (canonical) {
+				/* Skip the locations of other strand */
+				if (!(flags[s] & SEED_PALINDROME) && ((locations[j] ^ flags[s]) & 1)) continue;
+				add_anchor (cb, locations[j] >> 1, s * m);
+			} else {
+				add_anchor (cb, locations[j], s * m);
+			}
+		}
+	}
+	return cb->nanchors;
+}
+
+static int compare_anchors (const void *a, const void *b) {
+	const anchor *x = (const anchor *) a, *y = (const anchor *) b;
+	if (x->rpos != y->rpos) return (x->rpos < y->rpos) ? -1 : 1;
+	if (x->qpos != y->qpos) return (x->qpos < y->qpos) ? -1 : 1;
+	return 0;
+}
+
+static int compare_keys_descending (const void *a, const void *b) {
+	unsigned long long x = *((const unsigned long long *) a), y = *((const unsigned long long *) b);
+	return (x > y) ? -1 : (x < y);
+}
+
+static int ilog2 (u32 v) {
+	int n = 0;
+	while (v >>= 1) n += 1;
+	return n;
+}
+
+/*
+ * Co-linear chaining of anchors by dynamic programming
+ * Anchors are sorted by genome location, the score of chain ending at anchor i is
+ * f(i) = max (wordlen, max_j f(j) + min (dq, dr, wordlen) - gapcost (|dr - dq|)) over the
+ * CHAIN_MAX_PREDECESSORS previous anchors j that precede i in both query and genome by at most maxgap
+ * Chains are then taken greedily from the highest scoring end, each anchor belongs to one chain
+ *
+ * cb         - chain block with anchors (from collect_anchors), chains are written to its growable arrays
+ * wordlen    - word length (the score of single anchor)
+ * maxgap     - maximum distance between chained anchors in query and in genome
+ * minscore   - chains with lower score are dropped
+ * max_chains - maximum number of chains (0 - no limit), the best ones are kept
+ *
+ * returns    - number of chains, in the order of decreasing score
+ */
+
+u32 chain_anchors (chainblock *cb, u32 wordlen, u32 maxgap, int minscore, u32 max_chains) {
+	anchor *a = cb->anchors;
+	u32 n = cb->nanchors, i, k, nmembers;
+
+	cb->nchains = 0;
+	if (n == 0) return 0;
+	qsort (a, n, sizeof (anchor), compare_anchors);
+
+	for (i = 0; i < n; i++) {
+		u32 j, jmin = (i > CHAIN_MAX_PREDECESSORS) ? i - CHAIN_MAX_PREDECESSORS : 0;
+		cb->score[i] = wordlen;
+		cb->prev[i] = -1;
+		for (j = i; j > jmin; j--) {
+			u32 dr = a[i].rpos - a[j - 1].rpos, dq, gap;
+			int alpha, beta, sc;
+			if (dr > maxgap) break;
+			if ((dr == 0) || (a[j - 1].qpos >= a[i].qpos)) continue;
+			dq = a[i].qpos - a[j - 1].qpos;
+			if (dq > maxgap) continue;
+			alpha = (dq < dr) ? dq : dr;
+			if (alpha > (int) wordlen) alpha = wordlen;
+			/* Integer version of 0.01 * wordlen * gap + 0.5 * log2 (gap) */
+			gap = (dr > dq) ? dr - dq : dq - dr;
+			beta = (gap) ? (int) (gap * wordlen / 100) + ilog2 (gap) / 2 : 0;
+			sc = cb->score[j - 1] + alpha - beta;
+			if (sc > cb->score[i]) {
+				cb->score[i] = sc;
+				cb->prev[i] = j - 1;
+			}
+		}
+		cb->order[i] = ((unsigned long long) cb->score[i] << 32) | i;
+		cb->used[i] = 0;
+	}
+
+	/* Backtrack from the best ends, stopping at anchors already used by better chains */
+	qsort (cb->order, n, sizeof (unsigned long long), compare_keys_descending);
+	nmembers = 0;
+	for (k = 0; k < n; k++) {
+		int end = (int) (cb->order[k] & 0xffffffff), p;
+		u32 first = nmembers, len = 0, l;
+		int score;
+		if (cb->used[end]) continue;
+		for (p = end; (p >= 0) && !cb->used[p]; p = cb->prev[p]) {
+			cb->used[p] = 1;
+			cb->members[first + len++] = p;
+		}
+		score = cb->score[end] - ((p >= 0) ? cb->score[p] : 0);
+		if (score < minscore) continue;
+		for (l = 0; l < len / 2; l++) {
+			u32 t = cb->members[first + l];
+			cb->members[first + l] = cb->members[first + len - 1 - l];
+			cb->members[first + len - 1 - l] = t;
+		}
+		if (cb->nchains >= cb->nchain_slots) {
+			cb->nchain_slots = (cb->nchain_slots) ? 2 * cb->nchain_slots : 16;
+			cb->chains = (chain *) realloc (cb->chains, cb->nchain_slots * sizeof (chain));
+		}
+		cb->chains[cb->nchains].first = first;
+		cb->chains[cb->nchains].nanchors = len;
+		cb->chains[cb->nchains].score = score;
+		cb->nchains += 1;
+		nmembers += len;
+		if (max_chains && (cb->nchains >= max_chains)) break;
+	}
+	return cb->nchains;
 }
 
 /*
@@ -199,9 +1010,9 @@ u32 find_candidates (queryblock *qb, u32 *words, u32 nwords, u32 *starts, u32 *l
  * returns    - number of seeds
  */
 
-u32 get_seeds (const char *query, u32 *words, u32 nwords, u32 wordlen, u32 m, u32 *seeds) {
-	static int *nucl = NULL;
-	u32 qlen, pos, idx;
+static inline KERNEL u32 get_seeds_body (const char *query, u32 qlen, u32 *words, u32 nwords, const u32 wordlen, const u32 m, u32 *seeds) {
+	static __thread int *nucl = NULL;
+	u32 pos, idx;
 
 	/* Initialize nucleotide lookup table */
 	if (nucl == NULL) {
@@ -214,7 +1025,6 @@ u32 get_seeds (const char *query, u32 *words, u32 nwords, u32 wordlen, u32 m, u3
 		nucl['t'] = nucl['T'] = 3;
 	}
 
-	qlen = strlen (query);
 	pos = 0;
 	idx = 0;
 	while (pos < (qlen - wordlen)) {
@@ -239,6 +1049,74 @@ u32 get_seeds (const char *query, u32 *words, u32 nwords, u32 wordlen, u32 m, u3
 	return idx;
 }
 
+u32 get_seeds (const char *query, u32 *words, u32 nwords, u32 wordlen, u32 m, u32 *seeds) {
+	return get_seeds_body (query, (u32) strlen (query), words, nwords, wordlen, m, seeds);
+}
+
+/*
+ * Get list of canonical seed indices (in words array)
+ *
+ * query      - search query
+ * words      - pointer to sorted array of all canonical words in genome
+ * nwords     - number of words (and starts)
+ * wordlen    - word length
+ * m          - step between seeds
+ * seeds      - array where seeds will be written (has to be big enough to fit all)
+ * flags      - array where seed flags will be written (SEED_REVERSE if query word is not canonical,
+ *              SEED_PALINDROME if word is its own reverse complement)
+ *
+ * returns    - number of seeds
+ */
+
+static inline KERNEL u32 get_canonical_seeds_body (const char *query, u32 qlen, u32 *words, u32 nwords, const u32 wordlen, const u32 m, u32 *seeds, u32 *flags) {
+	static __thread int *nucl = NULL;
+	u32 pos, idx;
+
+	/* Initialize nucleotide lookup table */
+	if (nucl == NULL) {
+		int i;
+		nucl = (int *) malloc (256 * sizeof (int));
+		for (i = 0; i < 256; i++) nucl[i] = -1;
+		nucl['a'] = nucl['A'] = 0;
+		nucl['c'] = nucl['C'] = 1;
+		nucl['g'] = nucl['G'] = 2;
+		nucl['t'] = nucl['T'] = 3;
+	}
+
+	pos = 0;
+	idx = 0;
+	while (pos < (qlen - wordlen)) {
+		u32 word = 0, rcword = 0;
+		u32 i;
+		for (i = 0; i < wordlen; i++) {
+			int v = nucl[(unsigned char) query[pos + i]];
+			if (v < 0) break;
+			word = (word << 2) | v;
+			rcword = (rcword >> 2) | ((u32) (3 - v) << (2 * (wordlen - 1)));
+		}
+		flags[idx] = 0;
+		if (i == wordlen) {
+			if (word == rcword) {
+				flags[idx] = SEED_PALINDROME;
+			} else if (rcword < word) {
+				flags[idx] = SEED_REVERSE;
+				word = rcword;
+			}
+			seeds[idx] = search_word (word, words, nwords);
+		} else {
+			seeds[idx] = nwords;
+		}
+		idx += 1;
+		pos += m;
+	}
+
+	return idx;
+}
+
+u32 get_canonical_seeds (const char *query, u32 *words, u32 nwords, u32 wordlen, u32 m, u32 *seeds, u32 *flags) {
+	return get_canonical_seeds_body (query, (u32) strlen (query), words, nwords, wordlen, m, seeds, flags);
+}
+
 /*
  * Binary search
  *
@@ -0,0 +1,970 @@
+/*
+ * Genome Mapper
+ * (mapping of single queries: candidate verification, alignment and long read chaining)
+ *
+ * Authors: Maarja Lepamets, Fanny-Dhelia Pajuste
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <pthread.h>
+
+#include "utils.h"
+
+/* Maximum band width of region verification (the same as maximum number of mismatches) */
+#define MAX_BAND 10
+
+/* Long read mapping: seeds with more locations are skipped, chained anchors are at most LONG_MAX_GAP apart */
+#define LONG_MAX_OCCURRENCES 200
+#define LONG_MAX_GAP 5000
+#define LONG_MIN_CHAIN_SCORE 40
+/* Gaps between anchors up to LONG_FULL_CELLS cells are aligned fully, longer ones in band of LONG_BAND */
+#define LONG_FULL_CELLS 65536
+#define LONG_BAND 32
+
+static unsigned searchquery(mapworker *w, unsigned queryidx, const char *query, unsigned len);
+static void reporthit(mapworker *w, unsigned queryidx, unsigned chrom, unsigned pos, unsigned dist, unsigned reverse);
+static void candidateoverflow(mapworker *w, unsigned queryidx);
+static void packquery(mapworker *w, const char *query, unsigned len);
+static void profilequery(mapworker *w, const char *query, unsigned len);
+/* Return edit distance */
+static unsigned adjustmapping (mapworker *w, unsigned queryidx, candidate *cand, const char *query, unsigned qlen, unsigned reverse);
+static const char *candidatewindow (const Chromosome *c, unsigned loc, unsigned before, unsigned slen, char *seq);
+/* Map one strand of long query by chaining, returns the number of hits */
+static unsigned maplong(mapworker *w, unsigned queryidx, const char *query, unsigned len, unsigned reverse);
+static int chaindistance(mapworker *w, chain *ch, const char *query, unsigned qlen, unsigned *chrom, unsigned *pos);
+static int editDistance(const char *query, const char *sequence, unsigned *qstart, char *s, char *q);
+static unsigned longDistance (mapworker *w, const char *query, int qlen, const char *seq, int slen, int freeend, int *used);
+static unsigned regionDistance (const char *query, unsigned qlen, const Chromosome *chr, candidate *cand, unsigned nmm);
+
+/* Default mapping options (the same as the defaults of mapper) */
+void defaultmapoptions(mapoptions *opt)
+{
+	memset(opt, 0, sizeof(mapoptions));
+	opt->maxcandidates = 10000;
+	opt->scoring.match = 1;
+	opt->scoring.mismatch = 4;
+	opt->scoring.gapopen = 6;
+	opt->scoring.gapextend = 1;
+	opt->minscore = -1;
+	opt->maxerror = 15;
+	opt->minseed = 19;
+}
+
+/*
+ * Set up mapping context for index data (as loaded by loadindex or indexreplica)
+ * FM index is recognized by its header, then there are no words and candidates are found from SMEM seeds
+ */
+void initmapcontext(mapcontext *ctx, const char *index, unsigned mmis, unsigned step, const mapoptions *opt, Chromosome *chr, unsigned nchr, readcache *cache)
+{
+	info *h = (info *) index;
+	ctx->mmis = mmis;
+	ctx->step = step;
+	ctx->opt = *opt;
+	ctx->chr = chr;
+	ctx->nchr = nchr;
+	ctx->cache = cache;
+	ctx->fallback = NULL;
+	if (openfmindex(&ctx->fm, index)) {
+		ctx->wordlength = 0;
+		ctx->canonical = 0;
+		ctx->nwords = ctx->nloc = 0;
+		ctx->words = ctx->starts = ctx->locations = NULL;
+		ctx->findcandidates = NULL;
+		return;
+	}
+	ctx->fm.h = NULL;
+	ctx->wordlength = h->wordsize & INDEX_WORDSIZE_MASK;
+	ctx->canonical = (h->wordsize & INDEX_CANONICAL) != 0;
+	ctx->nwords = h->nwords;
+	ctx->nloc = h->nlocations;
+	ctx->words = (unsigned *)(index + sizeof(info));
+	ctx->starts = (unsigned *)(index + sizeof(info) + ctx->nwords * sizeof(unsigned));
+	ctx->locations = (unsigned *)(index + sizeof(info) + ctx->nwords * sizeof(unsigned) + ctx->nwords * sizeof(unsigned));
+	if (opt->diagonal) {
+		ctx->findcandidates = (ctx->canonical) ? find_candidates_canonical_diagonal : find_candidates_diagonal;
+	} else {
+		ctx->findcandidates = select_find_candidates (ctx->wordlength, step, ctx->canonical);
+	}
+	/* Multi-k index: the table of shorter words starts after the locations of this one */
+	if (h->wordsize & INDEX_MORE_TABLES) {
+		ctx->fallback = (mapcontext *) malloc (sizeof(mapcontext));
+		initmapcontext(ctx->fallback, (const char *) (ctx->locations + ctx->nloc), mmis, step, opt, chr, nchr, cache);
+	}
+}
+
+/* Free the contexts of shorter word tables of multi-k index */
+void freemapcontext(mapcontext *ctx)
+{
+	if (ctx->fallback) {
+		freemapcontext(ctx->fallback);
+		free(ctx->fallback);
+		ctx->fallback = NULL;
+	}
+}
+
+/* Worker without output, buffers grow on demand and are reused for all queries */
+void initmapworker(mapworker *w, mapcontext *ctx)
+{
+	memset(w, 0, sizeof(mapworker));
+	w->ctx = ctx;
+	w->qb.cutoffshift = ctx->opt.cutoffshift;
+	w->pin = -1;
+}
+
+void freemapworker(mapworker *w)
+{
+	free(w->seeds);
+	free(w->rev);
+	free(w->cb.anchors);
+	free(w->cb.score);
+	free(w->cb.prev);
+	free(w->cb.order);
+	free(w->cb.used);
+	free(w->cb.members);
+	free(w->cb.chains);
+	free(w->gapbuf);
+	free(w->dp);
+	free(w->qb.candidates);
+	free(w->hits);
+	free(w->qpacked);
+	free(w->qnmask);
+	free(w->qgcounts);
+	free(w->qgused);
+	freealignquery(&w->aq);
+}
+
+/*
+ * Read chromosome description file (name, sequence file and position in index of every chromosome)
+ * Sequences are loaded on first use by getchromosome
+ *
+ * returns    - the number of chromosomes
+ */
+unsigned readchromosomes(const char *filename, Chromosome *chr, unsigned maxchr)
+{
+	struct stat stindex;
+	const char *chrmap;
+	unsigned nchr = 0;
+
+	chrmap = filemmap (filename, &stindex);
+	if (chrmap) {
+		unsigned s = 0;
+		if (debug > 0) fprintf (stderr, "Chromosome locations:\n");
+		while (s < stindex.st_size) {
+			unsigned ns, ne, fs, fe, ps, pe;
+			ns = ne = s;
+			while (chrmap[ne] > ' ') ne += 1;
+			fs = ne;
+			while ((fs < stindex.st_size) && (chrmap[fs] <= ' ')) fs += 1;
+			fe = fs;
+			while (chrmap[fe] > ' ') fe += 1;
+			ps = fe;
+			while ((ps < stindex.st_size) && (chrmap[ps] <= ' ')) ps += 1;
+			pe = ps;
+			while (chrmap[pe] > ' ') pe += 1;
+			if ((ne > ns) && (fe > fs) && (pe > ps)) {
+				if (nchr >= maxchr) {
+					fprintf (stderr, "Too many chromosomes in %s (at most %u)!\n", filename, maxchr);
+					exit (1);
+				}
+				chr[nchr].name = (char *) malloc (ne - ns + 1);
+				memcpy (chr[nchr].name, chrmap + ns, ne - ns + 1);
+				chr[nchr].name[ne - ns] = 0;
+				chr[nchr].filename = (char *) malloc (fe - fs + 1);
+				memcpy (chr[nchr].filename, chrmap + fs, fe - fs + 1);
+				chr[nchr].filename[fe - fs] = 0;
+				chr[nchr].start = strtol(chrmap + ps, NULL, 10);
+				chr[nchr].length = 0;
+				chr[nchr].sequence = NULL;
+				chr[nchr].packed = chr[nchr].nmask = NULL;
+				chr[nchr].offset = chr[nchr].regionlength = 0;
+				chr[nchr].fileoffset = 0;
+				/* Region index has offset in chromosome, length and offset in file on the same line */
+				while ((pe < stindex.st_size) && (chrmap[pe] <= ' ') && (chrmap[pe] != '\n')) pe += 1;
+				if ((pe < stindex.st_size) && (chrmap[pe] > ' ')) {
+					char *e;
+					chr[nchr].offset = strtoul(chrmap + pe, &e, 10);
+					chr[nchr].regionlength = strtoul(e, &e, 10);
+					chr[nchr].fileoffset = strtoull(e, &e, 10);
+					pe = e - chrmap;
+					if (chr[nchr].regionlength == 0) {
+						fprintf (stderr, "Invalid region of %s in %s!\n", chr[nchr].name, filename);
+						exit (1);
+					}
+				}
+				if (debug > 0) fprintf (stderr, "Chromosome %s at %s position %u\n", chr[nchr].name, chr[nchr].filename, chr[nchr].start);
+				nchr += 1;
+			}
+			s = pe;
+			while ((s < stindex.st_size) && (chrmap[s] <= ' ')) s += 1;
+		}
+		munmap ((void *) chrmap, stindex.st_size);
+	}
+	return nchr;
+}
+
+/*
+ * Map single query, hits are kept in worker (hits, nhits) and written to worker output if it is set,
+ * unmapped queries are written to worker error output if it is set
+ *
+ * returns    - the number of hits
+ */
+unsigned mapquery(mapworker *w, unsigned queryidx, const char *readfw)
+{
+	mapcontext *ctx = w->ctx;
+	unsigned int len = (unsigned int)strlen(readfw);
+	unsigned nmatched, j;
+
+	w->nhits = 0;
+	if (len == 0) return 0;
+	if (!ctx->opt.longreads && (len >= MAX_READ_LENGTH)) {
+		w->ntoolong += 1;
+		if (w->err) fprintf (w->err, "%d\t-\n", queryidx);
+		return 0;
+	}
+	if (ctx->cache && readcachelookup(ctx->cache, readfw, len, &w->hits, &w->nhit_slots, &w->nhits)) {
+		/* The same query has been mapped before */
+		for (j = 0; j < w->nhits; j++) {
+			cachehit *hit = &w->hits[j];
+			if (w->out) fprintf (w->out, "%u\t%s\t%u\t%d\t%s\n", queryidx, ctx->chr[hit->chr].name, ctx->chr[hit->chr].offset + hit->pos, hit->dist, (hit->strand) ? "R" : "F");
+		}
+		nmatched = w->nhits;
+	} else {
+		nmatched = searchquery(w, queryidx, readfw, len);
+		/* Multi-k index: shorter words are only tried when longer ones found no hits */
+		if (!nmatched && ctx->fallback) w->nfallbacks += 1;
+		while (!nmatched && w->ctx->fallback) {
+			w->ctx = w->ctx->fallback;
+			nmatched = searchquery(w, queryidx, readfw, len);
+		}
+		w->ctx = ctx;
+		if (ctx->cache) readcacheinsert(ctx->cache, readfw, len, w->hits, w->nhits);
+	}
+	if (nmatched) w->nmapped += 1;
+	if (!nmatched && w->err) fprintf (w->err, "%d\t-\n", queryidx);
+	return nmatched;
+}
+
+/* Find and verify candidates on both strands */
+static unsigned searchquery(mapworker *w, unsigned queryidx, const char *readfw, unsigned len)
+{
+	mapcontext *ctx = w->ctx;
+	const mapoptions *opt = &ctx->opt;
+	queryblock *qb = &w->qb;
+	unsigned int j;
+	unsigned ncandidates;
+	char *r;
+	unsigned nmatched;
+
+	if (w->nseed_slots < len) {
+		w->nseed_slots = len;
+		w->seeds = (unsigned *) realloc (w->seeds, w->nseed_slots * sizeof(unsigned));
+	}
+	if (w->nrev_slots < len + 1) {
+		w->nrev_slots = len + 1;
+		w->rev = (char *) realloc (w->rev, w->nrev_slots);
+	}
+	r = w->rev;
+	if (debug > 1) fprintf (stderr, "Query: %s\n", readfw);
+
+	if (opt->longreads) {
+		getreversecomplementstr (r, readfw, len);
+		r[len] = 0;
+		nmatched = maplong (w, queryidx, readfw, len, 0);
+		nmatched += maplong (w, queryidx, r, len, 1);
+		return nmatched;
+	}
+
+	if (ctx->canonical || ctx->fm.h) {
+		/* Both strands from single lookup */
+		unsigned strand;
+		getreversecomplementstr (r, readfw, len);
+		r[len] = 0;
+		qb->query = readfw;
+		if (ctx->fm.h) {
+			/*
+			 * Hit has at most mmis + 1 edits (query[0] is not charged), so the len - mmis - 1 other nucleotides have an
+			 * exact part of ceil((len - mmis - 1) / (mmis + 2)) nucleotides between them, there is no such bound for alignment score
+			 * Shorter seeds than --min-seed are searched if the bound is below it, otherwise such hits would be lost
+			 */
+			unsigned minexact = 0, minseed = opt->minseed;
+			if (!opt->scoremode && (len > ctx->mmis + 1)) minexact = (len - ctx->mmis - 1 + ctx->mmis + 1) / (ctx->mmis + 2);
+			if (!opt->scoremode && (minexact < minseed)) minseed = (minexact > 0) ? minexact : 1;
+			ncandidates = find_candidates_fm (qb, &ctx->fm, minseed, opt->maxcandidates, minexact, (opt->noindels) ? 0 : ctx->mmis);
+		} else {
+			ncandidates = ctx->findcandidates (qb, ctx->words, ctx->nwords, ctx->starts, ctx->locations, ctx->nloc, ctx->wordlength, ctx->step, w->seeds, opt->maxcandidates, ctx->mmis, (opt->noindels) ? 0 : ctx->mmis);
+		}
+		w->ncandidates += ncandidates;
+		if (qb->overflow) candidateoverflow(w, queryidx);
+		if (debug > 0) fprintf (stderr, "Found %u candidates\n", ncandidates);
+		nmatched = 0;
+		for (strand = 0; strand < 2; strand++) {
+			if (opt->noindels) packquery (w, (strand) ? r : readfw, len);
+			if (opt->prefilter) profilequery (w, (strand) ? r : readfw, len);
+			if (opt->scoremode) setalignquery (&w->aq, (strand) ? r : readfw, len, &opt->scoring);
+			if (opt->skipoverflow && (qb->overflow & (1 << strand))) continue;
+			for (j = 0; j < ncandidates; j++) {
+				unsigned editdist;
+				if (qb->candidates[j].strand != strand) continue;
+				editdist = adjustmapping (w, queryidx, &qb->candidates[j], (strand) ? r : readfw, len, strand);
+				if (editdist <= ctx->mmis) nmatched += 1;
+			}
+		}
+		return nmatched;
+	}
+	qb->query = readfw;
+	ncandidates = ctx->findcandidates (qb, ctx->words, ctx->nwords, ctx->starts, ctx->locations, ctx->nloc, ctx->wordlength, ctx->step, w->seeds, opt->maxcandidates, ctx->mmis, (opt->noindels) ? 0 : ctx->mmis);
+	w->ncandidates += ncandidates;
+	if (qb->overflow) candidateoverflow(w, queryidx);
+	if (debug > 0) {
+		fprintf (stderr, "Found %u candidates:\n", ncandidates);
+		if (debug > 1) {
+			for (j = 0; j < ncandidates; j++) {
+				unsigned k;
+				fprintf (stderr, "Candidate %u location %u length %u nregions %u\n", j, qb->candidates[j].loc, qb->candidates[j].length, qb->candidates[j].nregions);
+				if (debug > 2) {
+					for (k = 0; k < qb->candidates[j].nregions; ++k) {
+						fprintf (stderr, "    Region %u qstart %u qend %u loc %u\n", k, qb->candidates[j].reg[k].qstart, qb->candidates[j].reg[k].qend, qb->candidates[j].reg[k].loc);
+					}
+				}
+			}
+		}
+	}
+	nmatched = 0;
+	if (opt->noindels) packquery (w, qb->query, len);
+	if (opt->prefilter) profilequery (w, qb->query, len);
+	if (opt->scoremode) setalignquery (&w->aq, qb->query, len, &opt->scoring);
+	if (opt->skipoverflow && qb->overflow) ncandidates = 0;
+	for (j = 0; j < ncandidates; j++) {
+		unsigned editdist;
+		editdist = adjustmapping (w, queryidx, &qb->candidates[j], qb->query, len, 0);
+		if (editdist <= ctx->mmis) nmatched += 1;
+	}
+	/* Reverse complement */
+	getreversecomplementstr (r, readfw, len);
+	r[len] = 0;
+	qb->query = r;
+	if (debug > 1) fprintf (stderr, "Reverse Query: %s\n", qb->query);
+	ncandidates = ctx->findcandidates (qb, ctx->words, ctx->nwords, ctx->starts, ctx->locations, ctx->nloc, ctx->wordlength, ctx->step, w->seeds, opt->maxcandidates, ctx->mmis, (opt->noindels) ? 0 : ctx->mmis);
+	w->ncandidates += ncandidates;
+	if (qb->overflow) candidateoverflow(w, queryidx);
+	if (debug > 2) if (ncandidates) fprintf(stderr, "kandidaatide arv: %u, neist esimene: %d, mismatche %d\n", ncandidates, qb->candidates[0].loc, qb->candidates[0].mmis);
+	if (debug > 1) {
+		fprintf (stderr, "Candidates:\n");
+		for (j = 0; j < ncandidates; j++) {
+			unsigned k;
+			fprintf (stderr, "Loc %u len %u nregions %u\n", qb->candidates[j].loc, qb->candidates[j].length, qb->candidates[j].nregions);
+			for (k = 0; k < qb->candidates[j].nregions; ++k) {
+				fprintf (stderr, "  Region %u qstart %u qend %u loc %u\n", k, qb->candidates[j].reg[k].qstart, qb->candidates[j].reg[k].qend, qb->candidates[j].reg[k].loc);
+			}
+		}
+	}
+	if (opt->noindels) packquery (w, qb->query, len);
+	if (opt->prefilter) profilequery (w, qb->query, len);
+	if (opt->scoremode) setalignquery (&w->aq, qb->query, len, &opt->scoring);
+	if (opt->skipoverflow && qb->overflow) ncandidates = 0;
+	for (j = 0; j < ncandidates; j++) {
+		unsigned editdist;
+		editdist = adjustmapping (w, queryidx, &qb->candidates[j], qb->query, len, 1);
+		if (editdist <= ctx->mmis) nmatched += 1;
+	}
+	return nmatched;
+}
+
+/*
+ * Load chromosome sequence on first use, mapping threads may ask for it at the same time
+ * If pack is set, 2-bit packed sequence is made too (for mapping without indels)
+ */
+const char *getchromosome(Chromosome *c, int pack)
+{
+	static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+	char *sequence = __atomic_load_n(&c->sequence, __ATOMIC_ACQUIRE);
+	if (sequence) return sequence;
+	pthread_mutex_lock(&lock);
+	if (c->sequence == NULL) {
+		struct stat st;
+		unsigned d, s, header;
+		const char *seq = filemmap (c->filename, &st);
+		if (seq == NULL) {
+			fprintf (stderr, "Cannot mmap %s\n", c->filename);
+			exit (1);
+		}
+		if (c->regionlength) {
+			/* Only the nucleotides of region are in file, windows of candidates near its end may reach past it */
+			if (c->fileoffset + c->regionlength > (unsigned long long) st.st_size) {
+				fprintf (stderr, "Region of %s is outside of %s\n", c->name, c->filename);
+				exit (1);
+			}
+			d = c->regionlength;
+			sequence = (char *) malloc (d + MAX_READ_LENGTH + 2 * MAX_BAND);
+			memcpy (sequence, seq + c->fileoffset, d);
+			memset (sequence + d, 'N', MAX_READ_LENGTH + 2 * MAX_BAND);
+		} else {
+			sequence = (char *) malloc (st.st_size);
+			d = 0;
+			header = 0;
+			for (s = 0; s < st.st_size; s++) {
+				if (seq[s] == '>') header = 1;
+				if (header) {
+					if (seq[s] == '\n') header = 0;
+				} else {
+					if (seq[s] >= 'A') sequence[d++] = seq[s];
+				}
+			}
+		}
+		c->length = d;
+		munmap ((void *) seq, st.st_size);
+		if (pack) {
+			/* Queries may extend past the end of sequence */
+			unsigned nwords = (d + 31) / 32 + (MAX_READ_LENGTH + 31) / 32 + 1;
+			c->packed = (unsigned long long *) malloc (nwords * sizeof(unsigned long long));
+			c->nmask = (unsigned long long *) malloc (nwords * sizeof(unsigned long long));
+			packsequence (sequence, d, nwords, c->packed, c->nmask);
+		}
+		__atomic_store_n(&c->sequence, sequence, __ATOMIC_RELEASE);
+	}
+	pthread_mutex_unlock(&lock);
+	return c->sequence;
+}
+
+/* Pack query (one strand) for comparison without indels */
+static void packquery(mapworker *w, const char *query, unsigned len)
+{
+	unsigned nwords = (len + 31) / 32 + 1;
+	if (w->nqpacked_slots < nwords) {
+		w->nqpacked_slots = nwords;
+		w->qpacked = (unsigned long long *) realloc (w->qpacked, nwords * sizeof(unsigned long long));
+		w->qnmask = (unsigned long long *) realloc (w->qnmask, nwords * sizeof(unsigned long long));
+	}
+	packsequence (query, len, nwords, w->qpacked, w->qnmask);
+}
+
+/*
+ * Q-gram profile of query (one strand) for pre-alignment filter
+ * editDistance never charges query[0] and at the end of sequence one more query position can be
+ * left uncharged, so a hit has at most nmm + 1 edits between query[1..] and some part of the window.
+ * Every edit destroys at most q q-grams, so the window has to share at least valid - q * (nmm + 1)
+ * q-grams with query[1..] (q-gram lemma). The q with the largest margin over the expected number
+ * of random shared q-grams is used, the strand is not filtered if there is no margin.
+ */
+static void profilequery(mapworker *w, const char *query, unsigned len)
+{
+	unsigned nmm = w->ctx->mmis, slen = len + 2 * nmm, valid, q;
+	double best = 0;
+	if (!w->qgcounts) {
+		w->qgcounts = (unsigned short *) malloc ((1 << (2 * QGRAM_MAX)) * sizeof(unsigned short));
+		w->qgused = (unsigned short *) malloc ((1 << (2 * QGRAM_MAX)) * sizeof(unsigned short));
+		memset(w->qgused, 0, (1 << (2 * QGRAM_MAX)) * sizeof(unsigned short));
+	}
+	w->qgq = 0;
+	w->qgneed = 0;
+	for (q = 3; q <= QGRAM_MAX; q++) {
+		double margin;
+		if (len < q + 1) break;
+		margin = (double) (len - q) - q * (nmm + 1) - (double) (len - q) * (slen - q + 1) / (1 << (2 * q));
+		if (margin > best) {
+			best = margin;
+			w->qgq = q;
+		}
+	}
+	if (!w->qgq) return;
+	valid = qgramprofile (query + 1, len - 1, w->qgq, w->qgcounts);
+	if (valid > w->qgq * (nmm + 1)) w->qgneed = valid - w->qgq * (nmm + 1);
+}
+
+/* Count query strands whose candidates did not fit into limit */
+static void candidateoverflow(mapworker *w, unsigned queryidx)
+{
+	if (debug > 0) fprintf (stderr, "Query %u has more than %u candidates per strand, %s\n", queryidx, w->ctx->opt.maxcandidates, (w->ctx->opt.skipoverflow) ? "they are not verified" : "the rest are ignored");
+	w->noverflows += (w->qb.overflow & 1) + ((w->qb.overflow >> 1) & 1);
+}
+
+/* Sequence that contains location (the last one starting at or before it) */
+static unsigned findchromosome(const Chromosome *chr, unsigned nchr, unsigned loc)
+{
+	unsigned lo = 0, hi = nchr;
+	while (hi - lo > 1) {
+		unsigned mid = (lo + hi) / 2;
+		if (chr[mid].start <= loc) {
+			lo = mid;
+		} else {
+			hi = mid;
+		}
+	}
+	return lo;
+}
+
+/* Keep hit (for read cache and library) and write it if worker has output, positions in regions are written as positions in chromosome */
+static void reporthit(mapworker *w, unsigned queryidx, unsigned chrom, unsigned pos, unsigned dist, unsigned reverse)
+{
+	if (w->out) fprintf (w->out, "%u\t%s\t%u\t%d\t%s\n", queryidx, w->ctx->chr[chrom].name, w->ctx->chr[chrom].offset + pos, dist, (reverse) ? "R" : "F");
+	if (w->nhits >= w->nhit_slots) {
+		w->nhit_slots = (w->nhit_slots) ? 2 * w->nhit_slots : 16;
+		w->hits = (cachehit *) realloc (w->hits, w->nhit_slots * sizeof(cachehit));
+	}
+	w->hits[w->nhits].chr = chrom;
+	w->hits[w->nhits].pos = pos;
+	w->hits[w->nhits].dist = dist;
+	w->hits[w->nhits].strand = reverse;
+	w->nhits += 1;
+}
+
+static unsigned adjustmapping (mapworker *w, unsigned queryidx, candidate *cand, const char *query, unsigned qlen, unsigned reverse)
+{
+	const mapoptions *opt = &w->ctx->opt;
+	Chromosome *chr = w->ctx->chr;
+	unsigned nchr = w->ctx->nchr, nmm = w->ctx->mmis;
+	unsigned i, editdist, qstart;
+	unsigned sloc, slen;
+	char seq[MAX_READ_LENGTH + 2 * MAX_BAND];
+	char s[2 * (MAX_READ_LENGTH + 2 * MAX_BAND)], q[2 * (MAX_READ_LENGTH + 2 * MAX_BAND)];
+	i = findchromosome (chr, nchr, cand->loc);
+	getchromosome(&chr[i], opt->noindels);
+	if ((cand->loc < chr[i].start) || (cand->loc - chr[i].start >= chr[i].length)) {
+		/* Candidate in the gap after sequence (FM index fills gaps with pseudo-random nucleotides) */
+		if (debug > 0) fprintf (stderr, "Location %u is outside of sequences\n", cand->loc);
+		return nmm + 1;
+	}
+
+	if (opt->noindels) {
+		/* Only substitutions, candidate location is the location of query */
+		sloc = cand->loc - chr[i].start;
+		if (sloc + qlen > chr[i].length + MAX_READ_LENGTH) return nmm + 1;
+		editdist = hammingdistance (w->qpacked, w->qnmask, qlen, chr[i].packed, chr[i].nmask, sloc, nmm);
+		if (debug > 0) fprintf (stderr, "Location %u Mismatches %u\n", cand->loc, editdist);
+		if (editdist <= nmm) reporthit (w, queryidx, i, sloc, editdist, reverse);
+		return editdist;
+	}
+
+	if (opt->scoremode) {
+		/* Local alignment over the same window, return value tells only whether hit was accepted */
+		int score, start, qstart, needed;
+		needed = (opt->minscore >= 0) ? opt->minscore : (int) qlen * opt->scoring.match - (int) nmm * (opt->scoring.match + opt->scoring.mismatch);
+		sloc = cand->loc - nmm;
+		slen = qlen + 2 * nmm;
+		score = alignscore (&w->aq, candidatewindow (&chr[i], cand->loc, nmm, slen, seq), slen, &start, &qstart);
+		if (debug > 0) fprintf (stderr, "Location %u Score %d Start %d Query start %d\n", cand->loc, score, start, qstart);
+		if ((score > 0) && (score >= needed)) {
+			/* Location of the first query position, even if it is clipped from alignment */
+			reporthit (w, queryidx, i, sloc + start - qstart - chr[i].start, score, reverse);
+			return 0;
+		}
+		return nmm + 1;
+	}
+
+	if (opt->regionverify && (cand->shift == 0) && (cand->nregions > 0)) {
+		/*
+		 * All confirming seeds are on the same diagonal, only regions need alignment
+		 * Trusting the seeds can only overestimate distance, so it rejects candidates and accepted ones are
+		 * aligned fully below to report the same distance and position as without -rv
+		 */
+		editdist = regionDistance (query, qlen, &chr[i], cand, nmm + 2);
+		if (debug > 0) fprintf (stderr, "Location %u Region distance %u\n", cand->loc, editdist);
+		if (editdist > nmm + 2) return editdist;
+	}
+
+	slen = qlen + 2 * nmm;
+	candidatewindow (&chr[i], cand->loc, nmm, slen, seq);
+	if (opt->prefilter) {
+		w->nprefiltered += 1;
+		if (w->qgneed && (qgramcommon (w->qgcounts, w->qgused, w->qgq, seq, slen, w->qgneed) < w->qgneed)) {
+			if (debug > 0) fprintf (stderr, "Location %u rejected by pre-filter\n", cand->loc);
+			w->nrejected += 1;
+			return nmm + 1;
+		}
+	}
+	seq[slen] = 0;
+	/* editdist = editDistanceMiddle (q, s); */
+	qstart = nmm;
+	editdist = editDistance (query, seq, &qstart, s, q);
+	if (debug > 0) {
+		fprintf (stderr, "Location %u Distance %u Query start %u\n", cand->loc, editdist, qstart);
+		fprintf (stderr, "Query: %s\n", q);
+		fprintf (stderr, "Seq:   %s\n", s);
+	}
+	if (editdist <= nmm) {
+		reporthit (w, queryidx, i, cand->loc - nmm + qstart - chr[i].start, editdist, reverse);
+	}
+	return editdist;
+}
+
+/*
+ * Copy slen nucleotides of sequence from before nucleotides before location loc to seq
+ * The parts before the start and after the end of sequence are filled with N
+ */
+
+static const char *candidatewindow (const Chromosome *c, unsigned loc, unsigned before, unsigned slen, char *seq)
+{
+	unsigned pos = loc - c->start, lead = 0, n;
+	if (pos < before) lead = before - pos;
+	memset (seq, 'N', lead);
+	n = slen - lead;
+	if (pos - before + lead + n > c->length) n = (pos - before + lead < c->length) ? c->length - (pos - before + lead) : 0;
+	memcpy (seq + lead, c->sequence + pos - before + lead, n);
+	memset (seq + lead + n, 'N', slen - lead - n);
+	return seq;
+}
+
+static unsigned maplong(mapworker *w, unsigned queryidx, const char *query, unsigned len, unsigned reverse)
+{
+	mapcontext *ctx = w->ctx;
+	const mapoptions *opt = &ctx->opt;
+	chainblock *cb = &w->cb;
+	unsigned nanchors, nchains, c, nmatched = 0;
+
+	nanchors = collect_anchors (cb, query, ctx->words, ctx->nwords, ctx->starts, ctx->locations, ctx->nloc, ctx->wordlength, ctx->step, w->seeds, ctx->canonical, LONG_MAX_OCCURRENCES);
+	nchains = chain_anchors (cb, ctx->wordlength, LONG_MAX_GAP, LONG_MIN_CHAIN_SCORE, opt->maxcandidates);
+	if (debug > 0) fprintf (stderr, "Query %u strand %u: %u anchors, %u chains\n", queryidx, reverse, nanchors, nchains);
+	for (c = 0; c < nchains; c++) {
+		unsigned chrom, pos;
+		int editdist = chaindistance (w, &cb->chains[c], query, len, &chrom, &pos);
+		if (debug > 0) fprintf (stderr, "Chain %u score %d anchors %u Distance %d\n", c, cb->chains[c].score, cb->chains[c].nanchors, editdist);
+		if ((editdist < 0) || ((unsigned long long) editdist * 100 > (unsigned long long) len * opt->maxerror)) continue;
+		reporthit (w, queryidx, chrom, pos, editdist, reverse);
+		nmatched += 1;
+	}
+	return nmatched;
+}
+
+/*
+ * Edit distance of long query along chain of anchors
+ * Overlapping anchors on the same diagonal are merged into exact matches, only the gaps between
+ * them are aligned, as well as the query before the first and after the last anchor (with free sequence ends)
+ * Returns -1 if chain cannot be aligned (crosses the end of chromosome)
+ */
+
+static int chaindistance(mapworker *w, chain *ch, const char *query, unsigned qlen, unsigned *chrom, unsigned *pos)
+{
+	Chromosome *chr = w->ctx->chr;
+	unsigned nchr = w->ctx->nchr, wordlen = w->ctx->wordlength;
+	anchor *a = w->cb.anchors;
+	unsigned *members = w->cb.members + ch->first;
+	long long qe, re, rs, chrlen;
+	unsigned i, k, dist;
+	const char *seq;
+	int used;
+
+	i = findchromosome (chr, nchr, a[members[0]].rpos);
+	seq = getchromosome(&chr[i], 0);
+	chrlen = chr[i].length;
+	if ((long long) a[members[ch->nanchors - 1]].rpos - chr[i].start + wordlen > chrlen) return -1;
+
+	/* End of current exact match in query and sequence */
+	rs = (long long) a[members[0]].rpos - chr[i].start;
+	qe = a[members[0]].qpos + wordlen;
+	re = rs + wordlen;
+	dist = 0;
+	for (k = 1; k < ch->nanchors; k++) {
+		long long q = a[members[k]].qpos, r = (long long) a[members[k]].rpos - chr[i].start;
+		if ((r - q == re - qe) && (q <= qe)) {
+			/* Extends current match */
+			re += q + wordlen - qe;
+			qe = q + wordlen;
+			continue;
+		}
+		/* Anchor overlapping current match on other diagonal is skipped */
+		if ((q < qe) || (r < re)) continue;
+		dist += longDistance (w, query + qe, q - qe, seq + re, r - re, 0, &used);
+		qe = q + wordlen;
+		re = r + wordlen;
+	}
+
+	/* Trailing part of query */
+	if (qe < qlen) {
+		long long n = qlen - qe, sn = n + n / 8 + LONG_BAND;
+		if (re + sn > chrlen) sn = chrlen - re;
+		dist += longDistance (w, query + qe, n, seq + re, sn, 1, &used);
+	}
+	/* Leading part of query, aligned backwards */
+	qe = a[members[0]].qpos;
+	if (qe > 0) {
+		long long n = qe, sn = n + n / 8 + LONG_BAND;
+		char *qrev, *srev;
+		if (sn > rs) sn = rs;
+		if (w->ngapbuf_slots < (unsigned) (n + sn)) {
+			w->ngapbuf_slots = n + sn;
+			w->gapbuf = (char *) realloc (w->gapbuf, w->ngapbuf_slots);
+		}
+		qrev = w->gapbuf;
+		srev = w->gapbuf + n;
+		for (k = 0; k < n; k++) qrev[k] = query[qe - 1 - k];
+		for (k = 0; k < sn; k++) srev[k] = seq[rs - 1 - k];
+		dist += longDistance (w, qrev, n, srev, sn, 1, &used);
+		rs -= used;
+	}
+	*chrom = i;
+	*pos = rs;
+	return dist;
+}
+
+/*
+ * Banded edit distance of query and sequence, both starting from the same (anchored) position
+ * If freeend is set, the end of sequence is free, otherwise both have to be aligned fully
+ * Returns w + 1 as soon as the distance is known to exceed w
+ */
+
+static unsigned bandedDistance (const char *query, int qlen, const char *seq, int slen, int w, int freeend)
+{
+	int prev[2 * MAX_BAND + 3], cur[2 * MAX_BAND + 3];
+	int qi, k, best;
+	/* Cell (qi, si) is stored at index si - qi + w + 1, values outside of the band are kept at w + 1 */
+	for (k = 0; k < 2 * w + 3; k++) prev[k] = cur[k] = w + 1;
+	for (k = 0; k <= w; k++) {
+		if (k <= slen) prev[k + w + 1] = k;
+	}
+	for (qi = 1; qi <= qlen; qi++) {
+		int rowmin = w + 1;
+		for (k = -w; k <= w; k++) {
+			int si = qi + k, v;
+			if ((si < 0) || (si > slen)) {
+				cur[k + w + 1] = w + 1;
+				continue;
+			}
+			/* Gap in sequence */
+			v = prev[k + w + 2] + 1;
+			/* Gap in query */
+			if (cur[k + w] + 1 < v) v = cur[k + w] + 1;
+			/* Match or mismatch */
+			if (si > 0) {
+				int dtl = prev[k + w + 1] + (query[qi - 1] != seq[si - 1]);
+				if (dtl < v) v = dtl;
+			}
+			if (v > w + 1) v = w + 1;
+			cur[k + w + 1] = v;
+			if (v < rowmin) rowmin = v;
+		}
+		if (rowmin > w) return w + 1;
+		for (k = 0; k < 2 * w + 3; k++) prev[k] = cur[k];
+	}
+	if (!freeend) {
+		return (qlen <= slen) ? prev[w + 1] : w + 1;
+	}
+	best = w + 1;
+	for (k = 0; k < 2 * w + 3; k++) {
+		if (prev[k] < best) best = prev[k];
+	}
+	return best;
+}
+
+/*
+ * Edit distance of candidate that trusts the parts of query confirmed by seeds
+ * Inner regions are aligned globally, the first region with free sequence start and
+ * the last region with free sequence end
+ * Returns nmm + 1 as soon as accumulated distance exceeds nmm
+ */
+
+static unsigned regionDistance (const char *query, unsigned qlen, const Chromosome *chr, candidate *cand, unsigned nmm)
+{
+	char qrev[MAX_READ_LENGTH], srev[MAX_READ_LENGTH + 2 * MAX_BAND];
+	unsigned r, total;
+	long long sstart = (long long) cand->loc - chr->start;
+
+	total = 0;
+	for (r = 0; r < cand->nregions; r++) {
+		unsigned qs = cand->reg[r].qstart, qe = cand->reg[r].qend;
+		long long gs = sstart + qs, ge = sstart + qe;
+		unsigned w = nmm - total, d;
+		if (qe <= qs) continue;
+		if ((qs == 0) && (qe >= qlen)) {
+			/* Nothing is anchored */
+			unsigned qstart = nmm;
+			char seq[MAX_READ_LENGTH + 2 * MAX_BAND + 1];
+			if ((sstart < nmm) || (sstart + qlen + nmm > chr->length)) return nmm + 1;
+			memcpy (seq, chr->sequence + sstart - nmm, qlen + 2 * nmm);
+			seq[qlen + 2 * nmm] = 0;
+			return editDistance (query, seq, &qstart, NULL, NULL);
+		} else if (qs == 0) {
+			/* Leading region is anchored at its end, align reversed strings */
+			unsigned i, n = qe, sn = qe + w;
+			if (ge > (long long) chr->length) return nmm + 1;
+			if (sn > ge) sn = ge;
+			for (i = 0; i < n; i++) qrev[i] = query[qe - 1 - i];
+			for (i = 0; i < sn; i++) srev[i] = chr->sequence[ge - 1 - i];
+			d = bandedDistance (qrev, n, srev, sn, w, 1);
+		} else if (qe >= qlen) {
+			/* Trailing region is anchored at its start */
+			long long sn = (qlen - qs) + w;
+			if (gs + sn > chr->length) sn = chr->length - gs;
+			if (sn < 0) return nmm + 1;
+			d = bandedDistance (query + qs, qlen - qs, chr->sequence + gs, sn, w, 1);
+		} else {
+			/* Inner region is anchored at both ends */
+			if (ge > (long long) chr->length) return nmm + 1;
+			d = bandedDistance (query + qs, qe - qs, chr->sequence + gs, qe - qs, w, 0);
+		}
+		total += d;
+		if (total > nmm) return nmm + 1;
+	}
+	return total;
+}
+
+/*
+ * Edit distance of the gap between long query anchors (or of its ends)
+ * Small gaps are aligned fully, large ones in band of LONG_BAND around the diagonal from start to the
+ * end of both strings (or the main diagonal if freeend is set)
+ * If freeend is set, the end of sequence is free and used is set to the number of aligned sequence nucleotides
+ */
+
+static unsigned longDistance (mapworker *w, const char *query, int qlen, const char *seq, int slen, int freeend, int *used)
+{
+	int *prev, *cur, qi, si, band, lo, hi, best;
+	*used = 0;
+	if (qlen <= 0) return 0;
+	if (slen <= 0) return qlen;
+	if ((long long) qlen * slen <= LONG_FULL_CELLS) {
+		band = (qlen > slen) ? qlen : slen;
+	} else {
+		band = LONG_BAND;
+	}
+	if (w->ndp_slots < (unsigned) (2 * (slen + 2))) {
+		w->ndp_slots = 2 * (slen + 2);
+		w->dp = (int *) realloc (w->dp, w->ndp_slots * sizeof(int));
+	}
+	/* Cells outside of band are never written and stay at qlen + slen */
+	prev = w->dp + 1;
+	cur = w->dp + slen + 3;
+	for (si = -1; si <= slen; si++) prev[si] = cur[si] = qlen + slen;
+	hi = (band < slen) ? band : slen;
+	for (si = 0; si <= hi; si++) prev[si] = si;
+	for (qi = 1; qi <= qlen; qi++) {
+		int *t, center = (freeend) ? qi : (int) ((long long) qi * slen / qlen);
+		lo = (center - band > 0) ? center - band : 0;
+		hi = (center + band < slen) ? center + band : slen;
+		cur[lo - 1] = qlen + slen;
+		for (si = lo; si <= hi; si++) {
+			/* Gap in sequence */
+			int v = prev[si] + 1;
+			/* Gap in query */
+			if (cur[si - 1] + 1 < v) v = cur[si - 1] + 1;
+			/* Match or mismatch */
+			if ((si > 0) && (prev[si - 1] + (query[qi - 1] != seq[si - 1]) < v)) v = prev[si - 1] + (query[qi - 1] != seq[si - 1]);
+			cur[si] = v;
+		}
+		t = prev;
+		prev = cur;
+		cur = t;
+	}
+	if (!freeend) return (prev[slen] < qlen + slen) ? prev[slen] : qlen + slen;
+	best = qlen + slen;
+	for (si = lo; si <= hi; si++) {
+		if (prev[si] < best) {
+			best = prev[si];
+			*used = si;
+		}
+	}
+	return best;
+}
+
+/* fixme: Update qstart */
+
+static int editDistance (const char *query, const char *seq, unsigned *qstart, char *s, char *q)
+{
+	static __thread int *d = NULL;
+	static __thread int dsize = 0;
+	int qlen, slen, qi, si, dist, lasts;
+	qlen = strlen (query);
+	slen = strlen (seq);
+	if (debug > 2) fprintf (stderr, "editDistance: Query %s (len = %d), sequence %s (len = %d)\n", query, qlen, seq, slen);
+	if ((qlen + 1) * (slen + 1) > dsize) {
+		dsize = (qlen + 1) * (slen + 1);
+		d = (int *) realloc (d, dsize * sizeof (int));
+	}
+	/* Fill first column */
+	for (si = 0; si <= slen; si++) {
+		/*d[si * (qlen + 1) + 0] = (si < (int) *qstart) ? *qstart - si : si - *qstart;*/
+		d[si * (qlen + 1) + 0] = (si < (int) 2 * *qstart) ? 0 : si - 2 * *qstart;
+	}
+	/* Fill first row */
+	for (qi = 1; qi <= qlen; qi++) {
+		d[qi] = 99;
+	}
+	for (qi = 1; qi <= qlen; qi++) {
+		for (si = 1; si <= slen; si++) {
+			unsigned dl, dtl, dt;
+			dl = d[si * (qlen + 1) + qi - 1] + 1;
+			dtl = d[(si - 1) * (qlen + 1) + qi - 1];
+			if ((qi < qlen) && (si < slen) && (query[qi] != seq[si])) dtl += 1;
+			dt = d[(si - 1) * (qlen + 1) + qi] + 1;
+			d[si * (qlen + 1) + qi] = ((dl < dtl) && (dl < dt)) ? dl : ((dt < dl) && (dt < dtl)) ? dt : dtl;
+		}
+	}
+	if (debug > 3) {
+		/* Print table */
+		for (si = 0; si <= slen; si++) {
+			for (qi = 0; qi <= qlen; qi++) {
+				fprintf (stderr, "%2u ", d[si * (qlen + 1) + qi]);
+			}
+			fprintf (stderr, "\n");
+		}
+	}
+	dist = 99;
+	lasts = 0;
+	for (si = 0; si <= slen; si++) {
+		if (d[si * (qlen + 1) + qlen] < dist) {
+			dist = d[si * (qlen + 1) + qlen];
+			lasts = si;
+		}
+	}
+	if (s && q) {
+		unsigned sp, qp, i;
+		/* Print alignment */
+		sp = 0;
+		qp = 0;
+		qi = qlen - 1;
+		si = slen - 1;
+		while (si >= lasts) {
+			s[sp++] = seq[si--];
+			q[qp++] = '-';
+		}
+		while ((qi >= 0) || (si >= 0)) {
+			unsigned dl, dtl, dt;
+			dl = (qi > 0) ? d[si * (qlen + 1) + qi - 1] : 99;
+			dtl = ((qi > 0) && (si > 0)) ? d[(si - 1) * (qlen + 1) + qi - 1] : 99;
+			dt = (si > 0) ? d[(si - 1) * (qlen + 1) + qi] : 99;
+			if (qi < 0) {
+				/* End of query */
+				s[sp++] = seq[si--];
+				q[qp++] = '-';
+			} else if (si < 0) {
+				/* End of sequence */
+				s[sp++] = '-';
+				q[qp++] = query[qi--];
+			} else if (qi == 0) {
+				s[sp++] = seq[si--];
+				q[qp++] = query[qi--];
+			} else if ((dtl <= dl) && (dtl <= dt)) {
+				/* Match or ungapped mismatch */
+				s[sp++] = seq[si--];
+				q[qp++] = query[qi--];
+			} else if (si == 0) {
+				s[sp++] = seq[si--];
+				q[qp++] = '-';
+			} else if ((dl <= dtl) && (dl <= dt)) {
+				/* Gap in sequence */
+				s[sp++] = '-';
+				q[qp++] = query[qi--];
+			} else {
+				/* Gap in query */
+				s[sp++] = seq[si--];
+				q[qp++] = '-';
+			}
+		}
+		for (i = 0; i < qp / 2; i++) {
+			char t = q[i];
+			q[i] = q[qp - 1 - i];
+			q[qp - 1 - i] = t;
+		}
+		for (i = 0; i < sp / 2; i++) {
+			char t = s[i];
+			s[i] = s[sp - 1 - i];
+			s[sp - 1 - i] = t;
+		}
+		s[sp] = 0;
+		q[qp] = 0;
+	}
+	return dist;
+}
@@ -0,0 +1,337 @@
+/*
+ * Genome Mapper
+ * (reader - mapper - writer pipeline)
+ *
+ * Authors: Maarja Lepamets, Fanny-Dhelia Pajuste
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+
+#include "utils.h"
+
+/*
+ * Bounded multi-producer multi-consumer queue (D. Vyukov)
+ * Every cell has sequence number telling whether it is free for the producer
+ * of given position (seq == pos) or holds data for the consumer (seq == pos + 1)
+ */
+
+typedef struct _queuecell {
+	unsigned long long seq;
+	void *data;
+} queuecell;
+
+typedef struct _boundedqueue {
+	queuecell *cells;
+	unsigned long long mask;
+	/* Producer and consumer positions are kept on separate cache lines */
+	char pad0[64];
+	unsigned long long enqueuepos;
+	char pad1[64];
+	unsigned long long dequeuepos;
+	char pad2[64];
+} boundedqueue;
+
+typedef struct _pipeline {
+	FILE *in;
+	FILE *out;
+	FILE *err;
+	unsigned batchsize;
+	/* Maximum number of batches between reader and writer */
+	unsigned window;
+	batchfunc func;
+	/* Called after every written batch (NULL - not called) */
+	checkpointfunc checkpoint;
+	void *checkpointarg;
+	boundedqueue input;
+	boundedqueue output;
+	/* Set by reader at the end of input */
+	unsigned nbatches;
+	unsigned nqueries;
+	/* Number of batches written, reader waits if it gets window batches ahead */
+	unsigned written;
+} pipeline;
+
+typedef struct _workerarg {
+	pipeline *p;
+	void *worker;
+} workerarg;
+
+/* Capacity is rounded up to power of 2 */
+static void queueinit(boundedqueue *q, unsigned capacity)
+{
+	unsigned long long size = 2, i;
+	while (size < capacity) size *= 2;
+	q->cells = (queuecell *) malloc (size * sizeof(queuecell));
+	for (i = 0; i < size; i++) q->cells[i].seq = i;
+	q->mask = size - 1;
+	q->enqueuepos = 0;
+	q->dequeuepos = 0;
+}
+
+/* Returns 0 if queue is full */
+static int queuetrypush(boundedqueue *q, void *data)
+{
+	unsigned long long pos = __atomic_load_n(&q->enqueuepos, __ATOMIC_RELAXED);
+	for (;;) {
+		queuecell *cell = &q->cells[pos & q->mask];
+		long long dif = (long long) __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE) - (long long) pos;
+		if (dif == 0) {
+			if (__atomic_compare_exchange_n(&q->enqueuepos, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+				cell->data = data;
+				__atomic_store_n(&cell->seq, pos + 1, __ATOMIC_RELEASE);
+				return 1;
+			}
+		} else if (dif < 0) {
+			return 0;
+		} else {
+			pos = __atomic_load_n(&q->enqueuepos, __ATOMIC_RELAXED);
+		}
+	}
+}
+
+/* Returns 0 if queue is empty */
+static int queuetrypop(boundedqueue *q, void **data)
+{
+	unsigned long long pos = __atomic_load_n(&q->dequeuepos, __ATOMIC_RELAXED);
+	for (;;) {
+		queuecell *cell = &q->cells[pos & q->mask];
+		long long dif = (long long) __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE) - (long long) (pos + 1);
+		if (dif == 0) {
+			if (__atomic_compare_exchange_n(&q->dequeuepos, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+				*data = cell->data;
+				__atomic_store_n(&cell->seq, pos + q->mask + 1, __ATOMIC_RELEASE);
+				return 1;
+			}
+		} else if (dif < 0) {
+			return 0;
+		} else {
+			pos = __atomic_load_n(&q->dequeuepos, __ATOMIC_RELAXED);
+		}
+	}
+}
+
+/* Spin for a while, then yield, then sleep (up to 1 ms) */
+static void backoff(unsigned *round)
+{
+	if (*round < 64) {
+		*round += 1;
+	} else if (*round < 128) {
+		*round += 1;
+		sched_yield();
+	} else {
+		struct timespec ts;
+		ts.tv_sec = 0;
+		ts.tv_nsec = (*round < 1000) ? *round * 1000 : 1000000;
+		*round += 16;
+		nanosleep(&ts, NULL);
+	}
+}
+
+static void queuepush(boundedqueue *q, void *data)
+{
+	unsigned round = 0;
+	while (!queuetrypush(q, data)) backoff(&round);
+}
+
+static void *queuepop(boundedqueue *q)
+{
+	unsigned round = 0;
+	void *data;
+	while (!queuetrypop(q, &data)) backoff(&round);
+	return data;
+}
+
+static readbatch *newbatch(unsigned seq, unsigned first, unsigned batchsize)
+{
+	readbatch *b = (readbatch *) malloc (sizeof(readbatch));
+	memset(b, 0, sizeof(readbatch));
+	b->seq = seq;
+	b->first = first;
+	b->offsets = (unsigned *) malloc (batchsize * sizeof(unsigned));
+	b->datasize = batchsize * 128;
+	b->data = (char *) malloc (b->datasize);
+	return b;
+}
+
+static void freebatch(readbatch *b)
+{
+	free(b->offsets);
+	free(b->data);
+	free(b->out);
+	free(b->err);
+	free(b);
+}
+
+/* Append next whitespace-separated word of input (of any length) to batch data, returns 0 at the end of input */
+static int readword(FILE *f, readbatch *b)
+{
+	unsigned start = b->datalen;
+	int c;
+	while (((c = getc_unlocked(f)) != EOF) && isspace(c)) {}
+	if (c == EOF) return 0;
+	do {
+		if (b->datalen + 2 > b->datasize) {
+			b->datasize *= 2;
+			b->data = (char *) realloc (b->data, b->datasize);
+		}
+		b->data[b->datalen++] = c;
+	} while (((c = getc_unlocked(f)) != EOF) && !isspace(c));
+	b->data[b->datalen++] = 0;
+	b->offsets[b->n++] = start;
+	return 1;
+}
+
+/* Cut input into batches, stop if too far ahead of the writer */
+static void *readerthread(void *arg)
+{
+	pipeline *p = (pipeline *) arg;
+	unsigned seq = 0, nqueries = 0, eof = 0;
+	while (!eof) {
+		unsigned round = 0;
+		readbatch *b = NULL;
+		while (seq >= __atomic_load_n(&p->written, __ATOMIC_ACQUIRE) + p->window) backoff(&round);
+		while (!b || (b->n < p->batchsize)) {
+			if (!b) b = newbatch(seq, nqueries, p->batchsize);
+			if (!readword(p->in, b)) {
+				eof = 1;
+				break;
+			}
+			nqueries += 1;
+		}
+		if (b && (b->n == 0)) {
+			freebatch(b);
+			b = NULL;
+		}
+		if (b) {
+			b->inputend = ftello(p->in);
+			queuepush(&p->input, b);
+			seq += 1;
+		}
+	}
+	p->nqueries = nqueries;
+	__atomic_store_n(&p->nbatches, seq, __ATOMIC_RELEASE);
+	return NULL;
+}
+
+/* Map batches until reader sends NULL */
+static void *workerthread(void *arg)
+{
+	workerarg *wa = (workerarg *) arg;
+	pipeline *p = wa->p;
+	readbatch *b;
+	while ((b = (readbatch *) queuepop(&p->input)) != NULL) {
+		b->outf = open_memstream(&b->out, &b->outlen);
+		b->errf = open_memstream(&b->err, &b->errlen);
+		if (!b->outf || !b->errf) {
+			fprintf (stderr, "Cannot create output buffer!\n");
+			exit (1);
+		}
+		p->func(b, wa->worker);
+		fclose(b->outf);
+		fclose(b->errf);
+		b->outf = b->errf = NULL;
+		queuepush(&p->output, b);
+	}
+	return NULL;
+}
+
+/* Write batches in the order of input */
+static void *writerthread(void *arg)
+{
+	pipeline *p = (pipeline *) arg;
+	readbatch **pending = (readbatch **) malloc (p->window * sizeof(readbatch *));
+	unsigned next = 0;
+	memset(pending, 0, p->window * sizeof(readbatch *));
+	while (next < __atomic_load_n(&p->nbatches, __ATOMIC_ACQUIRE)) {
+		readbatch *b;
+		unsigned round = 0;
+		while (!pending[next % p->window]) {
+			if (next >= __atomic_load_n(&p->nbatches, __ATOMIC_ACQUIRE)) break;
+			if (queuetrypop(&p->output, (void **) &b)) {
+				pending[b->seq % p->window] = b;
+				round = 0;
+			} else {
+				backoff(&round);
+			}
+		}
+		b = pending[next % p->window];
+		if (!b) break;
+		pending[next % p->window] = NULL;
+		if (b->outlen) fwrite(b->out, 1, b->outlen, p->out);
+		if (b->errlen) fwrite(b->err, 1, b->errlen, p->err);
+		if (p->checkpoint) p->checkpoint(b->first + b->n, b->inputend, p->checkpointarg);
+		freebatch(b);
+		next += 1;
+		__atomic_store_n(&p->written, next, __ATOMIC_RELEASE);
+	}
+	free(pending);
+	return NULL;
+}
+
+/*
+ * Map all queries of input using reader thread, nworkers mapping threads and writer thread
+ * Queries are whitespace-separated words of input, func maps one batch of them using
+ * given worker state and writes results to batch->outf and messages to batch->errf
+ * Results are written to out and err in the order of queries, after every batch checkpoint (if not NULL)
+ * is called with the number of queries written and the offset of input after them
+ *
+ * returns    - number of queries
+ */
+unsigned runpipeline(FILE *in, FILE *out, FILE *err, unsigned batchsize, unsigned nworkers, void **workers, batchfunc func, checkpointfunc checkpoint, void *checkpointarg)
+{
+	pipeline p;
+	pthread_t reader, writer, *threads;
+	workerarg *args;
+	unsigned i;
+
+	memset(&p, 0, sizeof(pipeline));
+	p.in = in;
+	p.out = out;
+	p.err = err;
+	p.batchsize = (batchsize > 0) ? batchsize : 1;
+	p.func = func;
+	p.checkpoint = checkpoint;
+	p.checkpointarg = checkpointarg;
+	p.nbatches = 0xffffffff;
+	/* Enough batches for every worker to have one in progress and one waiting */
+	queueinit(&p.input, 2 * nworkers + 2);
+	p.window = 2 * (p.input.mask + 1);
+	queueinit(&p.output, p.window);
+
+	threads = (pthread_t *) malloc (nworkers * sizeof(pthread_t));
+	args = (workerarg *) malloc (nworkers * sizeof(workerarg));
+	if (pthread_create(&reader, NULL, readerthread, &p) || pthread_create(&writer, NULL, writerthread, &p)) {
+		fprintf (stderr, "Cannot create thread!\n");
+		exit (1);
+	}
+	for (i = 0; i < nworkers; i++) {
+		args[i].p = &p;
+		args[i].worker = workers[i];
+		if (pthread_create(&threads[i], NULL, workerthread, &args[i])) {
+			fprintf (stderr, "Cannot create thread!\n");
+			exit (1);
+		}
+	}
+	pthread_join(reader, NULL);
+	/* Tell workers that there is no more input */
+	for (i = 0; i < nworkers; i++) queuepush(&p.input, NULL);
+	for (i = 0; i < nworkers; i++) pthread_join(threads[i], NULL);
+	pthread_join(writer, NULL);
+	fflush(out);
+
+	free(threads);
+	free(args);
+	free(p.input.cells);
+	free(p.output.cells);
+	return p.nqueries;
+}
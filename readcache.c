@@ -0,0 +1,267 @@
+/*
+ * Genome Mapper
+ * (cache of mapping results of repeated queries)
+ *
+ * Authors: Maarja Lepamets, Fanny-Dhelia Pajuste
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "utils.h"
+
+/* Cache is split into independently locked shards, shard is chosen by the high bits of hash */
+#define CACHE_SHARD_BITS 6
+#define CACHE_NSHARDS (1 << CACHE_SHARD_BITS)
+
+typedef struct _cacheentry {
+	/* Next entry in hash bucket */
+	struct _cacheentry *next;
+	/* Least recently used list, head is the most recently used */
+	struct _cacheentry *lruprev;
+	struct _cacheentry *lrunext;
+	unsigned long long hash;
+	unsigned qlen;
+	unsigned nhits;
+	/* Followed by nhits hits and (qlen + 3) / 4 bytes of packed query */
+} cacheentry;
+
+typedef struct _cacheshard {
+	pthread_mutex_t lock;
+	cacheentry **buckets;
+	unsigned nbuckets;
+	unsigned nentries;
+	cacheentry *lruhead;
+	cacheentry *lrutail;
+	unsigned long long used;
+} cacheshard;
+
+struct _readcache {
+	unsigned long long shardbudget;
+	cacheshard shards[CACHE_NSHARDS];
+	/* Statistics (shared by all shards) */
+	unsigned long long lookups;
+	unsigned long long hits;
+	unsigned long long inserts;
+	unsigned long long evictions;
+};
+
+static unsigned long long entrysize(unsigned qlen, unsigned nhits)
+{
+	return sizeof(cacheentry) + nhits * sizeof(cachehit) + (qlen + 3) / 4;
+}
+
+static cachehit *entryhits(cacheentry *e)
+{
+	return (cachehit *) (e + 1);
+}
+
+static unsigned char *entrykey(cacheentry *e)
+{
+	return (unsigned char *) (entryhits(e) + e->nhits);
+}
+
+/*
+ * Pack query into 2 bits per nucleotide
+ * Only queries of uppercase A, C, G, T are cached, as other symbols affect alignment
+ * Long queries (MAX_READ_LENGTH and more) are not cached
+ *
+ * returns    - 1 if packed, 0 if query cannot be cached
+ */
+static int packquery(const char *query, unsigned qlen, unsigned char *key, unsigned long long *hash)
+{
+	unsigned i;
+	unsigned long long h = 14695981039346656037ULL;
+	memset(key, 0, (qlen + 3) / 4);
+	for (i = 0; i < qlen; i++) {
+		unsigned v;
+		switch (query[i]) {
+		case 'A': v = 0; break;
+		case 'C': v = 1; break;
+		case 'G': v = 2; break;
+		case 'T': v = 3; break;
+		default: return 0;
+		}
+		key[i / 4] |= v << (2 * (i % 4));
+	}
+	/* FNV-1a of packed bytes and length */
+	for (i = 0; i < (qlen + 3) / 4; i++) {
+		h = (h ^ key[i]) * 1099511628211ULL;
+	}
+	h = (h ^ qlen) * 1099511628211ULL;
+	*hash = h;
+	return 1;
+}
+
+static cacheentry *findentry(cacheshard *s, unsigned long long hash, unsigned qlen, const unsigned char *key)
+{
+	cacheentry *e;
+	for (e = s->buckets[hash & (s->nbuckets - 1)]; e; e = e->next) {
+		if ((e->hash == hash) && (e->qlen == qlen) && !memcmp(entrykey(e), key, (qlen + 3) / 4)) return e;
+	}
+	return NULL;
+}
+
+static void lruunlink(cacheshard *s, cacheentry *e)
+{
+	if (e->lruprev) e->lruprev->lrunext = e->lrunext;
+	else s->lruhead = e->lrunext;
+	if (e->lrunext) e->lrunext->lruprev = e->lruprev;
+	else s->lrutail = e->lruprev;
+}
+
+static void lrupush(cacheshard *s, cacheentry *e)
+{
+	e->lruprev = NULL;
+	e->lrunext = s->lruhead;
+	if (s->lruhead) s->lruhead->lruprev = e;
+	s->lruhead = e;
+	if (!s->lrutail) s->lrutail = e;
+}
+
+static void removeentry(cacheshard *s, cacheentry *e)
+{
+	cacheentry **p = &s->buckets[e->hash & (s->nbuckets - 1)];
+	while (*p != e) p = &(*p)->next;
+	*p = e->next;
+	lruunlink(s, e);
+	s->used -= entrysize(e->qlen, e->nhits);
+	s->nentries -= 1;
+	free(e);
+}
+
+static void growbuckets(cacheshard *s)
+{
+	unsigned nbuckets = s->nbuckets * 2, i;
+	cacheentry **buckets = (cacheentry **) malloc (nbuckets * sizeof(cacheentry *));
+	memset(buckets, 0, nbuckets * sizeof(cacheentry *));
+	for (i = 0; i < s->nbuckets; i++) {
+		cacheentry *e = s->buckets[i];
+		while (e) {
+			cacheentry *next = e->next;
+			e->next = buckets[e->hash & (nbuckets - 1)];
+			buckets[e->hash & (nbuckets - 1)] = e;
+			e = next;
+		}
+	}
+	s->used += (nbuckets - s->nbuckets) * sizeof(cacheentry *);
+	free(s->buckets);
+	s->buckets = buckets;
+	s->nbuckets = nbuckets;
+}
+
+/* Create cache that uses at most budget bytes */
+readcache *newreadcache(unsigned long long budget)
+{
+	readcache *c = (readcache *) malloc (sizeof(readcache));
+	unsigned i;
+	memset(c, 0, sizeof(readcache));
+	c->shardbudget = budget / CACHE_NSHARDS;
+	for (i = 0; i < CACHE_NSHARDS; i++) {
+		cacheshard *s = &c->shards[i];
+		pthread_mutex_init(&s->lock, NULL);
+		s->nbuckets = 64;
+		s->buckets = (cacheentry **) malloc (s->nbuckets * sizeof(cacheentry *));
+		memset(s->buckets, 0, s->nbuckets * sizeof(cacheentry *));
+		s->used = s->nbuckets * sizeof(cacheentry *);
+	}
+	return c;
+}
+
+void freereadcache(readcache *c)
+{
+	unsigned i;
+	for (i = 0; i < CACHE_NSHARDS; i++) {
+		cacheshard *s = &c->shards[i];
+		while (s->lruhead) removeentry(s, s->lruhead);
+		free(s->buckets);
+		pthread_mutex_destroy(&s->lock);
+	}
+	free(c);
+}
+
+/*
+ * Find cached hits of query, hits are copied to (growable) array of caller
+ *
+ * returns    - 1 if query was found, 0 otherwise
+ */
+int readcachelookup(readcache *c, const char *query, unsigned qlen, cachehit **hits, unsigned *nslots, unsigned *nhits)
+{
+	unsigned char key[MAX_READ_LENGTH / 4 + 1];
+	unsigned long long hash;
+	cacheshard *s;
+	cacheentry *e;
+	int found = 0;
+
+	if ((qlen >= MAX_READ_LENGTH) || !packquery(query, qlen, key, &hash)) return 0;
+	s = &c->shards[hash >> (64 - CACHE_SHARD_BITS)];
+	pthread_mutex_lock(&s->lock);
+	__atomic_fetch_add(&c->lookups, 1, __ATOMIC_RELAXED);
+	e = findentry(s, hash, qlen, key);
+	if (e) {
+		if (*nslots < e->nhits) {
+			*nslots = e->nhits;
+			*hits = (cachehit *) realloc (*hits, *nslots * sizeof(cachehit));
+		}
+		memcpy(*hits, entryhits(e), e->nhits * sizeof(cachehit));
+		*nhits = e->nhits;
+		lruunlink(s, e);
+		lrupush(s, e);
+		__atomic_fetch_add(&c->hits, 1, __ATOMIC_RELAXED);
+		found = 1;
+	}
+	pthread_mutex_unlock(&s->lock);
+	return found;
+}
+
+/* Store hits of query, least recently used queries are evicted to stay within the budget */
+void readcacheinsert(readcache *c, const char *query, unsigned qlen, const cachehit *hits, unsigned nhits)
+{
+	unsigned char key[MAX_READ_LENGTH / 4 + 1];
+	unsigned long long hash, size = entrysize(qlen, nhits);
+	cacheshard *s;
+	cacheentry *e;
+
+	if (size > c->shardbudget / 4) return;
+	if ((qlen >= MAX_READ_LENGTH) || !packquery(query, qlen, key, &hash)) return;
+	s = &c->shards[hash >> (64 - CACHE_SHARD_BITS)];
+	pthread_mutex_lock(&s->lock);
+	/* Other thread may have mapped the same query meanwhile */
+	if (findentry(s, hash, qlen, key)) {
+		pthread_mutex_unlock(&s->lock);
+		return;
+	}
+	while (s->lrutail && (s->used + size > c->shardbudget)) {
+		removeentry(s, s->lrutail);
+		__atomic_fetch_add(&c->evictions, 1, __ATOMIC_RELAXED);
+	}
+	e = (cacheentry *) malloc (size);
+	e->hash = hash;
+	e->qlen = qlen;
+	e->nhits = nhits;
+	memcpy(entryhits(e), hits, nhits * sizeof(cachehit));
+	memcpy(entrykey(e), key, (qlen + 3) / 4);
+	e->next = s->buckets[hash & (s->nbuckets - 1)];
+	s->buckets[hash & (s->nbuckets - 1)] = e;
+	lrupush(s, e);
+	s->used += size;
+	s->nentries += 1;
+	__atomic_fetch_add(&c->inserts, 1, __ATOMIC_RELAXED);
+	if (s->nentries > s->nbuckets) growbuckets(s);
+	pthread_mutex_unlock(&s->lock);
+}
+
+void readcachestats(readcache *c, FILE *f)
+{
+	unsigned long long entries = 0, used = 0;
+	unsigned i;
+	for (i = 0; i < CACHE_NSHARDS; i++) {
+		entries += c->shards[i].nentries;
+		used += c->shards[i].used;
+	}
+	fprintf (f, "Read cache: %llu lookups, %llu hits (%.1f%%), %llu inserts, %llu evictions, %llu entries, %.1f MB\n",
+			c->lookups, c->hits, (c->lookups) ? 100.0 * c->hits / c->lookups : 0.0,
+			c->inserts, c->evictions, entries, used / 1048576.0);
+}
@@ -0,0 +1,463 @@
+/*
+ * Genome Mapper
+ * (splitting of query file into chunks that are mapped by several processes or hosts)
+ *
+ * Chunks are described by task files in spool directory, any process that sees the directory
+ * (local worker or worker on other host over shared filesystem) can take task by renaming it
+ *   task.K      - query file, byte range and index of the first query of chunk K
+ *   claimed.K   - task taken by some worker
+ *   owner.K     - host and process id of the worker that took task K, touched every SPOOL_HEARTBEAT seconds
+ *                 while the task is mapped (task whose owner file is not touched for lease seconds is taken back)
+ *   out.K err.K - results and messages of chunk K, err.K appears last
+ *
+ * Authors: Maarja Lepamets, Fanny-Dhelia Pajuste
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include <limits.h>
+#include <pthread.h>
+
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+#include <dirent.h>
+#include <unistd.h>
+
+#include "utils.h"
+
+/* Seconds between the touches of owner file of task being mapped */
+#define SPOOL_HEARTBEAT 5
+
+/* Task being mapped by this process, given back if the process exits before finishing it */
+static char currentclaim[PATH_MAX + 32];
+static char currenttask[PATH_MAX + 32];
+static char currentowner[PATH_MAX + 32];
+static int releaseregistered = 0;
+/* Host and process id of this worker, also the suffix of its partial result files */
+static char ownerid[300];
+/* Heartbeat thread touches owner file until stopheartbeat is set */
+static pthread_mutex_t heartbeatlock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t heartbeatcond = PTHREAD_COND_INITIALIZER;
+static int stopheartbeat;
+
+static void setownerid(void)
+{
+	char host[256];
+	if (gethostname(host, sizeof(host))) strcpy(host, "unknown");
+	host[sizeof(host) - 1] = 0;
+	snprintf(ownerid, sizeof(ownerid), "%s %d", host, (int) getpid());
+}
+
+/* Whether owner file still names this worker (task may have been taken back and claimed by other worker) */
+static int ownsfile(const char *name)
+{
+	char line[300];
+	FILE *f = fopen(name, "r");
+	int own;
+	if (f == NULL) return 0;
+	own = (fgets(line, sizeof(line), f) != NULL) && !strncmp(line, ownerid, strlen(ownerid)) && (line[strlen(ownerid)] == '\n');
+	fclose(f);
+	return own;
+}
+
+static void releasetask(void)
+{
+	if (currentclaim[0] && ownsfile(currentowner)) {
+		unlink(currentowner);
+		rename(currentclaim, currenttask);
+	}
+}
+
+/* Record which process took task, so that the task of killed local worker can be given back */
+static void writeowner(const char *name)
+{
+	FILE *f = fopen(name, "w");
+	if (f == NULL) return;
+	fprintf(f, "%s\n", ownerid);
+	fclose(f);
+}
+
+static void *heartbeatthread(void *arg)
+{
+	const char *name = (const char *) arg;
+	struct timespec ts;
+	pthread_mutex_lock(&heartbeatlock);
+	while (!stopheartbeat) {
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_sec += SPOOL_HEARTBEAT;
+		pthread_cond_timedwait(&heartbeatcond, &heartbeatlock, &ts);
+		if (!stopheartbeat) utimes(name, NULL);
+	}
+	pthread_mutex_unlock(&heartbeatlock);
+	return NULL;
+}
+
+/* Write file through temporary name so that readers never see it half written */
+static void writetask(const char *dir, unsigned k, const char *queryfile, unsigned long long start, unsigned long long end, unsigned first)
+{
+	char name[PATH_MAX + 32], part[PATH_MAX + 32];
+	FILE *f;
+	snprintf(name, sizeof(name), "%s/task.%u", dir, k);
+	snprintf(part, sizeof(part), "%s/task.%u.part", dir, k);
+	f = fopen(part, "w");
+	if (f == NULL) {
+		fprintf(stderr, "spool: Cannot create file %s.\n", part);
+		exit (1);
+	}
+	fprintf(f, "%llu %llu %u %s\n", start, end, first, queryfile);
+	fclose(f);
+	if (rename(part, name)) {
+		fprintf(stderr, "spool: Cannot rename %s.\n", part);
+		exit (1);
+	}
+}
+
+/*
+ * Split query file into at most nchunks byte ranges of about equal size and write their tasks to dir
+ * Ranges start at query boundaries and every task knows the index of its first query
+ *
+ * returns    - the number of tasks (empty ranges are left out)
+ */
+unsigned spoolsplit(const char *queryfile, unsigned nchunks, const char *dir)
+{
+	char path[PATH_MAX];
+	struct stat st;
+	const char *data;
+	unsigned long long pos = 0, start, end;
+	unsigned k, ntasks = 0, nqueries = 0;
+	DIR *d;
+	struct dirent *e;
+
+	/* Tasks of earlier run would be mixed with ours */
+	d = opendir(dir);
+	if (d == NULL) {
+		fprintf(stderr, "spool: Cannot open directory %s.\n", dir);
+		exit (1);
+	}
+	while ((e = readdir(d)) != NULL) {
+		if (e->d_name[0] != '.') {
+			fprintf(stderr, "spool: Directory %s is not empty.\n", dir);
+			exit (1);
+		}
+	}
+	closedir(d);
+	/* Workers may run in other directories */
+	if (!realpath(queryfile, path)) {
+		fprintf(stderr, "spool: Cannot open file %s.\n", queryfile);
+		exit (1);
+	}
+	data = filemmap(path, &st);
+	for (k = 0; k < nchunks; k++) {
+		unsigned first = nqueries;
+		start = pos;
+		end = (unsigned long long) st.st_size * (k + 1) / nchunks;
+		if (end < start) end = start;
+		/* Move end to the beginning of next query */
+		while ((end < (unsigned long long) st.st_size) && (end > 0) && !isspace(data[end - 1])) end += 1;
+		while ((end < (unsigned long long) st.st_size) && isspace(data[end])) end += 1;
+		for (; pos < end; pos++) {
+			if (!isspace(data[pos]) && ((pos == 0) || isspace(data[pos - 1]))) nqueries += 1;
+		}
+		if (nqueries == first) continue;
+		if (debug > 0) fprintf(stderr, "Chunk %u: bytes %llu-%llu, queries %u-%u\n", ntasks, start, end, first, nqueries - 1);
+		writetask(dir, ntasks, path, start, end, first);
+		ntasks += 1;
+	}
+	munmap((void *) data, st.st_size);
+	return ntasks;
+}
+
+/* Map one claimed task */
+static void runtask(const char *dir, unsigned k, chunkfunc func, void *arg)
+{
+	char name[PATH_MAX + 32], part[PATH_MAX + 32], queryfile[PATH_MAX];
+	unsigned long long start, end;
+	unsigned first;
+	struct stat st;
+	const char *data;
+	FILE *f, *q, *out, *err;
+
+	snprintf(name, sizeof(name), "%s/claimed.%u", dir, k);
+	f = fopen(name, "r");
+	if ((f == NULL) || (fscanf(f, "%llu %llu %u %4095[^\n]", &start, &end, &first, queryfile) != 4)) {
+		fprintf(stderr, "spool: Invalid task %s.\n", name);
+		exit (1);
+	}
+	fclose(f);
+	data = filemmap(queryfile, &st);
+	if (end > (unsigned long long) st.st_size) {
+		fprintf(stderr, "spool: Task %s is beyond the end of %s.\n", name, queryfile);
+		exit (1);
+	}
+	q = fmemopen((void *) (data + start), end - start, "r");
+	/* Worker whose task was taken back may still finish it at the same time as the new owner */
+	snprintf(part, sizeof(part), "%s/out.%u.%.250s.part", dir, k, ownerid);
+	out = fopen(part, "w");
+	snprintf(part, sizeof(part), "%s/err.%u.%.250s.part", dir, k, ownerid);
+	err = fopen(part, "w");
+	if (!q || !out || !err) {
+		fprintf(stderr, "spool: Cannot open files of task %s.\n", name);
+		exit (1);
+	}
+	func(q, first, out, err, arg);
+	fclose(q);
+	fclose(out);
+	fclose(err);
+	munmap((void *) data, st.st_size);
+
+	snprintf(part, sizeof(part), "%s/out.%u.%.250s.part", dir, k, ownerid);
+	snprintf(name, sizeof(name), "%s/out.%u", dir, k);
+	if (rename(part, name)) {
+		fprintf(stderr, "spool: Cannot rename %s.\n", part);
+		exit (1);
+	}
+	snprintf(part, sizeof(part), "%s/err.%u.%.250s.part", dir, k, ownerid);
+	snprintf(name, sizeof(name), "%s/err.%u", dir, k);
+	if (rename(part, name)) {
+		fprintf(stderr, "spool: Cannot rename %s.\n", part);
+		exit (1);
+	}
+}
+
+/*
+ * Take tasks of dir one by one and map them with func until no task is left
+ * Several workers may run on the same directory at the same time
+ *
+ * returns    - the number of tasks mapped by this worker
+ */
+unsigned spoolwork(const char *dir, chunkfunc func, void *arg)
+{
+	unsigned ndone = 0, claimed = 1;
+	if (!releaseregistered) {
+		atexit(releasetask);
+		releaseregistered = 1;
+	}
+	/* Forked worker has its own process id */
+	setownerid();
+	while (claimed) {
+		DIR *d = opendir(dir);
+		struct dirent *e;
+		if (d == NULL) {
+			fprintf(stderr, "spool: Cannot open directory %s.\n", dir);
+			exit (1);
+		}
+		claimed = 0;
+		while ((e = readdir(d)) != NULL) {
+			char task[PATH_MAX + 32], name[PATH_MAX + 32], c;
+			pthread_t heartbeat;
+			unsigned k;
+			if ((sscanf(e->d_name, "task.%u%c", &k, &c) != 1)) continue;
+			snprintf(task, sizeof(task), "%s/task.%u", dir, k);
+			snprintf(name, sizeof(name), "%s/claimed.%u", dir, k);
+			/* Only one worker succeeds, others find the task gone */
+			if (rename(task, name)) continue;
+			if (debug > 0) fprintf(stderr, "Mapping chunk %u of %s\n", k, dir);
+			strcpy(currentclaim, name);
+			strcpy(currenttask, task);
+			snprintf(currentowner, sizeof(currentowner), "%s/owner.%u", dir, k);
+			writeowner(currentowner);
+			stopheartbeat = 0;
+			if (pthread_create(&heartbeat, NULL, heartbeatthread, currentowner)) {
+				fprintf(stderr, "spool: Cannot create thread.\n");
+				exit (1);
+			}
+			runtask(dir, k, func, arg);
+			pthread_mutex_lock(&heartbeatlock);
+			stopheartbeat = 1;
+			pthread_cond_signal(&heartbeatcond);
+			pthread_mutex_unlock(&heartbeatlock);
+			pthread_join(heartbeat, NULL);
+			currentclaim[0] = 0;
+			ndone += 1;
+			claimed = 1;
+		}
+		closedir(d);
+	}
+	return ndone;
+}
+
+/*
+ * Give back the unfinished task of local worker process pid that has exited
+ * (killed worker does not run its exit handler), so that other workers can map it
+ *
+ * returns    - the number of tasks given back
+ */
+unsigned spoolrelease(const char *dir, int pid)
+{
+	char host[256], name[PATH_MAX + 32], task[PATH_MAX + 32], owner[256];
+	unsigned nreleased = 0;
+	DIR *d;
+	struct dirent *e;
+
+	if (gethostname(host, sizeof(host))) strcpy(host, "unknown");
+	host[sizeof(host) - 1] = 0;
+	d = opendir(dir);
+	if (d == NULL) {
+		fprintf(stderr, "spool: Cannot open directory %s.\n", dir);
+		exit (1);
+	}
+	while ((e = readdir(d)) != NULL) {
+		struct stat st;
+		unsigned k;
+		int opid;
+		char c;
+		FILE *f;
+		if ((sscanf(e->d_name, "owner.%u%c", &k, &c) != 1)) continue;
+		snprintf(name, sizeof(name), "%s/owner.%u", dir, k);
+		f = fopen(name, "r");
+		if (f == NULL) continue;
+		if ((fscanf(f, "%255s %d", owner, &opid) != 2) || strcmp(owner, host) || (opid != pid)) {
+			fclose(f);
+			continue;
+		}
+		fclose(f);
+		/* Finished task has its results */
+		snprintf(task, sizeof(task), "%s/err.%u", dir, k);
+		if (stat(task, &st) == 0) continue;
+		unlink(name);
+		snprintf(name, sizeof(name), "%s/claimed.%u", dir, k);
+		snprintf(task, sizeof(task), "%s/task.%u", dir, k);
+		if (!rename(name, task)) nreleased += 1;
+	}
+	closedir(d);
+	return nreleased;
+}
+
+/*
+ * Give back task k whose worker has not touched its owner file for lease seconds (worker on other host
+ * died or lost the spool directory), so that it is mapped again
+ */
+static void expiretask(const char *dir, unsigned k, unsigned lease)
+{
+	char name[PATH_MAX + 32], task[PATH_MAX + 32];
+	snprintf(name, sizeof(name), "%s/claimed.%u", dir, k);
+	snprintf(task, sizeof(task), "%s/task.%u", dir, k);
+	if (rename(name, task)) return;
+	snprintf(name, sizeof(name), "%s/owner.%u", dir, k);
+	unlink(name);
+	fprintf(stderr, "Warning: Worker of chunk %u has not been seen for %u seconds, the chunk is mapped again.\n", k, lease);
+}
+
+/*
+ * Wait until results of all ntasks tasks are in dir
+ * Tasks given back by failed workers are mapped with func meanwhile
+ * Claimed task whose owner file has not changed for lease seconds (by the local clock, as the clocks of hosts may differ)
+ * is given back, 0 - wait for workers forever
+ */
+void spoolwait(const char *dir, unsigned ntasks, unsigned lease, chunkfunc func, void *arg)
+{
+	char name[PATH_MAX + 32];
+	struct stat st;
+	struct timespec ts;
+	time_t *seen, lastcheck = 0;
+	struct timespec *stamp;
+	unsigned k = 0, j;
+	ts.tv_sec = 0;
+	ts.tv_nsec = 100000000;
+	/* The last seen modification time of owner file of every task and when it was seen to change */
+	stamp = (struct timespec *) calloc(ntasks, sizeof(struct timespec));
+	seen = (time_t *) malloc(ntasks * sizeof(time_t));
+	for (j = 0; j < ntasks; j++) seen[j] = time(NULL);
+	while (k < ntasks) {
+		snprintf(name, sizeof(name), "%s/err.%u", dir, k);
+		if (stat(name, &st) == 0) {
+			k += 1;
+			continue;
+		}
+		if (spoolwork(dir, func, arg)) continue;
+		nanosleep(&ts, NULL);
+		if (!lease || (time(NULL) == lastcheck)) continue;
+		lastcheck = time(NULL);
+		for (j = k; j < ntasks; j++) {
+			struct timespec m = { 0, 0 };
+			snprintf(name, sizeof(name), "%s/err.%u", dir, j);
+			if (stat(name, &st) == 0) continue;
+			snprintf(name, sizeof(name), "%s/task.%u", dir, j);
+			if (stat(name, &st) == 0) {
+				/* Not claimed, lease starts when it is */
+				seen[j] = lastcheck;
+				continue;
+			}
+			snprintf(name, sizeof(name), "%s/owner.%u", dir, j);
+			if (stat(name, &st) == 0) m = st.st_mtim;
+			if ((m.tv_sec != stamp[j].tv_sec) || (m.tv_nsec != stamp[j].tv_nsec)) {
+				stamp[j] = m;
+				seen[j] = lastcheck;
+			} else if (lastcheck - seen[j] >= (time_t) lease) {
+				expiretask(dir, j, lease);
+				seen[j] = lastcheck;
+			}
+		}
+	}
+	free(stamp);
+	free(seen);
+}
+
+static void copyfile(const char *name, FILE *dst)
+{
+	char buf[65536];
+	size_t n;
+	FILE *f = fopen(name, "r");
+	if (f == NULL) {
+		fprintf(stderr, "spool: Cannot open file %s.\n", name);
+		exit (1);
+	}
+	while ((n = fread(buf, 1, sizeof(buf), f)) > 0) fwrite(buf, 1, n, dst);
+	fclose(f);
+	unlink(name);
+}
+
+/*
+ * Write results and messages of tasks to out and err in the order of tasks (and so of queries)
+ * and remove the files of tasks from dir
+ */
+void spoolmerge(const char *dir, unsigned ntasks, FILE *out, FILE *err)
+{
+	char name[PATH_MAX + 32];
+	unsigned k;
+	DIR *d;
+	struct dirent *e;
+	for (k = 0; k < ntasks; k++) {
+		snprintf(name, sizeof(name), "%s/out.%u", dir, k);
+		copyfile(name, out);
+		snprintf(name, sizeof(name), "%s/err.%u", dir, k);
+		copyfile(name, err);
+		snprintf(name, sizeof(name), "%s/claimed.%u", dir, k);
+		unlink(name);
+		snprintf(name, sizeof(name), "%s/owner.%u", dir, k);
+		unlink(name);
+	}
+	/* Partial results of workers whose tasks were taken back */
+	d = opendir(dir);
+	if (d != NULL) {
+		while ((e = readdir(d)) != NULL) {
+			size_t len = strlen(e->d_name);
+			if ((strncmp(e->d_name, "out.", 4) && strncmp(e->d_name, "err.", 4)) || (len < 5) || strcmp(e->d_name + len - 5, ".part")) continue;
+			snprintf(name, sizeof(name), "%s/%s", dir, e->d_name);
+			unlink(name);
+		}
+		closedir(d);
+	}
+	fflush(out);
+	fflush(err);
+}
+
+/* Remove private spool directory with all its files (run that ends with an error) */
+void spoolremove(const char *dir)
+{
+	char name[PATH_MAX + 32];
+	DIR *d = opendir(dir);
+	struct dirent *e;
+	if (d == NULL) return;
+	while ((e = readdir(d)) != NULL) {
+		if (!strcmp(e->d_name, ".") || !strcmp(e->d_name, "..")) continue;
+		snprintf(name, sizeof(name), "%s/%s", dir, e->d_name);
+		unlink(name);
+	}
+	closedir(d);
+	rmdir(dir);
+}
@@ -0,0 +1,22 @@
+#!/bin/sh
+# Autotune (--autotune, --autotune-save): the chosen setting finds at least --autotune-target percent of
+# the hits of -step 1, and the saved options can be given to mapper (the chosen setting can differ between
+# runs, as it depends on timing)
+
+. "$(dirname "$0")/common.sh"
+
+makegenome
+"$INDEXER" -i chrA.fa chrB.fa -o kmer -n 12 > /dev/null
+makereads reads 2000 100 2 41
+
+"$MAPPER" -i kmer_12.index -g kmer.names -q reads -mm 2 -step 1 > base.out 2> /dev/null
+"$MAPPER" -i kmer_12.index -g kmer.names -q reads -mm 2 --autotune --autotune-target 99 > tuned.out 2> tuned.err
+grep -q "^Autotune: -step" tuned.err || fail "no autotune summary"
+hitset base.out > base.set
+hitset tuned.out > tuned.set
+missing=$(comm -23 base.set tuned.set | wc -l)
+[ $((missing * 100)) -le $(wc -l < base.set) ] || fail "tuned setting misses $missing of $(wc -l < base.set) hits"
+
+"$MAPPER" -i kmer_12.index -g kmer.names -q reads -mm 2 --autotune --autotune-save opts > /dev/null 2>&1
+grep -q "^-step [0-9]* --candidates [a-z]* --cutoff-shift -\?[0-9]$" opts || fail "bad saved options: $(cat opts)"
+"$MAPPER" -i kmer_12.index -g kmer.names -q reads -mm 2 $(cat opts) > saved.out 2> /dev/null || fail "mapping with saved options failed"
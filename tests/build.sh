@@ -0,0 +1,17 @@
+#!/bin/sh
+# Index build engines (indexer -b): counting, packed and radix sort give the same words and locations,
+# also for canonical and multi-k index
+
+. "$(dirname "$0")/common.sh"
+
+makegenome
+for opts in "-n 12" "-n 14" "-n 12 -c" "-n 14,10"; do
+	for b in counting packed radix; do
+		"$INDEXER" -i chrA.fa chrB.fa -o $b $opts -b $b > /dev/null
+		"$INDEXSTATS" -i $b*.index > /dev/null || fail "$opts -b $b: index is not valid"
+		"$INDEXSTATS" -i $b*.index --dump > $b.dump
+		rm -f $b*.index
+	done
+	cmp -s counting.dump packed.dump || fail "$opts: -b packed differs from -b counting"
+	cmp -s counting.dump radix.dump || fail "$opts: -b radix differs from -b counting"
+done
@@ -0,0 +1,21 @@
+#!/bin/sh
+# Read cache (--cache): repeated queries get the same output as without cache, also when the cache is
+# too small for all queries and with several threads
+
+. "$(dirname "$0")/common.sh"
+
+makegenome
+"$INDEXER" -i chrA.fa chrB.fa -o kmer -n 12 > /dev/null
+makereads reads 12000 100 3 141
+for i in 1 2 3; do cat reads; done > reads3
+
+"$MAPPER" -i kmer_12.index -g kmer.names -q reads3 -mm 3 > base.out 2> base.err
+for mb in 64 1; do
+	for t in 1 4; do
+		"$MAPPER" -i kmer_12.index -g kmer.names -q reads3 -mm 3 --cache $mb -t $t > cache.out 2> cache$mb.err
+		cmp -s base.out cache.out || fail "--cache $mb -t $t: output differs"
+		grep -v "^Read cache" cache$mb.err | cmp -s base.err - || fail "--cache $mb -t $t: unmapped queries differ"
+	done
+done
+grep -q " [1-9][0-9]* hits" cache64.err || fail "no queries were answered from cache"
+grep -q " [1-9][0-9]* evictions" cache1.err || fail "--cache 1 did not drop queries"
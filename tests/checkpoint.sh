@@ -0,0 +1,31 @@
+#!/bin/sh
+# Checkpoints (--checkpoint, --resume): a run killed after some checkpoints and resumed gives the same
+# output as an uninterrupted run, --resume without checkpoint maps from the beginning and resuming a finished
+# run does not change its output
+
+. "$(dirname "$0")/common.sh"
+
+makegenome
+"$INDEXER" -i chrA.fa chrB.fa -o kmer -n 12 > /dev/null
+makereads reads 3000 100 4 71
+for i in 1 2 3 4 5 6 7 8 9 10 11 12 13 14 15 16 17 18 19 20; do cat reads; done > reads20
+
+"$MAPPER" -i kmer_12.index -g kmer.names -q reads20 -mm 4 > base.out 2> /dev/null
+"$MAPPER" -i kmer_12.index -g kmer.names -q reads20 -mm 4 -o fresh.out --resume 2> /dev/null
+cmp -s base.out fresh.out || fail "--resume without checkpoint differs"
+
+"$MAPPER" -i kmer_12.index -g kmer.names -q reads20 -mm 4 -o killed.out --checkpoint 1 2> /dev/null &
+pid=$!
+n=0
+while [ ! -s killed.out.checkpoint ] && [ $n -lt 100 ]; do
+	sleep 0.1
+	n=$((n + 1))
+done
+kill -9 $pid 2> /dev/null || true
+wait $pid 2> /dev/null || true
+[ -s killed.out.checkpoint ] || fail "no checkpoint was written"
+"$MAPPER" -i kmer_12.index -g kmer.names -q reads20 -mm 4 -o killed.out --resume 2> resume.err
+grep -q "Resuming from query" resume.err || fail "run was not resumed from checkpoint"
+cmp -s base.out killed.out || fail "resumed output differs"
+"$MAPPER" -i kmer_12.index -g kmer.names -q reads20 -mm 4 -o killed.out --resume 2> /dev/null
+cmp -s base.out killed.out || fail "resuming finished run changed output"
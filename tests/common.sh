@@ -0,0 +1,102 @@
+# Common part of regression tests (sourced by tests/*.sh, run by make test)
+# Every test works in its own temporary directory on a small random genome and reads sampled from it
+
+set -e
+TOP=$(cd "$(dirname "$0")/.." && pwd)
+INDEXER="$TOP/indexer"
+MAPPER="$TOP/mapper"
+INDEXSTATS="$TOP/indexstats"
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+cd "$WORK"
+
+fail() {
+	echo "FAIL $(basename "$0"): $*" >&2
+	exit 1
+}
+
+# makegenome: chrA.fa (200000 nt with a run of N), chrB.fa (150000 nt) and chrC.fa (80000 nt)
+makegenome() {
+	for c in A:200000:1 B:150000:2 C:80000:3; do
+		awk -v name="chr${c%%:*}" -v len=$(echo $c | cut -d: -f2) -v seed=${c##*:} 'BEGIN {
+			srand(seed);
+			print ">" name " test";
+			line = "";
+			for (i = 0; i < len; i++) {
+				n = ((name == "chrA") && (i >= 120000) && (i < 120050)) ? "N" : substr("ACGT", int(rand() * 4) + 1, 1);
+				line = line n;
+				if (length(line) == 60) { print line; line = ""; }
+			}
+			if (line != "") print line;
+		}' > chr${c%%:*}.fa
+	done
+}
+
+# makereads FILE COUNT LENGTH MAXEDITS SEED [FASTA...]: reads from random positions of both strands with up to MAXEDITS
+# substitutions or indels (but no N), the first and last reads of every sequence start at its ends
+# The sequence, 0-based position and strand (F/R) of every read are written to FILE.origin
+makereads() {
+	out=$1; count=$2; len=$3; maxedits=$4; seed=$5
+	shift 5
+	[ $# -gt 0 ] || set -- chrA.fa chrB.fa
+	cat "$@" | awk -v origin="$out.origin" -v count=$count -v len=$len -v maxedits=$maxedits -v seed=$seed '
+		/^>/ { nseq += 1; name[nseq] = substr($1, 2); next }
+		{ seq[nseq] = seq[nseq] $0 }
+		END {
+			srand(seed);
+			comp["A"] = "T"; comp["C"] = "G"; comp["G"] = "C"; comp["T"] = "A"; comp["N"] = "N";
+			for (r = 0; r < count; r++) {
+				s = int(rand() * nseq) + 1;
+				l = length(seq[s]);
+				if (r < 2 * nseq) {
+					s = int(r / 2) + 1;
+					l = length(seq[s]);
+					pos = (r % 2) ? l - len : 0;
+				} else {
+					do {
+						pos = int(rand() * (l - len - 20));
+					} while (index(substr(seq[s], pos + 1, len), "N"));
+				}
+				q = substr(seq[s], pos + 1, len);
+				ne = int(rand() * (maxedits + 1));
+				for (e = 0; e < ne; e++) {
+					j = int(rand() * length(q)) + 1;
+					t = rand();
+					b = substr("ACGT", int(rand() * 4) + 1, 1);
+					if (t < 0.6) {
+						q = substr(q, 1, j - 1) b substr(q, j + 1);
+					} else if (t < 0.8) {
+						q = substr(q, 1, j - 1) substr(q, j + 1);
+					} else {
+						q = substr(q, 1, j - 1) b substr(q, j);
+					}
+				}
+				strand = "F";
+				if (rand() < 0.5) {
+					rc = "";
+					for (j = length(q); j > 0; j--) rc = rc comp[substr(q, j, 1)];
+					q = rc;
+					strand = "R";
+				}
+				print q;
+				print name[s] "\t" pos "\t" strand > origin;
+			}
+		}' > "$out"
+}
+
+# hitset FILE: query, chromosome, distance and strand of every hit (positions of equal hits can differ where alignment is ambiguous)
+hitset() {
+	cut -f1,2,4,5 "$1" | sort -u
+}
+
+# samehits FILE1 FILE2 DESCRIPTION
+samehits() {
+	hitset "$1" > "$1.set"
+	hitset "$2" > "$2.set"
+	cmp -s "$1.set" "$2.set" || fail "$3: $(comm -23 "$1.set" "$2.set" | wc -l) hits missing, $(comm -13 "$1.set" "$2.set" | wc -l) extra"
+}
+
+# mappedqueries FILE: the numbers of queries with hits
+mappedqueries() {
+	cut -f1 "$1" | sort -u
+}
@@ -0,0 +1,15 @@
+#!/bin/sh
+# Diagonal binning (--candidates diagonal): the same output as merging seed locations
+
+. "$(dirname "$0")/common.sh"
+
+makegenome
+"$INDEXER" -i chrA.fa chrB.fa -o kmer -n 12 > /dev/null
+makereads reads 3000 100 4 181
+
+for opts in "-mm 2" "-mm 4" "-mm 4 -step 1" "-mm 4 --cutoff-shift -1"; do
+	"$MAPPER" -i kmer_12.index -g kmer.names -q reads $opts > merge.out 2> merge.err
+	"$MAPPER" -i kmer_12.index -g kmer.names -q reads $opts --candidates diagonal > diagonal.out 2> diagonal.err
+	cmp -s merge.out diagonal.out || fail "$opts: output differs"
+	cmp -s merge.err diagonal.err || fail "$opts: unmapped queries differ"
+done
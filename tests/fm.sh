@@ -0,0 +1,29 @@
+#!/bin/sh
+# FM index (indexer --fm): the same hits as the k-mer index, also for short reads with many errors,
+# no crash on seeds in the pseudo-random gaps between sequences or near the ends of sequences, and hits at
+# the start of genome are found by every candidate search
+
+. "$(dirname "$0")/common.sh"
+
+makegenome
+"$INDEXER" -i chrA.fa chrB.fa -o kmer -n 12 > /dev/null
+"$INDEXER" -i chrA.fa chrB.fa -o fm --fm > /dev/null
+
+makereads reads100 2000 100 3 11
+makereads reads50 2000 50 3 12
+for r in reads100 reads50; do
+	"$MAPPER" -i kmer_12.index -g kmer.names -q $r -mm 3 -step 1 > $r.kmer 2> /dev/null
+	"$MAPPER" -i fm.fm -g fm.names -q $r -mm 3 > $r.fm 2> /dev/null || fail "mapper crashed on $r"
+	samehits $r.kmer $r.fm "FM index on $r"
+done
+
+# Seeds of 10 nucleotides hit the gap fillers and N runs
+"$MAPPER" -i fm.fm -g fm.names -q reads100 -mm 3 --min-seed 10 > seed10.fm 2> /dev/null || fail "mapper crashed with --min-seed 10"
+samehits reads100.kmer seed10.fm "FM index with --min-seed 10"
+
+# Query at the start of genome with an insertion before all its seeds starts before the genome on their diagonals
+"$INDEXER" -i chrA.fa chrB.fa -o canon -n 12 -c > /dev/null
+awk 'NR > 1' chrA.fa | tr -d '\n' | awk '{ print substr($0, 1, 3) "A" substr($0, 4, 96) }' > start
+for index in "kmer_12.index -g kmer.names" "kmer_12.index -g kmer.names --candidates diagonal" "canon_12.index -g canon.names" "fm.fm -g fm.names"; do
+	"$MAPPER" -i $index -q start -mm 2 2> /dev/null | grep -q "^0	chrA	0	1	F$" || fail "query at the start of genome is not mapped with -i $index"
+done
@@ -0,0 +1,32 @@
+#!/bin/sh
+# Index statistics (indexstats): counts agree with the dump of index, valid k-mer and FM indexes pass
+# validation, truncated and corrupted indexes fail it
+
+. "$(dirname "$0")/common.sh"
+
+makegenome
+"$INDEXER" -i chrA.fa chrB.fa -o kmer -n 12 > /dev/null
+"$INDEXER" -i chrA.fa chrB.fa -o fm --fm > /dev/null
+
+"$INDEXSTATS" -i kmer_12.index > stats.out || fail "valid k-mer index failed validation"
+grep -q "^Validation: OK" stats.out || fail "no validation result for k-mer index"
+nwords=$(sed -n 's/^Words: \([0-9]*\) .*/\1/p' stats.out)
+nloc=$(sed -n 's/^Locations: \([0-9]*\) .*/\1/p' stats.out)
+"$INDEXSTATS" -i kmer_12.index --dump > dump.out
+# Dump has a line of word and location count followed by a line of locations for every word
+[ "$(awk 'NR % 2 == 1' dump.out | wc -l)" -eq "$nwords" ] || fail "number of words differs from dump"
+[ "$(awk 'NR % 2 == 0 { n += NF } END { print n }' dump.out)" -eq "$nloc" ] || fail "number of locations differs from dump"
+[ "$(grep -c "^	" stats.out)" -eq 10 ] || fail "heaviest words are not listed"
+
+"$INDEXSTATS" -i fm.fm > fm.out || fail "valid FM index failed validation"
+grep -q "^FM index" fm.out && grep -q "^Validation: OK" fm.out || fail "FM index was not validated"
+
+# Truncated index and the first word overwritten with a word longer than the word length
+size=$(wc -c < kmer_12.index)
+head -c $((size - 4)) kmer_12.index > short.index
+if "$INDEXSTATS" -i short.index > short.out; then fail "truncated index passed"; fi
+grep -q "does not match header" short.out || fail "truncated index was not reported"
+cp kmer_12.index bad.index
+printf '\377\377\377\377' | dd of=bad.index bs=1 seek=$((size - 4 * (2 * nwords + nloc))) conv=notrunc 2> /dev/null
+if "$INDEXSTATS" -i bad.index > bad.out; then fail "corrupted index passed"; fi
+grep -q "(first: word 0 is longer than word length)" bad.out || fail "corrupted index was not reported"
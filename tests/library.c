@@ -0,0 +1,89 @@
+/*
+ * Genome Mapper
+ * (libgmapper test: builds index and maps queries one by one or in batches, prints hits as Mapper does)
+ *
+ * Usage: library OUTPUTNAME MISMATCHES QUERYFILE FASTA...
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gmapper.h"
+
+#define BATCH 100
+#define MAX_HITS 100000
+
+static char *queries[BATCH];
+
+static void printhits(const gmapper_hit *hits, unsigned n, unsigned first)
+{
+	unsigned i;
+	for (i = 0; i < n; i++) {
+		printf("%u\t%s\t%u\t%u\t%s\n", first + hits[i].query, hits[i].chromosome, hits[i].pos, hits[i].dist, (hits[i].reverse) ? "R" : "F");
+	}
+}
+
+/* Odd batches are mapped one query at a time */
+static void mapqueries(gmapper_index *idx, unsigned first, unsigned n, gmapper_hit *hits)
+{
+	unsigned i, nhits;
+	if ((first / BATCH) % 2) {
+		for (i = 0; i < n; i++) {
+			nhits = gmapper_map_read(idx, queries[i], hits, MAX_HITS);
+			printhits(hits, nhits, first + i);
+		}
+	} else {
+		nhits = gmapper_map_batch(idx, (const char **) queries, n, hits, MAX_HITS);
+		printhits(hits, nhits, first);
+	}
+	for (i = 0; i < n; i++) free(queries[i]);
+}
+
+int main(int argc, const char *argv[])
+{
+	gmapper_options opt;
+	gmapper_index *idx;
+	gmapper_hit *hits;
+	char indexfile[1024], namesfile[1024], line[2048];
+	unsigned nqueries = 0, n = 0;
+	FILE *f;
+
+	if (argc < 5) {
+		fprintf(stderr, "Usage: library OUTPUTNAME MISMATCHES QUERYFILE FASTA...\n");
+		return 1;
+	}
+	if (gmapper_build_index(argv + 4, argc - 4, 12, 0, argv[1])) {
+		fprintf(stderr, "Cannot build index.\n");
+		return 1;
+	}
+	snprintf(indexfile, sizeof(indexfile), "%s_12.index", argv[1]);
+	snprintf(namesfile, sizeof(namesfile), "%s.names", argv[1]);
+	gmapper_default_options(&opt);
+	opt.mismatches = atoi(argv[2]);
+	idx = gmapper_open(indexfile, namesfile, &opt);
+	if (idx == NULL) {
+		fprintf(stderr, "Cannot open index.\n");
+		return 1;
+	}
+	hits = (gmapper_hit *) malloc(MAX_HITS * sizeof(gmapper_hit));
+	f = fopen(argv[3], "r");
+	if (f == NULL) {
+		fprintf(stderr, "Cannot open file %s.\n", argv[3]);
+		return 1;
+	}
+	while (fgets(line, sizeof(line), f)) {
+		line[strcspn(line, "\r\n")] = 0;
+		queries[n++] = strdup(line);
+		if (n == BATCH) {
+			mapqueries(idx, nqueries, n, hits);
+			nqueries += n;
+			n = 0;
+		}
+	}
+	if (n) mapqueries(idx, nqueries, n, hits);
+	fclose(f);
+	free(hits);
+	gmapper_close(idx);
+	return 0;
+}
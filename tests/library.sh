@@ -0,0 +1,19 @@
+#!/bin/sh
+# Library (libgmapper.a): a program built with it gets the same index as indexer and the same hits as
+# mapper, both from single query and batch calls
+
+. "$(dirname "$0")/common.sh"
+
+gcc -I"$TOP" -o library "$TOP/tests/library.c" "$TOP/libgmapper.a" -lpthread -lm || fail "cannot build program with libgmapper.a"
+makegenome
+"$INDEXER" -i chrA.fa chrB.fa -o kmer -n 12 > /dev/null
+makereads reads 3000 100 3 161
+
+./library lib 3 reads chrA.fa chrB.fa > lib.out || fail "library program failed"
+# Index header holds memory addresses of indexer, so the words and locations are compared
+"$INDEXSTATS" -i kmer_12.index --dump > kmer.dump
+"$INDEXSTATS" -i lib_12.index --dump > lib.dump
+cmp -s kmer.dump lib.dump || fail "index built by library differs"
+cmp -s kmer.names lib.names || fail "names file built by library differs"
+"$MAPPER" -i kmer_12.index -g kmer.names -q reads -mm 3 > base.out 2> /dev/null
+cmp -s base.out lib.out || fail "library hits differ: $(diff base.out lib.out | grep -c '^[<>]') lines"
@@ -0,0 +1,19 @@
+#!/bin/sh
+# Index loading policies (--load): the same output with every policy, also where it is not available
+# and mapper falls back to another one
+
+. "$(dirname "$0")/common.sh"
+
+makegenome
+"$INDEXER" -i chrA.fa chrB.fa -o kmer -n 12 > /dev/null
+"$INDEXER" -i chrA.fa chrB.fa -o fm --fm > /dev/null
+makereads reads 2000 100 2 201
+
+"$MAPPER" -i kmer_12.index -g kmer.names -q reads -mm 2 > base.out 2> /dev/null
+"$MAPPER" -i fm.fm -g fm.names -q reads -mm 2 > basefm.out 2> /dev/null
+for load in lazy populate mlock hugepages hugetlb numa; do
+	"$MAPPER" -i kmer_12.index -g kmer.names -q reads -mm 2 -t 2 --load $load > load.out 2> /dev/null || fail "--load $load failed"
+	cmp -s base.out load.out || fail "--load $load output differs"
+	"$MAPPER" -i fm.fm -g fm.names -q reads -mm 2 -t 2 --load $load > load.out 2> /dev/null || fail "--load $load failed with FM index"
+	cmp -s basefm.out load.out || fail "--load $load output differs with FM index"
+done
@@ -0,0 +1,19 @@
+#!/bin/sh
+# Long reads (--long): reads of several kilobases with errors are mapped to their origin within
+# --max-error, with the same output from several threads
+
+. "$(dirname "$0")/common.sh"
+
+makegenome
+"$INDEXER" -i chrA.fa chrB.fa -o kmer -n 12 > /dev/null
+makereads reads 300 3000 150 151
+
+"$MAPPER" -i kmer_12.index -g kmer.names -q reads --long > long.out 2> long.err
+"$MAPPER" -i kmer_12.index -g kmer.names -q reads --long -t 4 > long4.out 2> /dev/null
+cmp -s long.out long4.out || fail "output with 4 threads differs"
+awk '$4 > 3000 * 15 / 100' long.out | grep -q . && fail "hits with more than 15% errors"
+# Hit at the origin of every read (reads have at most 150 indels)
+awk 'NR == FNR { chr[NR - 1] = $1; pos[NR - 1] = $2; strand[NR - 1] = $3; next }
+	($2 == chr[$1]) && ($5 == strand[$1]) && ($3 - pos[$1] <= 150) && (pos[$1] - $3 <= 150) { found[$1] = 1 }
+	END { for (q in chr) if (!(q in found)) { print q; exit 1 } }' reads.origin long.out > missing.out ||
+	fail "query $(cat missing.out) is not mapped to its origin"
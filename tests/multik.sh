@@ -0,0 +1,20 @@
+#!/bin/sh
+# Multi-k index (indexer -n 16,12): every query gets the hits of 16-mer index, or of 12-mer index if it
+# has none with 16-mers, and indexstats validates both tables
+
+. "$(dirname "$0")/common.sh"
+
+makegenome
+"$INDEXER" -i chrA.fa chrB.fa -o k16 -n 16 > /dev/null
+"$INDEXER" -i chrA.fa chrB.fa -o k12 -n 12 > /dev/null
+"$INDEXER" -i chrA.fa chrB.fa -o multi -n 16,12 > /dev/null
+"$INDEXSTATS" -i multi_16-12.index > stats.out || fail "indexstats rejects multi-k index"
+makereads reads 3000 50 5 101
+
+"$MAPPER" -i k16_16.index -g k16.names -q reads -mm 5 > k16.out 2> /dev/null
+"$MAPPER" -i k12_12.index -g k12.names -q reads -mm 5 > k12.out 2> /dev/null
+"$MAPPER" -i multi_16-12.index -g multi.names -q reads -mm 5 > multi.out 2> multi.err
+awk 'NR == FNR { found[$1] = 1; print; next } !($1 in found)' k16.out k12.out | sort -n -k1,1 -s > expected.out
+sort -n -k1,1 -s multi.out > multi.sorted
+cmp -s expected.out multi.sorted || fail "multi-k hits differ: $(diff expected.out multi.sorted | grep -c '^[<>]') lines"
+[ $(mappedqueries multi.out | wc -l) -gt $(mappedqueries k16.out | wc -l) ] || fail "no queries were found by fallback"
@@ -0,0 +1,42 @@
+#!/bin/sh
+# Mapping without indels (--no-indels): every hit has the reported number of mismatches at its position,
+# and every hit with 0 edits found by edit distance mapping is found at the same position
+
+. "$(dirname "$0")/common.sh"
+
+makegenome
+"$INDEXER" -i chrA.fa chrB.fa -o kmer -n 12 > /dev/null
+makereads reads 3000 100 3 131
+
+"$MAPPER" -i kmer_12.index -g kmer.names -q reads -mm 3 > base.out 2> /dev/null
+"$MAPPER" -i kmer_12.index -g kmer.names -q reads -mm 3 --no-indels > noindels.out 2> /dev/null
+[ -s noindels.out ] || fail "no hits"
+
+# Mismatches of every hit counted from the sequences
+cat chrA.fa chrB.fa | awk -v queries=reads '
+	/^>/ { name = substr($1, 2); next }
+	{ seq[name] = seq[name] $0 }
+	END {
+		comp["A"] = "T"; comp["C"] = "G"; comp["G"] = "C"; comp["T"] = "A";
+		n = 0;
+		while ((getline q < queries) > 0) query[n++] = q;
+		while ((getline < "noindels.out") > 0) {
+			q = query[$1];
+			if ($5 == "R") {
+				rc = "";
+				for (j = length(q); j > 0; j--) rc = rc ((substr(q, j, 1) in comp) ? comp[substr(q, j, 1)] : "N");
+				q = rc;
+			}
+			mm = 0;
+			for (j = 1; j <= length(q); j++) {
+				g = substr(seq[$2], $3 + j, 1);
+				if ((g != substr(q, j, 1)) || (g == "N")) mm += 1;
+			}
+			if (mm != $4) { print "query " $1 " at " $2 ":" $3 " has " mm " mismatches, reported " $4; exit 1 }
+		}
+	}' > check.out || fail "$(cat check.out)"
+
+# Edit distance does not charge the first query nucleotide, so these hits can have 1 mismatch
+awk '$4 == 0 { print $1 "\t" $2 "\t" $3 "\t" $5 }' base.out | sort > exact.set
+awk '$4 <= 1 { print $1 "\t" $2 "\t" $3 "\t" $5 }' noindels.out | sort > noindels.set
+[ -z "$(comm -23 exact.set noindels.set)" ] || fail "$(comm -23 exact.set noindels.set | wc -l) exact hits missing"
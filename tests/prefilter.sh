@@ -0,0 +1,19 @@
+#!/bin/sh
+# Q-gram pre-filter (--prefilter): the same output as without it, on reads from the genome and on reads
+# from other sequence, where most candidates are rejected
+
+. "$(dirname "$0")/common.sh"
+
+makegenome
+"$INDEXER" -i chrA.fa chrB.fa -o kmer -n 12 > /dev/null
+makereads reads 3000 100 4 191
+makereads other 1000 100 0 192 chrC.fa
+cat reads other > all
+
+for mm in 1 4 8; do
+	"$MAPPER" -i kmer_12.index -g kmer.names -q all -mm $mm -step 1 > base.out 2> base.err
+	"$MAPPER" -i kmer_12.index -g kmer.names -q all -mm $mm -step 1 --prefilter > filter.out 2> filter.err
+	cmp -s base.out filter.out || fail "-mm $mm: output differs"
+	grep -v "^Pre-filter" filter.err | cmp -s base.err - || fail "-mm $mm: unmapped queries differ"
+done
+grep -q "rejected ([1-9]" filter.err || fail "no candidates were rejected"
@@ -0,0 +1,25 @@
+#!/bin/sh
+# Region index (indexer --regions): hits inside the padded regions are the same as with the index of
+# whole genome (in chromosome coordinates), and there are no hits outside of them
+
+. "$(dirname "$0")/common.sh"
+
+makegenome
+"$INDEXER" -i chrA.fa chrB.fa -o kmer -n 12 > /dev/null
+printf "chrA\t10000\t30000\nchrA\t100000\t125000\nchrA\t124950\t130000\nchrB\t50000\t60000\nchrB\t149000\t150000\n" > panel.bed
+"$INDEXER" -i chrA.fa chrB.fa -o panel -n 12 --regions panel.bed --padding 100 > /dev/null 2>&1
+makereads reads 3000 100 2 91
+
+"$MAPPER" -i kmer_12.index -g kmer.names -q reads -mm 2 > base.out 2> /dev/null
+"$MAPPER" -i panel_12.index -g panel.names -q reads -mm 2 > panel.out 2> /dev/null || fail "mapper failed on region index"
+# Padded and merged regions: chrA 9900-30100 and 99900-130100, chrB 49900-60100 and 148900-150000
+inside='($2 == "chrA" && (($3 >= 9900 && $3 + 110 <= 30100) || ($3 >= 99900 && $3 + 110 <= 130100))) ||
+	($2 == "chrB" && (($3 >= 49900 && $3 + 110 <= 60100) || ($3 >= 148900)))'
+awk "$inside" base.out > expected.out
+[ -s expected.out ] || fail "no hits in regions"
+awk "$inside" panel.out > inside.out
+cmp -s expected.out inside.out || fail "hits in regions differ: $(diff expected.out inside.out | grep -c '^[<>]') lines"
+overlap='($2 == "chrA" && (($3 < 30100 && $3 + 110 > 9900) || ($3 < 130100 && $3 + 110 > 99900))) ||
+	($2 == "chrB" && (($3 < 60100 && $3 + 110 > 49900) || ($3 + 110 > 148900)))'
+outside=$(awk "!($overlap)" panel.out | wc -l)
+[ "$outside" -eq 0 ] || fail "$outside hits outside of regions"
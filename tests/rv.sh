@@ -0,0 +1,17 @@
+#!/bin/sh
+# Region verification (-rv): the same hits with the same distances and positions as full alignment,
+# also for reads with many errors and for reads that are not from the genome
+
+. "$(dirname "$0")/common.sh"
+
+makegenome
+"$INDEXER" -i chrA.fa chrB.fa -o kmer -n 12 > /dev/null
+makereads reads 3000 100 4 61
+makereads other 1000 100 0 62 chrC.fa
+cat reads other > all
+
+for mm in 1 3 5; do
+	"$MAPPER" -i kmer_12.index -g kmer.names -q all -mm $mm > base.out 2> /dev/null
+	"$MAPPER" -i kmer_12.index -g kmer.names -q all -mm $mm -rv > rv.out 2> /dev/null
+	cmp -s base.out rv.out || fail "-mm $mm -rv output differs: $(diff base.out rv.out | grep -c '^[<>]') lines"
+done
@@ -0,0 +1,24 @@
+#!/bin/sh
+# Local alignment scoring (--score): every instruction set gives the same output with 8-bit, 16-bit and
+# scalar scores, and exact hits of edit distance mapping are found at the same positions
+
+. "$(dirname "$0")/common.sh"
+
+makegenome
+"$INDEXER" -i chrA.fa chrB.fa -o kmer -n 12 > /dev/null
+makereads reads 2000 100 3 51
+
+"$MAPPER" -i kmer_12.index -g kmer.names -q reads -mm 3 > base.out 2> /dev/null
+for sc in 1,4,6,1 100,200,300,50 400,10,10,5; do
+	"$MAPPER" -i kmer_12.index -g kmer.names -q reads -mm 3 --score $sc --simd scalar > scalar.out 2> /dev/null
+	for e in sse2 avx2; do
+		"$MAPPER" -i kmer_12.index -g kmer.names -q reads -mm 3 --score $sc --simd $e > $e.out 2> /dev/null
+		cmp -s scalar.out $e.out || fail "--score $sc --simd $e output differs from scalar"
+	done
+done
+
+"$MAPPER" -i kmer_12.index -g kmer.names -q reads -mm 3 --score 1,4,6,1 > score.out 2> /dev/null
+awk '$4 == 0 { print $1 "\t" $2 "\t" $3 "\t" $5 }' base.out | sort > exact.set
+awk '{ print $1 "\t" $2 "\t" $3 "\t" $5 }' score.out | sort > score.set
+[ -s exact.set ] || fail "no exact hits"
+[ -z "$(comm -23 exact.set score.set)" ] || fail "$(comm -23 exact.set score.set | wc -l) exact hits missing with --score"
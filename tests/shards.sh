@@ -0,0 +1,16 @@
+#!/bin/sh
+# Sharded index (indexer -s): the same output as a single index in serial and parallel shard mode
+
+. "$(dirname "$0")/common.sh"
+
+makegenome
+"$INDEXER" -i chrA.fa chrB.fa chrC.fa -o kmer -n 12 > /dev/null
+"$INDEXER" -i chrA.fa chrB.fa chrC.fa -o shard -n 12 -s 3 > /dev/null
+makereads reads 3000 100 3 121 chrA.fa chrB.fa chrC.fa
+
+"$MAPPER" -i kmer_12.index -g kmer.names -q reads -mm 3 > base.out 2> base.err
+for mode in serial parallel; do
+	"$MAPPER" -s shard_12.shards -g shard.names -q reads -mm 3 --shard-mode $mode > $mode.out 2> $mode.err
+	cmp -s base.out $mode.out || fail "--shard-mode $mode output differs"
+	cmp -s base.err $mode.err || fail "--shard-mode $mode unmapped queries differ"
+done
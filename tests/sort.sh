@@ -0,0 +1,24 @@
+#!/bin/sh
+# Sorted output (--sort): hits sorted by chromosome (in the order of names file) and position, the same
+# when runs are merged from temporary files (--sort-memory 1 keeps about 16000 hits per run)
+
+. "$(dirname "$0")/common.sh"
+
+makegenome
+"$INDEXER" -i chrA.fa chrB.fa -o kmer -n 12 > /dev/null
+makereads reads 3000 100 2 81
+for i in 1 2 3 4 5 6 7 8 9 10 11 12 13 14 15 16 17 18 19 20; do cat reads; done > reads20
+
+"$MAPPER" -i kmer_12.index -g kmer.names -q reads20 -mm 2 > base.out 2> /dev/null
+"$MAPPER" -i kmer_12.index -g kmer.names -q reads20 -mm 2 --sort > sorted.out 2> /dev/null
+mkdir tmp
+TMPDIR=$WORK/tmp "$MAPPER" -i kmer_12.index -g kmer.names -q reads20 -mm 2 -t 4 --sort --sort-memory 1 > spilled.out 2> /dev/null
+
+sort base.out > base.lines
+sort sorted.out > sorted.lines
+cmp -s base.lines sorted.lines || fail "--sort changed the hits"
+awk 'NR == FNR { order[$1] = NR; next }
+	{ o = order[$2]; if ((o < lo) || ((o == lo) && ($3 < lastpos))) exit 1; lo = o; lastpos = $3 }' kmer.names sorted.out ||
+	fail "--sort output is not sorted"
+cmp -s sorted.out spilled.out || fail "--sort-memory 1 output differs"
+[ -z "$(ls tmp)" ] || fail "temporary files are left"
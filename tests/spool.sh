@@ -0,0 +1,37 @@
+#!/bin/sh
+# Multi-process mapping (--processes, --spool): the same output as one process, also when the worker of
+# a chunk dies on other host (its claim is taken over after --spool-lease seconds)
+
+. "$(dirname "$0")/common.sh"
+
+makegenome
+"$INDEXER" -i chrA.fa chrB.fa -o kmer -n 12 > /dev/null
+makereads reads 3000 100 2 21
+for i in 1 2 3 4 5 6 7 8 9 10; do cat reads; done > reads10
+
+"$MAPPER" -i kmer_12.index -g kmer.names -q reads10 -mm 2 > base.out 2> base.err
+"$MAPPER" -i kmer_12.index -g kmer.names -q reads10 -mm 2 --processes 3 > proc.out 2> proc.err
+cmp -s base.out proc.out || fail "--processes 3 output differs"
+cmp -s base.err proc.err || fail "--processes 3 unmapped queries differ"
+
+# A claim of dead worker on other host: some task is taken as soon as the coordinator writes it
+mkdir sp
+(
+	n=0
+	while [ $n -lt 100000 ]; do
+		for t in sp/task.*; do
+			[ -f "$t" ] || continue
+			k=${t##*.}
+			if mv "$t" sp/claimed.$k 2> /dev/null; then
+				echo "otherhost 1" > sp/owner.$k
+				exit 0
+			fi
+		done
+		n=$((n + 1))
+	done
+) &
+"$MAPPER" -i kmer_12.index -g kmer.names -q reads10 -mm 2 --processes 2 --chunks 16 --spool sp --spool-lease 15 > spool.out 2> spool.err
+wait
+cmp -s base.out spool.out || fail "--spool output differs"
+grep -q "the chunk is mapped again" spool.err || fail "claim of dead worker was not taken over"
+[ -z "$(ls sp)" ] || fail "spool directory is not empty after run"
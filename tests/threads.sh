@@ -0,0 +1,19 @@
+#!/bin/sh
+# Mapping pipeline (-t, --batch): the same output and unmapped queries with any number of threads and
+# batch size, also for queries longer than the limit of short read mapping
+
+. "$(dirname "$0")/common.sh"
+
+makegenome
+"$INDEXER" -i chrA.fa chrB.fa -o kmer -n 12 > /dev/null
+makereads reads 3000 100 3 211
+makereads long 5 1200 0 212
+cat reads long reads > all
+
+"$MAPPER" -i kmer_12.index -g kmer.names -q all -mm 3 > base.out 2> base.err
+grep -q "queries were longer than" base.err || fail "long queries were not reported"
+for opts in "-t 2" "-t 4 --batch 1" "-t 3 --batch 7" "-t 8 --batch 5000"; do
+	"$MAPPER" -i kmer_12.index -g kmer.names -q all -mm 3 $opts > threads.out 2> threads.err
+	cmp -s base.out threads.out || fail "$opts: output differs"
+	cmp -s base.err threads.err || fail "$opts: unmapped queries differ"
+done
@@ -0,0 +1,34 @@
+#!/bin/sh
+# Index update (indexer --append, --remove, --replace): the same words and locations as an index built
+# from the resulting sequences, and after replacing a sequence the same hits
+
+. "$(dirname "$0")/common.sh"
+
+makegenome
+sed '2,100y/ACGT/CATG/' chrB.fa > chrB2.fa
+"$INDEXER" -i chrA.fa chrB.fa -o ab -n 12 > /dev/null
+"$INDEXER" -i chrA.fa chrB.fa chrC.fa -o abc -n 12 > /dev/null
+"$INDEXER" -i chrA.fa chrB2.fa chrC.fa -o ab2c -n 12 > /dev/null
+"$INDEXSTATS" -i ab_12.index --dump > ab.dump
+"$INDEXSTATS" -i abc_12.index --dump > abc.dump
+
+"$INDEXER" -i chrA.fa -o app -n 12 > /dev/null
+"$INDEXER" --append app_12.index chrB.fa chrC.fa > /dev/null
+"$INDEXSTATS" -i app_12.index --dump > app.dump
+cmp -s abc.dump app.dump || fail "--append index differs"
+cmp -s abc.names app.names || fail "--append names differ"
+
+cp abc_12.index rm_12.index
+cp abc.names rm.names
+"$INDEXER" --append rm_12.index --remove chrC > /dev/null
+"$INDEXSTATS" -i rm_12.index --dump > rm.dump
+cmp -s ab.dump rm.dump || fail "--remove index differs"
+
+# Replaced sequence moves to the end of index, so hits are compared regardless of their order
+cp abc_12.index rp_12.index
+cp abc.names rp.names
+"$INDEXER" --append rp_12.index --replace chrB chrB2.fa > /dev/null
+makereads reads 3000 100 2 171 chrA.fa chrB2.fa chrC.fa
+"$MAPPER" -i ab2c_12.index -g ab2c.names -q reads -mm 2 2> /dev/null | sort > base.out
+"$MAPPER" -i rp_12.index -g rp.names -q reads -mm 2 2> /dev/null | sort > rp.out
+cmp -s base.out rp.out || fail "--replace hits differ: $(diff base.out rp.out | grep -c '^[<>]') lines"
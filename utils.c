@@ -11,7 +11,14 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+
 const char *alphabet = "ACGTUacgtu";
+int debug = 0;
+int quiet = 0;
 
 /* get the bit value of the nucleotide (two bits) */
 int getnuclvalue(char nucl)
@@ -32,7 +39,7 @@ int getnuclvalue(char nucl)
 unsigned int getreversecomplementstr (char *dst, const char *seq, unsigned len)
 {
 	unsigned i, valid;
-	static char *rev = NULL;
+	static __thread char *rev = NULL;
 	if (!rev) {
 		rev = (char *) malloc (256);
 		for (i = 0; i < 256; i++) rev[i] = 'N';
@@ -49,6 +56,33 @@ unsigned int getreversecomplementstr (char *dst, const char *seq, unsigned len)
 	return valid;
 }
 
+/* Memory-map a file read-only, exits on failure */
+const char* filemmap(const char *filename, struct stat *st)
+{
+	int status, handle;
+	const char *data;
+
+	/* memory-mapping a file */
+	status = stat(filename, st);
+	if (status < 0) {
+		fprintf (stderr, "Cannot get the statistics of file %s!\n", filename);
+		exit (1);
+	}
+	handle = open(filename, O_RDONLY);
+	if (handle < 0) {
+		fprintf (stderr, "Cannot open file %s!\n", filename);
+		exit (1);
+	}
+	data = (const char *) mmap(NULL, st->st_size, PROT_READ, MAP_SHARED, handle, 0);
+	if (data == (const char *) -1) {
+		fprintf (stderr, "Cannot memory-map file %s!\n", filename);
+		exit (1);
+	}
+	close(handle);
+
+	return data;
+}
+
 char* word2string(unsigned w, int wordlength)
 {
 	char *sequence = (char *)malloc(wordlength + 1);
@@ -176,3 +210,63 @@ void hybridInPlaceRadixSort256(unsigned *begin, unsigned *end, unsigned *beg_loc
 	}
 	return;
 }
+
+/*
+ * Out-of-place LSD radix sort of packed 64-bit records on their low keybits bits
+ * Histograms of all 8-bit digits are made in one pass over records and digits that are the same
+ * in all records are skipped. Records are scattered through small per-bin buffers of one cache line
+ * (software write-combining), so every pass reads one array and writes full cache lines of the other.
+ *
+ * returns    - records or buffer, whichever holds the sorted records
+ */
+#define PACKED_DIGITS 8
+#define PACKED_LINE 8
+
+unsigned long long *radixsortpacked(unsigned long long *records, unsigned long long *buffer, unsigned long long n, unsigned keybits)
+{
+	unsigned long long (*counts)[256], *src = records, *dst = buffer, *t, i;
+	unsigned long long positions[256];
+	unsigned long long (*lines)[PACKED_LINE];
+	unsigned fill[256];
+	unsigned ndigits = (keybits + 7) / 8, d, b;
+
+	if (ndigits > PACKED_DIGITS) ndigits = PACKED_DIGITS;
+	counts = (unsigned long long (*)[256]) malloc (PACKED_DIGITS * sizeof(*counts));
+	lines = (unsigned long long (*)[PACKED_LINE]) aligned_alloc (64, 256 * sizeof(*lines));
+	memset(counts, 0, PACKED_DIGITS * sizeof(*counts));
+	for (i = 0; i < n; i++) {
+		unsigned long long r = src[i];
+		for (d = 0; d < ndigits; d++) counts[d][(r >> (8 * d)) & 255] += 1;
+	}
+
+	for (d = 0; d < ndigits; d++) {
+		unsigned shift = 8 * d;
+		unsigned long long sum = 0;
+		/* All records have the same digit */
+		if (counts[d][(src[0] >> shift) & 255] == n) continue;
+		for (b = 0; b < 256; b++) {
+			positions[b] = sum;
+			sum += counts[d][b];
+		}
+		memset(fill, 0, sizeof(fill));
+		for (i = 0; i < n; i++) {
+			unsigned long long r = src[i];
+			b = (r >> shift) & 255;
+			lines[b][fill[b]++] = r;
+			if (fill[b] == PACKED_LINE) {
+				memcpy(dst + positions[b], lines[b], sizeof(lines[b]));
+				positions[b] += PACKED_LINE;
+				fill[b] = 0;
+			}
+		}
+		for (b = 0; b < 256; b++) {
+			memcpy(dst + positions[b], lines[b], fill[b] * sizeof(unsigned long long));
+		}
+		t = src;
+		src = dst;
+		dst = t;
+	}
+	free(counts);
+	free(lines);
+	return src;
+}
@@ -10,13 +10,41 @@
 
 #ifndef __UTILS_CPP__
 extern const char *alphabet;
+/* Level of diagnostic messages on stderr (0 - none) */
+extern int debug;
+/* No messages on standard output (library) */
+extern int quiet;
 #endif
 
 /* Maximum number of mismatched regions */
 #define MAX_REGIONS 4
 
+/*
+ * Index flags are stored in the high bits of info.wordsize
+ * so that old indices (without flags) can still be read
+ */
+#define INDEX_WORDSIZE_MASK 0xff
+/* Words are canonical (smaller of word and its reverse complement), locations are (location << 1) | strand */
+#define INDEX_CANONICAL 0x100
+/* Another table (of shorter words, over the same locations) follows this one in the file (multi-k index) */
+#define INDEX_MORE_TABLES 0x200
+/* Most word lengths in multi-k index */
+#define MAX_INDEX_TABLES 4
+
+/* index build engines */
+#define BUILD_AUTO 0
+#define BUILD_RADIX 1
+#define BUILD_COUNTING 2
+#define BUILD_PACKED 3
+
+/* word length up to which counting sort is always used */
+#define MIN_COUNTING_WORDLENGTH 12
+/* word length above which counting sort is never used (4^15 counters take 4 GB) */
+#define MAX_COUNTING_WORDLENGTH 14
+
 typedef struct _wordtable {
 	int wordlength;
+	unsigned flags;
 	unsigned nword_slots;
 	unsigned nwords;
 	unsigned nstart_slots;
@@ -52,38 +80,427 @@ typedef struct _candidate {
 	unsigned loc;
 	unsigned mmis;
 	unsigned length;
+	/* 0 - forward query, 1 - reverse complement of query */
+	unsigned strand;
+	/* Largest distance of confirming seed diagonal from loc */
+	unsigned shift;
 	unsigned nregions;
 	region reg[MAX_REGIONS];
 } candidate;
 
 typedef struct _queryblock {
 	const char *query;
+	/* Grows as needed, kept between queries */
 	candidate *candidates;
+	unsigned ncandidate_slots;
 	unsigned ncandidates;
+	/* Candidates of both strands (search of single strand uses strand 0) */
+	unsigned nstrand[2];
+	/* Bit 1 << strand is set if strand had more candidates than allowed */
+	unsigned overflow;
+	/* Added to the number of confirming seeds needed (negative - more candidates) */
+	int cutoffshift;
 } queryblock;
 
+/* Exact seed match of long query, rpos is the genome location of query position qpos */
+typedef struct _anchor {
+	unsigned rpos;
+	unsigned qpos;
+} anchor;
+
+/* Co-linear chain of anchors, its anchors are members[first .. first + nanchors - 1] of chain block */
+typedef struct _chain {
+	unsigned first;
+	unsigned nanchors;
+	int score;
+} chain;
+
+typedef struct _chainblock {
+	/* Grow as needed, kept between queries */
+	anchor *anchors;
+	int *score;
+	int *prev;
+	unsigned long long *order;
+	unsigned char *used;
+	unsigned nanchors;
+	unsigned nanchor_slots;
+	/* Anchor indices of all chains, in the order of increasing location within chain */
+	unsigned *members;
+	chain *chains;
+	unsigned nchains;
+	unsigned nchain_slots;
+} chainblock;
+
+/* FM index file (indexer --fm) starts with FM_MAGIC instead of the word length of k-mer index */
+#define FM_MAGIC 0x314d4647
+/* Every FM_SA_RATE-th row of suffix array is stored, genome has to be shorter than FM_MAX_LENGTH */
+#define FM_SA_RATE 32
+#define FM_MAX_LENGTH (1U << 30)
+
+/* Header of FM index, padded to 64 bytes so that blocks do not cross cache lines */
+typedef struct _fmheader {
+	unsigned magic;
+	/* Length of genome, text is genome and its reverse complement */
+	unsigned length;
+	/* Rows of BWT (2 * length + 1) and the row of the whole text (its BWT character is the end of text) */
+	unsigned nrows;
+	unsigned primary;
+	/* 1 + the number of text characters smaller than A, C, G, T and end of text */
+	unsigned count[5];
+	unsigned sarate;
+	unsigned nblocks;
+	unsigned nsamples;
+	unsigned reserved[4];
+} fmheader;
+
+/* 64 rows of BWT: occurrences of every nucleotide before the block and 2-bit characters */
+typedef struct _fmblock {
+	unsigned occ[4];
+	unsigned long long bwt[2];
+} fmblock;
+
+/* FM index data (as loaded by loadindex) */
+typedef struct _fmindex {
+	const fmheader *h;
+	const fmblock *blocks;
+	const unsigned *samples;
+} fmindex;
+
+/* Rows of exact match (k), rows of its reverse complement (l), number of rows (s) and the matching part of query */
+typedef struct _fminterval {
+	unsigned k, l, s;
+	unsigned qstart, qend;
+} fminterval;
+
+/* Index loading policies */
+#define LOAD_LAZY 0
+#define LOAD_POPULATE 1
+#define LOAD_MLOCK 2
+#define LOAD_HUGEPAGES 3
+#define LOAD_HUGETLB 4
+#define LOAD_NUMA 5
+
+#define MAX_INDEX_REPLICAS 8
+
+typedef struct _loadedindex {
+	const char *data;
+	unsigned long long size;
+	unsigned long long mapsize;
+	int policy;
+	/* 1 if data is the mapping of file, 0 if anonymous copy */
+	int filemapped;
+	/* per NUMA node copies */
+	int nreplicas;
+	int nodes[MAX_INDEX_REPLICAS];
+	const char *replicas[MAX_INDEX_REPLICAS];
+} loadedindex;
+
+/* Longest query (including terminating 0) */
+#define MAX_READ_LENGTH 1000
+
+/* Most sequences in names file (region index has one per region) */
+#define MAX_CHROMOSOMES 65536
+
+/* Batch of queries passed from reader to mapping threads and from them to writer */
+typedef struct _readbatch {
+	/* Number of batch and index of its first query */
+	unsigned seq;
+	unsigned first;
+	unsigned n;
+	/* Queries (0-terminated) and their offsets in data */
+	char *data;
+	unsigned datalen;
+	unsigned datasize;
+	unsigned *offsets;
+	/* Offset of input after the last query of batch */
+	unsigned long long inputend;
+	/* Mapping results and messages (unmapped queries) are collected into memory */
+	FILE *outf;
+	FILE *errf;
+	char *out;
+	size_t outlen;
+	char *err;
+	size_t errlen;
+} readbatch;
+
+typedef void (*batchfunc) (readbatch *batch, void *worker);
+
+/* Called by writer when the results of the first nqueries queries (input up to inputoffset) are written */
+typedef void (*checkpointfunc) (unsigned nqueries, unsigned long long inputoffset, void *arg);
+
+/* Maps queries of chunk (numbered from first), writes results to out and messages to err */
+typedef void (*chunkfunc) (FILE *queries, unsigned first, FILE *out, FILE *err, void *arg);
+
+/* Alignment engines */
+#define ALIGN_AUTO -1
+#define ALIGN_SCALAR 0
+#define ALIGN_SSE2 1
+#define ALIGN_AVX2 2
+
+/* Affine gap scoring, gap of length L costs gapopen + L * gapextend */
+typedef struct _alignscoring {
+	int match;
+	int mismatch;
+	int gapopen;
+	int gapextend;
+} alignscoring;
+
+/* Query of local alignment (one strand) with its striped profiles and buffers reused for all candidates */
+typedef struct _alignquery {
+	alignscoring scoring;
+	unsigned char query[MAX_READ_LENGTH];
+	unsigned qlen;
+	/* Profiles of 8 and 16-bit lanes (built on first use), profile of reversed query prefix */
+	void *profile8;
+	void *profile16;
+	void *revprofile;
+	int built8, built16;
+	/* Columns of SIMD kernels and rows of scalar alignment */
+	void *work;
+	int *rows;
+	/* Candidate window as nucleotide codes */
+	unsigned char *seq;
+	unsigned nseq_slots;
+} alignquery;
+
+/* Hit of query stored in read cache */
+typedef struct _cachehit {
+	unsigned chr;
+	unsigned pos;
+	unsigned short dist;
+	unsigned short strand;
+} cachehit;
+
+typedef struct _readcache readcache;
+
+typedef struct _hitsorter hitsorter;
+
 typedef struct _chromosome {
 	char *name;
 	char *filename;
 	unsigned start;
 	unsigned length;
 	char *sequence;
+	/* 2-bit packed sequence and mask of unknown nucleotides (only for mapping without indels) */
+	unsigned long long *packed;
+	unsigned long long *nmask;
+	/* Region of chromosome (indexer --regions): regionlength nucleotides at fileoffset of file, offset is added to positions of hits */
+	unsigned offset;
+	unsigned regionlength;
+	unsigned long long fileoffset;
 } Chromosome;
 
 /*
  * functions are defined and commented in utils.c
  */
 int getnuclvalue(char nucl);
+const char* filemmap(const char *filename, struct stat *st);
 unsigned int getreversecomplementstr (char *dst, const char *seq, unsigned len);
 
 void hybridInPlaceRadixSort256(unsigned *begin, unsigned *end, unsigned *beg_location, unsigned shift);
+unsigned long long *radixsortpacked(unsigned long long *records, unsigned long long *buffer, unsigned long long n, unsigned keybits);
 char* word2string(unsigned w, int wordlength);
 
 unsigned get_seeds (const char *query, unsigned *words, unsigned nwords, unsigned wordlen, unsigned m, unsigned *seeds);
 unsigned search_word (unsigned word, unsigned *words, unsigned nwords);
 
 unsigned find_candidates (queryblock *qb, unsigned *words, unsigned nwords, unsigned *starts, unsigned *locations, unsigned nlocations,
-		unsigned wordlen, unsigned m, unsigned *seeds, unsigned max_candidates, unsigned mmis);
+		unsigned wordlen, unsigned m, unsigned *seeds, unsigned max_candidates, unsigned mmis, unsigned maxshift);
+
+unsigned get_canonical_seeds (const char *query, unsigned *words, unsigned nwords, unsigned wordlen, unsigned m, unsigned *seeds, unsigned *flags);
+unsigned find_candidates_canonical (queryblock *qb, unsigned *words, unsigned nwords, unsigned *starts, unsigned *locations, unsigned nlocations,
+		unsigned wordlen, unsigned m, unsigned *seeds, unsigned max_candidates, unsigned mmis, unsigned maxshift);
+
+/* Candidate search of find_candidates type, specialized for word length and step */
+typedef unsigned (*findcandidatesfunc) (queryblock *qb, unsigned *words, unsigned nwords, unsigned *starts, unsigned *locations, unsigned nlocations,
+		unsigned wordlen, unsigned m, unsigned *seeds, unsigned max_candidates, unsigned mmis, unsigned maxshift);
+findcandidatesfunc select_find_candidates (unsigned wordlen, unsigned m, unsigned canonical);
+unsigned find_candidates_diagonal (queryblock *qb, unsigned *words, unsigned nwords, unsigned *starts, unsigned *locations, unsigned nlocations,
+		unsigned wordlen, unsigned m, unsigned *seeds, unsigned max_candidates, unsigned mmis, unsigned maxshift);
+unsigned find_candidates_canonical_diagonal (queryblock *qb, unsigned *words, unsigned nwords, unsigned *starts, unsigned *locations, unsigned nlocations,
+		unsigned wordlen, unsigned m, unsigned *seeds, unsigned max_candidates, unsigned mmis, unsigned maxshift);
 
+unsigned collect_anchors (chainblock *cb, const char *query, unsigned *words, unsigned nwords, unsigned *starts, unsigned *locations, unsigned nlocations,
+		unsigned wordlen, unsigned m, unsigned *seeds, unsigned canonical, unsigned maxocc);
+unsigned chain_anchors (chainblock *cb, unsigned wordlen, unsigned maxgap, int minscore, unsigned max_chains);
+unsigned find_candidates_fm (queryblock *qb, const fmindex *fm, unsigned minlen, unsigned max_candidates, unsigned minexact, unsigned maxshift);
+
+
+/*
+ * functions are defined and commented in indexbuilder.c
+ */
+void buildindex(const char *files[], int nfiles, int wordlen, unsigned flags, int engine, int nshards, const char *outputname);
+void buildmultiindex(const char *files[], int nfiles, const int *wordlens, int nwordlens, unsigned flags, int engine, const char *outputname);
+void buildregionindex(const char *files[], int nfiles, const char *bedfile, unsigned padding, int wordlen, unsigned flags, int engine, const char *outputname);
+void updateindex(const char *indexname, const char *namesname, const char *outputname, const char *files[], int nfiles,
+		const char *removed[], int nremoved, int engine);
+
+/*
+ * functions are defined and commented in fmindex.c
+ */
+void buildfmindex(const char *files[], int nfiles, const char *outputname);
+int openfmindex(fmindex *fm, const char *data);
+unsigned fmseeds(const fmindex *fm, const char *query, unsigned qlen, unsigned minlen, fminterval **seeds);
+unsigned fmlocate(const fmindex *fm, unsigned row);
+
+/*
+ * functions are defined and commented in indexloader.c
+ */
+const char *loadindex(const char *filename, int policy, loadedindex *li, int report);
+const char *indexreplica(loadedindex *li, int node);
+void unloadindex(loadedindex *li);
+int parseloadpolicy(const char *name);
+int numanodes(int *nodes);
+int pintonode(int node);
+
+/*
+ * functions are defined and commented in pipeline.c
+ */
+unsigned runpipeline(FILE *in, FILE *out, FILE *err, unsigned batchsize, unsigned nworkers, void **workers, batchfunc func, checkpointfunc checkpoint, void *checkpointarg);
+
+/*
+ * functions are defined and commented in spool.c
+ */
+unsigned spoolsplit(const char *queryfile, unsigned nchunks, const char *dir);
+unsigned spoolwork(const char *dir, chunkfunc func, void *arg);
+unsigned spoolrelease(const char *dir, int pid);
+void spoolwait(const char *dir, unsigned ntasks, unsigned lease, chunkfunc func, void *arg);
+void spoolmerge(const char *dir, unsigned ntasks, FILE *out, FILE *err);
+void spoolremove(const char *dir);
+
+/*
+ * functions are defined and commented in readcache.c
+ */
+readcache *newreadcache(unsigned long long budget);
+void freereadcache(readcache *c);
+int readcachelookup(readcache *c, const char *query, unsigned qlen, cachehit **hits, unsigned *nslots, unsigned *nhits);
+void readcacheinsert(readcache *c, const char *query, unsigned qlen, const cachehit *hits, unsigned nhits);
+void readcachestats(readcache *c, FILE *f);
+
+/*
+ * functions are defined and commented in hitsort.c
+ */
+hitsorter *newhitsorter(FILE *out, const Chromosome *chr, unsigned nchr, unsigned long long memory, FILE **input);
+void finishhitsorter(hitsorter *s, FILE *input);
+
+/*
+ * functions are defined and commented in align.c
+ */
+int setalignengine(int engine);
+const char *alignenginename(int engine);
+void setalignquery(alignquery *a, const char *query, unsigned qlen, const alignscoring *sc);
+void freealignquery(alignquery *a);
+int alignscore(alignquery *a, const char *seq, unsigned slen, int *seqstart, int *querystart);
+void packsequence(const char *seq, unsigned len, unsigned nwords, unsigned long long *packed, unsigned long long *nmask);
+unsigned hammingdistance(const unsigned long long *query, const unsigned long long *qmask, unsigned qlen, const unsigned long long *seq, const unsigned long long *smask, unsigned pos, unsigned maxmm);
+/* Longest q-gram of pre-alignment filter */
+#define QGRAM_MAX 6
+unsigned qgramprofile(const char *seq, unsigned len, unsigned q, unsigned short *counts);
+unsigned qgramcommon(const unsigned short *counts, unsigned short *used, unsigned q, const char *seq, unsigned len, unsigned need);
+
+/* Mapping options that are not part of index or mapping run */
+typedef struct _mapoptions {
+	/* Maximum number of candidates per query and strand (0 - no limit) */
+	unsigned maxcandidates;
+	/* Query strands with more candidates are not verified at all instead of verifying the first maxcandidates */
+	int skipoverflow;
+	/* Candidates are found by diagonal binning of seed hits instead of merging sorted location lists */
+	int diagonal;
+	/* Added to the number of confirming seeds candidate search needs */
+	int cutoffshift;
+	/* Verify candidates only over the regions not covered by confirming seeds */
+	int regionverify;
+	/* Only substitutions are allowed, candidates are verified by comparing packed sequences */
+	int noindels;
+	/* Affine gap scoring instead of edit distance, hits need at least minscore (-1 - derived from mismatches) */
+	int scoremode;
+	alignscoring scoring;
+	int minscore;
+	/* Long reads are mapped by chaining seed anchors, hits can have up to maxerror percent of errors */
+	int longreads;
+	unsigned maxerror;
+	/* Candidates that cannot be within edit distance by q-gram count are rejected before alignment */
+	int prefilter;
+	/* Shortest SMEM seed used with FM index */
+	unsigned minseed;
+} mapoptions;
+
+/* Index and parameters used by mapping thread */
+typedef struct _mapcontext {
+	unsigned *words, *starts, *locations;
+	unsigned nwords, nloc;
+	int wordlength, canonical;
+	unsigned mmis, step;
+	/* Candidate search specialized for word length and step */
+	findcandidatesfunc findcandidates;
+	/* FM index (fm.h is NULL for k-mer index) */
+	fmindex fm;
+	Chromosome *chr;
+	unsigned nchr;
+	/* Shared by all threads, NULL if not used */
+	readcache *cache;
+	mapoptions opt;
+	/* Next (shorter word) table of multi-k index, NULL if none */
+	struct _mapcontext *fallback;
+} mapcontext;
+
+/* Per thread state */
+typedef struct _mapworker {
+	mapcontext *ctx;
+	unsigned *seeds;
+	unsigned nseed_slots;
+	queryblock qb;
+	/* Number of query strands that had more than maxcandidates candidates */
+	unsigned noverflows;
+	/* Number of queries too long for short read mapping */
+	unsigned ntoolong;
+	/* Number of queries with hits and candidates found */
+	unsigned nmapped;
+	/* Number of queries without hits in the longest word table of multi-k index (searched again with shorter words) */
+	unsigned nfallbacks;
+	unsigned long long ncandidates;
+	/* Reverse complement of current query */
+	char *rev;
+	unsigned nrev_slots;
+	/* Anchors and chains of long query, alignment buffers of the gaps between anchors */
+	chainblock cb;
+	char *gapbuf;
+	unsigned ngapbuf_slots;
+	int *dp;
+	unsigned ndp_slots;
+	/* Packed query of current strand (without indels) */
+	unsigned long long *qpacked;
+	unsigned long long *qnmask;
+	unsigned nqpacked_slots;
+	/* Q-gram profile of current strand, q-grams of window found so far and the number needed (0 - not filtered) */
+	unsigned short *qgcounts;
+	unsigned short *qgused;
+	unsigned qgq, qgneed;
+	/* Local alignment of current strand (score mode) */
+	alignquery aq;
+	/* Candidates checked and rejected by pre-filter */
+	unsigned long long nprefiltered, nrejected;
+	/* Hits of current query (for read cache and library) */
+	cachehit *hits;
+	unsigned nhit_slots;
+	unsigned nhits;
+	/* NUMA node to move to before mapping, -1 if none */
+	int pin;
+	/* Where results and unmapped queries of current batch are written (NULL - not written) */
+	FILE *out;
+	FILE *err;
+} mapworker;
+
+/*
+ * functions are defined and commented in mapping.c
+ */
+void defaultmapoptions(mapoptions *opt);
+void initmapcontext(mapcontext *ctx, const char *index, unsigned mmis, unsigned step, const mapoptions *opt, Chromosome *chr, unsigned nchr, readcache *cache);
+void freemapcontext(mapcontext *ctx);
+void initmapworker(mapworker *w, mapcontext *ctx);
+void freemapworker(mapworker *w);
+unsigned readchromosomes(const char *filename, Chromosome *chr, unsigned maxchr);
+unsigned mapquery(mapworker *w, unsigned queryidx, const char *readfw);
+const char *getchromosome(Chromosome *c, int pack);
 
 #endif /* INDEXCREATER_H_ */